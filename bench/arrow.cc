@@ -0,0 +1,158 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sqlitex/arrow.hh>
+#include <sqlitex/transaction.hh>
+
+#include "bench.hh"
+
+using sqlite::int64;
+using sqlite::bench::expect;
+using sqlite::bench::select;
+
+namespace {
+
+	constexpr const int64 batch_rows = 65536;
+
+	/// Record batches exported in advance, so that only the import is measured.
+	struct batches {
+		ArrowSchema schema{};
+		std::vector<ArrowArray> arrays;
+		std::size_t next = 0;
+
+		~batches() {
+			if (this->schema.release) { this->schema.release(&this->schema); }
+			for (auto& a : this->arrays) {
+				if (a.release) { a.release(&a); }
+			}
+		}
+	};
+
+	batches*
+	export_table(sqlite::connection& db) {
+		std::unique_ptr<batches> result(new batches);
+		auto s = db.prepare("SELECT i, r, s FROM src");
+		while (true) {
+			ArrowArray array{};
+			ArrowSchema schema{};
+			const auto n = s.to_arrow(&array, &schema, batch_rows);
+			if (n == 0) { break; }
+			if (!result->schema.release) { result->schema = schema; }
+			else { schema.release(&schema); }
+			result->arrays.emplace_back(array);
+		}
+		return result.release();
+	}
+
+	/// Stream that moves the batches to the consumer.
+	void
+	make_stream(batches* b, ArrowArrayStream* out) {
+		out->get_schema = [] (ArrowArrayStream* stream, ArrowSchema* schema) {
+			auto* b = static_cast<batches*>(stream->private_data);
+			*schema = b->schema;
+			b->schema.release = nullptr;
+			return 0;
+		};
+		out->get_next = [] (ArrowArrayStream* stream, ArrowArray* array) {
+			auto* b = static_cast<batches*>(stream->private_data);
+			if (b->next == b->arrays.size()) {
+				*array = ArrowArray{};
+				return 0;
+			}
+			*array = b->arrays[b->next];
+			b->arrays[b->next++].release = nullptr;
+			return 0;
+		};
+		out->get_last_error = [] (ArrowArrayStream*) -> const char* { return nullptr; };
+		out->release = [] (ArrowArrayStream* stream) {
+			delete static_cast<batches*>(stream->private_data);
+			stream->release = nullptr;
+		};
+		out->private_data = b;
+	}
+
+	/// Baseline: one-row INSERT per row that binds the same Arrow buffers.
+	void
+	insert_rows(sqlite::connection& db, const batches& b) {
+		auto s = db.prepare("INSERT INTO dst (i, r, s) VALUES (?,?,?)");
+		int64 ntransaction = 0;
+		std::unique_ptr<sqlite::immediate_transaction> tr;
+		for (const auto& a : b.arrays) {
+			const auto* integers = static_cast<const int64*>(a.children[0]->buffers[1]);
+			const auto* reals = static_cast<const double*>(a.children[1]->buffers[1]);
+			const auto* offsets = static_cast<const int64*>(a.children[2]->buffers[1]);
+			const auto* text = static_cast<const char*>(a.children[2]->buffers[2]);
+			for (int64 row=0; row<a.length; ++row) {
+				if (!tr) { tr.reset(new sqlite::immediate_transaction(db)); }
+				s.bind(1, integers[row]);
+				s.bind(2, reals[row]);
+				::sqlite3_bind_text(s.get(), 3, text + offsets[row],
+					int(offsets[row+1] - offsets[row]), SQLITE_STATIC);
+				s.step();
+				s.reset();
+				if (++ntransaction == batch_rows) {
+					tr->commit();
+					tr.reset();
+					ntransaction = 0;
+				}
+			}
+		}
+		if (tr) { tr->commit(); }
+	}
+
+	void
+	recreate(sqlite::connection& db) {
+		db.execute("DROP TABLE IF EXISTS dst");
+		db.execute("CREATE TABLE dst(i INTEGER, r REAL, s TEXT)");
+	}
+
+}
+
+/// Usage: arrow [rows]
+int main(int argc, char** argv) {
+	using namespace sqlite::bench;
+	const long nrows = argument(argc, argv, 1, 1000000);
+	sqlite::connection db(":memory:");
+	db.execute("CREATE TABLE src(i INTEGER, r REAL, s TEXT)");
+	{
+		generator random;
+		sqlite::immediate_transaction t(db);
+		auto s = db.prepare("INSERT INTO src VALUES (?,?,?)");
+		std::string text;
+		for (long i=0; i<nrows; ++i) {
+			text.assign(8 + random(24), 'a' + char(random(26)));
+			s.bind(1, int64(random()));
+			s.bind(2, double(random(1000000)) / 1000.0);
+			s.bind(3, text);
+			s.step();
+			s.reset();
+		}
+		t.commit();
+	}
+	const auto expected = select(db, "SELECT sum(length(s)) + count(*) FROM src");
+	std::printf("%ld rows, batches of %lld rows\n\n", nrows, static_cast<long long>(batch_rows));
+	double best[2] = {0, 0};
+	for (int i=0; i<5; ++i) {
+		std::unique_ptr<batches> b(export_table(db));
+		recreate(db);
+		auto t0 = clock_type::now();
+		insert_rows(db, *b);
+		const double t1 = seconds_since(t0);
+		expect(select(db, "SELECT sum(length(s)) + count(*) FROM dst") == expected, "rows");
+		recreate(db);
+		ArrowArrayStream stream;
+		make_stream(b.release(), &stream);
+		t0 = clock_type::now();
+		db.import_arrow("dst", &stream);
+		const double t2 = seconds_since(t0);
+		stream.release(&stream);
+		expect(select(db, "SELECT sum(length(s)) + count(*) FROM dst") == expected, "import_arrow");
+		if (i == 0 || t1 < best[0]) { best[0] = t1; }
+		if (i == 0 || t2 < best[1]) { best[1] = t2; }
+	}
+	print("one-row INSERT per row", best[0]);
+	print("connection::import_arrow", best[1]);
+	std::printf("\n%.0f rows/s with import_arrow\n", double(nrows) / best[1]);
+	return 0;
+}
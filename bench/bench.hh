@@ -0,0 +1,102 @@
+#ifndef SQLITEX_BENCH_BENCH_HH
+#define SQLITEX_BENCH_BENCH_HH
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	namespace bench {
+
+		using clock_type = std::chrono::steady_clock;
+
+		inline double
+		seconds_since(clock_type::time_point t0) {
+			return std::chrono::duration<double>(clock_type::now() - t0).count();
+		}
+
+		inline void
+		print(const char* name, double seconds) {
+			std::printf("%-56s %10.3f ms\n", name, seconds*1e3);
+		}
+
+		/**
+		Call \p func \p repeat times and print the fastest run.
+		\return the fastest run in seconds
+		*/
+		template <class Function>
+		inline double
+		measure(const char* name, Function func, int repeat=5) {
+			double best = 0;
+			for (int i=0; i<repeat; ++i) {
+				const auto t0 = clock_type::now();
+				func();
+				const double t = seconds_since(t0);
+				if (i == 0 || t < best) { best = t; }
+			}
+			print(name, best);
+			return best;
+		}
+
+		/// The command line argument \p i as a number or \p default_value.
+		inline long
+		argument(int argc, char** argv, int i, long default_value) {
+			return i < argc ? std::atol(argv[i]) : default_value;
+		}
+
+		/// Deterministic xorshift64* generator, so that the runs are comparable.
+		class generator {
+
+		private:
+			std::uint64_t _state;
+
+		public:
+
+			inline explicit
+			generator(std::uint64_t seed=1): _state(seed) {}
+
+			inline std::uint64_t
+			operator()() noexcept {
+				auto& x = this->_state;
+				x ^= x >> 12;
+				x ^= x << 25;
+				x ^= x >> 27;
+				return x * UINT64_C(2685821657736338717);
+			}
+
+			/// Uniform number from <code>[0,n)</code>.
+			inline std::uint64_t
+			operator()(std::uint64_t n) noexcept {
+				return (*this)() % n;
+			}
+
+		};
+
+		/// The first column of the first row.
+		inline int64
+		select(connection_base& db, const u8string& sql) {
+			auto s = db.prepare(sql);
+			int64 value = 0;
+			if (s.step() == errc::row) { s.column(0, value); }
+			return value;
+		}
+
+		/// Print the failed expression and exit, the results are not comparable.
+		inline void
+		expect(bool value, const char* what) {
+			if (!value) {
+				std::fprintf(stderr, "unexpected result: %s\n", what);
+				std::exit(1);
+			}
+		}
+
+	}
+
+}
+
+#endif // vim:filetype=cpp
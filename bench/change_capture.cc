@@ -0,0 +1,73 @@
+#include <atomic>
+#include <thread>
+
+#include <sqlitex/change_capture.hh>
+#include <sqlitex/transaction.hh>
+
+#include "bench.hh"
+
+using sqlite::int64;
+using sqlite::bench::expect;
+using sqlite::bench::measure;
+
+namespace {
+
+	constexpr const long rows_per_transaction = 100;
+
+	void
+	insert(sqlite::connection& db, long nrows) {
+		// DROP TABLE is not reported to the preupdate hook
+		db.execute("DROP TABLE IF EXISTS t");
+		db.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b REAL, c TEXT)");
+		auto s = db.prepare("INSERT INTO t(a, b, c) VALUES (?,?,?)");
+		const std::string text(32, 'x');
+		for (long i=0; i<nrows; i += rows_per_transaction) {
+			sqlite::immediate_transaction t(db);
+			for (long j=i; j<i+rows_per_transaction && j<nrows; ++j) {
+				s.bind(1, int64(j));
+				s.bind(2, double(j) * 0.5);
+				s.bind(3, text);
+				s.step();
+				s.reset();
+			}
+			t.commit();
+		}
+	}
+
+	/// Time per inserted row in nanoseconds.
+	inline double per_row(double seconds, long nrows) { return seconds * 1e9 / double(nrows); }
+
+}
+
+/// Usage: change_capture [rows]
+int main(int argc, char** argv) {
+	const long nrows = sqlite::bench::argument(argc, argv, 1, 200000);
+	sqlite::connection db(":memory:");
+	std::printf("%ld rows in transactions of %ld rows\n\n", nrows, rows_per_transaction);
+	const double t0 = measure("no hooks", [&] () { insert(db, nrows); });
+	int owner = 0;
+	db.add_preupdate_hook(&owner, [] (sqlite::preupdate_database&, sqlite::action,
+									  const char*, const char*, int64, int64) {});
+	const double t1 = measure("empty preupdate hook", [&] () { insert(db, nrows); });
+	db.remove_preupdate_hook(&owner);
+	double t2 = 0;
+	{
+		sqlite::change_capture capture(db, 4096);
+		std::atomic<bool> stopped{false};
+		std::atomic<long> consumed{0};
+		std::thread consumer([&] () {
+			while (!stopped.load() || capture.size() != 0) {
+				capture.wait(std::chrono::milliseconds(10));
+				consumed += long(capture.consume([] (const sqlite::change_capture::change&) {}));
+			}
+		});
+		t2 = measure("change_capture with consumer thread", [&] () { insert(db, nrows); });
+		stopped = true;
+		consumer.join();
+		expect(capture.statistics().lost_transactions == 0, "lost transactions");
+		expect(consumed.load() == 5*nrows, "consumed changes");
+	}
+	std::printf("\n%.0f ns/row for the empty hook, %.0f ns/row for change_capture over it\n",
+		per_row(t1 - t0, nrows), per_row(t2 - t1, nrows));
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include <string>
+
+#include <sqlitex/collation.hh>
+#include <sqlitex/transaction.hh>
+
+#include "bench.hh"
+
+using sqlite::bench::expect;
+using sqlite::bench::measure;
+
+namespace {
+
+	/// The same comparison through the adapter that copies the strings.
+	class copying_nocase_collation: public sqlite::collation_base<sqlite::encoding::utf8> {
+	public:
+		inline int
+		operator()(const string& lhs, const string& rhs) const noexcept {
+			return sqlite::ascii_nocase_compare(lhs, rhs);
+		}
+	};
+
+	static_assert(!sqlite::bits::accepts<copying_nocase_collation,
+		sqlite::bits::collation_view<copying_nocase_collation>>::value,
+		"the adapter must copy the strings");
+
+}
+
+/// Usage: collation [rows]
+int main(int argc, char** argv) {
+	const long nrows = sqlite::bench::argument(argc, argv, 1, 1000000);
+	sqlite::connection db(":memory:");
+	db.collation("ascii_nocase", sqlite::ascii_nocase_collation());
+	db.collation("copying_nocase", copying_nocase_collation());
+	db.collation("natural", sqlite::natural_collation());
+	db.collation("utf8_casefold", sqlite::utf8_casefold_collation());
+	db.execute("CREATE TABLE t(s TEXT)");
+	{
+		// file names with a shared prefix, mixed case and numbers
+		sqlite::bench::generator random;
+		sqlite::immediate_transaction t(db);
+		auto s = db.prepare("INSERT INTO t VALUES (?)");
+		std::string text;
+		for (long i=0; i<nrows; ++i) {
+			text = "Documents/Reports/";
+			const auto n = 4 + random(12);
+			for (std::uint64_t j=0; j<n; ++j) {
+				text += char((random(2) ? 'a' : 'A') + random(26));
+			}
+			text += std::to_string(random(100000));
+			text += ".txt";
+			s.bind(1, text);
+			s.step();
+			s.reset();
+		}
+		t.commit();
+	}
+	std::printf("%ld rows\n\n", nrows);
+	for (const char* name : {"BINARY", "NOCASE", "ascii_nocase", "copying_nocase",
+							 "natural", "utf8_casefold"}) {
+		// NATURAL is a keyword
+		const std::string title = std::string("ORDER BY s COLLATE \"") + name + '"';
+		const std::string sql = "SELECT s FROM t " + title;
+		long count = 0;
+		measure(title.data(), [&] () {
+			auto s = db.prepare(sql);
+			count = 0;
+			while (s.step() == sqlite::errc::row) { ++count; }
+		}, 3);
+		expect(count == nrows, name);
+	}
+	return 0;
+}
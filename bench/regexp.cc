@@ -0,0 +1,91 @@
+#include <initializer_list>
+
+#include <sqlitex/regexp.hh>
+#include <sqlitex/transaction.hh>
+
+#include "bench.hh"
+
+using sqlite::bench::expect;
+using sqlite::bench::measure;
+using sqlite::bench::select;
+
+namespace {
+
+	/// Scan the table with each condition, the counts must be equal.
+	void
+	compare(sqlite::connection& db, std::initializer_list<const char*> conditions) {
+		sqlite::int64 expected = -1;
+		for (const char* condition : conditions) {
+			std::string sql = "SELECT count(*) FROM t WHERE ";
+			sql += condition;
+			sqlite::int64 count = 0;
+			measure(condition, [&] () { count = select(db, sql); });
+			if (expected == -1) { expected = count; }
+			expect(count == expected, condition);
+		}
+		std::printf("\n");
+	}
+
+}
+
+/// Usage: regexp [rows]
+int main(int argc, char** argv) {
+	const long nrows = sqlite::bench::argument(argc, argv, 1, 200000);
+	sqlite::connection db(":memory:");
+	sqlite::register_regexp(db);
+	db.execute("CREATE TABLE t(x TEXT)");
+	{
+		sqlite::bench::generator random;
+		sqlite::immediate_transaction t(db);
+		auto s = db.prepare("INSERT INTO t VALUES (?)");
+		std::string text;
+		for (long i=0; i<nrows; ++i) {
+			// about 100 bytes of lowercase words and numbers
+			text.clear();
+			while (text.size() < 100) {
+				const auto n = 2 + random(8);
+				const bool digits = random(5) == 0;
+				for (std::uint64_t j=0; j<n; ++j) {
+					text += char(digits ? '0' + random(10) : 'a' + random(26));
+				}
+				text += ' ';
+			}
+			if (random(100) == 0) { text.insert(random(text.size()), "needle"); }
+			s.bind(1, text);
+			s.step();
+			s.reset();
+		}
+		t.commit();
+	}
+	std::printf("%ld rows\n\n", nrows);
+	compare(db, {
+		"x REGEXP 'needle'",
+		"x LIKE '%needle%'",
+		"x GLOB '*needle*'",
+	});
+	compare(db, {
+		"x REGEXP '^abc'",
+		"x LIKE 'abc%'",
+		"x GLOB 'abc*'",
+	});
+	compare(db, {
+		"x REGEXP 'ne[a-z]dle'",
+		"x GLOB '*ne[a-z]dle*'",
+	});
+	compare(db, {
+		"x REGEXP '[0-9]{4} [a-z]'",
+		"x GLOB '*[0-9][0-9][0-9][0-9] [a-z]*'",
+	});
+	// one large text, the time is linear in its length
+	db.execute("DELETE FROM t");
+	db.execute("INSERT INTO t VALUES (replace(hex(zeroblob(8388608)),'0','a') || 'xb')");
+	compare(db, {
+		"x REGEXP 'x.*b'",
+		"x GLOB '*x*b*'",
+	});
+	compare(db, {
+		"x REGEXP '(a|b)*c'",
+		"x GLOB '*c*'",
+	});
+	return 0;
+}
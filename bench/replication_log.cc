@@ -0,0 +1,178 @@
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <sqlitex/replication_log.hh>
+
+#include "bench.hh"
+
+using sqlite::int64;
+using sqlite::uint64;
+using sqlite::bench::clock_type;
+using sqlite::bench::expect;
+using sqlite::bench::seconds_since;
+using sqlite::bench::select;
+
+namespace {
+
+	constexpr const long keys = 10000;
+	constexpr const int changes_per_transaction = 4;
+
+	void
+	open(sqlite::connection& db, const std::string& path) {
+		db.open(path.data());
+		db.execute("PRAGMA journal_mode=WAL");
+		db.execute("PRAGMA synchronous=NORMAL");
+		db.execute("CREATE TABLE IF NOT EXISTS kv(k INTEGER PRIMARY KEY, v INTEGER NOT NULL)");
+	}
+
+	int64
+	digest(sqlite::connection& db) {
+		return select(db, "SELECT count(*) + sum(v) + sum((k*v) % 1000003) FROM kv");
+	}
+
+	/// Apply batches until the writer reports the last one, runs in the child process.
+	int
+	replica(const std::string& directory) {
+		sqlite::connection db;
+		open(db, directory + "/replica.db");
+		sqlite::replication_log_reader::options opts;
+		opts.directory = directory;
+		sqlite::replication_log_reader reader(db, opts);
+		const auto replace = [] (sqlite::conflict_type, sqlite::changeset_iterator_base&) {
+			return sqlite::conflict_action::replace;
+		};
+		const std::string done = directory + "/done";
+		uint64 last = 0;
+		uint64 nbatches = 0;
+		double lag_sum = 0, lag_max = 0;
+		clock_type::time_point first;
+		while (true) {
+			if (reader.apply(replace, 1) == 1) {
+				const double lag = std::chrono::duration<double>(
+					sqlite::replication_log::clock_type::now() - reader.timestamp()).count();
+				if (nbatches++ == 0) { first = clock_type::now(); }
+				lag_sum += lag;
+				if (lag > lag_max) { lag_max = lag; }
+				continue;
+			}
+			if (last == 0) {
+				if (auto* in = std::fopen(done.data(), "r")) {
+					unsigned long long n = 0;
+					if (std::fscanf(in, "%llu", &n) == 1) { last = n; }
+					std::fclose(in);
+				}
+			}
+			if (last != 0 && reader.sequence() > last) { break; }
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		const double seconds = seconds_since(first);
+		std::printf("replica: %llu batches in %.3f s, %.0f batches/s\n",
+			static_cast<unsigned long long>(nbatches), seconds, double(nbatches)/seconds);
+		std::printf("lag: %.3f ms average, %.3f ms maximum\n",
+			lag_sum/double(nbatches)*1e3, lag_max*1e3);
+		std::fflush(stdout);
+		return 0;
+	}
+
+	void
+	remove_all(const std::string& directory) {
+		if (auto* dir = ::opendir(directory.data())) {
+			while (auto* entry = ::readdir(dir)) {
+				const std::string name = entry->d_name;
+				if (name != "." && name != "..") { ::unlink((directory + '/' + name).data()); }
+			}
+			::closedir(dir);
+		}
+		::rmdir(directory.data());
+	}
+
+}
+
+/// Usage: replication_log [transactions] [max batch delay in ms]
+int main(int argc, char** argv) {
+	const long ntransactions = sqlite::bench::argument(argc, argv, 1, 50000);
+	const long delay = sqlite::bench::argument(argc, argv, 2, 5);
+	char tmp[] = "/tmp/sqlitex-bench-XXXXXX";
+	expect(::mkdtemp(tmp) != nullptr, "mkdtemp");
+	const std::string directory = tmp;
+	std::printf("%ld transactions of %d upserts, %ld ms batch delay\n\n",
+		ntransactions, changes_per_transaction, delay);
+	std::fflush(stdout);
+	const auto pid = ::fork();
+	expect(pid != -1, "fork");
+	if (pid == 0) { std::_Exit(replica(directory)); }
+	sqlite::connection db;
+	open(db, directory + "/primary.db");
+	sqlite::replication_log::options opts;
+	opts.directory = directory;
+	opts.max_batch_delay = std::chrono::milliseconds(delay);
+	uint64 input_bytes = 0, output_bytes = 0, nbatches = 0;
+	{
+		sqlite::replication_log log(opts);
+		sqlite::bench::generator random;
+		auto upsert = db.prepare(
+			"INSERT INTO kv(k,v) VALUES (?,?) ON CONFLICT(k) DO UPDATE SET v=excluded.v");
+		const auto t0 = clock_type::now();
+		for (long i=0; i<ntransactions; ++i) {
+			sqlite::session s(db);
+			s.attach_all();
+			db.execute("BEGIN");
+			for (int j=0; j<changes_per_transaction; ++j) {
+				upsert.bind(1, int64(random(keys)));
+				upsert.bind(2, int64(random(1000000)));
+				upsert.step();
+				upsert.reset();
+			}
+			db.execute("COMMIT");
+			log.append(s.changeset());
+		}
+		log.flush();
+		const double seconds = seconds_since(t0);
+		std::printf("writer: %.3f s, %.0f transactions/s\n", seconds, double(ntransactions)/seconds);
+		input_bytes = log.statistics().input_bytes;
+		output_bytes = log.statistics().output_bytes;
+		nbatches = log.statistics().batches;
+		if (auto* out = std::fopen((directory + "/done.tmp").data(), "w")) {
+			std::fprintf(out, "%llu\n", static_cast<unsigned long long>(log.sequence() - 1));
+			std::fclose(out);
+			std::rename((directory + "/done.tmp").data(), (directory + "/done").data());
+		}
+	}
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "replica");
+	std::printf("%llu batches, %llu bytes of changesets compacted into %llu bytes\n",
+		static_cast<unsigned long long>(nbatches),
+		static_cast<unsigned long long>(input_bytes),
+		static_cast<unsigned long long>(output_bytes));
+	sqlite::connection replica;
+	open(replica, directory + "/replica.db");
+	expect(digest(db) == digest(replica), "the replica differs from the primary");
+	std::printf("the replica matches the primary\n");
+	{
+		// a new replica catches up with the whole log
+		sqlite::connection fresh;
+		open(fresh, directory + "/fresh.db");
+		sqlite::replication_log_reader::options ropts;
+		ropts.directory = directory;
+		sqlite::replication_log_reader reader(fresh, ropts);
+		const auto t0 = clock_type::now();
+		const auto n = reader.apply([] (sqlite::conflict_type, sqlite::changeset_iterator_base&) {
+			return sqlite::conflict_action::replace;
+		});
+		const double seconds = seconds_since(t0);
+		expect(n == nbatches, "batches");
+		expect(digest(db) == digest(fresh), "the new replica differs from the primary");
+		std::printf("catch-up: %.3f s, %.0f batches/s, %.0f transactions/s\n",
+			seconds, double(n)/seconds, double(ntransactions)/seconds);
+	}
+	db.close();
+	replica.close();
+	remove_all(directory);
+	return 0;
+}
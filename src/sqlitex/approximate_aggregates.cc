@@ -0,0 +1,881 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <sqlitex/approximate_aggregates.hh>
+#include <sqlitex/function.hh>
+
+namespace {
+
+	using sqlite::any_base;
+	using sqlite::context;
+	using sqlite::int64;
+	using sqlite::uint64;
+
+	constexpr const double pi = 3.14159265358979323846;
+
+	template <class T>
+	inline void
+	append_le(std::string& out, T value) {
+		for (std::size_t i=0; i<sizeof(T); ++i) { out += char((value >> (8*i)) & 0xff); }
+	}
+
+	inline void
+	append_double(std::string& out, double value) {
+		uint64 bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		append_le(out, bits);
+	}
+
+	/// Sequential reader of serialized state.
+	class reader {
+
+	private:
+		const unsigned char* _first;
+		const unsigned char* _last;
+
+	public:
+
+		inline reader(const void* data, std::size_t size) noexcept:
+		_first(static_cast<const unsigned char*>(data)), _last(_first + size) {}
+
+		inline void
+		check(std::size_t n) const {
+			if (std::size_t(this->_last - this->_first) < n) {
+				throw std::invalid_argument("malformed aggregate state");
+			}
+		}
+
+		template <class T>
+		inline T
+		get() {
+			check(sizeof(T));
+			T value = 0;
+			for (std::size_t i=0; i<sizeof(T); ++i) { value |= T(this->_first[i]) << (8*i); }
+			this->_first += sizeof(T);
+			return value;
+		}
+
+		inline double
+		get_double() {
+			auto bits = get<uint64>();
+			double value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		inline const unsigned char*
+		bytes(std::size_t n) {
+			check(n);
+			auto* p = this->_first;
+			this->_first += n;
+			return p;
+		}
+
+		inline bool empty() const noexcept { return this->_first == this->_last; }
+
+	};
+
+	inline void
+	expect(bool condition) {
+		if (!condition) { throw std::invalid_argument("malformed aggregate state"); }
+	}
+
+	inline uint64
+	fmix64(uint64 x) noexcept {
+		x ^= x >> 33;
+		x *= UINT64_C(0xff51afd7ed558ccd);
+		x ^= x >> 33;
+		x *= UINT64_C(0xc4ceb9fe1a85ec53);
+		x ^= x >> 33;
+		return x;
+	}
+
+	uint64
+	hash_bytes(const void* data, std::size_t n, uint64 seed) noexcept {
+		constexpr const uint64 k = UINT64_C(0x9e3779b97f4a7c15);
+		auto* p = static_cast<const unsigned char*>(data);
+		uint64 h = seed ^ (n * k);
+		for (; n >= 8; n -= 8, p += 8) {
+			uint64 w;
+			std::memcpy(&w, p, sizeof(w));
+			h = (h ^ fmix64(w)) * k;
+			h = (h << 27) | (h >> 37);
+		}
+		uint64 w = 0;
+		for (std::size_t i=0; i<n; ++i) { w |= uint64(p[i]) << (8*i); }
+		return fmix64(h ^ fmix64(w + k));
+	}
+
+	/// Integer value of the real number if it is exactly representable.
+	inline bool
+	as_integer(double x, int64& out) noexcept {
+		if (!(x >= -9223372036854775808.0 && x < 9223372036854775808.0)) { return false; }
+		auto i = int64(x);
+		if (double(i) != x) { return false; }
+		out = i;
+		return true;
+	}
+
+	/// Hash that is equal for equal SQL values, NULL is not hashed.
+	uint64
+	value_hash(any_base v) noexcept {
+		auto* ptr = v.get();
+		switch (::sqlite3_value_type(ptr)) {
+			case SQLITE_INTEGER:
+				return fmix64(uint64(::sqlite3_value_int64(ptr)) ^ 'i');
+			case SQLITE_FLOAT: {
+				const double x = ::sqlite3_value_double(ptr);
+				int64 i;
+				if (as_integer(x, i)) { return fmix64(uint64(i) ^ 'i'); }
+				return hash_bytes(&x, sizeof(x), 'f');
+			}
+			case SQLITE_TEXT:
+				return hash_bytes(::sqlite3_value_text(ptr), ::sqlite3_value_bytes(ptr), 't');
+			default:
+				return hash_bytes(::sqlite3_value_blob(ptr), ::sqlite3_value_bytes(ptr), 'b');
+		}
+	}
+
+	/// Type tag followed by the value, integer-valued reals are stored as integers.
+	void
+	value_key(any_base v, std::string& key) {
+		auto* ptr = v.get();
+		key.clear();
+		switch (::sqlite3_value_type(ptr)) {
+			case SQLITE_INTEGER:
+				key += 'i';
+				append_le(key, uint64(::sqlite3_value_int64(ptr)));
+				break;
+			case SQLITE_FLOAT: {
+				const double x = ::sqlite3_value_double(ptr);
+				int64 i;
+				if (as_integer(x, i)) { key += 'i'; append_le(key, uint64(i)); }
+				else { key += 'f'; append_double(key, x); }
+				break;
+			}
+			case SQLITE_TEXT:
+				key += 't';
+				key.append(reinterpret_cast<const char*>(::sqlite3_value_text(ptr)),
+					::sqlite3_value_bytes(ptr));
+				break;
+			default:
+				key += 'b';
+				key.append(static_cast<const char*>(::sqlite3_value_blob(ptr)),
+					::sqlite3_value_bytes(ptr));
+				break;
+		}
+	}
+
+	void
+	append_json(std::string& out, const char* s, std::size_t n) {
+		const char* digits = "0123456789abcdef";
+		out += '"';
+		for (std::size_t i=0; i<n; ++i) {
+			const auto ch = static_cast<unsigned char>(s[i]);
+			switch (ch) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					if (ch >= 0x20) { out += char(ch); break; }
+					out += "\\u00";
+					out += digits[ch >> 4];
+					out += digits[ch & 15];
+			}
+		}
+		out += '"';
+	}
+
+	void
+	append_key_json(std::string& out, const std::string& key) {
+		reader in(key.data(), key.size());
+		switch (key.empty() ? 0 : key[0]) {
+			case 'i': {
+				in.bytes(1);
+				char buf[32];
+				::sqlite3_snprintf(sizeof(buf), buf, "%lld", (long long)int64(in.get<uint64>()));
+				out += buf;
+				break;
+			}
+			case 'f': {
+				in.bytes(1);
+				const double x = in.get_double();
+				// JSON has no infinity
+				if (std::isinf(x)) { out += "null"; break; }
+				char buf[32];
+				::sqlite3_snprintf(sizeof(buf), buf, "%!.15g", x);
+				out += buf;
+				break;
+			}
+			case 't':
+				append_json(out, key.data()+1, key.size()-1);
+				break;
+			default: {
+				const char* digits = "0123456789abcdef";
+				std::string hex;
+				for (std::size_t i=1; i<key.size(); ++i) {
+					const auto ch = static_cast<unsigned char>(key[i]);
+					hex += digits[ch >> 4];
+					hex += digits[ch & 15];
+				}
+				append_json(out, hex.data(), hex.size());
+			}
+		}
+	}
+
+	inline void
+	result_blob(context* c, const std::string& data) {
+		::sqlite3_result_blob64(c->get(), data.data(), data.size(), SQLITE_TRANSIENT);
+	}
+
+	inline bool
+	is_null(any_base v) noexcept {
+		return ::sqlite3_value_type(v.get()) == SQLITE_NULL;
+	}
+
+	template <class T>
+	inline void
+	deserialize(T& state, any_base v) {
+		state.deserialize(::sqlite3_value_blob(v.get()), ::sqlite3_value_bytes(v.get()));
+	}
+
+	/// Rank of the first non-zero bit in the register-index-free part of the hash.
+	inline unsigned char
+	rank(uint64 w) noexcept {
+		return static_cast<unsigned char>(__builtin_clzll(w) + 1);
+	}
+
+	/// Dense register index and rank of a sparse entry.
+	inline std::size_t
+	dense_entry(std::uint32_t e, unsigned char& r) noexcept {
+		using sqlite::hyperloglog;
+		constexpr const int extra = hyperloglog::sparse_precision - hyperloglog::precision;
+		const std::uint32_t index = e >> 6;
+		const std::uint32_t low = index & ((1u << extra) - 1);
+		r = low != 0
+			? static_cast<unsigned char>(__builtin_clz(low) - (32 - extra) + 1)
+			: static_cast<unsigned char>(extra + (e & 63));
+		return index >> extra;
+	}
+
+	double
+	sigma(double x) noexcept {
+		if (x == 1) { return std::numeric_limits<double>::infinity(); }
+		double y = 1, z = x, old;
+		do {
+			x *= x;
+			old = z;
+			z += x*y;
+			y += y;
+		} while (z != old);
+		return z;
+	}
+
+	double
+	tau(double x) noexcept {
+		if (x == 0 || x == 1) { return 0; }
+		double y = 1, z = 1 - x, old;
+		do {
+			x = std::sqrt(x);
+			old = z;
+			y *= 0.5;
+			z -= (1 - x)*(1 - x)*y;
+		} while (z != old);
+		return z/3;
+	}
+
+	/// Sketches can not remove values, frames have to start at UNBOUNDED PRECEDING.
+	template <class T>
+	struct sketch: public sqlite::aggregate {
+
+		inline void
+		inverse(context*, int, any_base*) {
+			throw std::invalid_argument("approximate aggregates do not support moving window frames");
+		}
+
+		inline void end(context* c) { static_cast<T*>(this)->value(c); }
+
+	};
+
+	template <bool State>
+	struct count_distinct: public sketch<count_distinct<State>> {
+		sqlite::hyperloglog hll;
+
+		inline void
+		step(context*, int, any_base* args) {
+			if (!is_null(args[0])) { this->hll.add(value_hash(args[0])); }
+		}
+
+		inline void
+		value(context* c) {
+			if (State) { result_blob(c, this->hll.serialize()); }
+			else { c->result(int64(this->hll.estimate())); }
+		}
+	};
+
+	struct count_distinct_merge: public sketch<count_distinct_merge> {
+		sqlite::hyperloglog hll;
+
+		inline void
+		step(context*, int, any_base* args) {
+			if (is_null(args[0])) { return; }
+			sqlite::hyperloglog tmp;
+			deserialize(tmp, args[0]);
+			this->hll.merge(tmp);
+		}
+
+		inline void value(context* c) { c->result(int64(this->hll.estimate())); }
+	};
+
+	inline double
+	percentile_argument(any_base v) {
+		const double p = ::sqlite3_value_double(v.get());
+		if (!(p >= 0 && p <= 1)) { throw std::invalid_argument("percentile must be in [0,1]"); }
+		return p;
+	}
+
+	inline void
+	result_quantile(context* c, sqlite::tdigest& digest, double p) {
+		if (digest.empty()) { c->result(nullptr); }
+		else { c->result(digest.quantile(p)); }
+	}
+
+	template <bool State>
+	struct percentile: public sketch<percentile<State>> {
+		sqlite::tdigest digest;
+		double p = 0.5;
+
+		inline void
+		step(context*, int, any_base* args) {
+			this->p = percentile_argument(args[1]);
+			const auto t = ::sqlite3_value_numeric_type(args[0].get());
+			if (t == SQLITE_INTEGER || t == SQLITE_FLOAT) {
+				this->digest.add(::sqlite3_value_double(args[0].get()));
+			}
+		}
+
+		inline void
+		value(context* c) {
+			if (State) { result_blob(c, this->digest.serialize()); }
+			else { result_quantile(c, this->digest, this->p); }
+		}
+	};
+
+	struct percentile_merge: public sketch<percentile_merge> {
+		sqlite::tdigest digest;
+		double p = 0.5;
+
+		inline void
+		step(context*, int, any_base* args) {
+			this->p = percentile_argument(args[1]);
+			if (is_null(args[0])) { return; }
+			sqlite::tdigest tmp;
+			deserialize(tmp, args[0]);
+			this->digest.merge(tmp);
+		}
+
+		inline void value(context* c) { result_quantile(c, this->digest, this->p); }
+	};
+
+	inline std::size_t
+	top_k_argument(any_base v) {
+		const auto k = ::sqlite3_value_int64(v.get());
+		if (k < 1 || k > 100000) { throw std::invalid_argument("k must be in [1,100000]"); }
+		return std::size_t(k);
+	}
+
+	void
+	result_top_k(context* c, const sqlite::space_saving& s, std::size_t k) {
+		std::string out = "[";
+		for (const auto& x : s.top(k)) {
+			if (out.size() != 1) { out += ','; }
+			out += "{\"value\":";
+			append_key_json(out, x.key);
+			char buf[64];
+			::sqlite3_snprintf(sizeof(buf), buf, ",\"count\":%llu,\"error\":%llu}",
+				(unsigned long long)x.count, (unsigned long long)x.error);
+			out += buf;
+		}
+		out += ']';
+		c->result(out);
+	}
+
+	template <bool State>
+	struct top_k: public sketch<top_k<State>> {
+		sqlite::space_saving summary;
+		std::size_t k = 0;
+		std::string key;
+
+		inline void
+		step(context*, int nargs, any_base* args) {
+			if (this->k == 0) {
+				this->k = top_k_argument(args[1]);
+				std::size_t capacity = std::max<std::size_t>(10*this->k, 64);
+				if (nargs > 2) {
+					capacity = std::size_t(::sqlite3_value_int64(args[2].get()));
+					if (capacity < this->k || capacity > 1000000) {
+						throw std::invalid_argument("capacity must be in [k,1000000]");
+					}
+				}
+				this->summary.capacity(capacity);
+			}
+			if (is_null(args[0])) { return; }
+			value_key(args[0], this->key);
+			this->summary.add(this->key);
+		}
+
+		inline void
+		value(context* c) {
+			if (State) { result_blob(c, this->summary.serialize()); }
+			else { result_top_k(c, this->summary, this->k); }
+		}
+	};
+
+	struct top_k_merge: public sketch<top_k_merge> {
+		sqlite::space_saving summary;
+		std::size_t k = 0;
+		bool empty = true;
+
+		inline void
+		step(context*, int, any_base* args) {
+			this->k = top_k_argument(args[1]);
+			if (is_null(args[0])) { return; }
+			sqlite::space_saving tmp;
+			deserialize(tmp, args[0]);
+			if (this->empty) { this->summary.capacity(tmp.capacity()); this->empty = false; }
+			this->summary.merge(tmp);
+		}
+
+		inline void value(context* c) { result_top_k(c, this->summary, this->k); }
+	};
+
+}
+
+void
+sqlite::hyperloglog::add(uint64 hash) {
+	if (this->dense()) {
+		const auto index = hash >> (64 - precision);
+		const auto r = rank((hash << precision) | (uint64(1) << (precision - 1)));
+		auto& reg = this->_registers[index];
+		if (reg < r) { reg = r; }
+		return;
+	}
+	const auto index = std::uint32_t(hash >> (64 - sparse_precision));
+	const auto r = rank((hash << sparse_precision) | (uint64(1) << (sparse_precision - 1)));
+	this->_sparse.emplace_back((index << 6) | r);
+	if (this->_sparse.size() >= 2*this->_sorted + 1024) { this->compact(); }
+}
+
+void
+sqlite::hyperloglog::compact() {
+	auto& s = this->_sparse;
+	std::sort(s.begin(), s.end());
+	// keep the maximal rank for each index
+	std::size_t n = 0;
+	for (std::size_t i=0; i<s.size(); ++i) {
+		if (i+1 < s.size() && (s[i] >> 6) == (s[i+1] >> 6)) { continue; }
+		s[n++] = s[i];
+	}
+	s.resize(n);
+	this->_sorted = n;
+	// sparse representation is larger than dense registers
+	if (n*sizeof(std::uint32_t) > num_registers) { this->to_dense(); }
+}
+
+void
+sqlite::hyperloglog::to_dense() {
+	this->_registers.assign(num_registers, 0);
+	for (auto e : this->_sparse) {
+		unsigned char r;
+		auto& reg = this->_registers[dense_entry(e, r)];
+		if (reg < r) { reg = r; }
+	}
+	std::vector<std::uint32_t>().swap(this->_sparse);
+	this->_sorted = 0;
+}
+
+void
+sqlite::hyperloglog::merge(const hyperloglog& rhs) {
+	if (!this->dense() && !rhs.dense()) {
+		this->_sparse.insert(this->_sparse.end(), rhs._sparse.begin(), rhs._sparse.end());
+		this->compact();
+		return;
+	}
+	if (!this->dense()) { this->to_dense(); }
+	if (!rhs.dense()) {
+		for (auto e : rhs._sparse) {
+			unsigned char r;
+			auto& reg = this->_registers[dense_entry(e, r)];
+			if (reg < r) { reg = r; }
+		}
+		return;
+	}
+	auto* a = this->_registers.data();
+	auto* b = rhs._registers.data();
+	std::size_t i = 0;
+	#if defined(__SSE2__)
+	for (; i+16 <= num_registers; i += 16) {
+		__m128i x, y;
+		std::memcpy(&x, a+i, sizeof(x));
+		std::memcpy(&y, b+i, sizeof(y));
+		x = _mm_max_epu8(x, y);
+		std::memcpy(a+i, &x, sizeof(x));
+	}
+	#endif
+	for (; i<num_registers; ++i) { a[i] = std::max(a[i], b[i]); }
+}
+
+auto
+sqlite::hyperloglog::estimate() -> uint64 {
+	if (!this->dense()) {
+		this->compact();
+		if (!this->dense()) {
+			// linear counting with sparse precision is exact enough for small cardinalities
+			const double m = double(uint64(1) << sparse_precision);
+			const double n = double(this->_sparse.size());
+			return uint64(std::llround(m*std::log(m/(m - n))));
+		}
+	}
+	constexpr const int q = 64 - precision;
+	double counts[q+2] = {};
+	for (auto r : this->_registers) { ++counts[r]; }
+	const double m = double(num_registers);
+	double z = m*tau(1 - counts[q+1]/m);
+	for (int k=q; k>=1; --k) { z = 0.5*(z + counts[k]); }
+	z += m*sigma(counts[0]/m);
+	const double alpha = 0.5/std::log(2.0);
+	return uint64(std::llround(alpha*m*m/z));
+}
+
+std::string
+sqlite::hyperloglog::serialize() {
+	std::string out;
+	out += 'H';
+	out += char(precision);
+	if (this->dense()) {
+		out += 'D';
+		out.append(reinterpret_cast<const char*>(this->_registers.data()), num_registers);
+	} else {
+		this->compact();
+		out += this->dense() ? 'D' : 'S';
+		if (this->dense()) {
+			out.append(reinterpret_cast<const char*>(this->_registers.data()), num_registers);
+		} else {
+			append_le(out, std::uint32_t(this->_sparse.size()));
+			for (auto e : this->_sparse) { append_le(out, e); }
+		}
+	}
+	return out;
+}
+
+void
+sqlite::hyperloglog::deserialize(const void* data, std::size_t size) {
+	reader in(data, size);
+	auto* header = in.bytes(3);
+	expect(header[0] == 'H' && header[1] == precision);
+	if (header[2] == 'D') {
+		auto* registers = in.bytes(num_registers);
+		this->_registers.assign(registers, registers + num_registers);
+		for (auto r : this->_registers) { expect(r <= 64 - precision + 1); }
+		this->_sparse.clear();
+	} else {
+		expect(header[2] == 'S');
+		const auto n = in.get<std::uint32_t>();
+		in.check(std::size_t(n)*sizeof(std::uint32_t));
+		this->_registers.clear();
+		this->_sparse.resize(n);
+		for (auto& e : this->_sparse) {
+			e = in.get<std::uint32_t>();
+			expect((e >> 6) < (1u << sparse_precision));
+			expect((e & 63) != 0 && (e & 63) <= 64 - sparse_precision + 1);
+		}
+		this->_sorted = 0;
+		this->compact();
+	}
+	expect(in.empty());
+}
+
+void
+sqlite::tdigest::add(double x, double weight) {
+	if (std::isnan(x) || !(weight > 0)) { return; }
+	this->_buffer.emplace_back(centroid{x, weight});
+	this->_total_weight += weight;
+	this->_min = std::min(this->_min, x);
+	this->_max = std::max(this->_max, x);
+	if (this->_buffer.size() >= std::size_t(5*this->_compression)) { this->compress(); }
+}
+
+void
+sqlite::tdigest::compress() {
+	if (this->_buffer.empty()) { return; }
+	auto& all = this->_buffer;
+	all.insert(all.end(), this->_centroids.begin(), this->_centroids.end());
+	std::sort(all.begin(), all.end(),
+		[] (const centroid& a, const centroid& b) { return a.mean < b.mean; });
+	const double total = this->_total_weight;
+	const double delta = this->_compression;
+	// k1 scale function limits the size of centroids near the tails
+	auto k = [delta] (double q) { return delta/(2*pi)*std::asin(2*q - 1); };
+	auto q_limit = [delta,&k] (double q) {
+		const double x = k(q) + 1;
+		return x >= delta/4 ? 1.0 : (std::sin(x*2*pi/delta) + 1)/2;
+	};
+	std::vector<centroid> result;
+	result.reserve(std::size_t(delta));
+	centroid current = all.front();
+	double weight_so_far = 0;
+	double limit = q_limit(0);
+	for (std::size_t i=1; i<all.size(); ++i) {
+		const auto& c = all[i];
+		const double q = (weight_so_far + current.weight + c.weight)/total;
+		if (q <= limit) {
+			current.mean += (c.mean - current.mean)*c.weight/(current.weight + c.weight);
+			current.weight += c.weight;
+		} else {
+			weight_so_far += current.weight;
+			result.emplace_back(current);
+			limit = q_limit(weight_so_far/total);
+			current = c;
+		}
+	}
+	result.emplace_back(current);
+	this->_centroids.swap(result);
+	this->_buffer.clear();
+}
+
+void
+sqlite::tdigest::merge(const tdigest& rhs) {
+	if (rhs.empty()) { return; }
+	this->_buffer.insert(this->_buffer.end(), rhs._centroids.begin(), rhs._centroids.end());
+	this->_buffer.insert(this->_buffer.end(), rhs._buffer.begin(), rhs._buffer.end());
+	this->_total_weight += rhs._total_weight;
+	this->_min = std::min(this->_min, rhs._min);
+	this->_max = std::max(this->_max, rhs._max);
+	this->compress();
+}
+
+double
+sqlite::tdigest::quantile(double q) {
+	this->compress();
+	const auto& c = this->_centroids;
+	if (c.empty()) { return std::numeric_limits<double>::quiet_NaN(); }
+	if (c.size() == 1) { return c.front().mean; }
+	const double target = std::min(std::max(q, 0.0), 1.0)*this->_total_weight;
+	// interpolate between the centers of adjacent centroids
+	double center = c.front().weight/2;
+	if (target <= center) {
+		return this->_min + (c.front().mean - this->_min)*(center == 0 ? 0 : target/center);
+	}
+	for (std::size_t i=0; i+1<c.size(); ++i) {
+		const double next = center + (c[i].weight + c[i+1].weight)/2;
+		if (target <= next) {
+			const double t = (target - center)/(next - center);
+			return c[i].mean + t*(c[i+1].mean - c[i].mean);
+		}
+		center = next;
+	}
+	const double rest = this->_total_weight - center;
+	const double t = rest == 0 ? 1 : (target - center)/rest;
+	return c.back().mean + t*(this->_max - c.back().mean);
+}
+
+std::string
+sqlite::tdigest::serialize() {
+	this->compress();
+	std::string out;
+	out += 'T';
+	append_double(out, this->_compression);
+	append_double(out, this->_min);
+	append_double(out, this->_max);
+	append_le(out, std::uint32_t(this->_centroids.size()));
+	for (const auto& c : this->_centroids) {
+		append_double(out, c.mean);
+		append_double(out, c.weight);
+	}
+	return out;
+}
+
+void
+sqlite::tdigest::deserialize(const void* data, std::size_t size) {
+	reader in(data, size);
+	expect(in.bytes(1)[0] == 'T');
+	this->_compression = in.get_double();
+	expect(this->_compression >= 10 && this->_compression <= 10000);
+	this->_min = in.get_double();
+	this->_max = in.get_double();
+	const auto n = in.get<std::uint32_t>();
+	in.check(std::size_t(n)*16);
+	this->_centroids.resize(n);
+	this->_buffer.clear();
+	this->_total_weight = 0;
+	for (auto& c : this->_centroids) {
+		c.mean = in.get_double();
+		c.weight = in.get_double();
+		expect(c.weight > 0 && !std::isnan(c.mean));
+		this->_total_weight += c.weight;
+	}
+	expect(in.empty());
+}
+
+void
+sqlite::space_saving::swap(std::size_t i, std::size_t j) noexcept {
+	std::swap(this->_heap[i], this->_heap[j]);
+	this->_index[this->_heap[i].key] = i;
+	this->_index[this->_heap[j].key] = j;
+}
+
+void
+sqlite::space_saving::sift_up(std::size_t i) noexcept {
+	while (i != 0) {
+		const auto parent = (i-1)/2;
+		if (this->_heap[parent].count <= this->_heap[i].count) { break; }
+		this->swap(i, parent);
+		i = parent;
+	}
+}
+
+void
+sqlite::space_saving::sift_down(std::size_t i) noexcept {
+	const auto n = this->_heap.size();
+	for (;;) {
+		auto smallest = i;
+		const auto left = 2*i+1, right = 2*i+2;
+		if (left < n && this->_heap[left].count < this->_heap[smallest].count) { smallest = left; }
+		if (right < n && this->_heap[right].count < this->_heap[smallest].count) { smallest = right; }
+		if (smallest == i) { break; }
+		this->swap(i, smallest);
+		i = smallest;
+	}
+}
+
+void
+sqlite::space_saving::add(const std::string& key, uint64 count) {
+	auto result = this->_index.find(key);
+	if (result != this->_index.end()) {
+		const auto i = result->second;
+		this->_heap[i].count += count;
+		this->sift_down(i);
+		return;
+	}
+	if (this->_heap.size() < this->_capacity) {
+		this->_heap.emplace_back(counter{key, count, 0});
+		this->_index.emplace(key, this->_heap.size()-1);
+		this->sift_up(this->_heap.size()-1);
+		return;
+	}
+	if (this->_capacity == 0) { return; }
+	// replace the least frequent value
+	auto& min = this->_heap.front();
+	this->_index.erase(min.key);
+	min.error = min.count;
+	min.count += count;
+	min.key = key;
+	this->_index.emplace(key, 0);
+	this->sift_down(0);
+}
+
+void
+sqlite::space_saving::merge(const space_saving& rhs) {
+	// values that are missing in a full summary may have count up to its minimum
+	auto min_count = [] (const space_saving& s) -> uint64 {
+		return s._heap.size() < s._capacity || s._heap.empty() ? 0 : s._heap.front().count;
+	};
+	const auto min_lhs = min_count(*this), min_rhs = min_count(rhs);
+	std::vector<counter> all;
+	all.reserve(this->_heap.size() + rhs._heap.size());
+	for (const auto& c : this->_heap) {
+		auto result = rhs._index.find(c.key);
+		if (result == rhs._index.end()) {
+			all.emplace_back(counter{c.key, c.count + min_rhs, c.error + min_rhs});
+		} else {
+			const auto& d = rhs._heap[result->second];
+			all.emplace_back(counter{c.key, c.count + d.count, c.error + d.error});
+		}
+	}
+	for (const auto& d : rhs._heap) {
+		if (this->_index.count(d.key) != 0) { continue; }
+		all.emplace_back(counter{d.key, d.count + min_lhs, d.error + min_lhs});
+	}
+	if (all.size() > this->_capacity) {
+		std::nth_element(all.begin(), all.begin() + this->_capacity, all.end(),
+			[] (const counter& a, const counter& b) { return a.count > b.count; });
+		all.resize(this->_capacity);
+	}
+	this->_heap.swap(all);
+	this->_index.clear();
+	for (std::size_t i=0; i<this->_heap.size(); ++i) { this->_index[this->_heap[i].key] = i; }
+	for (std::size_t i=this->_heap.size()/2; i-- > 0; ) { this->sift_down(i); }
+}
+
+auto
+sqlite::space_saving::top(std::size_t k) const -> std::vector<counter> {
+	std::vector<counter> result(this->_heap);
+	std::sort(result.begin(), result.end(),
+		[] (const counter& a, const counter& b) {
+			return a.count > b.count || (a.count == b.count && a.error < b.error);
+		});
+	if (result.size() > k) { result.resize(k); }
+	return result;
+}
+
+std::string
+sqlite::space_saving::serialize() const {
+	std::string out;
+	out += 'K';
+	append_le(out, std::uint32_t(this->_capacity));
+	append_le(out, std::uint32_t(this->_heap.size()));
+	for (const auto& c : this->_heap) {
+		append_le(out, c.count);
+		append_le(out, c.error);
+		append_le(out, std::uint32_t(c.key.size()));
+		out += c.key;
+	}
+	return out;
+}
+
+void
+sqlite::space_saving::deserialize(const void* data, std::size_t size) {
+	reader in(data, size);
+	expect(in.bytes(1)[0] == 'K');
+	this->_capacity = in.get<std::uint32_t>();
+	const auto n = in.get<std::uint32_t>();
+	expect(n <= this->_capacity);
+	this->_heap.clear();
+	this->_index.clear();
+	for (std::uint32_t i=0; i<n; ++i) {
+		counter c;
+		c.count = in.get<uint64>();
+		c.error = in.get<uint64>();
+		const auto len = in.get<std::uint32_t>();
+		auto* key = in.bytes(len);
+		c.key.assign(reinterpret_cast<const char*>(key), len);
+		expect(this->_index.emplace(c.key, this->_heap.size()).second);
+		this->_heap.emplace_back(std::move(c));
+	}
+	expect(in.empty());
+	for (std::size_t i=this->_heap.size()/2; i-- > 0; ) { this->sift_down(i); }
+}
+
+void
+sqlite::register_approximate_aggregates(connection_base& db) {
+	db.window_function<count_distinct<false>>("approx_count_distinct", 1);
+	db.window_function<count_distinct<true>>("approx_count_distinct_state", 1);
+	db.window_function<count_distinct_merge>("approx_count_distinct_merge", 1);
+	db.window_function<percentile<false>>("approx_percentile", 2);
+	db.window_function<percentile<true>>("approx_percentile_state", 2);
+	db.window_function<percentile_merge>("approx_percentile_merge", 2);
+	db.window_function<top_k<false>>("approx_top_k", 2);
+	db.window_function<top_k<false>>("approx_top_k", 3);
+	db.window_function<top_k<true>>("approx_top_k_state", 2);
+	db.window_function<top_k<true>>("approx_top_k_state", 3);
+	db.window_function<top_k_merge>("approx_top_k_merge", 2);
+}
@@ -0,0 +1,175 @@
+#ifndef SQLITEX_APPROXIMATE_AGGREGATES_HH
+#define SQLITEX_APPROXIMATE_AGGREGATES_HH
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief HyperLogLog distinct counter with sparse representation for small
+	cardinalities.
+	\details
+	Dense registers use 16 KiB (precision 14), relative error is about 0.8%.
+	Cardinality is estimated with Ertl's improved estimator that does not
+	need bias correction tables.
+	*/
+	class hyperloglog {
+
+	public:
+		static constexpr const int precision = 14;
+		static constexpr const int sparse_precision = 25;
+		static constexpr const std::size_t num_registers = std::size_t(1) << precision;
+
+	private:
+		/// Sparse entries are (index << 6 | rank) with sparse precision.
+		std::vector<std::uint32_t> _sparse;
+		std::vector<unsigned char> _registers;
+		std::size_t _sorted = 0;
+
+	public:
+
+		/// Add 64-bit hash of a value.
+		void add(uint64 hash);
+
+		void merge(const hyperloglog& rhs);
+
+		/// The estimated number of distinct values.
+		uint64 estimate();
+
+		inline bool dense() const noexcept { return !this->_registers.empty(); }
+
+		std::string serialize();
+
+		/// \throw std::invalid_argument if the state is malformed
+		void deserialize(const void* data, std::size_t size);
+
+	private:
+		void compact();
+		void to_dense();
+
+	};
+
+	/**
+	\brief Merging t-digest for quantile estimation.
+	\details
+	The error is smallest near the extreme quantiles. The number of
+	centroids is bounded by compression parameter.
+	*/
+	class tdigest {
+
+	public:
+		struct centroid {
+			double mean;
+			double weight;
+		};
+
+	private:
+		double _compression;
+		std::vector<centroid> _centroids;
+		std::vector<centroid> _buffer;
+		double _total_weight = 0;
+		double _min = std::numeric_limits<double>::infinity();
+		double _max = -std::numeric_limits<double>::infinity();
+
+	public:
+
+		inline explicit tdigest(double compression=100): _compression(compression) {}
+
+		void add(double x, double weight=1);
+		void merge(const tdigest& rhs);
+
+		/// Estimated value of the quantile \p q from [0,1], NaN for empty digest.
+		double quantile(double q);
+
+		inline double total_weight() const noexcept { return this->_total_weight; }
+		inline bool empty() const noexcept { return this->_total_weight == 0; }
+
+		std::string serialize();
+
+		/// \throw std::invalid_argument if the state is malformed
+		void deserialize(const void* data, std::size_t size);
+
+	private:
+		void compress();
+
+	};
+
+	/**
+	\brief Space-saving summary of the most frequent values.
+	\details
+	The summary keeps at most \c capacity counters. Each counter
+	overestimates the frequency by at most its error. Keys are arbitrary
+	byte strings.
+	*/
+	class space_saving {
+
+	public:
+		struct counter {
+			std::string key;
+			uint64 count;
+			uint64 error;
+		};
+
+	private:
+		std::size_t _capacity;
+		/// Min-heap by count.
+		std::vector<counter> _heap;
+		std::unordered_map<std::string,std::size_t> _index;
+
+	public:
+
+		inline explicit space_saving(std::size_t capacity=64): _capacity(capacity) {}
+
+		void add(const std::string& key, uint64 count=1);
+		void merge(const space_saving& rhs);
+
+		/// At most \p k counters sorted by count in descending order.
+		std::vector<counter> top(std::size_t k) const;
+
+		inline std::size_t capacity() const noexcept { return this->_capacity; }
+		inline void capacity(std::size_t rhs) noexcept { this->_capacity = rhs; }
+		inline std::size_t size() const noexcept { return this->_heap.size(); }
+
+		std::string serialize() const;
+
+		/// \throw std::invalid_argument if the state is malformed
+		void deserialize(const void* data, std::size_t size);
+
+	private:
+		void sift_down(std::size_t i) noexcept;
+		void sift_up(std::size_t i) noexcept;
+		void swap(std::size_t i, std::size_t j) noexcept;
+
+	};
+
+	/**
+	Register approximate aggregate functions.
+	- \c approx_count_distinct(x) returns the estimated number of distinct
+	  non-NULL values (hyperloglog). As in SQL, integer-valued reals are
+	  equal to integers.
+	- \c approx_percentile(x,p) returns the estimated \p p-th quantile of
+	  numeric values, \p p is from [0,1] (tdigest).
+	- \c approx_top_k(x,k[,capacity]) returns JSON array of the \p k most
+	  frequent values with their counts and errors (space_saving). Infinite
+	  values are written as \c null.
+
+	Each function \c f has \c f_state with the same arguments that returns
+	the state as a blob, and \c f_merge that combines the states from
+	\c f_state and returns the same result as \c f
+	(\c approx_count_distinct_merge(state), \c approx_percentile_merge(state,p),
+	\c approx_top_k_merge(state,k)), so that partial results from shards or
+	partitions can be combined. All functions can be used as window
+	functions with frames that start at UNBOUNDED PRECEDING: sketches can
+	not remove values from moving frames.
+	*/
+	void register_approximate_aggregates(connection_base& db);
+
+}
+
+#endif // vim:filetype=cpp
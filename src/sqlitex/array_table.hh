@@ -0,0 +1,178 @@
+#ifndef SQLITEX_ARRAY_TABLE_HH
+#define SQLITEX_ARRAY_TABLE_HH
+
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+#include <sqlitex/virtual_table.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Contiguous values that are bound as a parameter of \c array
+	table-valued function.
+	\details
+	Values are not copied, both the reference and the values must outlive
+	statement execution.
+	\code{.cpp}
+	register_array_table(db);
+	std::vector<int64> ids{1, 2, 3};
+	array_ref ref(ids);
+	statement s = db.prepare("SELECT * FROM t WHERE id IN array(?)");
+	s.bind(1, ref.pointer());
+	\endcode
+	*/
+	class array_ref {
+
+	private:
+		data_type _type = data_type::null;
+		const void* _data = nullptr;
+		std::size_t _size = 0;
+
+	public:
+
+		inline static const char* pointer_name() noexcept { return "sqlitex_array"; }
+
+		inline array_ref(const int64* data, std::size_t n) noexcept:
+		_type(data_type::integer), _data(data), _size(n) {}
+
+		inline array_ref(const double* data, std::size_t n) noexcept:
+		_type(data_type::floating_point), _data(data), _size(n) {}
+
+		inline array_ref(const std::string* data, std::size_t n) noexcept:
+		_type(data_type::text), _data(data), _size(n) {}
+
+		template <class T, class Alloc>
+		inline explicit array_ref(const std::vector<T,Alloc>& rhs) noexcept:
+		array_ref(rhs.data(), rhs.size()) {}
+
+		array_ref() = default;
+		array_ref(const array_ref&) = default;
+		array_ref& operator=(const array_ref&) = default;
+
+		inline data_type type() const noexcept { return this->_type; }
+		inline std::size_t size() const noexcept { return this->_size; }
+		inline bool empty() const noexcept { return this->_size == 0; }
+
+		inline const int64*
+		integers() const noexcept { return static_cast<const int64*>(this->_data); }
+
+		inline const double*
+		reals() const noexcept { return static_cast<const double*>(this->_data); }
+
+		inline const std::string*
+		strings() const noexcept { return static_cast<const std::string*>(this->_data); }
+
+		/// Pointer that is bound with statement::bind.
+		inline named_ptr
+		pointer() const noexcept {
+			return named_ptr(const_cast<array_ref*>(this), pointer_name());
+		}
+
+	};
+
+	/**
+	\brief Eponymous virtual table that iterates over array_ref.
+	\details
+	The table has \c value column and hidden \c pointer column that is
+	the argument of the table-valued function. Rowid is the one-based
+	position of the value in the array.
+	*/
+	class array_table: public virtual_table {
+
+	public:
+		static constexpr const bool eponymous = true;
+
+	public:
+
+		inline
+		array_table(connection_base db, int, const char* const*) {
+			db.declare_virtual_table("CREATE TABLE x(value, pointer HIDDEN)");
+		}
+
+		inline int
+		best_index(virtual_table_index* info) {
+			int index = -1;
+			for (int i=0; i<info->nConstraint; ++i) {
+				const auto& c = info->aConstraint[i];
+				if (c.iColumn != 1 || c.op != SQLITE_INDEX_CONSTRAINT_EQ) { continue; }
+				// the pointer must be known before the scan
+				if (!c.usable) { return SQLITE_CONSTRAINT; }
+				index = i;
+			}
+			if (index == -1) {
+				info->idxNum = 0;
+				info->estimatedCost = 2147483647;
+				info->estimatedRows = 2147483647;
+				return SQLITE_OK;
+			}
+			info->aConstraintUsage[index].argvIndex = 1;
+			info->aConstraintUsage[index].omit = 1;
+			info->idxNum = 1;
+			info->estimatedCost = 1;
+			info->estimatedRows = 100;
+			return SQLITE_OK;
+		}
+
+	};
+
+	class array_cursor: public virtual_table_cursor {
+
+	private:
+		const array_ref* _array = nullptr;
+		std::size_t _position = 0;
+
+	public:
+
+		inline explicit array_cursor(array_table*) noexcept {}
+
+		inline int
+		filter(int idxNum, const char*, int argc, any_base* argv) {
+			this->_array = nullptr;
+			this->_position = 0;
+			if (idxNum == 1 && argc == 1) {
+				this->_array = static_cast<const array_ref*>(
+					::sqlite3_value_pointer(argv[0].get(), array_ref::pointer_name())
+				);
+			}
+			return SQLITE_OK;
+		}
+
+		inline int next() { ++this->_position; return SQLITE_OK; }
+
+		inline bool
+		eof() const noexcept {
+			return !this->_array || this->_position >= this->_array->size();
+		}
+
+		inline int
+		column(virtual_table_context* c, int n) {
+			if (n != 0) { c->result(nullptr); return SQLITE_OK; }
+			const auto i = this->_position;
+			switch (this->_array->type()) {
+				case data_type::integer: c->result(this->_array->integers()[i]); break;
+				case data_type::floating_point: c->result(this->_array->reals()[i]); break;
+				case data_type::text: c->result(this->_array->strings()[i], pass_by_reference); break;
+				default: c->result(nullptr); break;
+			}
+			return SQLITE_OK;
+		}
+
+		inline int
+		rowid(int64& out) {
+			out = this->_position + 1;
+			return SQLITE_OK;
+		}
+
+	};
+
+	/// Register \c array table-valued function (see array_ref).
+	inline void
+	register_array_table(connection_base& db, const char* name="array") {
+		db.virtual_table<array_table,array_cursor>(name);
+	}
+
+}
+
+#endif // vim:filetype=cpp
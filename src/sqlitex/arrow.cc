@@ -0,0 +1,641 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlitex/arrow.hh>
+#include <sqlitex/connection.hh>
+#include <sqlitex/transaction.hh>
+
+namespace {
+
+	using sqlite::arrow_type;
+
+	struct column_data {
+		std::vector<std::uint8_t> validity;
+		std::vector<std::int64_t> integers;
+		std::vector<double> reals;
+		std::vector<std::int64_t> offsets;
+		std::vector<char> bytes;
+		const void* buffers[3] = {nullptr, nullptr, nullptr};
+	};
+
+	struct batch_data {
+		std::vector<ArrowArray> arrays;
+		std::vector<ArrowArray*> children;
+		const void* buffers[1] = {nullptr};
+	};
+
+	struct schema_data {
+		std::vector<ArrowSchema> schemas;
+		std::vector<ArrowSchema*> children;
+	};
+
+	struct stream_data {
+		sqlite::statement owned;
+		sqlite::statement* stmt = nullptr;
+		std::vector<arrow_type> types;
+		sqlite::int64 batch_rows = 0;
+		bool started = false;
+		bool has_row = false;
+		bool done = false;
+		std::string error;
+	};
+
+	void
+	release_column(ArrowArray* a) {
+		delete static_cast<column_data*>(a->private_data);
+		a->release = nullptr;
+	}
+
+	void
+	release_batch(ArrowArray* a) {
+		auto* b = static_cast<batch_data*>(a->private_data);
+		for (auto* child : b->children) {
+			if (child->release) { child->release(child); }
+		}
+		delete b;
+		a->release = nullptr;
+	}
+
+	void
+	release_column_schema(ArrowSchema* s) {
+		delete static_cast<std::string*>(s->private_data);
+		s->release = nullptr;
+	}
+
+	void
+	release_schema(ArrowSchema* s) {
+		auto* d = static_cast<schema_data*>(s->private_data);
+		for (auto* child : d->children) {
+			if (child->release) { child->release(child); }
+		}
+		delete d;
+		s->release = nullptr;
+	}
+
+	bool
+	contains(const char* str, const char* pattern) {
+		const auto n = std::strlen(pattern);
+		for (; *str; ++str) {
+			if (::sqlite3_strnicmp(str, pattern, n) == 0) { return true; }
+		}
+		return false;
+	}
+
+	void
+	make_schema(
+		const sqlite::statement& s,
+		const std::vector<arrow_type>& types,
+		ArrowSchema* out
+	) {
+		const auto n = types.size();
+		std::unique_ptr<schema_data> d(new schema_data);
+		d->schemas.resize(n);
+		d->children.resize(n);
+		for (std::size_t i=0; i<n; ++i) {
+			auto& child = d->schemas[i];
+			const char* name = s.column_name(int(i));
+			auto* str = new std::string(name ? name : "");
+			child = ArrowSchema{};
+			child.format = to_string(types[i]);
+			child.name = str->data();
+			child.flags = ARROW_FLAG_NULLABLE;
+			child.release = release_column_schema;
+			child.private_data = str;
+			d->children[i] = &child;
+		}
+		*out = ArrowSchema{};
+		out->format = "+s";
+		out->name = "";
+		out->n_children = n;
+		out->children = d->children.data();
+		out->release = release_schema;
+		out->private_data = d.release();
+	}
+
+	sqlite::int64
+	make_batch(
+		sqlite::statement& s,
+		const std::vector<arrow_type>& types,
+		sqlite::int64 batch_rows,
+		bool& has_row,
+		bool& done,
+		ArrowArray* out
+	) {
+		const auto ncolumns = types.size();
+		std::vector<std::unique_ptr<column_data>> columns(ncolumns);
+		std::vector<std::int64_t> null_counts(ncolumns);
+		for (std::size_t i=0; i<ncolumns; ++i) {
+			columns[i].reset(new column_data);
+			if (types[i] == arrow_type::large_utf8 || types[i] == arrow_type::large_binary) {
+				columns[i]->offsets.emplace_back(0);
+			}
+		}
+		auto* ptr = s.get();
+		sqlite::int64 nrows = 0;
+		while (nrows < batch_rows) {
+			if (!has_row) {
+				if (done) { break; }
+				if (s.step() == sqlite::errc::done) { done = true; break; }
+			}
+			has_row = false;
+			const int bit = nrows % 8;
+			for (std::size_t i=0; i<ncolumns; ++i) {
+				auto& c = *columns[i];
+				const int j = int(i);
+				if (bit == 0) { c.validity.emplace_back(0); }
+				const bool null = ::sqlite3_column_type(ptr, j) == SQLITE_NULL;
+				if (null) { ++null_counts[i]; }
+				else { c.validity.back() |= std::uint8_t(1) << bit; }
+				switch (types[i]) {
+					case arrow_type::int64:
+						c.integers.emplace_back(null ? 0 : ::sqlite3_column_int64(ptr, j));
+						break;
+					case arrow_type::float64:
+						c.reals.emplace_back(null ? 0.0 : ::sqlite3_column_double(ptr, j));
+						break;
+					case arrow_type::large_utf8:
+					case arrow_type::large_binary:
+						if (!null) {
+							const char* data = types[i] == arrow_type::large_utf8
+								? reinterpret_cast<const char*>(::sqlite3_column_text(ptr, j))
+								: static_cast<const char*>(::sqlite3_column_blob(ptr, j));
+							const int size = ::sqlite3_column_bytes(ptr, j);
+							c.bytes.insert(c.bytes.end(), data, data + size);
+						}
+						c.offsets.emplace_back(c.bytes.size());
+						break;
+				}
+			}
+			++nrows;
+		}
+		std::unique_ptr<batch_data> b(new batch_data);
+		b->arrays.resize(ncolumns);
+		b->children.resize(ncolumns);
+		for (std::size_t i=0; i<ncolumns; ++i) {
+			auto* c = columns[i].release();
+			auto& a = b->arrays[i];
+			a = ArrowArray{};
+			a.length = nrows;
+			a.null_count = null_counts[i];
+			c->buffers[0] = null_counts[i] == 0 ? nullptr : c->validity.data();
+			switch (types[i]) {
+				case arrow_type::int64:
+					c->buffers[1] = c->integers.data();
+					a.n_buffers = 2;
+					break;
+				case arrow_type::float64:
+					c->buffers[1] = c->reals.data();
+					a.n_buffers = 2;
+					break;
+				case arrow_type::large_utf8:
+				case arrow_type::large_binary:
+					c->buffers[1] = c->offsets.data();
+					c->buffers[2] = c->bytes.data();
+					a.n_buffers = 3;
+					break;
+			}
+			a.buffers = c->buffers;
+			a.release = release_column;
+			a.private_data = c;
+			b->children[i] = &a;
+		}
+		*out = ArrowArray{};
+		out->length = nrows;
+		out->n_buffers = 1;
+		out->buffers = b->buffers;
+		out->n_children = ncolumns;
+		out->children = b->children.data();
+		out->release = release_batch;
+		out->private_data = b.release();
+		return nrows;
+	}
+
+	std::vector<arrow_type>
+	column_types(const sqlite::statement& s, bool has_row) {
+		std::vector<arrow_type> types;
+		const int n = s.num_columns();
+		types.reserve(n);
+		for (int i=0; i<n; ++i) { types.emplace_back(sqlite::to_arrow_type(s, i, has_row)); }
+		return types;
+	}
+
+	inline stream_data*
+	get_stream(ArrowArrayStream* stream) {
+		return static_cast<stream_data*>(stream->private_data);
+	}
+
+	void
+	start(stream_data* d) {
+		if (d->started) { return; }
+		d->has_row = d->stmt->step() == sqlite::errc::row;
+		d->done = !d->has_row;
+		d->types = column_types(*d->stmt, d->has_row);
+		d->started = true;
+	}
+
+	int
+	stream_get_schema(ArrowArrayStream* stream, ArrowSchema* out) {
+		auto* d = get_stream(stream);
+		try {
+			start(d);
+			make_schema(*d->stmt, d->types, out);
+		} catch (const std::exception& err) {
+			d->error = err.what();
+			return EIO;
+		}
+		return 0;
+	}
+
+	int
+	stream_get_next(ArrowArrayStream* stream, ArrowArray* out) {
+		auto* d = get_stream(stream);
+		try {
+			start(d);
+			if (d->done && !d->has_row) {
+				*out = ArrowArray{};
+				return 0;
+			}
+			make_batch(*d->stmt, d->types, d->batch_rows, d->has_row, d->done, out);
+		} catch (const std::exception& err) {
+			d->error = err.what();
+			return EIO;
+		}
+		return 0;
+	}
+
+	const char*
+	stream_get_last_error(ArrowArrayStream* stream) {
+		auto* d = get_stream(stream);
+		return d->error.empty() ? nullptr : d->error.data();
+	}
+
+	void
+	stream_release(ArrowArrayStream* stream) {
+		delete get_stream(stream);
+		stream->release = nullptr;
+	}
+
+	void
+	make_stream(stream_data* d, ArrowArrayStream* out) {
+		*out = ArrowArrayStream{};
+		out->get_schema = stream_get_schema;
+		out->get_next = stream_get_next;
+		out->get_last_error = stream_get_last_error;
+		out->release = stream_release;
+		out->private_data = d;
+	}
+
+}
+
+const char*
+sqlite::to_string(arrow_type rhs) {
+	switch (rhs) {
+		case arrow_type::int64: return "l";
+		case arrow_type::float64: return "g";
+		case arrow_type::large_utf8: return "U";
+		case arrow_type::large_binary: return "Z";
+		default: throw std::invalid_argument("bad arrow type");
+	}
+}
+
+auto
+sqlite::to_arrow_type(const statement& s, int i, bool has_row) -> arrow_type {
+	if (const char* decl = s.column_type_name(i)) {
+		// column affinity rules
+		if (contains(decl, "INT")) { return arrow_type::int64; }
+		if (contains(decl, "CHAR") || contains(decl, "CLOB") || contains(decl, "TEXT")) {
+			return arrow_type::large_utf8;
+		}
+		if (contains(decl, "BLOB")) { return arrow_type::large_binary; }
+		if (contains(decl, "REAL") || contains(decl, "FLOA") || contains(decl, "DOUB")) {
+			return arrow_type::float64;
+		}
+	}
+	if (has_row) {
+		switch (s.column_type(i)) {
+			case data_type::integer: return arrow_type::int64;
+			case data_type::floating_point: return arrow_type::float64;
+			case data_type::blob: return arrow_type::large_binary;
+			default: break;
+		}
+	}
+	return arrow_type::large_utf8;
+}
+
+void
+sqlite::to_arrow(statement&& s, ArrowArrayStream* out, int64 batch_rows) {
+	std::unique_ptr<stream_data> d(new stream_data);
+	d->owned = std::move(s);
+	d->stmt = &d->owned;
+	d->batch_rows = batch_rows;
+	make_stream(d.release(), out);
+}
+
+auto
+sqlite::statement::to_arrow(ArrowArray* array, ArrowSchema* schema, int64 batch_rows) -> int64 {
+	if (!this->_arrow) {
+		std::unique_ptr<bits::arrow_cursor> c(new bits::arrow_cursor);
+		c->has_row = this->step() == errc::row;
+		c->done = !c->has_row;
+		c->types = column_types(*this, c->has_row);
+		this->_arrow = std::move(c);
+	}
+	auto& c = *this->_arrow;
+	make_schema(*this, c.types, schema);
+	try {
+		return make_batch(*this, c.types, batch_rows, c.has_row, c.done, array);
+	} catch (...) {
+		schema->release(schema);
+		throw;
+	}
+}
+
+void
+sqlite::statement::to_arrow(ArrowArrayStream* stream, int64 batch_rows) {
+	std::unique_ptr<stream_data> d(new stream_data);
+	d->stmt = this;
+	d->batch_rows = batch_rows;
+	make_stream(d.release(), stream);
+}
+
+namespace {
+
+	struct column_reader {
+		const ArrowArray* array = nullptr;
+		char format = 0;
+		/// Values of dictionary-encoded column, the array contains the indices.
+		column_reader* dictionary = nullptr;
+
+		inline bool
+		null(sqlite::int64 row) const noexcept {
+			if (this->format == 'n') { return true; }
+			auto* validity = static_cast<const std::uint8_t*>(this->array->buffers[0]);
+			if (this->array->null_count == 0 || !validity) { return false; }
+			const auto i = this->array->offset + row;
+			return (validity[i/8] & (1 << (i%8))) == 0;
+		}
+
+		template <class T>
+		inline T
+		get(sqlite::int64 row) const noexcept {
+			auto* data = static_cast<const T*>(this->array->buffers[1]);
+			return data[this->array->offset + row];
+		}
+
+		template <class Offset>
+		inline std::pair<const char*,Offset>
+		get_bytes(sqlite::int64 row) const noexcept {
+			auto* offsets = static_cast<const Offset*>(this->array->buffers[1]);
+			auto* data = static_cast<const char*>(this->array->buffers[2]);
+			const auto i = this->array->offset + row;
+			return std::make_pair(data + offsets[i], offsets[i+1] - offsets[i]);
+		}
+
+		/// Dictionary index.
+		sqlite::int64
+		key(sqlite::int64 row) const {
+			switch (this->format) {
+				case 'c': return get<std::int8_t>(row);
+				case 'C': return get<std::uint8_t>(row);
+				case 's': return get<std::int16_t>(row);
+				case 'S': return get<std::uint16_t>(row);
+				case 'i': return get<std::int32_t>(row);
+				case 'I': return get<std::uint32_t>(row);
+				case 'l': return get<std::int64_t>(row);
+				case 'L': return sqlite::int64(get<std::uint64_t>(row));
+				default: throw std::invalid_argument("bad dictionary index type");
+			}
+		}
+
+		void
+		bind(sqlite::statement& s, int index, sqlite::int64 row) const {
+			using sqlite::call;
+			auto* ptr = s.get();
+			if (this->null(row)) {
+				call(::sqlite3_bind_null(ptr, index));
+				return;
+			}
+			if (this->dictionary) {
+				const auto k = this->key(row);
+				if (k < 0 || k >= this->dictionary->array->length) {
+					throw std::out_of_range("dictionary index out of range");
+				}
+				this->dictionary->bind(s, index, k);
+				return;
+			}
+			switch (this->format) {
+				case 'b': {
+					auto* data = static_cast<const std::uint8_t*>(this->array->buffers[1]);
+					const auto i = this->array->offset + row;
+					call(::sqlite3_bind_int(ptr, index, (data[i/8] >> (i%8)) & 1));
+					break;
+				}
+				case 'c': call(::sqlite3_bind_int(ptr, index, get<std::int8_t>(row))); break;
+				case 'C': call(::sqlite3_bind_int(ptr, index, get<std::uint8_t>(row))); break;
+				case 's': call(::sqlite3_bind_int(ptr, index, get<std::int16_t>(row))); break;
+				case 'S': call(::sqlite3_bind_int(ptr, index, get<std::uint16_t>(row))); break;
+				case 'i': call(::sqlite3_bind_int(ptr, index, get<std::int32_t>(row))); break;
+				case 'I': call(::sqlite3_bind_int64(ptr, index, get<std::uint32_t>(row))); break;
+				case 'l': call(::sqlite3_bind_int64(ptr, index, get<std::int64_t>(row))); break;
+				case 'L':
+					call(::sqlite3_bind_int64(ptr, index, sqlite::int64(get<std::uint64_t>(row))));
+					break;
+				case 'f': call(::sqlite3_bind_double(ptr, index, get<float>(row))); break;
+				case 'g': call(::sqlite3_bind_double(ptr, index, get<double>(row))); break;
+				case 'u': {
+					auto v = get_bytes<std::int32_t>(row);
+					call(::sqlite3_bind_text64(ptr, index, v.first, v.second,
+						sqlite::pass_by_reference, SQLITE_UTF8));
+					break;
+				}
+				case 'U': {
+					auto v = get_bytes<std::int64_t>(row);
+					call(::sqlite3_bind_text64(ptr, index, v.first, v.second,
+						sqlite::pass_by_reference, SQLITE_UTF8));
+					break;
+				}
+				case 'z': {
+					auto v = get_bytes<std::int32_t>(row);
+					call(::sqlite3_bind_blob64(ptr, index, v.first, v.second,
+						sqlite::pass_by_reference));
+					break;
+				}
+				case 'Z': {
+					auto v = get_bytes<std::int64_t>(row);
+					call(::sqlite3_bind_blob64(ptr, index, v.first, v.second,
+						sqlite::pass_by_reference));
+					break;
+				}
+				default: throw std::invalid_argument("unsupported arrow type");
+			}
+		}
+
+	};
+
+	const char*
+	declared_type(const ArrowSchema* schema) {
+		if (schema->dictionary) {
+			if (schema->dictionary->dictionary) {
+				throw std::invalid_argument("nested dictionaries are not supported");
+			}
+			// dictionary-encoded column has the type of its values
+			schema = schema->dictionary;
+		}
+		const char* format = schema->format;
+		if (std::strlen(format) != 1) { throw std::invalid_argument("unsupported arrow type"); }
+		switch (format[0]) {
+			case 'b': case 'c': case 'C': case 's': case 'S':
+			case 'i': case 'I': case 'l': case 'L': return "INTEGER";
+			case 'f': case 'g': return "REAL";
+			case 'u': case 'U': return "TEXT";
+			case 'z': case 'Z': return "BLOB";
+			case 'n': return "";
+			default: throw std::invalid_argument("unsupported arrow type");
+		}
+	}
+
+	class stream_error {
+
+	private:
+		ArrowArrayStream* _stream;
+
+	public:
+		inline explicit stream_error(ArrowArrayStream* s): _stream(s) {}
+
+		inline void
+		operator()(int ret) const {
+			if (ret == 0) { return; }
+			const char* msg = this->_stream->get_last_error(this->_stream);
+			throw std::runtime_error(msg ? msg : "arrow stream error");
+		}
+
+	};
+
+	struct schema_guard {
+		ArrowSchema schema{};
+		inline ~schema_guard() { if (this->schema.release) { this->schema.release(&this->schema); } }
+	};
+
+	struct array_guard {
+		ArrowArray array{};
+		inline ~array_guard() { if (this->array.release) { this->array.release(&this->array); } }
+	};
+
+}
+
+auto
+sqlite::connection::import_arrow(
+	const char* table,
+	ArrowArrayStream* stream,
+	bool create_table,
+	int64 rows_per_transaction
+) -> int64 {
+	stream_error check(stream);
+	schema_guard schema;
+	check(stream->get_schema(stream, &schema.schema));
+	const auto& sc = schema.schema;
+	if (std::strcmp(sc.format, "+s") != 0) { throw std::invalid_argument("not a struct array"); }
+	const int ncolumns = int(sc.n_children);
+	if (ncolumns == 0) { throw std::invalid_argument("no columns"); }
+	std::string columns;
+	std::string create = format("CREATE TABLE IF NOT EXISTS \"%w\" (", table).get();
+	for (int i=0; i<ncolumns; ++i) {
+		const auto* child = sc.children[i];
+		const char* type = declared_type(child);
+		if (i != 0) { columns += ','; create += ','; }
+		columns += format("\"%w\"", child->name ? child->name : "").get();
+		create += format("\"%w\" %s", child->name ? child->name : "", type).get();
+	}
+	create += ')';
+	if (create_table) { this->execute(create); }
+	// the largest number of rows per INSERT that fits into variable limit
+	const int max_rows = std::max(1, std::min(
+		this->limit(::sqlite::limit::variable_number)/ncolumns,
+		500
+	));
+	auto make_insert = [&] (int nrows) {
+		std::string sql = format("INSERT INTO \"%w\" (", table).get();
+		sql += columns;
+		sql += ") VALUES ";
+		std::string tuple = "(";
+		for (int i=0; i<ncolumns; ++i) { tuple += i == 0 ? "?" : ",?"; }
+		tuple += ')';
+		for (int i=0; i<nrows; ++i) {
+			if (i != 0) { sql += ','; }
+			sql += tuple;
+		}
+		return this->prepare(sql);
+	};
+	statement full = make_insert(max_rows);
+	statement tail;
+	int tail_rows = 0;
+	std::vector<column_reader> readers(ncolumns);
+	std::vector<column_reader> dictionaries(ncolumns);
+	for (int i=0; i<ncolumns; ++i) {
+		const auto* child = sc.children[i];
+		readers[i].format = child->format[0];
+		if (child->dictionary) {
+			dictionaries[i].format = child->dictionary->format[0];
+			readers[i].dictionary = &dictionaries[i];
+		}
+	}
+	int64 total = 0;
+	int64 ntransaction = 0;
+	std::unique_ptr<immediate_transaction> tr;
+	while (true) {
+		array_guard batch;
+		check(stream->get_next(stream, &batch.array));
+		if (!batch.array.release) { break; }
+		const auto& a = batch.array;
+		if (a.n_children != ncolumns) { throw std::invalid_argument("bad number of columns"); }
+		for (int i=0; i<ncolumns; ++i) {
+			readers[i].array = a.children[i];
+			if (readers[i].dictionary) {
+				if (!a.children[i]->dictionary) {
+					throw std::invalid_argument("no dictionary in dictionary-encoded column");
+				}
+				dictionaries[i].array = a.children[i]->dictionary;
+			}
+		}
+		int64 row = 0;
+		while (row < a.length) {
+			if (!tr) { tr.reset(new immediate_transaction(*this)); }
+			const int64 remaining = a.length - row;
+			const int nrows = int(std::min<int64>(remaining, max_rows));
+			statement* s = &full;
+			if (nrows != max_rows) {
+				if (tail_rows != nrows) {
+					tail = make_insert(nrows);
+					tail_rows = nrows;
+				}
+				s = &tail;
+			}
+			int index = 1;
+			for (int r=0; r<nrows; ++r) {
+				for (int i=0; i<ncolumns; ++i) {
+					readers[i].bind(*s, index++, a.offset + row + r);
+				}
+			}
+			s->step();
+			s->reset();
+			row += nrows;
+			total += nrows;
+			ntransaction += nrows;
+			if (ntransaction >= rows_per_transaction) {
+				tr->commit();
+				tr.reset();
+				ntransaction = 0;
+			}
+		}
+		// text and blobs are bound by reference
+		full.clear();
+		if (tail.is_open()) { tail.clear(); }
+	}
+	if (tr) { tr->commit(); }
+	return total;
+}
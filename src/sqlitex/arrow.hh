@@ -0,0 +1,78 @@
+#ifndef SQLITEX_ARROW_HH
+#define SQLITEX_ARROW_HH
+
+#include <cstdint>
+
+#include <sqlitex/statement.hh>
+
+extern "C" {
+
+	// Apache Arrow C data interface, see
+	// https://arrow.apache.org/docs/format/CDataInterface.html
+
+	#ifndef ARROW_C_DATA_INTERFACE
+	#define ARROW_C_DATA_INTERFACE
+
+	#define ARROW_FLAG_DICTIONARY_ORDERED 1
+	#define ARROW_FLAG_NULLABLE 2
+	#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+	struct ArrowSchema {
+		const char* format;
+		const char* name;
+		const char* metadata;
+		int64_t flags;
+		int64_t n_children;
+		struct ArrowSchema** children;
+		struct ArrowSchema* dictionary;
+		void (*release)(struct ArrowSchema*);
+		void* private_data;
+	};
+
+	struct ArrowArray {
+		int64_t length;
+		int64_t null_count;
+		int64_t offset;
+		int64_t n_buffers;
+		int64_t n_children;
+		const void** buffers;
+		struct ArrowArray** children;
+		struct ArrowArray* dictionary;
+		void (*release)(struct ArrowArray*);
+		void* private_data;
+	};
+
+	#endif
+
+	#ifndef ARROW_C_STREAM_INTERFACE
+	#define ARROW_C_STREAM_INTERFACE
+
+	struct ArrowArrayStream {
+		int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+		int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+		const char* (*get_last_error)(struct ArrowArrayStream*);
+		void (*release)(struct ArrowArrayStream*);
+		void* private_data;
+	};
+
+	#endif
+
+}
+
+namespace sqlite {
+
+	const char* to_string(arrow_type rhs);
+
+	/**
+	Deduce Arrow type of the column from its declared type, or from the type of
+	the value in the current row for expressions. Columns with unknown type
+	are exported as text.
+	*/
+	arrow_type to_arrow_type(const statement& s, int i, bool has_row);
+
+	/// Export statement result as a stream that owns the statement.
+	void to_arrow(statement&& s, ArrowArrayStream* out, int64 batch_rows=65536);
+
+}
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,378 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+
+#include <sqlitex/binary_log_table.hh>
+
+struct sqlite::binary_log_table::mapping {
+	const char* data = nullptr;
+	std::size_t size = 0;
+
+	mapping() = default;
+	mapping(const mapping&) = delete;
+	mapping& operator=(const mapping&) = delete;
+
+	inline ~mapping() noexcept {
+		if (this->data) { ::munmap(const_cast<char*>(this->data), this->size); }
+	}
+};
+
+namespace {
+
+	using sqlite::binary_log_schema;
+	using sqlite::field_type;
+	using sqlite::int64;
+
+	template <class T>
+	inline T
+	load_value(const char* p) noexcept {
+		T x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+
+	std::size_t
+	field_size(field_type type) noexcept {
+		switch (type) {
+			case field_type::int8: case field_type::uint8: return 1;
+			case field_type::int16: case field_type::uint16: return 2;
+			case field_type::int32: case field_type::uint32: case field_type::float32: return 4;
+			case field_type::int64: case field_type::uint64: case field_type::float64: return 8;
+			default: return 0;
+		}
+	}
+
+	bool
+	is_integer(field_type type) noexcept {
+		return type != field_type::float32 && type != field_type::float64 &&
+			type != field_type::text && type != field_type::blob;
+	}
+
+	int64
+	read_integer(const char* p, field_type type) noexcept {
+		switch (type) {
+			case field_type::int8: return load_value<std::int8_t>(p);
+			case field_type::int16: return load_value<std::int16_t>(p);
+			case field_type::int32: return load_value<std::int32_t>(p);
+			case field_type::int64: return load_value<std::int64_t>(p);
+			case field_type::uint8: return load_value<std::uint8_t>(p);
+			case field_type::uint16: return load_value<std::uint16_t>(p);
+			case field_type::uint32: return load_value<std::uint32_t>(p);
+			case field_type::uint64: return int64(load_value<std::uint64_t>(p));
+			default: return 0;
+		}
+	}
+
+	const char*
+	declared_type(field_type type) noexcept {
+		switch (type) {
+			case field_type::float32: case field_type::float64: return " REAL";
+			case field_type::text: return " TEXT";
+			case field_type::blob: return " BLOB";
+			default: return " INTEGER";
+		}
+	}
+
+	/// Inclusive range of integers.
+	struct bounds {
+		int64 first = std::numeric_limits<int64>::min();
+		int64 last = std::numeric_limits<int64>::max();
+		bool empty = false;
+	};
+
+	/// Convert constraint into inclusive range of integers.
+	bounds
+	to_bounds(char op, sqlite::types::value* value) {
+		constexpr const int64 min = std::numeric_limits<int64>::min();
+		constexpr const int64 max = std::numeric_limits<int64>::max();
+		bounds b;
+		const bool lower = op == 'g' || op == 'G' || op == 'e';
+		const bool upper = op == 'l' || op == 'L' || op == 'e';
+		switch (::sqlite3_value_numeric_type(value)) {
+			case SQLITE_INTEGER: {
+				const int64 x = ::sqlite3_value_int64(value);
+				switch (op) {
+					case 'e': b.first = b.last = x; break;
+					case 'g': if (x == max) { b.empty = true; } else { b.first = x+1; } break;
+					case 'G': b.first = x; break;
+					case 'l': if (x == min) { b.empty = true; } else { b.last = x-1; } break;
+					case 'L': b.last = x; break;
+				}
+				break;
+			}
+			case SQLITE_FLOAT: {
+				const double x = ::sqlite3_value_double(value);
+				if (!(x > -9.2e18 && x < 9.2e18)) {
+					// the value is outside of the range of integers
+					b.empty = (lower && x > 0) || (upper && x < 0);
+					break;
+				}
+				switch (op) {
+					case 'e':
+						if (std::floor(x) != x) { b.empty = true; }
+						else { b.first = b.last = int64(x); }
+						break;
+					case 'g': b.first = int64(std::floor(x)) + 1; break;
+					case 'G': b.first = int64(std::ceil(x)); break;
+					case 'l': b.last = int64(std::ceil(x)) - 1; break;
+					case 'L': b.last = int64(std::floor(x)); break;
+				}
+				break;
+			}
+			case SQLITE_NULL:
+				b.empty = true;
+				break;
+			default:
+				// numbers are less than text and blobs
+				b.empty = lower;
+				break;
+		}
+		return b;
+	}
+
+}
+
+void
+sqlite::binary_log_schema::add(
+	std::string name,
+	field_type type,
+	std::size_t offset,
+	std::size_t size
+) {
+	if (size == 0) { size = field_size(type); }
+	if (size == 0 || (field_size(type) != 0 && size != field_size(type))) {
+		throw std::invalid_argument("bad field size");
+	}
+	if (offset + size > this->_record_size) {
+		throw std::invalid_argument("field does not fit into the record");
+	}
+	this->_fields.emplace_back(field{std::move(name), type, offset, size});
+}
+
+void
+sqlite::binary_log_schema::sorted_by(const std::string& name) {
+	for (std::size_t i=0; i<this->_fields.size(); ++i) {
+		if (this->_fields[i].name == name) {
+			if (!is_integer(this->_fields[i].type)) {
+				throw std::invalid_argument("sorted field is not an integer");
+			}
+			this->_sorted_field = int(i);
+			return;
+		}
+	}
+	throw std::invalid_argument("no such field");
+}
+
+sqlite::binary_log_table::binary_log_table(
+	connection_base db,
+	int argc,
+	const char* const* argv,
+	void* schema
+): _schema(static_cast<const binary_log_schema*>(schema)) {
+	if (argc < 4) { throw std::invalid_argument("file name is not specified"); }
+	this->_path = argv[3];
+	auto& path = this->_path;
+	if (path.size() >= 2 && (path.front() == '\'' || path.front() == '"') &&
+		path.back() == path.front()) {
+		path = path.substr(1, path.size()-2);
+	}
+	if (this->_schema->record_size() == 0) { throw std::invalid_argument("zero record size"); }
+	this->map();
+	std::string sql = "CREATE TABLE x(";
+	const auto& fields = this->_schema->fields();
+	for (std::size_t i=0; i<fields.size(); ++i) {
+		if (i != 0) { sql += ','; }
+		sql += format("\"%w\"%s", fields[i].name.data(), declared_type(fields[i].type)).get();
+	}
+	sql += ')';
+	db.declare_virtual_table(sql.data());
+}
+
+auto
+sqlite::binary_log_table::map() -> std::shared_ptr<const mapping> {
+	struct ::stat st;
+	if (::stat(this->_path.data(), &st) == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+	const std::size_t size = st.st_size;
+	if (this->_mapping && this->_mapping->size == size) { return this->_mapping; }
+	std::shared_ptr<mapping> m(new mapping);
+	if (size != 0) {
+		int fd = ::open(this->_path.data(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) { throw std::system_error(errno, std::system_category()); }
+		void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		int ret = errno;
+		::close(fd);
+		if (data == MAP_FAILED) { throw std::system_error(ret, std::system_category()); }
+		::madvise(data, size, MADV_RANDOM);
+		m->data = static_cast<const char*>(data);
+		m->size = size;
+	}
+	// cursors keep the old mapping until the next filter
+	this->_mapping = std::move(m);
+	return this->_mapping;
+}
+
+int
+sqlite::binary_log_table::best_index(virtual_table_index* info) {
+	const int sorted = this->_schema->sorted_field();
+	const auto& s = *this->_schema;
+	const auto size = this->_mapping->size;
+	const double nrows = double(size > s.header_size() ? (size - s.header_size())/s.record_size() : 0);
+	std::string plan;
+	int argv_index = 0;
+	bool equal = false, range = false;
+	// LIMIT can be used only if the table evaluates all constraints
+	bool all_used = true;
+	for (int i=0; i<info->num_constraints(); ++i) {
+		const auto column = info->column(i);
+		char op = 0;
+		switch (info->op(i)) {
+			case constraint_op::eq: op = 'e'; break;
+			case constraint_op::gt: op = 'g'; break;
+			case constraint_op::ge: op = 'G'; break;
+			case constraint_op::lt: op = 'l'; break;
+			case constraint_op::le: op = 'L'; break;
+			#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+			case constraint_op::limit: case constraint_op::offset: continue;
+			#endif
+			default: all_used = false; continue;
+		}
+		if (!info->usable(i) || (column != -1 && (sorted == -1 || column != sorted))) {
+			all_used = false;
+			continue;
+		}
+		if (op == 'e') { equal = true; } else { range = true; }
+		info->use(i, ++argv_index);
+		plan += format("%d%c,", column, op).get();
+	}
+	info->idxNum = 0;
+	if (info->nOrderBy == 1) {
+		const auto& o = info->aOrderBy[0];
+		if (o.iColumn == -1 || (sorted != -1 && o.iColumn == sorted)) {
+			info->orderByConsumed = 1;
+			if (o.desc) { info->idxNum |= 1; }
+		}
+	}
+	#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+	const int limit = info->find(constraint_op::limit);
+	if (all_used && (info->nOrderBy == 0 || info->orderByConsumed) && limit != -1) {
+		// the offset is applied by SQLite, we return limit+offset records
+		info->use(limit, ++argv_index, false);
+		plan += "0n,";
+		const int offset = info->find(constraint_op::offset);
+		if (offset != -1) {
+			info->use(offset, ++argv_index, false);
+			plan += "0o,";
+		}
+	}
+	#endif
+	const double rows = equal ? std::min(nrows, 10.0) : range ? nrows/4 : nrows;
+	info->estimatedRows = int64(std::max(1.0, rows));
+	info->estimatedCost = (argv_index == 0 ? 0.0 : std::log2(nrows + 1)) + rows;
+	if (argv_index != 0) {
+		info->idxStr = ::sqlite3_mprintf("%s", plan.data());
+		info->needToFreeIdxStr = 1;
+	}
+	return SQLITE_OK;
+}
+
+int
+sqlite::binary_log_cursor::filter(int idxNum, const char* idxStr, int argc, any_base* argv) {
+	try {
+		this->_mapping = this->_table->map();
+	} catch (const std::system_error& err) {
+		return SQLITE_IOERR;
+	}
+	const auto& s = this->_table->schema();
+	const auto size = this->_mapping->size;
+	const std::size_t n = size > s.header_size() ? (size - s.header_size())/s.record_size() : 0;
+	this->_records = this->_mapping->data + s.header_size();
+	this->_descending = (idxNum & 1) != 0;
+	std::size_t lo = 0, hi = n;
+	int64 limit = -1, offset = 0;
+	const char* p = idxStr;
+	for (int k=0; k<argc && p && *p; ++k) {
+		char* end = nullptr;
+		const auto column = std::strtol(p, &end, 10);
+		const char op = *end;
+		p = end + 2;
+		if (op == 'n') { limit = ::sqlite3_value_int64(argv[k].get()); continue; }
+		if (op == 'o') { offset = ::sqlite3_value_int64(argv[k].get()); continue; }
+		const auto b = to_bounds(op, argv[k].get());
+		if (b.empty) { hi = lo; break; }
+		if (column == -1) {
+			if (b.first > 0) { lo = std::max<std::size_t>(lo, std::min<uint64>(b.first, n)); }
+			if (b.last < 0) { hi = 0; }
+			else { hi = std::min<std::size_t>(hi, std::min<uint64>(uint64(b.last)+1, n)); }
+		} else {
+			const auto& f = s.fields()[column];
+			const char* first = this->_records + f.offset;
+			const auto record_size = s.record_size();
+			// the first record with the key >= x
+			auto lower_bound = [&] (int64 x) {
+				std::size_t a = 0, count = n;
+				while (count != 0) {
+					auto step = count/2;
+					if (read_integer(first + (a+step)*record_size, f.type) < x) {
+						a += step + 1;
+						count -= step + 1;
+					} else {
+						count = step;
+					}
+				}
+				return a;
+			};
+			lo = std::max(lo, lower_bound(b.first));
+			if (b.last != std::numeric_limits<int64>::max()) {
+				hi = std::min(hi, lower_bound(b.last + 1));
+			}
+		}
+	}
+	if (hi < lo) { hi = lo; }
+	if (limit >= 0) {
+		const auto count = uint64(limit) + uint64(std::max<int64>(offset, 0));
+		if (count < hi - lo) {
+			if (this->_descending) { lo = hi - count; } else { hi = lo + count; }
+		}
+	}
+	this->_position = lo;
+	this->_end = hi;
+	return SQLITE_OK;
+}
+
+int
+sqlite::binary_log_cursor::column(virtual_table_context* c, int n) {
+	const auto& s = this->_table->schema();
+	const auto& fields = s.fields();
+	if (n < 0 || std::size_t(n) >= fields.size()) { c->result(nullptr); return SQLITE_OK; }
+	const auto& f = fields[n];
+	const char* p = this->_records + this->current()*s.record_size() + f.offset;
+	switch (f.type) {
+		case field_type::float32: c->result(double(load_value<float>(p))); break;
+		case field_type::float64: c->result(load_value<double>(p)); break;
+		case field_type::text: {
+			auto len = ::strnlen(p, f.size);
+			::sqlite3_result_text(c->get(), p, int(len), pass_by_reference);
+			break;
+		}
+		case field_type::blob:
+			::sqlite3_result_blob(c->get(), p, int(f.size), pass_by_reference);
+			break;
+		default:
+			c->result(read_integer(p, f.type));
+			break;
+	}
+	return SQLITE_OK;
+}
@@ -0,0 +1,171 @@
+#ifndef SQLITEX_BINARY_LOG_TABLE_HH
+#define SQLITEX_BINARY_LOG_TABLE_HH
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+#include <sqlitex/virtual_table.hh>
+
+namespace sqlite {
+
+	enum class field_type {
+		int8, int16, int32, int64,
+		uint8, uint16, uint32, uint64,
+		float32, float64,
+		/// Fixed-size text padded with zeroes.
+		text,
+		/// Fixed-size bytes.
+		blob,
+	};
+
+	/**
+	\brief Layout of fixed-size records in a binary log file.
+	\details
+	Numbers are stored in native byte order. Unsigned 64-bit values that do
+	not fit into \c int64 wrap around.
+	*/
+	class binary_log_schema {
+
+	public:
+		struct field {
+			std::string name;
+			field_type type;
+			std::size_t offset;
+			std::size_t size;
+		};
+
+	private:
+		std::size_t _record_size;
+		std::size_t _header_size;
+		std::vector<field> _fields;
+		int _sorted_field = -1;
+
+	public:
+
+		/// \param[in] header_size the number of bytes before the first record
+		inline explicit
+		binary_log_schema(std::size_t record_size, std::size_t header_size=0):
+		_record_size(record_size), _header_size(header_size) {}
+
+		/**
+		Add field at \p offset from the start of the record. The size of
+		numeric fields is deduced from the type.
+		\throw std::invalid_argument if the field does not fit into the record
+		*/
+		void add(std::string name, field_type type, std::size_t offset, std::size_t size=0);
+
+		/**
+		Records are sorted by this integer field in non-decreasing order
+		(e.g. a timestamp), constraints on it are evaluated with binary search.
+		*/
+		void sorted_by(const std::string& name);
+
+		inline std::size_t record_size() const noexcept { return this->_record_size; }
+		inline std::size_t header_size() const noexcept { return this->_header_size; }
+		inline const std::vector<field>& fields() const noexcept { return this->_fields; }
+		inline int sorted_field() const noexcept { return this->_sorted_field; }
+
+	};
+
+	/**
+	\brief Virtual table over memory-mapped binary log file.
+	\details
+	The file name is the argument of the module. The file is mapped again
+	when it grows, so that appended records become visible to the next
+	query. Rowid is the zero-based record number. Equality and range
+	constraints on the rowid and on the sorted field are converted into a
+	range of records with binary search, ORDER BY on either of them is
+	consumed. LIMIT narrows the range when all constraints are pushed down.
+	Text and blobs are returned without copying.
+	\code{.cpp}
+	binary_log_schema schema(32);
+	schema.add("t", field_type::int64, 0);
+	schema.add("value", field_type::float64, 8);
+	schema.add("tag", field_type::text, 16, 16);
+	schema.sorted_by("t");
+	register_binary_log_table(db, "binary_log", schema);
+	db.execute("CREATE VIRTUAL TABLE temp.events USING binary_log('/var/log/events.bin')");
+	\endcode
+	*/
+	class binary_log_table: public virtual_table {
+
+	public:
+		struct mapping;
+
+	private:
+		const binary_log_schema* _schema;
+		std::string _path;
+		std::shared_ptr<const mapping> _mapping;
+
+	public:
+
+		inline static void create(connection_base, int, const char* const*) {}
+
+		binary_log_table(connection_base db, int argc, const char* const* argv, void* schema);
+
+		int best_index(virtual_table_index* info);
+
+		/// Map the file again if its size has changed.
+		std::shared_ptr<const mapping> map();
+
+		inline const binary_log_schema& schema() const noexcept { return *this->_schema; }
+
+	};
+
+	class binary_log_cursor: public virtual_table_cursor {
+
+	private:
+		binary_log_table* _table;
+		std::shared_ptr<const binary_log_table::mapping> _mapping;
+		const char* _records = nullptr;
+		std::size_t _position = 0;
+		std::size_t _end = 0;
+		bool _descending = false;
+
+	public:
+
+		inline explicit
+		binary_log_cursor(binary_log_table* table) noexcept:
+		_table(table) {}
+
+		int filter(int idxNum, const char* idxStr, int argc, any_base* argv);
+
+		inline int
+		next() {
+			if (this->_descending) { --this->_end; } else { ++this->_position; }
+			return SQLITE_OK;
+		}
+
+		inline bool eof() const noexcept { return this->_position >= this->_end; }
+
+		int column(virtual_table_context* c, int n);
+
+		inline int
+		rowid(int64& out) {
+			out = this->current();
+			return SQLITE_OK;
+		}
+
+	private:
+		inline std::size_t
+		current() const noexcept {
+			return this->_descending ? this->_end-1 : this->_position;
+		}
+
+	};
+
+	inline void
+	register_binary_log_table(
+		connection_base& db,
+		const char* module_name,
+		const binary_log_schema& schema
+	) {
+		db.virtual_table<binary_log_table,binary_log_cursor>(
+			module_name, const_cast<binary_log_schema*>(&schema));
+	}
+
+}
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,206 @@
+#include <iterator>
+#include <stdexcept>
+
+#include <sqlitex/change_capture.hh>
+
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace {
+
+	inline void
+	assign(sqlite::change_capture::value& result, sqlite::types::value* v) {
+		using sqlite::data_type;
+		result.type = data_type(::sqlite3_value_type(v));
+		switch (result.type) {
+			case data_type::integer: result.integer = ::sqlite3_value_int64(v); break;
+			case data_type::floating_point: result.real = ::sqlite3_value_double(v); break;
+			case data_type::text:
+			case data_type::blob: {
+				const void* data = result.type == data_type::text
+					? static_cast<const void*>(::sqlite3_value_text(v))
+					: ::sqlite3_value_blob(v);
+				// keeps the capacity of the string
+				result.bytes.assign(data ? static_cast<const char*>(data) : "",
+					::sqlite3_value_bytes(v));
+				break;
+			}
+			default: break;
+		}
+	}
+
+}
+
+sqlite::change_capture::change_capture(
+	connection& db,
+	std::size_t capacity,
+	overflow_policy policy
+): _db(db), _policy(policy) {
+	if (capacity == 0) { throw std::invalid_argument("zero capacity"); }
+	uint64 n = 1;
+	while (n < capacity) { n <<= 1; }
+	this->_ring.reset(new change[n]);
+	this->_mask = n-1;
+	db.add_preupdate_hook(this, [this] (preupdate_database& pdb, action a, const char* database,
+										const char* table, int64 old_rowid, int64 new_rowid) {
+		this->on_change(pdb, a, database, table, old_rowid, new_rowid);
+	});
+	db.add_savepoint_hook(this, [this] (savepoint_event event, int level) {
+		this->on_savepoint(event, level);
+	});
+	db.add_statement_hook(this, [this] (statement_event event, types::statement* s) {
+		this->on_statement(event, s);
+	});
+	db.add_commit_hook(this, [this] () { return this->commit(); });
+	// publish only when the commit can not fail or be turned into rollback any more
+	db.add_commit_listener(this, [this] () { this->publish(); });
+	db.add_rollback_hook(this, [this] () { this->rollback(); });
+}
+
+sqlite::change_capture::~change_capture() noexcept {
+	this->_db.remove_preupdate_hook(this);
+	this->_db.remove_savepoint_hook(this);
+	this->_db.remove_statement_hook(this);
+	this->_db.remove_commit_hook(this);
+	this->_db.remove_commit_listener(this);
+	this->_db.remove_rollback_hook(this);
+}
+
+void
+sqlite::change_capture::on_change(
+	preupdate_database& pdb,
+	action a,
+	const char* database,
+	const char* table,
+	int64 old_rowid,
+	int64 new_rowid
+) {
+	if (this->_overflow) { return; }
+	if (!this->_tables.empty()) {
+		bool found = false;
+		for (const auto& name : this->_tables) {
+			if (::sqlite3_stricmp(name.data(), table) == 0) { found = true; break; }
+		}
+		if (!found) { return; }
+	}
+	const auto capacity = this->_mask + 1;
+	if (this->_write - this->_tail_cache == capacity) {
+		this->_tail_cache = this->_tail.load(std::memory_order_acquire);
+		if (this->_write - this->_tail_cache == capacity) { this->_overflow = true; return; }
+	}
+	auto& c = this->_ring[this->_write & this->_mask];
+	try {
+		c.transaction = this->_transaction;
+		c.operation = a;
+		c.database.assign(database);
+		c.table.assign(table);
+		c.old_rowid = old_rowid;
+		c.new_rowid = new_rowid;
+		const int n = pdb.num_columns();
+		c.old_values.resize(a == action::insert ? 0 : n);
+		c.new_values.resize(a == action::delete_ ? 0 : n);
+		for (int i=0; i<int(c.old_values.size()); ++i) {
+			assign(c.old_values[i], pdb.old_value(i).get());
+		}
+		for (int i=0; i<int(c.new_values.size()); ++i) {
+			assign(c.new_values[i], pdb.new_value(i).get());
+		}
+	} catch (...) {
+		// exceptions must not propagate through SQLite
+		this->_overflow = true;
+		return;
+	}
+	++this->_write;
+}
+
+void
+sqlite::change_capture::on_savepoint(savepoint_event event, int level) noexcept {
+	auto& sp = this->_savepoints;
+	if (event == savepoint_event::begin) {
+		try {
+			sp.push_back(savepoint_mark{level, this->_write, this->_overflow});
+		} catch (...) {
+			// the changes can not be rolled back to this savepoint
+			this->_overflow = true;
+		}
+		return;
+	}
+	while (!sp.empty() && sp.back().level > level) { sp.pop_back(); }
+	const bool found = !sp.empty() && sp.back().level == level;
+	if (event == savepoint_event::rollback) {
+		if (found) {
+			this->_write = sp.back().write;
+			this->_overflow = sp.back().overflow;
+		} else {
+			// the savepoint was created before the capture
+			this->_overflow = true;
+		}
+	}
+	if (found) { sp.pop_back(); }
+}
+
+void
+sqlite::change_capture::on_statement(statement_event event, types::statement* s) noexcept {
+	auto& marks = this->_statements;
+	if (event == statement_event::begin) {
+		// in autocommit mode the rollback hook discards the changes
+		if (::sqlite3_get_autocommit(this->_db.get()) || ::sqlite3_stmt_readonly(s)) { return; }
+		try {
+			marks.push_back(statement_mark{s, this->_write, this->_overflow});
+		} catch (...) {
+			// the changes can not be rolled back to the start of the statement
+			this->_overflow = true;
+		}
+		return;
+	}
+	auto first = marks.rbegin();
+	while (first != marks.rend() && first->statement != s) { ++first; }
+	if (first == marks.rend()) { return; }
+	const auto m = *first;
+	marks.erase(std::next(first).base());
+	const auto head = this->_head.load(std::memory_order_relaxed);
+	auto* db = this->_db.get();
+	const bool changed = this->_write != m.write || this->_overflow != m.overflow;
+	// statement rollback resets the number of changes to zero,
+	// the rollback of the whole transaction is handled by the rollback hook
+	if (changed && m.write >= head && this->_write >= m.write &&
+		!::sqlite3_get_autocommit(db) && ::sqlite3_changes(db) == 0) {
+		this->_write = m.write;
+		this->_overflow = m.overflow;
+	}
+}
+
+int
+sqlite::change_capture::commit() noexcept {
+	return this->_overflow && this->_policy == overflow_policy::abort ? 1 : 0;
+}
+
+void
+sqlite::change_capture::publish() noexcept {
+	const auto head = this->_head.load(std::memory_order_relaxed);
+	this->_savepoints.clear();
+	if (this->_overflow) {
+		this->_write = head;
+		this->_overflow = false;
+		++this->_counters.lost_transactions;
+		return;
+	}
+	if (this->_write == head) { return; }
+	this->_counters.changes += this->_write - head;
+	++this->_counters.transactions;
+	++this->_transaction;
+	// pairs with the store of the flag and the load of the head by the consumer
+	this->_head.store(this->_write);
+	if (this->_waiting.load()) {
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		this->_published.notify_one();
+	}
+}
+
+void
+sqlite::change_capture::rollback() noexcept {
+	const auto head = this->_head.load(std::memory_order_relaxed);
+	if (this->_write != head || this->_overflow) { ++this->_counters.rollbacks; }
+	this->_write = head;
+	this->_overflow = false;
+	this->_savepoints.clear();
+}
+#endif
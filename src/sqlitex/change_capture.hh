@@ -0,0 +1,218 @@
+#ifndef SQLITEX_CHANGE_CAPTURE_HH
+#define SQLITEX_CHANGE_CAPTURE_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace sqlite {
+
+	/**
+	\brief Row changes captured by the preupdate hook and streamed to a
+	consumer thread through a single-producer single-consumer ring buffer.
+	\details
+	The preupdate hook copies each change into the next free record of the
+	ring. Records are preallocated and reused, so that in the steady state
+	the hook does not allocate memory unless values grow larger than
+	before. Changes become visible to the consumer only after the commit
+	completes, so that a commit that fails with \c SQLITE_BUSY is not
+	published until it is retried successfully (see
+	connection::add_commit_listener); the rollback hook discards them,
+	and the savepoint hook discards the changes of rolled back savepoints
+	of transaction_statements. Each hook is wait-free, publishing takes a
+	mutex only when the consumer is waiting.
+
+	When the ring has no free records for the current transaction (it is
+	larger than the ring or the consumer is too slow), the transaction is
+	either dropped and counted as lost or, with
+	<tt>overflow_policy::abort</tt>, its commit is turned into rollback.
+
+	A statement that fails inside an explicit transaction is rolled back
+	by SQLite without calling any hook. The statement hook records the
+	producer state when each writing statement starts and restores it
+	when the statement ends with changes recorded, but \c sqlite3_changes
+	is zero. This also discards the changes that BEFORE triggers make when
+	the statement itself ignores all its rows (<tt>INSERT OR
+	IGNORE</tt>, <tt>ON CONFLICT DO NOTHING</tt>). Raw SQL <tt>ROLLBACK
+	TO</tt> is not seen by the hooks. The capture must be destroyed before
+	the connection and after the consumer stops.
+	\code{.cpp}
+	change_capture capture(db, 4096);
+	capture.add_table("orders");
+	// consumer thread
+	while (running) {
+		capture.wait(std::chrono::milliseconds(100));
+		capture.consume([] (const change_capture::change& c) { ... });
+	}
+	\endcode
+	*/
+	class change_capture {
+
+	public:
+		enum class overflow_policy { drop, abort };
+
+		struct value {
+			data_type type = data_type::null;
+			int64 integer = 0;
+			double real = 0;
+			/// Text or blob.
+			std::string bytes;
+		};
+
+		struct change {
+			/// Committed transactions are numbered sequentially from zero.
+			uint64 transaction = 0;
+			action operation = action::insert;
+			std::string database;
+			std::string table;
+			int64 old_rowid = 0;
+			int64 new_rowid = 0;
+			/// Empty for insertions.
+			std::vector<value> old_values;
+			/// Empty for deletions.
+			std::vector<value> new_values;
+		};
+
+		struct counters {
+			uint64 changes = 0;
+			uint64 transactions = 0;
+			uint64 rollbacks = 0;
+			uint64 lost_transactions = 0;
+		};
+
+	private:
+		static constexpr const std::size_t cache_line_size = 64;
+
+		/// Producer state when the savepoint was created.
+		struct savepoint_mark {
+			int level;
+			uint64 write;
+			bool overflow;
+		};
+
+		/// Producer state when the statement started.
+		struct statement_mark {
+			types::statement* statement;
+			uint64 write;
+			bool overflow;
+		};
+
+	private:
+		connection& _db;
+		std::unique_ptr<change[]> _ring;
+		uint64 _mask;
+		overflow_policy _policy;
+		std::vector<std::string> _tables;
+		// producer
+		/// The next record to write.
+		uint64 _write = 0;
+		/// Consumer position that was seen last time.
+		uint64 _tail_cache = 0;
+		uint64 _transaction = 0;
+		bool _overflow = false;
+		std::vector<savepoint_mark> _savepoints;
+		std::vector<statement_mark> _statements;
+		counters _counters;
+		char _padding0[cache_line_size];
+		/// Records before this position are published.
+		std::atomic<uint64> _head{0};
+		char _padding1[cache_line_size - sizeof(std::atomic<uint64>)];
+		/// Records before this position are consumed.
+		std::atomic<uint64> _tail{0};
+		char _padding2[cache_line_size - sizeof(std::atomic<uint64>)];
+		std::atomic<bool> _waiting{false};
+		std::mutex _mutex;
+		std::condition_variable _published;
+
+	public:
+
+		/**
+		\param capacity the number of records that is rounded up to the power of two
+		\throw std::invalid_argument if the capacity is zero
+		*/
+		change_capture(connection& db, std::size_t capacity,
+					   overflow_policy policy=overflow_policy::drop);
+
+		~change_capture() noexcept;
+
+		change_capture(const change_capture&) = delete;
+		change_capture& operator=(const change_capture&) = delete;
+
+		/// Capture changes of the table only. All tables are captured by default.
+		inline void add_table(std::string name) { this->_tables.emplace_back(std::move(name)); }
+
+		inline std::size_t capacity() const noexcept { return std::size_t(this->_mask + 1); }
+
+		/// Producer-side counters, must be read in the thread that uses the connection.
+		inline const counters& statistics() const noexcept { return this->_counters; }
+
+		/// The number of published changes that are not consumed yet.
+		inline std::size_t
+		size() const noexcept {
+			return std::size_t(this->_head.load(std::memory_order_acquire) -
+				this->_tail.load(std::memory_order_acquire));
+		}
+
+		/**
+		Call \p func for at most \p max_changes published changes in commit
+		order. Must be called from one thread at a time.
+		\return the number of consumed changes
+		*/
+		template <class Function>
+		inline std::size_t
+		consume(Function func, std::size_t max_changes=std::numeric_limits<std::size_t>::max()) {
+			const auto tail = this->_tail.load(std::memory_order_relaxed);
+			const auto head = this->_head.load(std::memory_order_acquire);
+			auto last = head - tail < max_changes ? head : tail + max_changes;
+			auto i = tail;
+			try {
+				for (; i != last; ++i) {
+					const change& c = this->_ring[i & this->_mask];
+					func(c);
+				}
+			} catch (...) {
+				this->_tail.store(i, std::memory_order_release);
+				throw;
+			}
+			this->_tail.store(last, std::memory_order_release);
+			return std::size_t(last - tail);
+		}
+
+		/// Wait until there are published changes or \p timeout expires.
+		template <class Rep, class Period>
+		inline bool
+		wait(const std::chrono::duration<Rep,Period>& timeout) {
+			if (this->size() != 0) { return true; }
+			std::unique_lock<std::mutex> lock(this->_mutex);
+			// pairs with the store of the head and the load of the flag by the producer
+			this->_waiting.store(true);
+			const bool ret = this->_published.wait_for(lock, timeout, [this] () {
+				return this->_head.load() != this->_tail.load(std::memory_order_relaxed);
+			});
+			this->_waiting.store(false);
+			return ret;
+		}
+
+	private:
+		void on_change(preupdate_database& pdb, action a, const char* database,
+					   const char* table, int64 old_rowid, int64 new_rowid);
+		void on_savepoint(savepoint_event event, int level) noexcept;
+		void on_statement(statement_event event, types::statement* s) noexcept;
+		int commit() noexcept;
+		void publish() noexcept;
+		void rollback() noexcept;
+
+	};
+
+}
+#endif
+
+#endif // vim:filetype=cpp
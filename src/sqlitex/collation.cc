@@ -0,0 +1,186 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <sqlitex/collation.hh>
+
+namespace {
+
+	using sqlite::u8string_view;
+
+	inline unsigned char
+	fold_ascii(unsigned char ch) noexcept {
+		return (ch >= 'A' && ch <= 'Z') ? ch + ('a'-'A') : ch;
+	}
+
+	inline bool is_digit(unsigned char ch) noexcept { return ch >= '0' && ch <= '9'; }
+
+	inline int
+	compare_sizes(std::size_t a, std::size_t b) noexcept {
+		return a < b ? -1 : a > b ? 1 : 0;
+	}
+
+	#if defined(__SSE2__)
+	inline __m128i
+	load16(const unsigned char* p) noexcept {
+		__m128i x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+
+	/// Convert upper case ASCII letters to lower case.
+	inline __m128i
+	fold16(__m128i x) noexcept {
+		// bytes >= 0x80 are negative and do not fall into the range
+		auto upper = _mm_and_si128(
+			_mm_cmpgt_epi8(x, _mm_set1_epi8('A'-1)),
+			_mm_cmplt_epi8(x, _mm_set1_epi8('Z'+1))
+		);
+		return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	}
+
+	/// Bit mask of bytes that are different after case folding.
+	inline unsigned
+	nocase_mismatch16(__m128i x, __m128i y) noexcept {
+		return ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(fold16(x), fold16(y)))) & 0xffffu;
+	}
+	#endif
+
+	/// The number of equal bytes at the start of both strings.
+	inline std::size_t
+	common_prefix(const unsigned char* a, const unsigned char* b, std::size_t n) noexcept {
+		std::size_t i = 0;
+		#if defined(__SSE2__)
+		for (; i+16 <= n; i += 16) {
+			auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(load16(a+i), load16(b+i)));
+			if (mask != 0xffff) { return i + __builtin_ctz(~unsigned(mask)); }
+		}
+		#endif
+		while (i < n && a[i] == b[i]) { ++i; }
+		return i;
+	}
+
+	/// Decode one code point, invalid bytes are returned as is.
+	inline std::uint32_t
+	decode(const unsigned char*& p, const unsigned char* last) noexcept {
+		std::uint32_t c = *p++;
+		if (c < 0x80) { return c; }
+		int n = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+		if (n == 0) { return c; }
+		c &= 0x3f >> n;
+		for (; n != 0 && p != last && (*p & 0xc0) == 0x80; --n) { c = (c << 6) | (*p++ & 0x3f); }
+		return c;
+	}
+
+	/// Simple case folding for the most common alphabets.
+	inline std::uint32_t
+	fold(std::uint32_t c) noexcept {
+		if (c < 0x80) { return fold_ascii(c); }
+		// Latin-1 Supplement
+		if (c >= 0xc0 && c <= 0xde && c != 0xd7) { return c + 0x20; }
+		// Latin Extended-A: upper case letter is followed by lower case letter
+		if (c >= 0x100 && c <= 0x17f) {
+			if (c == 0x178) { return 0xff; }
+			if ((c <= 0x137 || (c >= 0x14a && c <= 0x177)) && c%2 == 0) { return c + 1; }
+			if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e)) && c%2 == 1) { return c + 1; }
+			return c;
+		}
+		// Greek
+		if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2) { return c + 0x20; }
+		// Cyrillic
+		if (c >= 0x410 && c <= 0x42f) { return c + 0x20; }
+		if (c >= 0x400 && c <= 0x40f) { return c + 0x50; }
+		return c;
+	}
+
+}
+
+int
+sqlite::ascii_nocase_compare(u8string_view lhs, u8string_view rhs) noexcept {
+	auto a = reinterpret_cast<const unsigned char*>(lhs.data());
+	auto b = reinterpret_cast<const unsigned char*>(rhs.data());
+	const auto n = std::min(lhs.size(), rhs.size());
+	std::size_t i = 0;
+	#if defined(__SSE2__)
+	for (; i+16 <= n; i += 16) {
+		auto mask = nocase_mismatch16(load16(a+i), load16(b+i));
+		if (mask != 0) {
+			i += __builtin_ctz(mask);
+			return int(fold_ascii(a[i])) - int(fold_ascii(b[i]));
+		}
+	}
+	#endif
+	for (; i<n; ++i) {
+		int diff = int(fold_ascii(a[i])) - int(fold_ascii(b[i]));
+		if (diff != 0) { return diff; }
+	}
+	return compare_sizes(lhs.size(), rhs.size());
+}
+
+int
+sqlite::natural_compare(u8string_view lhs, u8string_view rhs) noexcept {
+	auto a = reinterpret_cast<const unsigned char*>(lhs.data());
+	auto b = reinterpret_cast<const unsigned char*>(rhs.data());
+	const auto na = lhs.size(), nb = rhs.size();
+	// skip the common prefix, but start from the beginning of the number
+	auto i = common_prefix(a, b, std::min(na, nb));
+	while (i != 0 && is_digit(a[i-1])) { --i; }
+	auto j = i;
+	while (i < na && j < nb) {
+		if (is_digit(a[i]) && is_digit(b[j])) {
+			while (i < na && a[i] == '0') { ++i; }
+			while (j < nb && b[j] == '0') { ++j; }
+			auto first_a = i, first_b = j;
+			while (i < na && is_digit(a[i])) { ++i; }
+			while (j < nb && is_digit(b[j])) { ++j; }
+			// longer number without leading zeroes is greater
+			int ret = compare_sizes(i-first_a, j-first_b);
+			if (ret == 0) { ret = std::memcmp(a+first_a, b+first_b, i-first_a); }
+			if (ret != 0) { return ret; }
+			continue;
+		}
+		if (a[i] != b[j]) { return int(a[i]) - int(b[j]); }
+		++i, ++j;
+	}
+	if (i < na) { return 1; }
+	if (j < nb) { return -1; }
+	return lhs.compare(rhs);
+}
+
+int
+sqlite::utf8_casefold_compare(u8string_view lhs, u8string_view rhs) noexcept {
+	auto a = reinterpret_cast<const unsigned char*>(lhs.data());
+	auto b = reinterpret_cast<const unsigned char*>(rhs.data());
+	const auto last_a = a + lhs.size(), last_b = b + rhs.size();
+	while (a != last_a && b != last_b) {
+		#if defined(__SSE2__)
+		if (last_a-a >= 16 && last_b-b >= 16) {
+			auto x = load16(a), y = load16(b);
+			// the number of leading ASCII bytes in both blocks
+			auto non_ascii = unsigned(_mm_movemask_epi8(_mm_or_si128(x, y))) | 0x10000u;
+			auto n = __builtin_ctz(non_ascii);
+			auto mask = nocase_mismatch16(x, y) & ((1u << n) - 1);
+			if (mask != 0) {
+				auto k = __builtin_ctz(mask);
+				return int(fold_ascii(a[k])) - int(fold_ascii(b[k]));
+			}
+			a += n, b += n;
+			if (n == 16) { continue; }
+		}
+		#endif
+		if (*a < 0x80 && *b < 0x80) {
+			int diff = int(fold_ascii(*a)) - int(fold_ascii(*b));
+			if (diff != 0) { return diff; }
+			++a, ++b;
+			continue;
+		}
+		auto x = fold(decode(a, last_a));
+		auto y = fold(decode(b, last_b));
+		if (x != y) { return x < y ? -1 : 1; }
+	}
+	return compare_sizes(last_a-a, last_b-b);
+}
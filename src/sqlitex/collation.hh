@@ -1,24 +1,120 @@
 #ifndef SQLITEX_COLLATION_HH
 #define SQLITEX_COLLATION_HH
 
+#include <utility>
+
 #include <sqlitex/forward.hh>
 
 namespace sqlite {
 
+	/**
+	\brief Base class for collations.
+	\details
+	Collation receives non-owning views of the strings, no memory is
+	allocated for the comparison. Collations that accept \c string instead
+	of \c string_view are still supported, but the strings are copied on
+	every comparison.
+	*/
 	template <encoding enc>
 	class collation_base {
 
 	public:
 		static constexpr const ::sqlite::encoding encoding() { return enc; }
 		using string = typename encoding_traits<enc>::string;
+		using string_view = typename encoding_traits<enc>::string_view;
 
 		inline int
-		operator()(const string& lhs, const string& rhs) {
+		operator()(string_view lhs, string_view rhs) const noexcept {
 			return lhs.compare(rhs);
 		}
 
 	};
 
+	/// ASCII case-insensitive comparison (built-in NOCASE) that compares 16 bytes at a time.
+	int ascii_nocase_compare(u8string_view lhs, u8string_view rhs) noexcept;
+
+	/**
+	Comparison that orders runs of decimal digits by their numeric value
+	("file9" < "file10"), other bytes are compared as is. Strings that
+	differ only in leading zeroes are ordered byte-wise.
+	*/
+	int natural_compare(u8string_view lhs, u8string_view rhs) noexcept;
+
+	/**
+	Case-insensitive comparison of UTF-8 strings by code points. Upper case
+	letters of ASCII, Latin-1, Latin Extended-A, Greek and Cyrillic are
+	folded to lower case, ASCII parts are compared 16 bytes at a time.
+	*/
+	int utf8_casefold_compare(u8string_view lhs, u8string_view rhs) noexcept;
+
+	class ascii_nocase_collation: public collation_base<encoding::utf8> {
+	public:
+		inline int
+		operator()(string_view lhs, string_view rhs) const noexcept {
+			return ascii_nocase_compare(lhs, rhs);
+		}
+	};
+
+	class natural_collation: public collation_base<encoding::utf8> {
+	public:
+		inline int
+		operator()(string_view lhs, string_view rhs) const noexcept {
+			return natural_compare(lhs, rhs);
+		}
+	};
+
+	class utf8_casefold_collation: public collation_base<encoding::utf8> {
+	public:
+		inline int
+		operator()(string_view lhs, string_view rhs) const noexcept {
+			return utf8_casefold_compare(lhs, rhs);
+		}
+	};
+
+	namespace bits {
+
+		template <class Collation, class String>
+		struct accepts {
+			template <class C> static auto
+			test(int) -> decltype(std::declval<C&>()(std::declval<String>(), std::declval<String>()),
+								  std::true_type());
+			template <class C> static std::false_type test(...);
+			static constexpr const bool value = decltype(test<Collation>(0))::value;
+		};
+
+		template <class Collation>
+		using collation_view =
+			basic_string_view<typename Collation::string::value_type>;
+
+		/// Pass string views to the collation. Lengths are in bytes.
+		template <class Collation>
+		inline auto
+		collate(void* ptr, int n1, const void* s1, int n2, const void* s2) noexcept ->
+		typename std::enable_if<accepts<Collation,collation_view<Collation>>::value,int>::type {
+			using view = collation_view<Collation>;
+			using const_pointer = const typename view::value_type*;
+			constexpr const auto size = sizeof(typename view::value_type);
+			return (*static_cast<Collation*>(ptr))(
+				view(static_cast<const_pointer>(s1), n1/size),
+				view(static_cast<const_pointer>(s2), n2/size)
+			);
+		}
+
+		/// Copy the strings for collations that do not accept views.
+		template <class Collation>
+		inline auto
+		collate(void* ptr, int n1, const void* s1, int n2, const void* s2) ->
+		typename std::enable_if<!accepts<Collation,collation_view<Collation>>::value,int>::type {
+			using string = typename Collation::string;
+			using const_pointer = const typename string::value_type*;
+			constexpr const auto size = sizeof(typename string::value_type);
+			string str1(static_cast<const_pointer>(s1), n1/size);
+			string str2(static_cast<const_pointer>(s2), n2/size);
+			return (*static_cast<Collation*>(ptr))(str1, str2);
+		}
+
+	}
+
 }
 
 #endif // vim:filetype=cpp
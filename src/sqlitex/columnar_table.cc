@@ -0,0 +1,434 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <sqlitex/columnar_table.hh>
+
+namespace {
+
+	using sqlite::data_type;
+	using sqlite::int64;
+	using sqlite::uint64;
+
+	struct eq_op {
+		template <class T, class V> inline bool operator()(const T& a, const V& b) const { return a == b; }
+		#if defined(__AVX2__)
+		static inline __m256i cmp(__m256i a, __m256i b) { return _mm256_cmpeq_epi64(a, b); }
+		static inline __m256d cmp(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+		#endif
+	};
+
+	struct gt_op {
+		template <class T, class V> inline bool operator()(const T& a, const V& b) const { return a > b; }
+		#if defined(__AVX2__)
+		static inline __m256i cmp(__m256i a, __m256i b) { return _mm256_cmpgt_epi64(a, b); }
+		static inline __m256d cmp(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+		#endif
+	};
+
+	struct ge_op {
+		template <class T, class V> inline bool operator()(const T& a, const V& b) const { return a >= b; }
+		#if defined(__AVX2__)
+		static inline __m256i
+		cmp(__m256i a, __m256i b) {
+			return _mm256_xor_si256(_mm256_cmpgt_epi64(b, a), _mm256_set1_epi64x(-1));
+		}
+		static inline __m256d cmp(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+		#endif
+	};
+
+	struct lt_op {
+		template <class T, class V> inline bool operator()(const T& a, const V& b) const { return a < b; }
+		#if defined(__AVX2__)
+		static inline __m256i cmp(__m256i a, __m256i b) { return _mm256_cmpgt_epi64(b, a); }
+		static inline __m256d cmp(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+		#endif
+	};
+
+	struct le_op {
+		template <class T, class V> inline bool operator()(const T& a, const V& b) const { return a <= b; }
+		#if defined(__AVX2__)
+		static inline __m256i
+		cmp(__m256i a, __m256i b) {
+			return _mm256_xor_si256(_mm256_cmpgt_epi64(a, b), _mm256_set1_epi64x(-1));
+		}
+		static inline __m256d cmp(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+		#endif
+	};
+
+	/// Bit mask of at most 64 values that satisfy the predicate.
+	template <class T, class Predicate>
+	inline uint64
+	block_mask(const T* x, std::size_t n, Predicate pred) {
+		uint64 mask = 0;
+		for (std::size_t i=0; i<n; ++i) { mask |= uint64(pred(x[i])) << i; }
+		return mask;
+	}
+
+	#if defined(__AVX2__)
+	template <class Op>
+	inline uint64
+	block_mask_avx2(const int64* x, int64 value) noexcept {
+		const auto v = _mm256_set1_epi64x(value);
+		uint64 mask = 0;
+		for (int i=0; i<64; i+=4) {
+			__m256i a;
+			std::memcpy(&a, x+i, sizeof(a));
+			auto r = _mm256_castsi256_pd(Op::cmp(a, v));
+			mask |= uint64(_mm256_movemask_pd(r)) << i;
+		}
+		return mask;
+	}
+
+	template <class Op>
+	inline uint64
+	block_mask_avx2(const double* x, double value) noexcept {
+		const auto v = _mm256_set1_pd(value);
+		uint64 mask = 0;
+		for (int i=0; i<64; i+=4) {
+			__m256d a;
+			std::memcpy(&a, x+i, sizeof(a));
+			mask |= uint64(_mm256_movemask_pd(Op::cmp(a, v))) << i;
+		}
+		return mask;
+	}
+	#endif
+
+	/// AND the bitmap with the mask of rows that satisfy the predicate.
+	template <class T, class Predicate>
+	inline void
+	scan(const T* x, std::size_t n, uint64* bits, Predicate pred) {
+		const std::size_t nwords = (n + 63) / 64;
+		for (std::size_t w=0; w<nwords; ++w) {
+			if (bits[w] == 0) { continue; }
+			bits[w] &= block_mask(x + w*64, std::min<std::size_t>(64, n - w*64), pred);
+		}
+	}
+
+	template <class Op, class T>
+	inline void
+	scan_simd(const T* x, std::size_t n, T value, uint64* bits) {
+		Op op;
+		const std::size_t nwords = (n + 63) / 64;
+		for (std::size_t w=0; w<nwords; ++w) {
+			if (bits[w] == 0) { continue; }
+			const T* p = x + w*64;
+			const auto count = std::min<std::size_t>(64, n - w*64);
+			#if defined(__AVX2__)
+			if (count == 64) { bits[w] &= block_mask_avx2<Op>(p, value); continue; }
+			#endif
+			bits[w] &= block_mask(p, count, [&op,value] (T a) { return op(a, value); });
+		}
+	}
+
+	template <class T>
+	void
+	compare_simd(char op, const T* x, std::size_t n, T value, uint64* bits) {
+		switch (op) {
+			case 'e': scan_simd<eq_op>(x, n, value, bits); break;
+			case 'g': scan_simd<gt_op>(x, n, value, bits); break;
+			case 'G': scan_simd<ge_op>(x, n, value, bits); break;
+			case 'l': scan_simd<lt_op>(x, n, value, bits); break;
+			case 'L': scan_simd<le_op>(x, n, value, bits); break;
+		}
+	}
+
+	template <class T, class V>
+	void
+	compare(char op, const T* x, std::size_t n, const V& value, uint64* bits) {
+		switch (op) {
+			case 'e': scan(x, n, bits, [&value] (const T& a) { return eq_op()(a, value); }); break;
+			case 'g': scan(x, n, bits, [&value] (const T& a) { return gt_op()(a, value); }); break;
+			case 'G': scan(x, n, bits, [&value] (const T& a) { return ge_op()(a, value); }); break;
+			case 'l': scan(x, n, bits, [&value] (const T& a) { return lt_op()(a, value); }); break;
+			case 'L': scan(x, n, bits, [&value] (const T& a) { return le_op()(a, value); }); break;
+		}
+	}
+
+	template <class T>
+	void
+	contains(const T* x, std::size_t n, std::vector<T>& values, uint64* bits) {
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+		scan(x, n, bits, [&values] (const T& a) {
+			return std::binary_search(values.begin(), values.end(), a);
+		});
+	}
+
+	/// Numbers are less than text and blobs.
+	inline bool
+	less_than_all(char op) noexcept { return op == 'l' || op == 'L'; }
+
+	template <class Function>
+	inline void
+	for_each_in(sqlite::types::value* list, Function func) {
+		#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+		for (sqlite::any_base v : sqlite::virtual_table_in_list(sqlite::any_base(list))) {
+			func(v.get());
+		}
+		#endif
+	}
+
+	void
+	filter_numeric(
+		char op,
+		const sqlite::array_ref& values,
+		sqlite::types::value* rhs,
+		std::vector<uint64>& bits
+	) {
+		const auto n = values.size();
+		const bool integers = values.type() == data_type::integer;
+		if (op == 'i') {
+			if (integers) {
+				std::vector<int64> list;
+				for_each_in(rhs, [&list] (sqlite::types::value* v) {
+					auto t = ::sqlite3_value_numeric_type(v);
+					if (t == SQLITE_INTEGER) { list.emplace_back(::sqlite3_value_int64(v)); }
+					if (t == SQLITE_FLOAT) {
+						double x = ::sqlite3_value_double(v);
+						if (std::floor(x) == x && std::abs(x) < 9.2e18) { list.emplace_back(int64(x)); }
+					}
+				});
+				contains(values.integers(), n, list, bits.data());
+			} else {
+				std::vector<double> list;
+				for_each_in(rhs, [&list] (sqlite::types::value* v) {
+					auto t = ::sqlite3_value_numeric_type(v);
+					if (t == SQLITE_INTEGER || t == SQLITE_FLOAT) {
+						list.emplace_back(::sqlite3_value_double(v));
+					}
+				});
+				contains(values.reals(), n, list, bits.data());
+			}
+			return;
+		}
+		switch (::sqlite3_value_numeric_type(rhs)) {
+			case SQLITE_INTEGER:
+				if (integers) {
+					compare_simd(op, values.integers(), n, int64(::sqlite3_value_int64(rhs)), bits.data());
+				} else {
+					compare_simd(op, values.reals(), n, ::sqlite3_value_double(rhs), bits.data());
+				}
+				break;
+			case SQLITE_FLOAT:
+				if (integers) {
+					compare(op, values.integers(), n, ::sqlite3_value_double(rhs), bits.data());
+				} else {
+					compare_simd(op, values.reals(), n, ::sqlite3_value_double(rhs), bits.data());
+				}
+				break;
+			case SQLITE_NULL:
+				std::fill(bits.begin(), bits.end(), 0);
+				break;
+			default:
+				if (!less_than_all(op)) { std::fill(bits.begin(), bits.end(), 0); }
+				break;
+		}
+	}
+
+	void
+	filter_text(
+		char op,
+		const sqlite::array_ref& values,
+		sqlite::types::value* rhs,
+		std::vector<uint64>& bits
+	) {
+		const auto n = values.size();
+		auto to_string = [] (sqlite::types::value* v) {
+			auto s = reinterpret_cast<const char*>(::sqlite3_value_text(v));
+			return std::string(s, ::sqlite3_value_bytes(v));
+		};
+		if (op == 'i') {
+			std::vector<std::string> list;
+			for_each_in(rhs, [&list,&to_string] (sqlite::types::value* v) {
+				auto t = ::sqlite3_value_type(v);
+				if (t != SQLITE_NULL && t != SQLITE_BLOB) { list.emplace_back(to_string(v)); }
+			});
+			contains(values.strings(), n, list, bits.data());
+			return;
+		}
+		switch (::sqlite3_value_type(rhs)) {
+			case SQLITE_NULL:
+				std::fill(bits.begin(), bits.end(), 0);
+				break;
+			case SQLITE_BLOB:
+				// text is less than blobs
+				if (!less_than_all(op)) { std::fill(bits.begin(), bits.end(), 0); }
+				break;
+			default:
+				compare(op, values.strings(), n, to_string(rhs), bits.data());
+				break;
+		}
+	}
+
+}
+
+void
+sqlite::columnar_data::add(std::string name, array_ref values) {
+	if (!this->_columns.empty() && values.size() != this->_num_rows) {
+		throw std::invalid_argument("column size mismatch");
+	}
+	this->_num_rows = values.size();
+	this->_columns.emplace_back(column{std::move(name), values});
+}
+
+sqlite::columnar_table::columnar_table(
+	connection_base db,
+	int,
+	const char* const*,
+	void* data
+): _data(static_cast<const columnar_data*>(data)) {
+	std::string sql = "CREATE TABLE x(";
+	const auto& columns = this->_data->columns();
+	for (std::size_t i=0; i<columns.size(); ++i) {
+		if (i != 0) { sql += ','; }
+		const char* type = "";
+		switch (columns[i].values.type()) {
+			case data_type::integer: type = " INTEGER"; break;
+			case data_type::floating_point: type = " REAL"; break;
+			case data_type::text: type = " TEXT"; break;
+			default: break;
+		}
+		sql += format("\"%w\"%s", columns[i].name.data(), type).get();
+	}
+	sql += ')';
+	db.declare_virtual_table(sql.data());
+}
+
+int
+sqlite::columnar_table::best_index(virtual_table_index* info) {
+	const auto& columns = this->_data->columns();
+	const double nrows = double(this->_data->num_rows());
+	std::string plan;
+	int argv_index = 0;
+	double selectivity = 1;
+	// LIMIT can be used only if the table evaluates all constraints
+	bool all_used = true;
+	for (int i=0; i<info->num_constraints(); ++i) {
+		const auto column = info->column(i);
+		char op = 0;
+		switch (info->op(i)) {
+			case constraint_op::eq: op = 'e'; break;
+			case constraint_op::gt: op = 'g'; break;
+			case constraint_op::ge: op = 'G'; break;
+			case constraint_op::lt: op = 'l'; break;
+			case constraint_op::le: op = 'L'; break;
+			#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+			case constraint_op::limit: case constraint_op::offset: continue;
+			#endif
+			default: all_used = false; continue;
+		}
+		if (!info->usable(i) || column < 0 || std::size_t(column) >= columns.size()) {
+			all_used = false;
+			continue;
+		}
+		if (columns[column].values.type() == data_type::text) {
+			const char* collation = info->collation(i);
+			if (collation && ::sqlite3_stricmp(collation, "BINARY") != 0) {
+				all_used = false;
+				continue;
+			}
+		}
+		if (op == 'e') {
+			#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+			if (info->in(i)) {
+				info->in(i, true);
+				op = 'i';
+			}
+			#endif
+			selectivity *= op == 'i' ? 0.05 : 0.01;
+		} else {
+			selectivity *= 0.25;
+		}
+		info->use(i, ++argv_index);
+		plan += format("%d%c,", column, op).get();
+	}
+	#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+	const int limit = info->find(constraint_op::limit);
+	if (all_used && info->nOrderBy == 0 && limit != -1) {
+		// the offset is applied by SQLite, we return limit+offset rows
+		info->use(limit, ++argv_index, false);
+		plan += "0n,";
+		const int offset = info->find(constraint_op::offset);
+		if (offset != -1) {
+			info->use(offset, ++argv_index, false);
+			plan += "0o,";
+		}
+	}
+	#endif
+	const double rows = std::max(1.0, nrows*selectivity);
+	info->estimatedRows = int64(rows);
+	if (argv_index == 0) {
+		info->estimatedCost = nrows;
+		return SQLITE_OK;
+	}
+	// bitmap scan is much cheaper than visiting every row
+	info->estimatedCost = nrows/16 + rows;
+	info->idxNum = argv_index;
+	info->idxStr = ::sqlite3_mprintf("%s", plan.data());
+	info->needToFreeIdxStr = 1;
+	return SQLITE_OK;
+}
+
+int
+sqlite::columnar_cursor::filter(int idxNum, const char* idxStr, int argc, any_base* argv) {
+	const auto n = this->_data->num_rows();
+	this->_bits.assign((n + 63) / 64, ~uint64(0));
+	if (n % 64 != 0) { this->_bits.back() = (uint64(1) << (n % 64)) - 1; }
+	int64 limit = -1, offset = 0;
+	const char* p = idxStr;
+	for (int k=0; k<argc && p && *p; ++k) {
+		char* end = nullptr;
+		const auto column = std::strtol(p, &end, 10);
+		const char op = *end;
+		p = end + 2;
+		if (op == 'n') { limit = ::sqlite3_value_int64(argv[k].get()); continue; }
+		if (op == 'o') { offset = ::sqlite3_value_int64(argv[k].get()); continue; }
+		const auto& values = this->_data->columns()[column].values;
+		if (values.type() == data_type::text) {
+			filter_text(op, values, argv[k].get(), this->_bits);
+		} else {
+			filter_numeric(op, values, argv[k].get(), this->_bits);
+		}
+	}
+	this->_remaining = std::numeric_limits<uint64>::max();
+	if (limit >= 0) { this->_remaining = uint64(limit) + uint64(std::max<int64>(offset, 0)); }
+	this->_position = this->find(0);
+	return SQLITE_OK;
+}
+
+int
+sqlite::columnar_cursor::column(virtual_table_context* c, int n) {
+	const auto& columns = this->_data->columns();
+	if (n < 0 || std::size_t(n) >= columns.size()) { c->result(nullptr); return SQLITE_OK; }
+	const auto& values = columns[n].values;
+	const auto i = this->_position;
+	switch (values.type()) {
+		case data_type::integer: c->result(values.integers()[i]); break;
+		case data_type::floating_point: c->result(values.reals()[i]); break;
+		case data_type::text: c->result(values.strings()[i], pass_by_reference); break;
+		default: c->result(nullptr); break;
+	}
+	return SQLITE_OK;
+}
+
+std::size_t
+sqlite::columnar_cursor::find(std::size_t i) const noexcept {
+	const auto n = this->_data->num_rows();
+	const auto nwords = this->_bits.size();
+	auto word = i / 64;
+	if (word >= nwords) { return n; }
+	auto bits = this->_bits[word] & (~uint64(0) << (i % 64));
+	while (bits == 0) {
+		if (++word == nwords) { return n; }
+		bits = this->_bits[word];
+	}
+	return word*64 + __builtin_ctzll(bits);
+}
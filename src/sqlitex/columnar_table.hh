@@ -0,0 +1,129 @@
+#ifndef SQLITEX_COLUMNAR_TABLE_HH
+#define SQLITEX_COLUMNAR_TABLE_HH
+
+#include <string>
+#include <vector>
+
+#include <sqlitex/array_table.hh>
+#include <sqlitex/connection.hh>
+#include <sqlitex/virtual_table.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Named columns of equal size that are exposed as a virtual table.
+	\details
+	Values are not copied, they must outlive the connection. Columns do not
+	contain NULLs.
+	*/
+	class columnar_data {
+
+	public:
+		struct column {
+			std::string name;
+			array_ref values;
+		};
+
+	private:
+		std::vector<column> _columns;
+		std::size_t _num_rows = 0;
+
+	public:
+
+		/// \throw std::invalid_argument if the column size differs from the other columns
+		void add(std::string name, array_ref values);
+
+		inline const std::vector<column>& columns() const noexcept { return this->_columns; }
+		inline std::size_t num_columns() const noexcept { return this->_columns.size(); }
+		inline std::size_t num_rows() const noexcept { return this->_num_rows; }
+
+	};
+
+	/**
+	\brief Eponymous virtual table over columnar_data.
+	\details
+	Equality, range and IN constraints are pushed down to the table and
+	evaluated by filter() column by column into a bitmap of matching rows
+	(with AVX2 when available), so that SQLite visits only matching rows.
+	Text constraints are pushed down only for BINARY collation. The scan
+	stops after LIMIT (plus OFFSET) rows when all constraints are pushed
+	down. Rowid is the zero-based row number.
+	\code{.cpp}
+	columnar_data data;
+	data.add("id", array_ref(ids));
+	data.add("price", array_ref(prices));
+	register_columnar_table(db, "items", data);
+	statement s = db.prepare(
+		"SELECT * FROM items JOIN orders USING (id) WHERE price BETWEEN ? AND ?");
+	\endcode
+	*/
+	class columnar_table: public virtual_table {
+
+	public:
+		static constexpr const bool eponymous = true;
+
+	private:
+		const columnar_data* _data;
+
+	public:
+
+		columnar_table(connection_base db, int argc, const char* const* argv, void* data);
+
+		int best_index(virtual_table_index* info);
+
+		inline const columnar_data& data() const noexcept { return *this->_data; }
+
+	};
+
+	class columnar_cursor: public virtual_table_cursor {
+
+	private:
+		const columnar_data* _data;
+		std::vector<uint64> _bits;
+		std::size_t _position = 0;
+		/// The number of rows left until the LIMIT.
+		uint64 _remaining = 0;
+
+	public:
+
+		inline explicit
+		columnar_cursor(columnar_table* table) noexcept:
+		_data(&table->data()) {}
+
+		int filter(int idxNum, const char* idxStr, int argc, any_base* argv);
+
+		inline int
+		next() {
+			this->_position = this->find(this->_position+1);
+			--this->_remaining;
+			return SQLITE_OK;
+		}
+
+		inline bool
+		eof() const noexcept {
+			return this->_position >= this->_data->num_rows() || this->_remaining == 0;
+		}
+
+		int column(virtual_table_context* c, int n);
+
+		inline int
+		rowid(int64& out) {
+			out = this->_position;
+			return SQLITE_OK;
+		}
+
+	private:
+		/// The first matching row starting from \p i.
+		std::size_t find(std::size_t i) const noexcept;
+
+	};
+
+	inline void
+	register_columnar_table(connection_base& db, const char* name, const columnar_data& data) {
+		db.virtual_table<columnar_table,columnar_cursor>(
+			name, const_cast<columnar_data*>(&data));
+	}
+
+}
+
+#endif // vim:filetype=cpp
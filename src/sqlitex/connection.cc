@@ -50,3 +50,114 @@ sqlite::to_string(encoding rhs) {
 		default: throw std::invalid_argument("bad encoding");
 	}
 }
+
+namespace {
+
+	inline sqlite::statement
+	prepare_persistent(sqlite::connection_base db, const char* sql) {
+		#if defined(SQLITE_PREPARE_PERSISTENT)
+		return db.prepare(sql, sqlite::prepare_f::persistent);
+		#else
+		return db.prepare(sql);
+		#endif
+	}
+
+	inline void
+	step_and_reset(sqlite::statement& s) {
+		sqlite::errc ret = sqlite::errc(::sqlite3_step(s.get()));
+		::sqlite3_reset(s.get());
+		if (ret != sqlite::errc::done && ret != sqlite::errc::row) {
+			sqlite::throw_error(ret);
+		}
+	}
+
+}
+
+void
+sqlite::transaction_statements::begin(connection_base db, transaction_type type) {
+	static const char* sql[] = {
+		"BEGIN DEFERRED", "BEGIN IMMEDIATE", "BEGIN EXCLUSIVE"
+	};
+	auto& s = this->_begin[int(type)];
+	if (!s.is_open()) { s = prepare_persistent(db, sql[int(type)]); }
+	step_and_reset(s);
+	this->_depth = 1;
+}
+
+void
+sqlite::transaction_statements::commit(connection_base db) {
+	if (!this->_commit.is_open()) { this->_commit = prepare_persistent(db, "COMMIT"); }
+	step_and_reset(this->_commit);
+	this->_depth = 0;
+}
+
+void
+sqlite::transaction_statements::rollback(connection_base db) {
+	if (!this->_rollback.is_open()) { this->_rollback = prepare_persistent(db, "ROLLBACK"); }
+	this->_depth = 0;
+	step_and_reset(this->_rollback);
+}
+
+int
+sqlite::transaction_statements::savepoint(connection_base db) {
+	int level = this->_depth + 1;
+	step_and_reset(get(this->_savepoint, db, "SAVEPOINT sqlitex_%d", level));
+	this->_depth = level;
+	this->notify(savepoint_event::begin, level);
+	return level;
+}
+
+void
+sqlite::transaction_statements::release(connection_base db, int level) {
+	step_and_reset(get(this->_release, db, "RELEASE sqlitex_%d", level));
+	this->_depth = level-1;
+	this->notify(savepoint_event::release, level);
+}
+
+void
+sqlite::transaction_statements::rollback(connection_base db, int level) {
+	this->_depth = level-1;
+	step_and_reset(get(this->_rollback_to, db, "ROLLBACK TO sqlitex_%d", level));
+	this->notify(savepoint_event::rollback, level);
+	step_and_reset(get(this->_release, db, "RELEASE sqlitex_%d", level));
+}
+
+void
+sqlite::transaction_statements::remove_hook(const void* owner) noexcept {
+	auto first = this->_hooks.begin();
+	while (first != this->_hooks.end()) {
+		if (first->first == owner) { first = this->_hooks.erase(first); }
+		else { ++first; }
+	}
+}
+
+void
+sqlite::transaction_statements::close() noexcept {
+	for (auto& s : this->_begin) { s = statement(); }
+	this->_commit = statement();
+	this->_rollback = statement();
+	this->_savepoint.clear();
+	this->_release.clear();
+	this->_rollback_to.clear();
+	this->_depth = 0;
+}
+
+void
+sqlite::transaction_statements::notify(savepoint_event event, int level) noexcept {
+	// hooks may add or remove hooks
+	auto hooks = this->_hooks;
+	for (auto& h : hooks) { h.second(event, level); }
+}
+
+auto
+sqlite::transaction_statements::get(
+	std::vector<statement>& v,
+	connection_base db,
+	const char* fmt,
+	int level
+) -> statement& {
+	if (v.size() < std::size_t(level)) { v.resize(level); }
+	auto& s = v[level-1];
+	if (!s.is_open()) { s = prepare_persistent(db, format(fmt, level).get()); }
+	return s;
+}
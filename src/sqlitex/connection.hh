@@ -2,7 +2,11 @@
 #define SQLITEX_CONNECTION_HH
 
 #include <chrono>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include <sqlitex/collation.hh>
 #include <sqlitex/column_metadata.hh>
@@ -118,6 +122,20 @@ namespace sqlite {
 			return s;
 		}
 
+		inline statement
+		prepare(const u8string& sql, prepare_f flags) {
+			types::statement* stmt = nullptr;
+			call(::sqlite3_prepare_v3(
+				this->_ptr,
+				sql.data(),
+				sql.size(),
+				downcast(flags),
+				&stmt,
+				nullptr
+			));
+			return statement(stmt);
+		}
+
 		template <class ... Args>
 		inline statement
 		prepare(const u16string& sql, const Args& ... args) {
@@ -484,35 +502,102 @@ namespace sqlite {
 			));
 		}
 
-		template <class Function>
+		/**
+		Register aggregate function. For each group the state of type \p Aggregate
+		is default-constructed in the memory of \c sqlite3_aggregate_context,
+		\c step is called for each row and \c end computes the result (see
+		::sqlite::aggregate). Exceptions are reported as function errors.
+		\code{.cpp}
+		struct product: public aggregate {
+			double x = 1;
+			void step(context*, int, any_base* args) { x *= ::sqlite3_value_double(args[0].get()); }
+			void end(context* c) { c->result(x); }
+		};
+		db.aggregate_function<product>("product", 1);
+		\endcode
+		*/
+		template <class Aggregate>
 		inline void
 		aggregate_function(
-			Function* func,
 			const char* name,
 			int narguments,
 			::sqlite::encoding enc = ::sqlite::encoding::utf8,
-			bool deterministic = true
+			bool deterministic = true,
+			void* data = nullptr
 		) {
 			int flags = static_cast<int>(enc);
 			if (deterministic) { flags |= SQLITE_DETERMINISTIC; }
 			call(::sqlite3_create_function_v2(
-				this->_ptr, name, narguments, flags, func,
-				[] (types::context* ctx, int nargs, types::value** args) {
-					context c(ctx);
-					c.data<Function>()->func(c, nargs, reinterpret_cast<any_base*>(args));
-				},
-				[] (types::context* ctx, int nargs, types::value** args) {
-					context c(ctx);
-					c.data<Function>()->step(c, nargs, reinterpret_cast<any_base*>(args));
-				},
-				[] (types::context* ctx, int nargs, types::value** args) {
-					context c(ctx);
-					c.data<Function>()->end(c, nargs, reinterpret_cast<any_base*>(args));
-				},
+				this->_ptr, name, narguments, flags, data,
+				nullptr,
+				bits::aggregate_step<Aggregate>,
+				bits::aggregate_final<Aggregate>,
+				nullptr
+			));
+		}
+
+		/**
+		Register aggregate window function. In addition to aggregate_function
+		requirements \p Window implements \c inverse that removes the oldest
+		row from the frame and \c value that returns the current result, so
+		that moving frames are updated in constant time per row.
+		*/
+		template <class Window>
+		inline void
+		window_function(
+			const char* name,
+			int narguments,
+			::sqlite::encoding enc = ::sqlite::encoding::utf8,
+			bool deterministic = true,
+			void* data = nullptr
+		) {
+			int flags = static_cast<int>(enc);
+			if (deterministic) { flags |= SQLITE_DETERMINISTIC; }
+			call(::sqlite3_create_window_function(
+				this->_ptr, name, narguments, flags, data,
+				bits::aggregate_step<Window>,
+				bits::aggregate_final<Window>,
+				bits::aggregate_value<Window>,
+				bits::aggregate_inverse<Window>,
 				nullptr
 			));
 		}
 
+		/**
+		Register scalar function with typed arguments. The number of
+		arguments and their types are deduced from the signature of \p func
+		(lambda, function object or function pointer), the arguments are
+		converted with the corresponding \c sqlite3_value_* function and the
+		return value is passed to the narrowest \c sqlite3_result_* function.
+		Supported types are arithmetic types, \c u8string_view,
+		\c u16string_view (valid until the function returns), \c u8string,
+		\c u16string, \c blob and \c any_base. Exceptions are reported as
+		function errors.
+		\code
+		db.function("clamp", [] (double x, double lo, double hi) {
+			return x < lo ? lo : x > hi ? hi : x;
+		});
+		\endcode
+		*/
+		template <class Function>
+		inline void
+		function(
+			const char* name,
+			Function func,
+			function_flag flags = function_flag::deterministic,
+			::sqlite::encoding enc = ::sqlite::encoding::utf8
+		) {
+			using traits = bits::function_traits<Function>;
+			call(::sqlite3_create_function_v2(
+				this->_ptr, name, traits::arity, int(flags) | int(enc),
+				new Function(func),
+				bits::typed_function<Function>,
+				nullptr,
+				nullptr,
+				bits::destroy<Function>
+			));
+		}
+
 		inline void
 		scalar_function(
 			types::scalar_function func,
@@ -560,16 +645,10 @@ namespace sqlite {
 		template <class Collation>
 		inline void
 		collation(const u8string& name, Collation coll) {
-			using string = typename Collation::string;
-			using const_pointer = const typename string::value_type*;
 			Collation* copy = new Collation(coll);
 			int ret = ::sqlite3_create_collation_v2(
 				this->_ptr, name.data(), downcast(Collation::encoding()), copy,
-				[] (void* ptr, int n1, const void* s1, int n2, const void* s2) -> int {
-					string str1(static_cast<const_pointer>(s1), n1);
-					string str2(static_cast<const_pointer>(s2), n2);
-					return (*static_cast<Collation*>(ptr))(str1, str2);
-				},
+				bits::collate<Collation>,
 				bits::destroy<Collation>
 			);
 			if (ret != SQLITE_OK) { bits::destroy<Collation>(copy); }
@@ -718,13 +797,60 @@ namespace sqlite {
 			call(::sqlite3_declare_vtab(this->_ptr, sql));
 		}
 
+		/**
+		Register virtual table module. The module is eponymous-only (i.e.
+		<tt>CREATE VIRTUAL TABLE</tt> is not supported) if \c Table::eponymous
+		is true. Cursors are deleted after Cursor::close and tables are deleted
+		after Table::disconnect and Table::destroy. Table is constructed with
+		\p client_data as the last argument if it has such constructor.
+		*/
 		template <class Table, class Cursor>
-		inline void virtual_table(const char* module_name) {
-			types::module m{};
-			m.iVersion = 2;
+		inline void
+		virtual_table(const char* module_name, void* client_data=nullptr) {
+			static const types::module m = make_module<Table,Cursor>();
+			call(::sqlite3_create_module_v2(this->_ptr, module_name, &m, client_data, nullptr));
+		}
+
+	private:
+
+		/// Error code of the exception that is being handled.
+		static inline int
+		current_error() noexcept {
+			try {
+				throw;
+			} catch (const std::bad_alloc&) {
+				return SQLITE_NOMEM;
+			} catch (const std::system_error& err) {
+				return err.code().category() == sqlite_category ? err.code().value() : SQLITE_ERROR;
+			} catch (...) {
+				return SQLITE_ERROR;
+			}
+		}
+
+		template <class Table>
+		static inline auto
+		new_table(types::connection* db, int argc, const char* const* argv, void* client_data) ->
+		typename std::enable_if<
+			std::is_constructible<Table,connection_base,int,const char* const*,void*>::value,
+			Table*>::type {
+			return new Table(connection_base(db), argc, argv, client_data);
+		}
+
+		template <class Table>
+		static inline auto
+		new_table(types::connection* db, int argc, const char* const* argv, void*) ->
+		typename std::enable_if<
+			!std::is_constructible<Table,connection_base,int,const char* const*,void*>::value,
+			Table*>::type {
+			return new Table(connection_base(db), argc, argv);
+		}
+
+		template <class Table>
+		static inline void
+		set_create(types::module& m, std::false_type) {
 			m.xCreate = [] (
 				types::connection* db,
-				void*,
+				void* client_data,
 				int argc,
 				const char *const* argv,
 				types::virtual_table** ptr,
@@ -733,16 +859,29 @@ namespace sqlite {
 				try {
 					Table::create(connection_base(db), argc, argv);
 					*ptr = reinterpret_cast<types::virtual_table*>(
-						new Table(connection_base(db), argc, argv)
+						new_table<Table>(db, argc, argv, client_data)
 					);
 				} catch (const std::bad_alloc& err) {
 					return SQLITE_NOMEM;
+				} catch (...) {
+					return SQLITE_ERROR;
 				}
 				return SQLITE_OK;
 			};
+		}
+
+		template <class Table>
+		static inline void set_create(types::module&, std::true_type) {}
+
+		template <class Table, class Cursor>
+		static types::module
+		make_module() {
+			types::module m{};
+			m.iVersion = 2;
+			set_create<Table>(m, std::integral_constant<bool,Table::eponymous>());
 			m.xConnect = [] (
 				types::connection* db,
-				void*,
+				void* client_data,
 				int argc,
 				const char *const* argv,
 				types::virtual_table** ptr,
@@ -750,17 +889,23 @@ namespace sqlite {
 			) -> int {
 				try {
 					*ptr = reinterpret_cast<types::virtual_table*>(
-						new Table(connection_base(db), argc, argv)
+						new_table<Table>(db, argc, argv, client_data)
 					);
 				} catch (const std::bad_alloc& err) {
 					return SQLITE_NOMEM;
+				} catch (...) {
+					return SQLITE_ERROR;
 				}
 				return SQLITE_OK;
 			};
 			m.xBestIndex = [] (types::virtual_table* ptr, types::index_info* idx) -> int {
-				return reinterpret_cast<::sqlite::virtual_table*>(ptr)->best_index(
-					static_cast<virtual_table_index*>(idx)
-				);
+				try {
+					return reinterpret_cast<Table*>(ptr)->best_index(
+						static_cast<virtual_table_index*>(idx)
+					);
+				} catch (...) {
+					return current_error();
+				}
 			};
 			m.xOpen = [] (
 				types::virtual_table* ptr,
@@ -772,6 +917,8 @@ namespace sqlite {
 					);
 				} catch (const std::bad_alloc& err) {
 					return SQLITE_NOMEM;
+				} catch (...) {
+					return SQLITE_ERROR;
 				}
 				return SQLITE_OK;
 			};
@@ -779,7 +926,12 @@ namespace sqlite {
 				m.field = [] (types::virtual_table_cursor* ptr) -> int { \
 					return reinterpret_cast<Cursor*>(ptr)->method(); \
 				}
-			SQLITEX_CURSOR_FIELD(xClose, close);
+			m.xClose = [] (types::virtual_table_cursor* ptr) -> int {
+				auto* cursor = reinterpret_cast<Cursor*>(ptr);
+				int ret = cursor->close();
+				delete cursor;
+				return ret;
+			};
 			m.xFilter = [] (
 				types::virtual_table_cursor* ptr,
 				int idxNum,
@@ -787,9 +939,13 @@ namespace sqlite {
 				int argc,
 				types::value** argv
 			) -> int {
-				return reinterpret_cast<Cursor*>(ptr)->filter(
-					idxNum, idxStr, argc, reinterpret_cast<any_base*>(argv)
-				);
+				try {
+					return reinterpret_cast<Cursor*>(ptr)->filter(
+						idxNum, idxStr, argc, reinterpret_cast<any_base*>(argv)
+					);
+				} catch (...) {
+					return current_error();
+				}
 			};
 			SQLITEX_CURSOR_FIELD(xNext, next);
 			SQLITEX_CURSOR_FIELD(xEof, eof);
@@ -812,8 +968,18 @@ namespace sqlite {
 				m.field = [] (types::virtual_table* ptr) -> int { \
 					return reinterpret_cast<Table*>(ptr)->method(); \
 				}
-			SQLITEX_TABLE_FIELD(xDisconnect, disconnect);
-			SQLITEX_TABLE_FIELD(xDestroy, destroy);
+			m.xDisconnect = [] (types::virtual_table* ptr) -> int {
+				auto* table = reinterpret_cast<Table*>(ptr);
+				int ret = table->disconnect();
+				if (ret == SQLITE_OK) { delete table; }
+				return ret;
+			};
+			m.xDestroy = [] (types::virtual_table* ptr) -> int {
+				auto* table = reinterpret_cast<Table*>(ptr);
+				int ret = table->destroy();
+				if (ret == SQLITE_OK) { delete table; }
+				return ret;
+			};
 			SQLITEX_TABLE_FIELD(xBegin, begin);
 			SQLITEX_TABLE_FIELD(xSync, sync);
 			SQLITEX_TABLE_FIELD(xCommit, commit);
@@ -827,7 +993,7 @@ namespace sqlite {
 			m.xRelease = [] (types::virtual_table* ptr, int n) -> int {
 				return reinterpret_cast<Table*>(ptr)->release(n);
 			};
-			m.xRollback = [] (types::virtual_table* ptr, int n) -> int {
+			m.xRollbackTo = [] (types::virtual_table* ptr, int n) -> int {
 				return reinterpret_cast<Table*>(ptr)->rollback(n);
 			};
 			m.xUpdate = [] (
@@ -857,9 +1023,11 @@ namespace sqlite {
 				);
 			};
 			#undef SQLITEX_TABLE_FIELD
-			call(::sqlite3_create_module_v2(this->_ptr, module_name, &m, nullptr, nullptr));
+			return m;
 		}
 
+	public:
+
 		inline void
 		overload_function(const char* name, int nargs) {
 			call(::sqlite3_overload_function(this->_ptr, name, nargs));
@@ -905,6 +1073,116 @@ namespace sqlite {
 
 	inline void swap(connection_base& lhs, connection_base& rhs) noexcept { lhs.swap(rhs); }
 
+	/**
+	\brief Prepared BEGIN/COMMIT/SAVEPOINT/RELEASE statements of a connection.
+	\details
+	Statements are prepared on first use and are reused by all transactions
+	of the connection. Savepoints are named by their nesting level, hence
+	there is one cached statement per level.
+
+	SQLite has no hook for <tt>ROLLBACK TO</tt>, so savepoint hooks are
+	called instead for savepoints that are created, released and rolled
+	back by these statements (including savepoint and nested transaction
+	objects). Rollback is reported before the savepoint is released. Hooks
+	must not throw.
+	*/
+	class transaction_statements {
+
+	public:
+		using hook_type = std::function<void(savepoint_event,int)>;
+
+	private:
+		statement _begin[3];
+		statement _commit;
+		statement _rollback;
+		std::vector<statement> _savepoint;
+		std::vector<statement> _release;
+		std::vector<statement> _rollback_to;
+		std::vector<std::pair<const void*,hook_type>> _hooks;
+		int _depth = 0;
+
+	public:
+
+		transaction_statements() = default;
+		transaction_statements(const transaction_statements&) = delete;
+		transaction_statements& operator=(const transaction_statements&) = delete;
+
+		inline int depth() const noexcept { return this->_depth; }
+
+		void begin(connection_base db, transaction_type type);
+		void commit(connection_base db);
+		void rollback(connection_base db);
+		int savepoint(connection_base db);
+		void release(connection_base db, int level);
+		void rollback(connection_base db, int level);
+
+		/// Add hook identified by \p owner that is called with the event and savepoint level.
+		inline void
+		add_hook(const void* owner, hook_type cb) {
+			this->_hooks.emplace_back(owner, std::move(cb));
+		}
+
+		void remove_hook(const void* owner) noexcept;
+
+		/// Finalize all statements. Hooks are kept.
+		void close() noexcept;
+
+	private:
+
+		void notify(savepoint_event event, int level) noexcept;
+
+		statement& get(std::vector<statement>& v, connection_base db,
+					   const char* fmt, int level);
+
+	};
+
+	#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+	/**
+	\brief Connection that is passed to preupdate hook.
+	\details
+	Column values are valid only inside the hook. Old values are available
+	for updates and deletions, new values are available for updates and
+	insertions.
+	*/
+	class preupdate_database: public connection_base {
+
+	public:
+		using connection_base::connection_base;
+
+		inline int num_columns() noexcept { return ::sqlite3_preupdate_count(get()); }
+
+		/// Zero for direct changes, one for changes from top-level triggers etc.
+		inline int depth() noexcept { return ::sqlite3_preupdate_depth(get()); }
+
+		inline any_base
+		old_value(int column) {
+			types::value* value = nullptr;
+			call(::sqlite3_preupdate_old(get(), column, &value));
+			return any_base(value);
+		}
+
+		inline any_base
+		new_value(int column) {
+			types::value* value = nullptr;
+			call(::sqlite3_preupdate_new(get(), column, &value));
+			return any_base(value);
+		}
+
+		/// Old values of the first \p n columns.
+		inline void
+		old_values(int n, any_base* values) {
+			for (int i=0; i<n; ++i) { values[i] = old_value(i); }
+		}
+
+		/// New values of the first \p n columns.
+		inline void
+		new_values(int n, any_base* values) {
+			for (int i=0; i<n; ++i) { values[i] = new_value(i); }
+		}
+
+	};
+	#endif
+
 	class connection: public connection_base {
 
 	public:
@@ -915,6 +1193,14 @@ namespace sqlite {
 		using collation_generator_type =
 			std::function<void(connection_base,::sqlite::encoding,u8string)>;
 		using commit_hook_type = std::function<int(connection_base,const char*,int)>;
+		using update_hook_type = std::function<void(action,const char*,const char*,int64)>;
+		using rollback_hook_type = std::function<void()>;
+		using transaction_hook_type = std::function<int()>;
+		using statement_hook_type = std::function<void(statement_event,types::statement*)>;
+		#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+		using preupdate_hook_type =
+			std::function<void(preupdate_database&,action,const char*,const char*,int64,int64)>;
+		#endif
 
 	private:
 		authorizer_type _authorizer;
@@ -922,14 +1208,37 @@ namespace sqlite {
 		progress_type _progress;
 		collation_generator_type _collation_generator;
 		commit_hook_type _commit_hook;
+		trace _trace_mask = trace::all;
+		int _progress_instructions = 0;
+		/// Commit hooks returned zero and the commit is not finished yet.
+		bool _commit_pending = false;
+		std::unique_ptr<transaction_statements> _transactions;
+		std::vector<std::pair<const void*,update_hook_type>> _update_hooks;
+		std::vector<std::pair<const void*,rollback_hook_type>> _rollback_hooks;
+		std::vector<std::pair<const void*,transaction_hook_type>> _commit_hooks;
+		std::vector<std::pair<const void*,rollback_hook_type>> _commit_listeners;
+		std::vector<std::pair<const void*,statement_hook_type>> _statement_hooks;
+		#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+		std::vector<std::pair<const void*,preupdate_hook_type>> _preupdate_hooks;
+		#endif
 
 	public:
 		inline ~connection() noexcept { this->close(); }
 		connection() = default;
 		connection(const connection&) = delete;
 		connection& operator=(const connection&) = delete;
-		connection(connection&&) = default;
-		connection& operator=(connection&& rhs) = default;
+
+		/// Hooks are installed again to point to the new object.
+		inline connection(connection&& rhs) { this->move(rhs); }
+
+		inline connection&
+		operator=(connection&& rhs) {
+			if (this != &rhs) {
+				this->close();
+				this->move(rhs);
+			}
+			return *this;
+		}
 
 		inline explicit
 		connection(
@@ -947,22 +1256,31 @@ namespace sqlite {
 		) {
 			this->close();
 			call(::sqlite3_open_v2(filename, &this->_ptr, int(flags), vfs_name));
+			this->install_hooks();
 		}
 
 		inline void
 		open(const u8string& filename) {
 			this->close();
 			call(::sqlite3_open(filename.data(), &this->_ptr));
+			this->install_hooks();
 		}
 
 		inline void
 		open(const u16string& filename) {
 			this->close();
 			call(::sqlite3_open16(filename.data(), &this->_ptr));
+			this->install_hooks();
 		}
 
+		/**
+		Close the connection. Callbacks and hooks are kept and are installed
+		again when the connection is reopened.
+		*/
 		inline void
 		close() {
+			this->_commit_pending = false;
+			if (this->_transactions) { this->_transactions->close(); }
 			if (this->_ptr) {
 				call(::sqlite3_close(this->_ptr));
 				this->_ptr = nullptr;
@@ -971,12 +1289,22 @@ namespace sqlite {
 
 		inline void
 		close_async() {
+			this->_commit_pending = false;
+			if (this->_transactions) { this->_transactions->close(); }
 			if (this->_ptr) {
 				call(::sqlite3_close_v2(this->_ptr));
 				this->_ptr = nullptr;
 			}
 		}
 
+		inline transaction_statements&
+		transactions() {
+			if (!this->_transactions) {
+				this->_transactions.reset(new transaction_statements);
+			}
+			return *this->_transactions;
+		}
+
 		inline void
 		recover(const char* name="main") {
 			call(::sqlite3_snapshot_recover(this->_ptr, name));
@@ -991,6 +1319,20 @@ namespace sqlite {
 			));
 		}
 
+		/**
+		Insert all batches from Arrow stream into the table (see arrow.hh).
+		Rows are inserted with multi-row INSERT statements in transactions of
+		\p rows_per_transaction rows. Dictionary-encoded columns are inserted
+		as their values. The stream is not released.
+		\return the number of inserted rows
+		*/
+		int64 import_arrow(
+			const char* table,
+			ArrowArrayStream* stream,
+			bool create_table=false,
+			int64 rows_per_transaction=65536
+		);
+
 		inline ::sqlite::snapshot
 		snapshot(const char* schema) {
 			types::snapshot* ptr = nullptr;
@@ -1001,6 +1343,249 @@ namespace sqlite {
 		inline void
 		authorizer(authorizer_type cb) {
 			this->_authorizer = cb;
+			this->install_authorizer();
+		}
+
+		inline void
+		authorizer(std::nullptr_t) {
+			this->_authorizer = nullptr;
+			call(::sqlite3_set_authorizer(this->_ptr, nullptr, nullptr));
+		}
+
+		inline const authorizer_type& authorizer() const noexcept { return this->_authorizer; }
+
+		inline void
+		tracer(tracer_type cb, trace mask=trace::all) {
+			this->_tracer = cb;
+			this->_trace_mask = mask;
+			this->install_tracer();
+		}
+
+		inline void
+		progress(progress_type cb, int ninstructions) {
+			this->_progress = cb;
+			this->_progress_instructions = ninstructions;
+			this->install_progress();
+		}
+
+		inline void
+		collation_generator(collation_generator_type cb) {
+			this->_collation_generator = cb;
+			this->install_collation_generator();
+		}
+
+		inline void
+		collation_generator(std::nullptr_t) {
+			this->_collation_generator = nullptr;
+			call(::sqlite3_collation_needed(this->_ptr, nullptr, nullptr));
+		}
+
+		inline void
+		on_commit(commit_hook_type cb) {
+			this->_commit_hook = cb;
+			this->install_wal_hook();
+		}
+
+		/**
+		Add update hook identified by \p owner. Unlike connection_base::update_hook
+		any number of hooks can be added.
+		*/
+		inline void
+		add_update_hook(const void* owner, update_hook_type cb) {
+			this->_update_hooks.emplace_back(owner, std::move(cb));
+			if (this->_update_hooks.size() == 1) { this->install_update_hook(); }
+		}
+
+		inline void
+		remove_update_hook(const void* owner) {
+			remove_hook(this->_update_hooks, owner);
+			if (this->_ptr && this->_update_hooks.empty()) {
+				this->update_hook(nullptr, nullptr);
+			}
+		}
+
+		inline void
+		add_rollback_hook(const void* owner, rollback_hook_type cb) {
+			this->_rollback_hooks.emplace_back(owner, std::move(cb));
+			if (this->_rollback_hooks.size() == 1) { this->install_rollback_hook(); }
+		}
+
+		inline void
+		remove_rollback_hook(const void* owner) {
+			remove_hook(this->_rollback_hooks, owner);
+			this->uninstall_rollback_hook();
+		}
+
+		/**
+		Add hook identified by \p owner that is called before each commit.
+		Non-zero return value of any hook turns the commit into rollback.
+		*/
+		inline void
+		add_commit_hook(const void* owner, transaction_hook_type cb) {
+			this->_commit_hooks.emplace_back(owner, std::move(cb));
+			this->install_commit_hook();
+		}
+
+		inline void
+		remove_commit_hook(const void* owner) {
+			remove_hook(this->_commit_hooks, owner);
+			this->uninstall_commit_hook();
+		}
+
+		/**
+		Add listener identified by \p owner that is called after each commit
+		that all commit hooks accepted. The listener is called when the
+		statement that commits (\c COMMIT or a statement in autocommit mode)
+		ends without an open write transaction, so that a commit that fails
+		with \c SQLITE_BUSY is reported only when it is retried successfully,
+		and is not reported at all when the transaction is rolled back
+		instead. Listeners are called from the same \c sqlite3_trace_v2
+		callback as statement hooks and must not modify the connection.
+		*/
+		inline void
+		add_commit_listener(const void* owner, rollback_hook_type cb) {
+			this->_commit_listeners.emplace_back(owner, std::move(cb));
+			this->install_commit_hook();
+			this->install_rollback_hook();
+			this->install_tracer();
+		}
+
+		inline void
+		remove_commit_listener(const void* owner) {
+			remove_hook(this->_commit_listeners, owner);
+			this->uninstall_commit_hook();
+			this->uninstall_rollback_hook();
+			this->install_tracer();
+		}
+
+		/**
+		Add hook identified by \p owner that is called when a prepared
+		statement starts (the first step after reset) and when it ends (it is
+		done, fails, or is reset or finalized before that). Statements of
+		triggers are not reported. Statement hooks share \c sqlite3_trace_v2
+		with tracer() and must not modify the connection.
+		*/
+		inline void
+		add_statement_hook(const void* owner, statement_hook_type cb) {
+			this->_statement_hooks.emplace_back(owner, std::move(cb));
+			this->install_tracer();
+		}
+
+		inline void
+		remove_statement_hook(const void* owner) {
+			remove_hook(this->_statement_hooks, owner);
+			this->install_tracer();
+		}
+
+		/**
+		Add hook identified by \p owner that is called when the savepoint
+		of transaction_statements is created, released or rolled back.
+		*/
+		inline void
+		add_savepoint_hook(const void* owner, transaction_statements::hook_type cb) {
+			this->transactions().add_hook(owner, std::move(cb));
+		}
+
+		inline void
+		remove_savepoint_hook(const void* owner) noexcept {
+			if (this->_transactions) { this->_transactions->remove_hook(owner); }
+		}
+
+		#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+		/**
+		Set preupdate hook that is called before each row is inserted,
+		updated or deleted. \p Update is called as
+		<code>(*ptr)(preupdate_database&, action, const char* database,
+		const char* table, int64 old_rowid, int64 new_rowid)</code>.
+		*/
+		template <class Update>
+		inline void
+		on_update(Update* ptr) {
+			::sqlite3_preupdate_hook(
+				this->_ptr,
+				[] (
+					void* ptr,
+					types::connection* db,
+					int op,
+					char const* dbname,
+					char const* table,
+					int64 old_rowid,
+					int64 new_rowid
+				) {
+					preupdate_database pdb(db);
+					(*static_cast<Update*>(ptr))(pdb, action(op), dbname, table, old_rowid, new_rowid);
+				},
+				ptr
+			);
+		}
+
+		inline void
+		on_update(std::nullptr_t) {
+			if (this->_ptr) { ::sqlite3_preupdate_hook(this->_ptr, nullptr, nullptr); }
+		}
+
+		/**
+		Add preupdate hook identified by \p owner. Unlike on_update any
+		number of hooks can be added.
+		*/
+		inline void
+		add_preupdate_hook(const void* owner, preupdate_hook_type cb) {
+			this->_preupdate_hooks.emplace_back(owner, std::move(cb));
+			if (this->_preupdate_hooks.size() == 1) { this->install_preupdate_hook(); }
+		}
+
+		inline void
+		remove_preupdate_hook(const void* owner) {
+			remove_hook(this->_preupdate_hooks, owner);
+			if (this->_preupdate_hooks.empty()) { this->on_update(nullptr); }
+		}
+		#endif
+
+	private:
+
+		inline void
+		move(connection& rhs) {
+			connection_base::operator=(std::move(rhs));
+			this->_authorizer = std::move(rhs._authorizer);
+			this->_tracer = std::move(rhs._tracer);
+			this->_trace_mask = rhs._trace_mask;
+			this->_progress = std::move(rhs._progress);
+			this->_progress_instructions = rhs._progress_instructions;
+			this->_collation_generator = std::move(rhs._collation_generator);
+			this->_commit_hook = std::move(rhs._commit_hook);
+			this->_transactions = std::move(rhs._transactions);
+			this->_update_hooks = std::move(rhs._update_hooks);
+			this->_rollback_hooks = std::move(rhs._rollback_hooks);
+			this->_commit_hooks = std::move(rhs._commit_hooks);
+			this->_commit_listeners = std::move(rhs._commit_listeners);
+			this->_statement_hooks = std::move(rhs._statement_hooks);
+			this->_commit_pending = rhs._commit_pending;
+			#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+			this->_preupdate_hooks = std::move(rhs._preupdate_hooks);
+			#endif
+			this->install_hooks();
+		}
+
+		/// Point all callbacks and hooks of the open connection to this object.
+		inline void
+		install_hooks() {
+			if (!this->_ptr) { return; }
+			if (this->_authorizer) { this->install_authorizer(); }
+			this->install_tracer();
+			if (this->_progress) { this->install_progress(); }
+			if (this->_collation_generator) { this->install_collation_generator(); }
+			if (this->_commit_hook) { this->install_wal_hook(); }
+			if (!this->_update_hooks.empty()) { this->install_update_hook(); }
+			this->install_rollback_hook();
+			this->install_commit_hook();
+			#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+			if (!this->_preupdate_hooks.empty()) { this->install_preupdate_hook(); }
+			#endif
+		}
+
+		inline void
+		install_authorizer() {
+			if (!this->_ptr) { return; }
 			call(::sqlite3_set_authorizer(
 				this->_ptr,
 				[] (void* ptr, int a,
@@ -1013,14 +1598,24 @@ namespace sqlite {
 			));
 		}
 
+		/// The tracer, statement hooks and commit listeners share the callback.
 		inline void
-		tracer(tracer_type cb, trace mask=trace::all) {
-			this->_tracer = cb;
+		install_tracer() {
+			if (!this->_ptr) { return; }
+			unsigned mask = this->_tracer ? static_cast<unsigned>(this->_trace_mask) : 0;
+			if (!this->_statement_hooks.empty()) { mask |= SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE; }
+			if (!this->_commit_listeners.empty()) { mask |= SQLITE_TRACE_PROFILE; }
 			call(::sqlite3_trace_v2(
 				this->_ptr,
-				static_cast<unsigned>(mask),
+				mask,
 				[] (unsigned mask, void* ptr, void* a1, void* a2) -> int {
 					auto* db = static_cast<connection*>(ptr);
+					if (mask == SQLITE_TRACE_STMT || mask == SQLITE_TRACE_PROFILE) {
+						db->on_statement(mask, static_cast<types::statement*>(a1), a2);
+					}
+					if (!db->_tracer || !(static_cast<unsigned>(db->_trace_mask) & mask)) {
+						return 0;
+					}
 					return static_cast<int>(db->_tracer(trace(mask),a1,a2));
 				},
 				this
@@ -1028,11 +1623,44 @@ namespace sqlite {
 		}
 
 		inline void
-		progress(progress_type cb, int ninstructions) {
-			this->_progress = cb;
+		on_statement(unsigned mask, types::statement* s, const void* sql) {
+			if (mask == SQLITE_TRACE_STMT) {
+				// statements of triggers are reported as SQL comments
+				if (this->_statement_hooks.empty() ||
+					std::strncmp(static_cast<const char*>(sql), "--", 2) == 0) {
+					return;
+				}
+				auto hooks = this->_statement_hooks;
+				for (auto& h : hooks) { h.second(statement_event::begin, s); }
+				return;
+			}
+			if (!this->_statement_hooks.empty()) {
+				auto hooks = this->_statement_hooks;
+				for (auto& h : hooks) { h.second(statement_event::end, s); }
+			}
+			if (this->_commit_pending && !this->writing()) {
+				this->_commit_pending = false;
+				auto listeners = this->_commit_listeners;
+				for (auto& h : listeners) { h.second(); }
+			}
+		}
+
+		/// True if the connection has uncommitted changes.
+		inline bool
+		writing() noexcept {
+			#if defined(SQLITE_TXN_WRITE)
+			return ::sqlite3_txn_state(this->_ptr, nullptr) == SQLITE_TXN_WRITE;
+			#else
+			return !::sqlite3_get_autocommit(this->_ptr);
+			#endif
+		}
+
+		inline void
+		install_progress() {
+			if (!this->_ptr) { return; }
 			::sqlite3_progress_handler(
 				this->_ptr,
-				ninstructions,
+				this->_progress_instructions,
 				[] (void* ptr) -> int {
 					auto* db = static_cast<connection*>(ptr);
 					return db->_progress();
@@ -1042,8 +1670,8 @@ namespace sqlite {
 		}
 
 		inline void
-		collation_generator(collation_generator_type cb) {
-			this->_collation_generator = cb;
+		install_collation_generator() {
+			if (!this->_ptr) { return; }
 			call(::sqlite3_collation_needed(
 				this->_ptr, this,
 				[] (void* ptr, types::connection* db, int enc, const char* name) {
@@ -1057,13 +1685,8 @@ namespace sqlite {
 		}
 
 		inline void
-		collation_generator(std::nullptr_t) {
-			call(::sqlite3_collation_needed(this->_ptr, nullptr, nullptr));
-		}
-
-		inline void
-		on_commit(commit_hook_type cb) {
-			this->_commit_hook = cb;
+		install_wal_hook() {
+			if (!this->_ptr) { return; }
 			::sqlite3_wal_hook(
 				this->_ptr,
 				[] (void* ptr, types::connection*, const char* name, int npages) {
@@ -1074,59 +1697,99 @@ namespace sqlite {
 			);
 		}
 
-		#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
-		template <class Update>
+		// Hooks are called on a copy of the list, because they may add or remove hooks.
+
 		inline void
-		on_update(Update* ptr) {
-			call(::sqlite3_preupdate_hook(
-				get(),
-				[] (
-					void* ptr,
-					types::connection* db,
-					int op,
-					char const* dbname,
-					char const* table,
-					sqlite3_int64 iKey1,
-					sqlite3_int64 iKey2
-				) {
-					preupdate_database db2(db);
-					(*reinterpret_cast<Update*>(ptr))(
-						&db,
-						action(op),
-						dbname,
-						table,
-						rowid1,
-						rowid2
-					);
+		install_update_hook() {
+			if (!this->_ptr) { return; }
+			this->update_hook(
+				[] (void* ptr, int op, const char* db, const char* table, int64 rowid) {
+					auto hooks = static_cast<connection*>(ptr)->_update_hooks;
+					for (auto& h : hooks) { h.second(action(op), db, table, rowid); }
 				},
-				ptr
-			));
+				this
+			);
 		}
-		#endif
 
-	};
-
-	#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
-	class preupdate_database: public connection_base {
+		inline void
+		install_rollback_hook() {
+			if (!this->_ptr) { return; }
+			if (this->_rollback_hooks.empty() && this->_commit_listeners.empty()) { return; }
+			this->rollback_hook(
+				[] (void* ptr) {
+					auto* c = static_cast<connection*>(ptr);
+					c->_commit_pending = false;
+					auto hooks = c->_rollback_hooks;
+					for (auto& h : hooks) { h.second(); }
+				},
+				this
+			);
+		}
 
-	public:
-		using connection_base::connection_base;
+		inline void
+		uninstall_rollback_hook() {
+			if (!this->_ptr) { return; }
+			if (this->_rollback_hooks.empty() && this->_commit_listeners.empty()) {
+				this->rollback_hook(nullptr, nullptr);
+			}
+		}
 
-		inline int num_columns() noexcept { return ::sqlite3_preupdate_count(get()); }
-		inline int depth() noexcept { return ::sqlite3_preupdate_depth(get()); }
+		inline void
+		install_commit_hook() {
+			if (!this->_ptr) { return; }
+			if (this->_commit_hooks.empty() && this->_commit_listeners.empty()) { return; }
+			this->commit_hook(
+				[] (void* ptr) {
+					auto* c = static_cast<connection*>(ptr);
+					auto hooks = c->_commit_hooks;
+					int ret = 0;
+					for (auto& h : hooks) { ret |= h.second(); }
+					// listeners are called when the statement ends
+					if (ret == 0 && !c->_commit_listeners.empty()) { c->_commit_pending = true; }
+					return ret;
+				},
+				this
+			);
+		}
 
 		inline void
-		old_values(int n, any_base* values) {
-			call(::sqlite3_preupdate_old(get(), n, reinterpret_cast<types::value**>(values)));
+		uninstall_commit_hook() {
+			if (!this->_ptr) { return; }
+			if (this->_commit_hooks.empty() && this->_commit_listeners.empty()) {
+				this->commit_hook(nullptr, nullptr);
+			}
 		}
 
+		#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
 		inline void
-		new_values(int n, any_base* values) {
-			call(::sqlite3_preupdate_new(get(), n, reinterpret_cast<types::value**>(values)));
+		install_preupdate_hook() {
+			if (!this->_ptr) { return; }
+			::sqlite3_preupdate_hook(
+				this->_ptr,
+				[] (void* ptr, types::connection* db, int op, const char* dbname,
+					const char* table, int64 old_rowid, int64 new_rowid) {
+					auto hooks = static_cast<connection*>(ptr)->_preupdate_hooks;
+					preupdate_database pdb(db);
+					for (auto& h : hooks) {
+						h.second(pdb, action(op), dbname, table, old_rowid, new_rowid);
+					}
+				},
+				this
+			);
+		}
+		#endif
+
+		template <class Hooks>
+		inline static void
+		remove_hook(Hooks& hooks, const void* owner) {
+			auto first = hooks.begin();
+			while (first != hooks.end()) {
+				if (first->first == owner) { first = hooks.erase(first); }
+				else { ++first; }
+			}
 		}
 
 	};
-	#endif
 
 	inline connection_base
 	context::connection() {
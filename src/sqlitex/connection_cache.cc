@@ -0,0 +1,171 @@
+#include <vector>
+
+#include <sqlitex/connection_cache.hh>
+
+sqlite::connection_cache::connection_cache(
+	std::size_t capacity,
+	file_flag flags,
+	open_callback on_open
+):
+_capacity(capacity == 0 ? 1 : capacity),
+_flags(flags),
+_on_open(std::move(on_open)) {}
+
+sqlite::connection_cache::~connection_cache() noexcept {
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		this->_stopped = true;
+		this->_queue.clear();
+	}
+	this->_queued.notify_all();
+	if (this->_thread.joinable()) { this->_thread.join(); }
+	this->_index.clear();
+	this->_lru.clear();
+}
+
+auto
+sqlite::connection_cache::get(const std::string& path) -> handle {
+	std::vector<handle> evicted;
+	std::unique_lock<std::mutex> lock(this->_mutex);
+	while (true) {
+		auto result = this->_index.find(path);
+		if (result != this->_index.end()) {
+			++this->_counters.hits;
+			this->_lru.splice(this->_lru.begin(), this->_lru, result->second);
+			return result->second->second;
+		}
+		// wait for the background thread instead of opening the file twice
+		if (this->_pending.count(path) == 0) { break; }
+		this->_opened.wait(lock);
+	}
+	++this->_counters.misses;
+	this->_pending.insert(path);
+	lock.unlock();
+	handle h;
+	try {
+		h = this->open(path, false);
+	} catch (...) {
+		lock.lock();
+		this->_pending.erase(path);
+		++this->_counters.open_errors;
+		lock.unlock();
+		this->_opened.notify_all();
+		throw;
+	}
+	lock.lock();
+	this->_pending.erase(path);
+	this->insert(path, h, evicted);
+	lock.unlock();
+	this->_opened.notify_all();
+	return h;
+}
+
+void
+sqlite::connection_cache::prefetch(const std::string& path) {
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		if (this->_index.count(path) != 0 || this->_pending.count(path) != 0) { return; }
+		if (!this->_thread.joinable()) {
+			this->_thread = std::thread(&connection_cache::run, this);
+		}
+		this->_pending.insert(path);
+		this->_queue.emplace_back(path);
+	}
+	this->_queued.notify_one();
+}
+
+void
+sqlite::connection_cache::evict(const std::string& path) {
+	handle h;
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	auto result = this->_index.find(path);
+	if (result == this->_index.end()) { return; }
+	h = std::move(result->second->second);
+	this->_lru.erase(result->second);
+	this->_index.erase(result);
+	++this->_counters.evictions;
+}
+
+void
+sqlite::connection_cache::clear() {
+	lru_list tmp;
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	this->_counters.evictions += this->_lru.size();
+	this->_index.clear();
+	tmp.swap(this->_lru);
+}
+
+std::size_t
+sqlite::connection_cache::size() {
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	return this->_lru.size();
+}
+
+auto
+sqlite::connection_cache::get_counters() -> counters {
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	return this->_counters;
+}
+
+auto
+sqlite::connection_cache::open(const std::string& path, bool background) -> handle {
+	auto t0 = clock_type::now();
+	::sqlite::connection db(path.data(), this->_flags);
+	// parse the schema now rather than on the first query
+	db.prepare("SELECT * FROM sqlite_master LIMIT 0");
+	handle h = std::make_shared<cached_connection>(std::move(db));
+	if (this->_on_open) { this->_on_open(*h); }
+	auto dt = clock_type::now() - t0;
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	++this->_counters.opens;
+	if (background) { ++this->_counters.background_opens; }
+	this->_counters.total_open_time += dt;
+	if (dt > this->_counters.max_open_time) { this->_counters.max_open_time = dt; }
+	return h;
+}
+
+void
+sqlite::connection_cache::insert(
+	const std::string& path,
+	handle h,
+	std::vector<handle>& evicted
+) {
+	this->_lru.emplace_front(path, std::move(h));
+	this->_index[path] = this->_lru.begin();
+	while (this->_lru.size() > this->_capacity) {
+		auto& last = this->_lru.back();
+		evicted.emplace_back(std::move(last.second));
+		this->_index.erase(last.first);
+		this->_lru.pop_back();
+		++this->_counters.evictions;
+	}
+}
+
+void
+sqlite::connection_cache::run() {
+	std::unique_lock<std::mutex> lock(this->_mutex);
+	while (true) {
+		this->_queued.wait(lock, [this] () { return this->_stopped || !this->_queue.empty(); });
+		if (this->_stopped) { break; }
+		std::string path = std::move(this->_queue.front());
+		this->_queue.pop_front();
+		lock.unlock();
+		std::vector<handle> evicted;
+		handle h;
+		try {
+			h = this->open(path, true);
+		} catch (...) {
+		}
+		lock.lock();
+		this->_pending.erase(path);
+		if (h) { this->insert(path, std::move(h), evicted); }
+		else { ++this->_counters.open_errors; }
+		lock.unlock();
+		this->_opened.notify_all();
+		evicted.clear();
+		lock.lock();
+	}
+	this->_pending.clear();
+	lock.unlock();
+	this->_opened.notify_all();
+}
@@ -0,0 +1,175 @@
+#ifndef SQLITEX_CONNECTION_CACHE_HH
+#define SQLITEX_CONNECTION_CACHE_HH
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Open connection together with its prepared statements.
+	\details
+	The connection is closed with connection::close_async when the object is
+	destroyed.
+	*/
+	class cached_connection {
+
+	private:
+		::sqlite::connection _db;
+		std::unordered_map<std::string,statement> _statements;
+
+	public:
+
+		inline explicit cached_connection(::sqlite::connection&& db): _db(std::move(db)) {}
+
+		inline ~cached_connection() noexcept {
+			this->_statements.clear();
+			try { this->_db.close_async(); } catch (...) {}
+		}
+
+		cached_connection(const cached_connection&) = delete;
+		cached_connection& operator=(const cached_connection&) = delete;
+
+		inline ::sqlite::connection& connection() noexcept { return this->_db; }
+		inline const ::sqlite::connection& connection() const noexcept { return this->_db; }
+
+		/// Returns cached statement that was reset and has its bindings cleared.
+		inline statement&
+		prepare(const std::string& sql) {
+			auto result = this->_statements.find(sql);
+			if (result == this->_statements.end()) {
+				#if defined(SQLITE_PREPARE_PERSISTENT)
+				auto s = this->_db.prepare(sql, prepare_f::persistent);
+				#else
+				auto s = this->_db.prepare(sql);
+				#endif
+				result = this->_statements.emplace(sql, std::move(s)).first;
+			} else {
+				result->second.reset();
+				result->second.clear();
+			}
+			return result->second;
+		}
+
+		inline std::size_t num_statements() const noexcept { return this->_statements.size(); }
+
+	};
+
+	/**
+	\brief LRU cache of connections to many database files.
+	\details
+	At most \c capacity connections are kept open, the least recently used
+	one is closed when a new one is opened. Connections that are still in
+	use by the caller are closed when the last handle is released.
+	Connections are opened either on demand by get() or in the background by
+	prefetch(). Newly opened connection reads database schema (so that the
+	first query does not have to) and then calls user-supplied callback.
+	All methods are thread-safe, but each connection should be used by one
+	thread at a time.
+	\code{.cpp}
+	connection_cache cache(1000);
+	cache.prefetch("tenant-2.db"); // predictor thinks it will be used soon
+	auto c = cache.get("tenant-1.db");
+	statement& s = c->prepare("SELECT * FROM t WHERE id=?");
+	\endcode
+	*/
+	class connection_cache {
+
+	public:
+		using handle = std::shared_ptr<cached_connection>;
+		using clock_type = std::chrono::steady_clock;
+		using duration = clock_type::duration;
+		using open_callback = std::function<void(cached_connection&)>;
+
+		struct counters {
+			uint64 hits = 0;
+			uint64 misses = 0;
+			uint64 opens = 0;
+			uint64 background_opens = 0;
+			uint64 open_errors = 0;
+			uint64 evictions = 0;
+			duration total_open_time{};
+			duration max_open_time{};
+
+			inline duration
+			average_open_time() const noexcept {
+				return this->opens == 0 ? duration{} : duration(total_open_time.count()/opens);
+			}
+
+			inline double
+			hit_ratio() const noexcept {
+				auto total = this->hits + this->misses;
+				return total == 0 ? 0.0 : double(this->hits)/double(total);
+			}
+		};
+
+	private:
+		using lru_list = std::list<std::pair<std::string,handle>>;
+		using lru_iterator = lru_list::iterator;
+
+	private:
+		std::size_t _capacity;
+		file_flag _flags;
+		open_callback _on_open;
+		lru_list _lru;
+		std::unordered_map<std::string,lru_iterator> _index;
+		std::unordered_set<std::string> _pending;
+		std::deque<std::string> _queue;
+		std::mutex _mutex;
+		std::condition_variable _opened;
+		std::condition_variable _queued;
+		std::thread _thread;
+		counters _counters;
+		bool _stopped = false;
+
+	public:
+
+		explicit
+		connection_cache(
+			std::size_t capacity,
+			file_flag flags=file_flag::read_write | file_flag::create,
+			open_callback on_open=nullptr
+		);
+
+		~connection_cache() noexcept;
+
+		connection_cache(const connection_cache&) = delete;
+		connection_cache& operator=(const connection_cache&) = delete;
+
+		/// Returns cached connection or opens a new one.
+		handle get(const std::string& path);
+
+		/// Open connection in the background thread unless it is already open.
+		void prefetch(const std::string& path);
+
+		/// Close connection if it is not in use.
+		void evict(const std::string& path);
+
+		void clear();
+
+		std::size_t size();
+		inline std::size_t capacity() const noexcept { return this->_capacity; }
+		counters get_counters();
+
+	private:
+		handle open(const std::string& path, bool background);
+		void insert(const std::string& path, handle h, std::vector<handle>& evicted);
+		void run();
+
+	};
+
+}
+
+#endif // vim:filetype=cpp
@@ -75,6 +75,17 @@ namespace sqlite {
 			);
 		}
 
+		inline void
+		result(u8string_view value, destructor destr=pass_by_copy) {
+			::sqlite3_result_text64(
+				this->_ptr,
+				value.data(),
+				value.size(),
+				destr,
+				downcast(encoding::utf8)
+			);
+		}
+
 		template <class Alloc>
 		inline void
 		result(const basic_u16string<Alloc>& value,
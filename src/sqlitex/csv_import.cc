@@ -0,0 +1,557 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <sqlitex/csv_import.hh>
+#include <sqlitex/transaction.hh>
+
+namespace {
+
+	using sqlite::csv_type;
+	using sqlite::data_type;
+	using sqlite::int64;
+	using sqlite::uint64;
+	using clock_type = sqlite::csv_import::clock_type;
+
+	class mapped_file {
+
+	private:
+		int _fd = -1;
+		void* _data = nullptr;
+		std::size_t _size = 0;
+
+	public:
+
+		inline explicit
+		mapped_file(const char* path) {
+			this->_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (this->_fd == -1) { throw_errno(); }
+			struct ::stat st;
+			if (::fstat(this->_fd, &st) == -1) { throw_errno(); }
+			this->_size = st.st_size;
+			if (this->_size == 0) { return; }
+			this->_data = ::mmap(nullptr, this->_size, PROT_READ, MAP_PRIVATE, this->_fd, 0);
+			if (this->_data == MAP_FAILED) { this->_data = nullptr; throw_errno(); }
+			::madvise(this->_data, this->_size, MADV_SEQUENTIAL);
+		}
+
+		inline ~mapped_file() noexcept {
+			if (this->_data) { ::munmap(this->_data, this->_size); }
+			if (this->_fd != -1) { ::close(this->_fd); }
+		}
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		inline const char* begin() const noexcept { return static_cast<const char*>(this->_data); }
+		inline const char* end() const noexcept { return this->begin() + this->_size; }
+		inline std::size_t size() const noexcept { return this->_size; }
+
+	private:
+		[[noreturn]] inline void
+		throw_errno() {
+			int ret = errno;
+			if (this->_fd != -1) { ::close(this->_fd); }
+			throw std::system_error(ret, std::system_category());
+		}
+
+	};
+
+	#if defined(__SSE2__)
+	inline __m128i
+	load16(const char* p) noexcept {
+		__m128i x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+	#endif
+
+	/// Find delimiter or newline.
+	inline const char*
+	find_field_end(const char* first, const char* last, char delimiter) noexcept {
+		#if defined(__SSE2__)
+		const auto d = _mm_set1_epi8(delimiter);
+		const auto nl = _mm_set1_epi8('\n');
+		for (; last-first >= 16; first += 16) {
+			auto x = load16(first);
+			auto mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, d), _mm_cmpeq_epi8(x, nl)));
+			if (mask != 0) { return first + __builtin_ctz(mask); }
+		}
+		#endif
+		for (; first != last; ++first) {
+			if (*first == delimiter || *first == '\n') { return first; }
+		}
+		return last;
+	}
+
+	inline std::size_t
+	count_char(const char* first, const char* last, char ch) noexcept {
+		std::size_t n = 0;
+		#if defined(__SSE2__)
+		const auto c = _mm_set1_epi8(ch);
+		for (; last-first >= 16; first += 16) {
+			auto x = load16(first);
+			n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(x, c)));
+		}
+		#endif
+		for (; first != last; ++first) { n += (*first == ch); }
+		return n;
+	}
+
+	inline bool
+	parse_integer(const char* first, const char* last, int64& result) noexcept {
+		bool negative = false;
+		if (first != last && (*first == '-' || *first == '+')) { negative = *first++ == '-'; }
+		if (first == last || last-first > 19) { return false; }
+		uint64 x = 0;
+		for (; first != last; ++first) {
+			unsigned digit = static_cast<unsigned char>(*first) - '0';
+			if (digit > 9) { return false; }
+			x = x*10 + digit;
+		}
+		const uint64 max = uint64(INT64_MAX) + negative;
+		if (x > max) { return false; }
+		result = negative ? int64(0-x) : int64(x);
+		return true;
+	}
+
+	inline bool
+	parse_real(const char* first, const char* last, double& result) noexcept {
+		char buf[64];
+		const auto n = last-first;
+		if (n == 0 || n >= int64(sizeof(buf))) { return false; }
+		bool digits = false;
+		for (auto p=first; p!=last; ++p) {
+			const char ch = *p;
+			if (ch >= '0' && ch <= '9') { digits = true; continue; }
+			if (ch != '.' && ch != 'e' && ch != 'E' && ch != '+' && ch != '-') { return false; }
+		}
+		if (!digits) { return false; }
+		std::memcpy(buf, first, n);
+		buf[n] = 0;
+		char* end = nullptr;
+		result = std::strtod(buf, &end);
+		return end == buf+n;
+	}
+
+	struct cell {
+		data_type type;
+		/// Text that is not owned by the batch or nullptr.
+		const char* text;
+		std::size_t size;
+		union {
+			int64 integer;
+			double real;
+			/// Offset of unescaped text in batch buffer.
+			std::size_t offset;
+		};
+	};
+
+	struct batch {
+		std::vector<cell> cells;
+		std::string buffer;
+		int64 rows = 0;
+
+		inline const char*
+		text(const cell& c) const noexcept {
+			return c.text ? c.text : this->buffer.data() + c.offset;
+		}
+	};
+
+	class parser {
+
+	private:
+		const sqlite::csv_import::options& _options;
+		std::size_t _ncolumns;
+		bool _text;
+
+	public:
+
+		/// \param[in] text do not convert fields to numbers
+		inline
+		parser(const sqlite::csv_import::options& opts, std::size_t ncolumns, bool text=false):
+		_options(opts), _ncolumns(ncolumns), _text(text) {}
+
+		inline const char*
+		skip_blank_lines(const char* p, const char* last) const noexcept {
+			while (p != last && (*p == '\n' || *p == '\r')) { ++p; }
+			return p;
+		}
+
+		/**
+		Parse one record into the batch, at most \c ncolumns fields are
+		appended.
+		\return the number of fields in the record
+		*/
+		std::size_t
+		record(const char*& p, const char* last, batch& b) const {
+			const char quote = this->_options.quote;
+			const char delimiter = this->_options.delimiter;
+			std::size_t col = 0;
+			while (true) {
+				const char* first;
+				const char* field_last;
+				bool quoted = false, escaped = false;
+				if (p != last && *p == quote) {
+					quoted = true;
+					first = ++p;
+					while (true) {
+						auto q = static_cast<const char*>(std::memchr(p, quote, last-p));
+						if (!q) { throw std::invalid_argument("unterminated quote"); }
+						if (q+1 != last && q[1] == quote) { escaped = true; p = q+2; continue; }
+						field_last = q;
+						p = q+1;
+						break;
+					}
+					p = find_field_end(p, last, delimiter);
+				} else {
+					first = p;
+					p = find_field_end(p, last, delimiter);
+					field_last = p;
+					if ((p == last || *p == '\n') && field_last != first && field_last[-1] == '\r') {
+						--field_last;
+					}
+				}
+				if (col < this->_ncolumns) {
+					this->field(first, field_last, quoted, escaped, column_type(col), b);
+				}
+				++col;
+				if (p == last) { break; }
+				if (*p++ == '\n') { break; }
+			}
+			return col;
+		}
+
+		inline void
+		pad(std::size_t nfields, batch& b) const {
+			cell c{};
+			c.type = data_type::null;
+			for (; nfields < this->_ncolumns; ++nfields) { b.cells.emplace_back(c); }
+		}
+
+		void
+		chunk(const char* p, const char* last, batch& b) const {
+			while (true) {
+				p = this->skip_blank_lines(p, last);
+				if (p == last) { break; }
+				this->pad(this->record(p, last, b), b);
+				++b.rows;
+			}
+		}
+
+	private:
+
+		inline csv_type
+		column_type(std::size_t i) const noexcept {
+			const auto& types = this->_options.types;
+			if (this->_text) { return csv_type::text; }
+			return i < types.size() ? types[i] : csv_type::automatic;
+		}
+
+		void
+		field(
+			const char* first,
+			const char* last,
+			bool quoted,
+			bool escaped,
+			csv_type type,
+			batch& b
+		) const {
+			cell c{};
+			if (!quoted && first == last && this->_options.empty_as_null) {
+				c.type = data_type::null;
+				b.cells.emplace_back(c);
+				return;
+			}
+			if (!escaped) {
+				switch (type) {
+					case csv_type::automatic:
+					case csv_type::integer:
+						if (parse_integer(first, last, c.integer)) {
+							c.type = data_type::integer;
+							b.cells.emplace_back(c);
+							return;
+						}
+						// fall through
+					case csv_type::real:
+						if (parse_real(first, last, c.real)) {
+							c.type = data_type::floating_point;
+							b.cells.emplace_back(c);
+							return;
+						}
+						break;
+					case csv_type::text:
+						break;
+				}
+			}
+			c.type = data_type::text;
+			if (escaped) {
+				const char quote = this->_options.quote;
+				c.offset = b.buffer.size();
+				for (; first != last; ++first) {
+					b.buffer += *first;
+					if (*first == quote) { ++first; }
+				}
+				c.size = b.buffer.size() - c.offset;
+			} else {
+				c.text = first;
+				c.size = last-first;
+			}
+			b.cells.emplace_back(c);
+		}
+
+	};
+
+	const char*
+	declared_type(csv_type type) noexcept {
+		switch (type) {
+			case csv_type::integer: return " INTEGER";
+			case csv_type::real: return " REAL";
+			case csv_type::text: return " TEXT";
+			default: return "";
+		}
+	}
+
+	/// Joins parser threads on any exit from import.
+	struct thread_group {
+		std::vector<std::thread> threads;
+		std::mutex mtx;
+		std::condition_variable produced;
+		std::condition_variable consumed;
+		bool stopped = false;
+
+		inline ~thread_group() noexcept {
+			{
+				std::lock_guard<std::mutex> lock(this->mtx);
+				this->stopped = true;
+			}
+			this->consumed.notify_all();
+			for (auto& t : this->threads) { if (t.joinable()) { t.join(); } }
+		}
+	};
+
+}
+
+auto
+sqlite::csv_import::import(const char* path, const char* table) -> int64 {
+	const auto t0 = clock_type::now();
+	this->_counters = counters{};
+	const auto& opts = this->_options;
+	mapped_file file(path);
+	const char* data = file.begin();
+	const char* last = file.end();
+	this->_counters.bytes = file.size();
+	if (file.size() == 0) { return 0; }
+	// column names
+	std::vector<std::string> names;
+	{
+		parser p(opts, std::size_t(-1), true);
+		batch b;
+		const char* first = p.skip_blank_lines(data, last);
+		if (first == last) { return 0; }
+		const char* ptr = first;
+		p.record(ptr, last, b);
+		for (std::size_t i=0; i<b.cells.size(); ++i) {
+			const auto& c = b.cells[i];
+			if (opts.header && c.size != 0) {
+				names.emplace_back(b.text(c), c.size);
+			} else {
+				names.emplace_back(format("c%d", int(i+1)).get());
+			}
+		}
+		data = opts.header ? ptr : first;
+	}
+	const auto ncolumns = names.size();
+	std::string columns;
+	std::string create = format("CREATE TABLE IF NOT EXISTS \"%w\" (", table).get();
+	for (std::size_t i=0; i<ncolumns; ++i) {
+		if (i != 0) { columns += ','; create += ','; }
+		columns += format("\"%w\"", names[i].data()).get();
+		create += format("\"%w\"%s", names[i].data(),
+			declared_type(i < opts.types.size() ? opts.types[i] : csv_type::automatic)).get();
+	}
+	create += ')';
+	if (opts.create_table) { this->_db.execute(create); }
+	// split the file at record boundaries using quote parity
+	const auto t1 = clock_type::now();
+	unsigned nthreads = opts.num_threads;
+	if (nthreads == 0) { nthreads = std::max(1u, std::thread::hardware_concurrency()); }
+	const std::size_t size = last-data;
+	const std::size_t chunk_size = std::max(std::size_t(1), opts.chunk_size);
+	const std::size_t nchunks = std::max(std::size_t(1), (size + chunk_size - 1) / chunk_size);
+	std::vector<const char*> chunks(nchunks+1);
+	for (std::size_t i=0; i<nchunks; ++i) { chunks[i] = data + i*(size/nchunks); }
+	chunks[nchunks] = last;
+	std::vector<std::size_t> quotes(nchunks);
+	{
+		std::vector<std::future<void>> futures;
+		for (unsigned t=0; t<nthreads; ++t) {
+			futures.emplace_back(std::async(std::launch::async, [&,t] () {
+				for (std::size_t i=t; i<nchunks; i+=nthreads) {
+					quotes[i] = count_char(chunks[i], chunks[i+1], opts.quote);
+				}
+			}));
+		}
+		for (auto& f : futures) { f.get(); }
+	}
+	std::size_t nquotes = quotes[0];
+	for (std::size_t i=1; i<nchunks; ++i) {
+		bool inside = nquotes % 2 != 0;
+		const char* p = chunks[i];
+		while (p != last) {
+			p = find_field_end(p, last, opts.quote);
+			if (p == last) { break; }
+			if (*p++ == '\n' && !inside) { break; }
+			if (p[-1] == opts.quote) { inside = !inside; }
+		}
+		nquotes += quotes[i];
+		chunks[i] = std::max(p, chunks[i-1]);
+	}
+	this->_counters.split_time = clock_type::now() - t1;
+	this->_counters.chunks = nchunks;
+	// parse chunks in parallel
+	parser chunk_parser(opts, ncolumns);
+	std::vector<std::unique_ptr<batch>> batches(nchunks);
+	std::size_t next = 0, written = 0;
+	const std::size_t max_inflight = 2*nthreads;
+	std::exception_ptr error;
+	duration parse_time{};
+	thread_group group;
+	for (unsigned t=0; t<nthreads; ++t) {
+		group.threads.emplace_back([&] () {
+			while (true) {
+				std::size_t i = 0;
+				{
+					std::unique_lock<std::mutex> lock(group.mtx);
+					group.consumed.wait(lock, [&] () {
+						return group.stopped || next == nchunks || next < written + max_inflight;
+					});
+					if (group.stopped || next == nchunks) { return; }
+					i = next++;
+				}
+				try {
+					auto t2 = clock_type::now();
+					std::unique_ptr<batch> b(new batch);
+					b->cells.reserve((chunks[i+1]-chunks[i])/8);
+					chunk_parser.chunk(chunks[i], chunks[i+1], *b);
+					auto dt = clock_type::now() - t2;
+					std::lock_guard<std::mutex> lock(group.mtx);
+					batches[i] = std::move(b);
+					parse_time += dt;
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(group.mtx);
+					if (!error) { error = std::current_exception(); }
+					group.stopped = true;
+				}
+				group.produced.notify_all();
+			}
+		});
+	}
+	// insert batches in file order
+	const std::size_t max_rows = std::max(std::size_t(1), std::min(
+		std::size_t(this->_db.limit(::sqlite::limit::variable_number))/ncolumns,
+		std::size_t(500)
+	));
+	auto make_insert = [&] (std::size_t nrows) {
+		std::string sql = format("INSERT INTO \"%w\" (", table).get();
+		sql += columns;
+		sql += ") VALUES ";
+		std::string tuple = "(";
+		for (std::size_t i=0; i<ncolumns; ++i) { tuple += i == 0 ? "?" : ",?"; }
+		tuple += ')';
+		for (std::size_t i=0; i<nrows; ++i) {
+			if (i != 0) { sql += ','; }
+			sql += tuple;
+		}
+		return this->_db.prepare(sql);
+	};
+	statement full = make_insert(max_rows);
+	statement tail;
+	std::size_t tail_rows = 0;
+	std::unique_ptr<immediate_transaction> tr;
+	int64 total = 0, ntransaction = 0;
+	for (std::size_t i=0; i<nchunks; ++i) {
+		std::unique_ptr<batch> b;
+		{
+			auto t2 = clock_type::now();
+			std::unique_lock<std::mutex> lock(group.mtx);
+			group.produced.wait(lock, [&] () { return batches[i] || error; });
+			if (error) { std::rethrow_exception(error); }
+			b = std::move(batches[i]);
+			++written;
+			this->_counters.wait_time += clock_type::now() - t2;
+		}
+		group.consumed.notify_all();
+		auto t2 = clock_type::now();
+		const cell* c = b->cells.data();
+		for (int64 row=0; row<b->rows; ) {
+			if (!tr) { tr.reset(new immediate_transaction(this->_db)); }
+			const auto nrows = std::size_t(std::min<int64>(b->rows - row, max_rows));
+			statement* s = &full;
+			if (nrows != max_rows) {
+				if (tail_rows != nrows) {
+					tail = make_insert(nrows);
+					tail_rows = nrows;
+				}
+				s = &tail;
+			}
+			auto* ptr = s->get();
+			const int nparams = int(nrows*ncolumns);
+			for (int j=1; j<=nparams; ++j, ++c) {
+				switch (c->type) {
+					case data_type::integer: call(::sqlite3_bind_int64(ptr, j, c->integer)); break;
+					case data_type::floating_point: call(::sqlite3_bind_double(ptr, j, c->real)); break;
+					case data_type::text:
+						call(::sqlite3_bind_text64(ptr, j, b->text(*c), c->size,
+							pass_by_reference, SQLITE_UTF8));
+						break;
+					default: call(::sqlite3_bind_null(ptr, j)); break;
+				}
+			}
+			s->step();
+			s->reset();
+			row += nrows;
+			ntransaction += nrows;
+			if (ntransaction >= opts.rows_per_transaction) {
+				tr->commit();
+				tr.reset();
+				ntransaction = 0;
+			}
+		}
+		// text is bound by reference
+		full.clear();
+		if (tail.is_open()) { tail.clear(); }
+		total += b->rows;
+		this->_counters.insert_time += clock_type::now() - t2;
+	}
+	if (tr) {
+		auto t2 = clock_type::now();
+		tr->commit();
+		this->_counters.insert_time += clock_type::now() - t2;
+	}
+	{
+		std::lock_guard<std::mutex> lock(group.mtx);
+		this->_counters.parse_time = parse_time;
+	}
+	this->_counters.rows = total;
+	this->_counters.total_time = clock_type::now() - t0;
+	return total;
+}
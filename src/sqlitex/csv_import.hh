@@ -0,0 +1,137 @@
+#ifndef SQLITEX_CSV_IMPORT_HH
+#define SQLITEX_CSV_IMPORT_HH
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	enum class csv_type {
+		/// Integer, real or text depending on the value.
+		automatic,
+		integer,
+		real,
+		text,
+	};
+
+	/**
+	\brief Parallel import of CSV files into a table.
+	\details
+	The file is memory-mapped and split into chunks at record boundaries.
+	Chunks are parsed on worker threads into batches of typed values, and
+	batches are inserted in file order by the calling thread with multi-row
+	INSERT statements inside chunked transactions. Delimiters and quotes
+	are searched with SSE2 when it is available.
+
+	Input should follow RFC 4180: fields that contain delimiters, quotes or
+	newlines are enclosed in quotes, and quotes are escaped by doubling
+	them. Records with fewer fields are padded with NULLs, extra fields are
+	ignored.
+	\code{.cpp}
+	csv_import::options opts;
+	opts.create_table = true;
+	csv_import csv(db, opts);
+	csv.import("dump.csv", "t");
+	auto c = csv.get_counters();
+	std::clog << c.parse_throughput() << " MB/s" << std::endl;
+	\endcode
+	*/
+	class csv_import {
+
+	public:
+		using clock_type = std::chrono::steady_clock;
+		using duration = clock_type::duration;
+
+		struct options {
+			char delimiter = ',';
+			char quote = '"';
+			/// The first record contains column names.
+			bool header = true;
+			/// Unquoted empty fields are inserted as NULLs instead of empty strings.
+			bool empty_as_null = true;
+			/// Create table with columns from the header if it does not exist.
+			bool create_table = false;
+			/// Types of the columns, missing columns are csv_type::automatic.
+			std::vector<csv_type> types;
+			/// The number of parser threads, zero means hardware concurrency.
+			unsigned num_threads = 0;
+			/// The size of the chunk that is parsed by one thread.
+			std::size_t chunk_size = std::size_t(1) << 23;
+			int64 rows_per_transaction = 100000;
+		};
+
+		struct counters {
+			uint64 bytes = 0;
+			uint64 rows = 0;
+			uint64 chunks = 0;
+			/// Time spent finding record boundaries.
+			duration split_time{};
+			/// Time spent parsing chunks summed over all threads.
+			duration parse_time{};
+			/// Time spent inserting rows.
+			duration insert_time{};
+			/// Time spent waiting for parsed chunks.
+			duration wait_time{};
+			duration total_time{};
+
+			/// Parser throughput in MB/s per thread.
+			inline double
+			parse_throughput() const noexcept {
+				return mb_per_second(this->bytes, this->parse_time);
+			}
+
+			inline double
+			insert_rows_per_second() const noexcept {
+				return per_second(this->rows, this->insert_time);
+			}
+
+			/// End-to-end throughput in MB/s.
+			inline double
+			throughput() const noexcept {
+				return mb_per_second(this->bytes, this->total_time);
+			}
+
+		private:
+			static inline double
+			per_second(uint64 n, duration d) noexcept {
+				using seconds = std::chrono::duration<double>;
+				auto s = std::chrono::duration_cast<seconds>(d).count();
+				return s == 0 ? 0.0 : double(n)/s;
+			}
+
+			static inline double
+			mb_per_second(uint64 n, duration d) noexcept {
+				return per_second(n, d) / double(1<<20);
+			}
+		};
+
+	private:
+		connection& _db;
+		options _options;
+		counters _counters;
+
+	public:
+
+		inline explicit csv_import(connection& db): _db(db) {}
+
+		inline
+		csv_import(connection& db, const options& opts):
+		_db(db), _options(opts) {}
+
+		/**
+		Import file into the table.
+		\return the number of inserted rows
+		*/
+		int64 import(const char* path, const char* table);
+
+		inline const counters& get_counters() const noexcept { return this->_counters; }
+		inline const options& get_options() const noexcept { return this->_options; }
+
+	};
+
+}
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,260 @@
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+
+#include <sqlitex/federated_table.hh>
+
+namespace {
+
+	std::string
+	unquote(std::string s) {
+		if (s.size() >= 2 && (s.front() == '\'' || s.front() == '"') && s.back() == s.front()) {
+			s = s.substr(1, s.size()-2);
+		}
+		return s;
+	}
+
+}
+
+sqlite::federated_table::federated_table(
+	connection_base db,
+	int argc,
+	const char* const* argv,
+	void* remote
+): _remote(static_cast<connection*>(remote)) {
+	if (argc < 4) { throw std::invalid_argument("table name is not specified"); }
+	this->_table = unquote(argv[3]);
+	if (argc >= 5) { this->_schema = unquote(argv[4]); }
+	const auto& schema = this->_schema;
+	const auto& table = this->_table;
+	std::string sql = "CREATE TABLE x(";
+	statement s = this->_remote->prepare(
+		format("PRAGMA \"%w\".table_xinfo(%Q)", schema.data(), table.data()).get());
+	std::string name, type;
+	while (s.step() == errc::row) {
+		int hidden = 0;
+		s.column(6, hidden);
+		// hidden columns of virtual tables are arguments, not data
+		if (hidden == 1) { continue; }
+		s.column(1, name);
+		s.column(2, type);
+		const char* collation = nullptr;
+		if (::sqlite3_table_column_metadata(this->_remote->get(), schema.data(), table.data(),
+			name.data(), nullptr, &collation, nullptr, nullptr, nullptr) != SQLITE_OK ||
+			!collation) {
+			collation = "BINARY";
+		}
+		if (!this->_columns.empty()) { sql += ','; }
+		sql += format("\"%w\" %s", name.data(), type.data()).get();
+		if (::sqlite3_stricmp(collation, "BINARY") != 0) {
+			sql += format(" COLLATE \"%w\"", collation).get();
+		}
+		this->_columns.emplace_back(column{name, collation});
+	}
+	if (this->_columns.empty()) {
+		throw std::invalid_argument(format("no such table: %s.%s", schema.data(), table.data()).get());
+	}
+	sql += ')';
+	try {
+		this->_remote->prepare(
+			format("SELECT rowid FROM \"%w\".\"%w\"", schema.data(), table.data()).get());
+	} catch (const std::system_error&) {
+		// WITHOUT ROWID table
+		this->_has_rowid = false;
+	}
+	db.declare_virtual_table(sql.data());
+}
+
+int
+sqlite::federated_table::best_index(virtual_table_index* info) {
+	const int ncolumns = int(this->_columns.size());
+	auto column_name = [this] (int i) -> std::string {
+		return i < 0 ? "rowid" : format("\"%w\"", this->_columns[i].name.data()).get();
+	};
+	std::string where;
+	int argv_index = 0;
+	double rows = 1e6;
+	bool unique = false;
+	// LIMIT can be used only if the remote side evaluates all constraints
+	bool all_used = true;
+	for (int i=0; i<info->num_constraints(); ++i) {
+		const auto column = info->column(i);
+		const char* op = nullptr;
+		bool unary = false;
+		switch (info->op(i)) {
+			case constraint_op::eq: op = "="; break;
+			case constraint_op::gt: op = ">"; break;
+			case constraint_op::ge: op = ">="; break;
+			case constraint_op::lt: op = "<"; break;
+			case constraint_op::le: op = "<="; break;
+			case constraint_op::ne: op = "<>"; break;
+			case constraint_op::is: op = "IS"; break;
+			case constraint_op::is_not: op = "IS NOT"; break;
+			case constraint_op::is_null: op = "IS NULL"; unary = true; break;
+			case constraint_op::is_not_null: op = "IS NOT NULL"; unary = true; break;
+			#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+			case constraint_op::limit: case constraint_op::offset: continue;
+			#endif
+			default: all_used = false; continue;
+		}
+		if (!info->usable(i) || column >= ncolumns || (column < 0 && !this->_has_rowid)) {
+			all_used = false;
+			continue;
+		}
+		if (column >= 0) {
+			// remote side compares with the collation of the column
+			const char* collation = info->collation(i);
+			if (collation && ::sqlite3_stricmp(collation, this->_columns[column].collation.data()) != 0) {
+				all_used = false;
+				continue;
+			}
+		}
+		where += where.empty() ? " WHERE " : " AND ";
+		where += column_name(column);
+		where += ' ';
+		where += op;
+		// unary operators ignore their argument
+		info->use(i, ++argv_index);
+		if (!unary) { where += format(" ?%d", argv_index).get(); }
+		switch (info->op(i)) {
+			case constraint_op::eq: case constraint_op::is:
+				if (column < 0) { unique = true; }
+				rows /= 10;
+				break;
+			case constraint_op::ne: case constraint_op::is_not: case constraint_op::is_not_null:
+				break;
+			default:
+				rows /= 4;
+				break;
+		}
+	}
+	std::string sql = "SELECT ";
+	for (int i=0; i<ncolumns; ++i) {
+		if (i != 0) { sql += ','; }
+		// do not read unused columns
+		if (i < 63 && (info->colUsed & (uint64(1) << i)) == 0) { sql += "NULL"; }
+		else { sql += column_name(i); }
+	}
+	if (this->_has_rowid) { sql += ",rowid"; }
+	sql += format(" FROM \"%w\".\"%w\"", this->_schema.data(), this->_table.data()).get();
+	sql += where;
+	if (info->nOrderBy > 0) {
+		std::string order;
+		bool usable = true;
+		for (int i=0; i<info->nOrderBy; ++i) {
+			const auto& o = info->aOrderBy[i];
+			if (o.iColumn >= ncolumns || (o.iColumn < 0 && !this->_has_rowid)) {
+				usable = false;
+				break;
+			}
+			order += i == 0 ? " ORDER BY " : ",";
+			order += column_name(o.iColumn);
+			if (o.desc) { order += " DESC"; }
+		}
+		if (usable && !this->remote_sorts(sql + order)) {
+			sql += order;
+			info->orderByConsumed = 1;
+		}
+	}
+	#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+	const int limit = info->find(constraint_op::limit);
+	if (all_used && (info->nOrderBy == 0 || info->orderByConsumed) && limit != -1) {
+		// the offset is applied by SQLite, we return limit+offset rows
+		info->use(limit, ++argv_index, false);
+		const int offset = info->find(constraint_op::offset);
+		if (offset == -1) {
+			sql += format(" LIMIT ?%d", argv_index).get();
+		} else {
+			info->use(offset, ++argv_index, false);
+			sql += format(" LIMIT CASE WHEN ?%d < 0 THEN -1 ELSE ?%d + max(?%d, 0) END",
+				argv_index-1, argv_index-1, argv_index).get();
+		}
+	}
+	#endif
+	if (unique) {
+		rows = 1;
+		info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+	}
+	info->estimatedRows = int64(rows < 1 ? 1 : rows);
+	// every remote query has fixed overhead
+	info->estimatedCost = 100 + rows;
+	info->idxNum = argv_index;
+	info->idxStr = ::sqlite3_mprintf("%s", sql.data());
+	info->needToFreeIdxStr = 1;
+	return SQLITE_OK;
+}
+
+bool
+sqlite::federated_table::remote_sorts(const std::string& sql) {
+	auto result = this->_sorted.find(sql);
+	if (result != this->_sorted.end()) { return result->second; }
+	statement s = this->_remote->prepare("EXPLAIN QUERY PLAN " + sql);
+	bool sorts = false;
+	std::string detail;
+	while (s.step() == errc::row) {
+		s.column(3, detail);
+		if (detail.find("TEMP B-TREE FOR") != std::string::npos &&
+			detail.find("ORDER BY") != std::string::npos) {
+			sorts = true;
+		}
+	}
+	this->_sorted.emplace(sql, sorts);
+	return sorts;
+}
+
+auto
+sqlite::federated_table::acquire(const std::string& sql) -> statement {
+	auto result = this->_statements.find(sql);
+	if (result != this->_statements.end() && !result->second.empty()) {
+		statement s = std::move(result->second.back());
+		result->second.pop_back();
+		return s;
+	}
+	#if defined(SQLITE_PREPARE_PERSISTENT)
+	return this->_remote->prepare(sql, prepare_f::persistent);
+	#else
+	return this->_remote->prepare(sql);
+	#endif
+}
+
+void
+sqlite::federated_table::recycle(const std::string& sql, statement&& s) noexcept {
+	::sqlite3_reset(s.get());
+	::sqlite3_clear_bindings(s.get());
+	try {
+		this->_statements[sql].emplace_back(std::move(s));
+	} catch (...) {
+		// the statement is finalized
+	}
+}
+
+int
+sqlite::federated_cursor::filter(int, const char* idxStr, int argc, any_base* argv) {
+	this->recycle();
+	this->_sql = idxStr ? idxStr : "";
+	this->_statement = this->_table->acquire(this->_sql);
+	const int nparams = this->_statement.num_parameters();
+	for (int k=0; k<argc && k<nparams; ++k) { this->_statement.bind(k+1, argv[k]); }
+	this->_position = 0;
+	this->_eof = this->_statement.step() == errc::done;
+	return SQLITE_OK;
+}
+
+int
+sqlite::federated_cursor::next() {
+	try {
+		++this->_position;
+		this->_eof = this->_statement.step() == errc::done;
+	} catch (const std::system_error& err) {
+		this->_eof = true;
+		return err.code().value();
+	}
+	return SQLITE_OK;
+}
+
+void
+sqlite::federated_cursor::recycle() noexcept {
+	if (!this->_statement.is_open()) { return; }
+	statement s(std::move(this->_statement));
+	this->_table->recycle(this->_sql, std::move(s));
+}
@@ -0,0 +1,125 @@
+#ifndef SQLITEX_FEDERATED_TABLE_HH
+#define SQLITEX_FEDERATED_TABLE_HH
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+#include <sqlitex/statement.hh>
+#include <sqlitex/virtual_table.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Virtual table that forwards scans to a table in another database.
+	\details
+	The module arguments are the name of the remote table and optionally
+	the name of the remote schema (\c main by default). Columns, their
+	types and collations are copied from the remote table, non-binary
+	collations must be registered on both connections.
+
+	Comparison constraints are translated into WHERE clause of a query
+	that is prepared on the remote connection and cached for each plan.
+	Columns that are not used by the query are not read. ORDER BY is
+	consumed when the remote query does not need a sorter (i.e. it is
+	satisfied by an index), LIMIT is forwarded when all constraints are
+	evaluated remotely. The remote connection must outlive the local one
+	and must not be used concurrently.
+	\code{.cpp}
+	connection shard("shard-1.db");
+	register_federated_table(db, "federated", shard);
+	db.execute("CREATE VIRTUAL TABLE temp.orders_1 USING federated(orders)");
+	statement s = db.prepare("SELECT * FROM orders_1 WHERE id > ? ORDER BY id");
+	\endcode
+	*/
+	class federated_table: public virtual_table {
+
+	private:
+		struct column {
+			std::string name;
+			std::string collation;
+		};
+
+	private:
+		connection* _remote;
+		std::string _schema{"main"};
+		std::string _table;
+		std::vector<column> _columns;
+		bool _has_rowid = true;
+		/// Prepared statements that are not used by any cursor.
+		std::unordered_map<std::string,std::vector<statement>> _statements;
+		/// Does remote query need a sorter?
+		std::unordered_map<std::string,bool> _sorted;
+
+	public:
+
+		inline static void create(connection_base, int, const char* const*) {}
+
+		federated_table(connection_base db, int argc, const char* const* argv, void* remote);
+
+		int best_index(virtual_table_index* info);
+
+		/// Cached statement or a new one if all cached statements are in use.
+		statement acquire(const std::string& sql);
+
+		/// Return statement to the cache.
+		void recycle(const std::string& sql, statement&& s) noexcept;
+
+		inline std::size_t num_columns() const noexcept { return this->_columns.size(); }
+		inline bool has_rowid() const noexcept { return this->_has_rowid; }
+
+	private:
+		bool remote_sorts(const std::string& sql);
+
+	};
+
+	class federated_cursor: public virtual_table_cursor {
+
+	private:
+		federated_table* _table;
+		std::string _sql;
+		statement _statement;
+		bool _eof = true;
+		int64 _position = 0;
+
+	public:
+
+		inline explicit
+		federated_cursor(federated_table* table) noexcept:
+		_table(table) {}
+
+		inline ~federated_cursor() noexcept { this->recycle(); }
+
+		int filter(int idxNum, const char* idxStr, int argc, any_base* argv);
+		int next();
+
+		inline bool eof() const noexcept { return this->_eof; }
+
+		inline int
+		column(virtual_table_context* c, int n) {
+			c->result(any_base(::sqlite3_column_value(this->_statement.get(), n)));
+			return SQLITE_OK;
+		}
+
+		/// Remote rowid or the row number for WITHOUT ROWID tables.
+		inline int
+		rowid(int64& out) {
+			if (!this->_table->has_rowid()) { out = this->_position; return SQLITE_OK; }
+			out = ::sqlite3_column_int64(this->_statement.get(), this->_table->num_columns());
+			return SQLITE_OK;
+		}
+
+	private:
+		void recycle() noexcept;
+
+	};
+
+	inline void
+	register_federated_table(connection_base& db, const char* module_name, connection& remote) {
+		db.virtual_table<federated_table,federated_cursor>(module_name, &remote);
+	}
+
+}
+
+#endif // vim:filetype=cpp
@@ -96,6 +96,86 @@ namespace sqlite {
 	template <class Alloc>
 	using basic_u16string = std::basic_string<char16_t,std::char_traits<char16_t>,Alloc>;
 
+	/**
+	\brief Non-owning reference to a string (a subset of C++17 \c std::basic_string_view).
+	\details
+	The string is not necessarily null-terminated.
+	*/
+	template <class Char>
+	class basic_string_view {
+
+	public:
+		using value_type = Char;
+		using traits_type = std::char_traits<Char>;
+		using const_iterator = const Char*;
+		using size_type = std::size_t;
+
+	private:
+		const Char* _data = nullptr;
+		std::size_t _size = 0;
+
+	public:
+
+		constexpr basic_string_view() noexcept = default;
+
+		inline constexpr
+		basic_string_view(const Char* data, std::size_t size) noexcept:
+		_data(data), _size(size) {}
+
+		inline
+		basic_string_view(const Char* data) noexcept:
+		_data(data), _size(traits_type::length(data)) {}
+
+		template <class Alloc>
+		inline
+		basic_string_view(const std::basic_string<Char,traits_type,Alloc>& rhs) noexcept:
+		_data(rhs.data()), _size(rhs.size()) {}
+
+		inline constexpr const Char* data() const noexcept { return this->_data; }
+		inline constexpr std::size_t size() const noexcept { return this->_size; }
+		inline constexpr std::size_t length() const noexcept { return this->_size; }
+		inline constexpr bool empty() const noexcept { return this->_size == 0; }
+		inline constexpr const_iterator begin() const noexcept { return this->_data; }
+		inline constexpr const_iterator end() const noexcept { return this->_data + this->_size; }
+		inline constexpr Char operator[](std::size_t i) const noexcept { return this->_data[i]; }
+
+		inline int
+		compare(basic_string_view rhs) const noexcept {
+			const auto n = this->_size < rhs._size ? this->_size : rhs._size;
+			int ret = n == 0 ? 0 : traits_type::compare(this->_data, rhs._data, n);
+			if (ret != 0) { return ret; }
+			return this->_size < rhs._size ? -1 : this->_size > rhs._size ? 1 : 0;
+		}
+
+		template <class Alloc=std::allocator<Char>>
+		inline std::basic_string<Char,traits_type,Alloc>
+		str() const {
+			return std::basic_string<Char,traits_type,Alloc>(this->_data, this->_size);
+		}
+
+	};
+
+	template <class Char>
+	inline bool
+	operator==(basic_string_view<Char> a, basic_string_view<Char> b) noexcept {
+		return a.compare(b) == 0;
+	}
+
+	template <class Char>
+	inline bool
+	operator!=(basic_string_view<Char> a, basic_string_view<Char> b) noexcept {
+		return !operator==(a, b);
+	}
+
+	template <class Char>
+	inline bool
+	operator<(basic_string_view<Char> a, basic_string_view<Char> b) noexcept {
+		return a.compare(b) < 0;
+	}
+
+	using u8string_view = basic_string_view<char>;
+	using u16string_view = basic_string_view<char16_t>;
+
 	struct sqlite_deleter {
 		inline void operator()(const void* ptr) { ::sqlite3_free(const_cast<void*>(ptr)); }
 	};
@@ -231,6 +311,23 @@ namespace sqlite {
 		return prepare_f(tp(a) | tp(b));
 	}
 
+	enum class function_flag: int {
+		none=0,
+		deterministic=SQLITE_DETERMINISTIC,
+		#if defined(SQLITE_DIRECTONLY)
+		direct_only=SQLITE_DIRECTONLY,
+		#endif
+		#if defined(SQLITE_INNOCUOUS)
+		innocuous=SQLITE_INNOCUOUS,
+		#endif
+	};
+
+	inline function_flag
+	operator|(function_flag a, function_flag b) {
+		using tp = std::underlying_type<function_flag>::type;
+		return function_flag(tp(a) | tp(b));
+	}
+
 	enum class encoding {
 		utf8 = SQLITE_UTF8,
 		utf16 = SQLITE_UTF16,
@@ -246,10 +343,12 @@ namespace sqlite {
 
 	template <> struct encoding_traits<encoding::utf8> {
 		using string = u8string;
+		using string_view = u8string_view;
 	};
 
 	template <> struct encoding_traits<encoding::utf16> {
 		using string = u16string;
+		using string_view = u16string_view;
 	};
 
 	enum class checkpoint_mode: int {
@@ -325,6 +424,37 @@ namespace sqlite {
 
 	enum class temp_store_mode: int {def=0, file=1, memory=2};
 
+	enum class transaction_type { deferred, immediate, exclusive };
+
+	/// Savepoint operation of transaction_statements that is reported to savepoint hooks.
+	enum class savepoint_event { begin, release, rollback };
+
+	/// Start or end of prepared statement execution that is reported to statement hooks.
+	enum class statement_event { begin, end };
+
+	/**
+	Output format of statement::export_to.
+	\details
+	Binary format is a sequence of rows, each row is 32-bit length of the
+	row followed by the values. Each value is one byte of data_type followed
+	by 64-bit integer, 64-bit double, or 32-bit length and the bytes for
+	text and blobs. Numbers are little-endian.
+	*/
+	enum class export_format { csv, ndjson, binary };
+
+	/**
+	\brief Arrow type of a result column.
+	\details
+	Text and blobs are exported as large (64-bit offset) types, so that a
+	batch is never split because of the data size.
+	*/
+	enum class arrow_type {
+		int64,
+		float64,
+		large_utf8,
+		large_binary,
+	};
+
 	template <class T>
 	inline auto
 	downcast(T value) -> typename std::enable_if<
@@ -1,6 +1,11 @@
 #ifndef SQLITEX_FUNCTION_HH
 #define SQLITEX_FUNCTION_HH
 
+#include <exception>
+#include <new>
+#include <tuple>
+#include <type_traits>
+
 #include <sqlitex/any.hh>
 #include <sqlitex/context.hh>
 #include <sqlitex/forward.hh>
@@ -14,6 +19,275 @@ namespace sqlite {
 		inline void end(context* ctx) {}
 	};
 
+	/**
+	\brief Base class for the state of aggregate and window functions.
+	\details
+	The state is constructed for each group in the memory of
+	\c sqlite3_aggregate_context and destroyed after \c end.
+	*/
+	class aggregate {
+	public:
+		inline void step(context* ctx, int nargs, any_base* args) {}
+		/// Remove the oldest row from the window (window functions only).
+		inline void inverse(context* ctx, int nargs, any_base* args) {}
+		/// Current value of the window (window functions only).
+		inline void value(context* ctx) {}
+		inline void end(context* ctx) {}
+	};
+
+	namespace bits {
+
+		template <class T>
+		struct aggregate_storage {
+			typename std::aligned_storage<sizeof(T),alignof(T)>::type state;
+			/// The memory is zeroed by SQLite.
+			bool constructed;
+		};
+
+		/// Construct the state on the first call, nullptr if out of memory.
+		template <class T>
+		inline T*
+		aggregate_state(types::context* ctx) {
+			static_assert(alignof(T) <= 8, "SQLite aligns aggregate context to 8 bytes");
+			using storage = aggregate_storage<T>;
+			auto* s = static_cast<storage*>(::sqlite3_aggregate_context(ctx, sizeof(storage)));
+			if (!s) { return nullptr; }
+			if (!s->constructed) {
+				new (&s->state) T();
+				s->constructed = true;
+			}
+			return reinterpret_cast<T*>(&s->state);
+		}
+
+		/// Report the current exception as function error.
+		inline void
+		result_error(context& c) noexcept {
+			try {
+				throw;
+			} catch (const std::bad_alloc&) {
+				c.error_bad_alloc();
+			} catch (const std::exception& err) {
+				c.error(err.what());
+			} catch (...) {
+				c.error("unknown error");
+			}
+		}
+
+		template <class T>
+		inline void
+		aggregate_step(types::context* ctx, int nargs, types::value** args) noexcept {
+			context c(ctx);
+			try {
+				auto* state = aggregate_state<T>(ctx);
+				if (!state) { c.error_bad_alloc(); return; }
+				state->step(&c, nargs, reinterpret_cast<any_base*>(args));
+			} catch (...) {
+				result_error(c);
+			}
+		}
+
+		template <class T>
+		inline void
+		aggregate_inverse(types::context* ctx, int nargs, types::value** args) noexcept {
+			context c(ctx);
+			try {
+				auto* state = aggregate_state<T>(ctx);
+				if (!state) { c.error_bad_alloc(); return; }
+				state->inverse(&c, nargs, reinterpret_cast<any_base*>(args));
+			} catch (...) {
+				result_error(c);
+			}
+		}
+
+		template <class T>
+		inline void
+		aggregate_value(types::context* ctx) noexcept {
+			context c(ctx);
+			try {
+				auto* state = aggregate_state<T>(ctx);
+				if (!state) { c.error_bad_alloc(); return; }
+				state->value(&c);
+			} catch (...) {
+				result_error(c);
+			}
+		}
+
+		/// Called for each group even if there were no rows and on errors.
+		template <class T>
+		inline void
+		aggregate_final(types::context* ctx) noexcept {
+			context c(ctx);
+			T* state = nullptr;
+			try {
+				state = aggregate_state<T>(ctx);
+				if (!state) { c.error_bad_alloc(); return; }
+				state->end(&c);
+			} catch (...) {
+				result_error(c);
+			}
+			if (state) { state->~T(); }
+		}
+
+		template <std::size_t ... I> struct indices {};
+
+		template <std::size_t N, std::size_t ... I>
+		struct make_indices: public make_indices<N-1,N-1,I...> {};
+
+		template <std::size_t ... I>
+		struct make_indices<0,I...> { using type = indices<I...>; };
+
+		/// Return and argument types of lambdas, function objects and function pointers.
+		template <class Function>
+		struct function_traits: public function_traits<decltype(&Function::operator())> {};
+
+		template <class Result, class ... Args>
+		struct function_traits<Result(*)(Args...)> {
+			using result_type = Result;
+			using arguments = std::tuple<Args...>;
+			using indices = typename make_indices<sizeof...(Args)>::type;
+			static constexpr const int arity = sizeof...(Args);
+		};
+
+		template <class Result, class ... Args>
+		struct function_traits<Result(Args...)>: public function_traits<Result(*)(Args...)> {};
+
+		template <class Class, class Result, class ... Args>
+		struct function_traits<Result(Class::*)(Args...)>:
+		public function_traits<Result(*)(Args...)> {};
+
+		template <class Class, class Result, class ... Args>
+		struct function_traits<Result(Class::*)(Args...) const>:
+		public function_traits<Result(*)(Args...)> {};
+
+		template <class T>
+		using decay = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+
+		/// Integral types that are converted with \c sqlite3_value_int.
+		template <class T>
+		struct is_int: public std::integral_constant<bool,std::is_integral<T>::value &&
+			(sizeof(T) < sizeof(int) || (sizeof(T) == sizeof(int) && std::is_signed<T>::value))> {};
+
+		/// Conversion of SQL value to the argument of type \p T.
+		template <class T, class Enable=void> struct argument;
+
+		template <>
+		struct argument<bool> {
+			static inline bool
+			get(types::value* v) noexcept { return ::sqlite3_value_int(v) != 0; }
+		};
+
+		template <class T>
+		struct argument<T,typename std::enable_if<is_int<T>::value>::type> {
+			static inline T get(types::value* v) noexcept { return T(::sqlite3_value_int(v)); }
+		};
+
+		template <class T>
+		struct argument<T,typename std::enable_if<std::is_integral<T>::value &&
+			!is_int<T>::value>::type> {
+			static inline T get(types::value* v) noexcept { return T(::sqlite3_value_int64(v)); }
+		};
+
+		template <class T>
+		struct argument<T,typename std::enable_if<std::is_floating_point<T>::value>::type> {
+			static inline T get(types::value* v) noexcept { return T(::sqlite3_value_double(v)); }
+		};
+
+		/// The view is valid until the function returns.
+		template <>
+		struct argument<u8string_view> {
+			static inline u8string_view
+			get(types::value* v) noexcept {
+				// the text has to be converted before its size is requested
+				auto* data = reinterpret_cast<const char*>(::sqlite3_value_text(v));
+				return u8string_view(data, ::sqlite3_value_bytes(v));
+			}
+		};
+
+		template <>
+		struct argument<u16string_view> {
+			static inline u16string_view
+			get(types::value* v) noexcept {
+				auto* data = static_cast<const char16_t*>(::sqlite3_value_text16(v));
+				return u16string_view(data, ::sqlite3_value_bytes16(v)/sizeof(char16_t));
+			}
+		};
+
+		template <>
+		struct argument<u8string> {
+			static inline u8string
+			get(types::value* v) { return argument<u8string_view>::get(v).str(); }
+		};
+
+		template <>
+		struct argument<u16string> {
+			static inline u16string
+			get(types::value* v) { return argument<u16string_view>::get(v).str(); }
+		};
+
+		template <>
+		struct argument<blob> {
+			static inline blob
+			get(types::value* v) {
+				auto* data = static_cast<const char*>(::sqlite3_value_blob(v));
+				return blob(data, data + ::sqlite3_value_bytes(v));
+			}
+		};
+
+		template <>
+		struct argument<any_base> {
+			static inline any_base get(types::value* v) noexcept { return any_base(v); }
+		};
+
+		/// Use the narrowest result overload for arithmetic types.
+		inline void result(context& c, bool value) { c.result(int(value)); }
+
+		template <class T>
+		inline typename std::enable_if<is_int<T>::value>::type
+		result(context& c, T value) { c.result(int(value)); }
+
+		template <class T>
+		inline typename std::enable_if<std::is_integral<T>::value && !is_int<T>::value>::type
+		result(context& c, T value) { c.result(int64(value)); }
+
+		template <class T>
+		inline typename std::enable_if<std::is_floating_point<T>::value>::type
+		result(context& c, T value) { c.result(double(value)); }
+
+		template <class T>
+		inline typename std::enable_if<!std::is_arithmetic<decay<T>>::value>::type
+		result(context& c, T&& value) { c.result(std::forward<T>(value)); }
+
+		template <class Function, std::size_t ... I>
+		inline void
+		invoke(context&, Function& func, types::value** args, indices<I...>, std::true_type) {
+			using arguments = typename function_traits<Function>::arguments;
+			func(argument<decay<typename std::tuple_element<I,arguments>::type>>::get(args[I])...);
+		}
+
+		template <class Function, std::size_t ... I>
+		inline void
+		invoke(context& c, Function& func, types::value** args, indices<I...>, std::false_type) {
+			using arguments = typename function_traits<Function>::arguments;
+			result(c, func(argument<decay<typename std::tuple_element<I,arguments>::type>>::get(args[I])...));
+		}
+
+		/// Decode the arguments, call the function and set the result.
+		template <class Function>
+		inline void
+		typed_function(types::context* ctx, int, types::value** args) noexcept {
+			using traits = function_traits<Function>;
+			using returns_void = typename std::is_void<typename traits::result_type>::type;
+			context c(ctx);
+			try {
+				auto& func = *static_cast<Function*>(::sqlite3_user_data(ctx));
+				invoke(c, func, args, typename traits::indices(), returns_void());
+			} catch (...) {
+				result_error(c);
+			}
+		}
+
+	}
+
 }
 
 #endif // vim:filetype=cpp
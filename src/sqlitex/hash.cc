@@ -0,0 +1,469 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <sqlitex/function.hh>
+#include <sqlitex/hash.hh>
+
+namespace {
+
+	using sqlite::any_base;
+	using sqlite::context;
+	using sqlite::int64;
+	using sqlite::uint64;
+
+	constexpr const uint64 prime32_1 = UINT64_C(0x9e3779b1);
+	constexpr const uint64 prime32_2 = UINT64_C(0x85ebca77);
+	constexpr const uint64 prime32_3 = UINT64_C(0xc2b2ae3d);
+	constexpr const uint64 prime64_1 = UINT64_C(0x9e3779b185ebca87);
+	constexpr const uint64 prime64_2 = UINT64_C(0xc2b2ae3d27d4eb4f);
+	constexpr const uint64 prime64_3 = UINT64_C(0x165667b19e3779f9);
+	constexpr const uint64 prime64_4 = UINT64_C(0x85ebca77c2b2ae63);
+	constexpr const uint64 prime64_5 = UINT64_C(0x27d4eb2f165667c5);
+	constexpr const uint64 prime_mx1 = UINT64_C(0x165667919e3779f9);
+	constexpr const uint64 prime_mx2 = UINT64_C(0x9fb21c651e98df25);
+
+	constexpr const std::size_t secret_size = 192;
+	constexpr const std::size_t secret_size_min = 136;
+	constexpr const std::size_t stripe_size = 64;
+
+	const unsigned char default_secret[secret_size] = {
+		0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+		0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+		0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+		0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+		0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+		0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+		0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+		0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+		0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+		0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+		0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+		0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+	};
+
+	inline std::uint32_t
+	read32(const unsigned char* p) noexcept {
+		return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) |
+			(std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+	}
+
+	inline uint64
+	read64(const unsigned char* p) noexcept {
+		return uint64(read32(p)) | (uint64(read32(p+4)) << 32);
+	}
+
+	inline void
+	write64(unsigned char* p, uint64 x) noexcept {
+		for (int i=0; i<8; ++i) { p[i] = static_cast<unsigned char>(x >> (8*i)); }
+	}
+
+	inline uint64 rotl(uint64 x, int n) noexcept { return (x << n) | (x >> (64 - n)); }
+	inline uint64 xorshift(uint64 x, int n) noexcept { return x ^ (x >> n); }
+
+	inline uint64
+	mul128_fold64(uint64 a, uint64 b) noexcept {
+		const auto product = static_cast<unsigned __int128>(a)*b;
+		return uint64(product) ^ uint64(product >> 64);
+	}
+
+	inline uint64
+	avalanche64(uint64 h) noexcept {
+		h ^= h >> 33;
+		h *= prime64_2;
+		h ^= h >> 29;
+		h *= prime64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	inline uint64
+	avalanche(uint64 h) noexcept {
+		h = xorshift(h, 37);
+		h *= prime_mx1;
+		return xorshift(h, 32);
+	}
+
+	inline uint64
+	rrmxmx(uint64 h, uint64 len) noexcept {
+		h ^= rotl(h, 49) ^ rotl(h, 24);
+		h *= prime_mx2;
+		h ^= (h >> 35) + len;
+		h *= prime_mx2;
+		return xorshift(h, 28);
+	}
+
+	inline uint64
+	mix16(const unsigned char* in, const unsigned char* secret, uint64 seed) noexcept {
+		return mul128_fold64(read64(in) ^ (read64(secret) + seed),
+			read64(in+8) ^ (read64(secret+8) - seed));
+	}
+
+	uint64
+	hash_short(const unsigned char* in, std::size_t len, const unsigned char* secret,
+		uint64 seed) noexcept {
+		if (len > 8) {
+			const uint64 lo = read64(in) ^ ((read64(secret+24) ^ read64(secret+32)) + seed);
+			const uint64 hi = read64(in+len-8) ^ ((read64(secret+40) ^ read64(secret+48)) - seed);
+			return avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+		}
+		if (len >= 4) {
+			seed ^= uint64(__builtin_bswap32(std::uint32_t(seed))) << 32;
+			const uint64 x = read32(in+len-4) + (uint64(read32(in)) << 32);
+			return rrmxmx(x ^ ((read64(secret+8) ^ read64(secret+16)) - seed), len);
+		}
+		if (len != 0) {
+			const std::uint32_t combined = (std::uint32_t(in[0]) << 16) |
+				(std::uint32_t(in[len >> 1]) << 24) | std::uint32_t(in[len-1]) |
+				(std::uint32_t(len) << 8);
+			return avalanche64(combined ^ ((read32(secret) ^ read32(secret+4)) + seed));
+		}
+		return avalanche64(seed ^ read64(secret+56) ^ read64(secret+64));
+	}
+
+	uint64
+	hash_medium(const unsigned char* in, std::size_t len, const unsigned char* secret,
+		uint64 seed) noexcept {
+		uint64 acc = len*prime64_1;
+		if (len <= 128) {
+			const std::size_t n = (len - 1)/32;
+			for (std::size_t i=0; i<=n; ++i) {
+				acc += mix16(in + 16*i, secret + 32*i, seed);
+				acc += mix16(in + len - 16*(i+1), secret + 32*i + 16, seed);
+			}
+			return avalanche(acc);
+		}
+		for (std::size_t i=0; i<8; ++i) { acc += mix16(in + 16*i, secret + 16*i, seed); }
+		uint64 acc_end = mix16(in + len - 16, secret + secret_size_min - 17, seed);
+		acc = avalanche(acc);
+		const std::size_t n = len/16;
+		for (std::size_t i=8; i<n; ++i) { acc_end += mix16(in + 16*i, secret + 16*(i-8) + 3, seed); }
+		return avalanche(acc + acc_end);
+	}
+
+	#if defined(__SSE2__)
+	inline __m128i
+	load16(const void* p) noexcept {
+		__m128i x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+
+	inline void
+	store16(void* p, __m128i x) noexcept {
+		std::memcpy(p, &x, sizeof(x));
+	}
+
+	/// Process 64-byte stripe two 64-bit lanes at a time.
+	inline void
+	accumulate(uint64* acc, const unsigned char* in, const unsigned char* secret) noexcept {
+		for (int i=0; i<4; ++i) {
+			const auto data = load16(in + 16*i);
+			const auto key = _mm_xor_si128(data, load16(secret + 16*i));
+			const auto product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0,3,0,1)));
+			const auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1,0,3,2));
+			store16(acc + 2*i, _mm_add_epi64(product, _mm_add_epi64(load16(acc + 2*i), swapped)));
+		}
+	}
+
+	inline void
+	scramble(uint64* acc, const unsigned char* secret) noexcept {
+		const auto prime = _mm_set1_epi32(int(prime32_1));
+		for (int i=0; i<4; ++i) {
+			const auto a = load16(acc + 2*i);
+			const auto key = _mm_xor_si128(_mm_xor_si128(a, _mm_srli_epi64(a, 47)),
+				load16(secret + 16*i));
+			const auto lo = _mm_mul_epu32(key, prime);
+			const auto hi = _mm_mul_epu32(_mm_shuffle_epi32(key, _MM_SHUFFLE(0,3,0,1)), prime);
+			store16(acc + 2*i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+		}
+	}
+	#else
+	inline void
+	accumulate(uint64* acc, const unsigned char* in, const unsigned char* secret) noexcept {
+		for (int i=0; i<8; ++i) {
+			const uint64 data = read64(in + 8*i);
+			const uint64 key = data ^ read64(secret + 8*i);
+			acc[i^1] += data;
+			acc[i] += (key & 0xffffffff)*(key >> 32);
+		}
+	}
+
+	inline void
+	scramble(uint64* acc, const unsigned char* secret) noexcept {
+		for (int i=0; i<8; ++i) {
+			acc[i] = (xorshift(acc[i], 47) ^ read64(secret + 8*i))*prime32_1;
+		}
+	}
+	#endif
+
+	uint64
+	hash_long(const unsigned char* in, std::size_t len, const unsigned char* secret) noexcept {
+		uint64 acc[8] = {
+			prime32_3, prime64_1, prime64_2, prime64_3,
+			prime64_4, prime32_2, prime64_5, prime32_1
+		};
+		constexpr const std::size_t stripes_per_block = (secret_size - stripe_size)/8;
+		constexpr const std::size_t block_size = stripe_size*stripes_per_block;
+		const std::size_t num_blocks = (len - 1)/block_size;
+		for (std::size_t n=0; n<num_blocks; ++n) {
+			for (std::size_t s=0; s<stripes_per_block; ++s) {
+				accumulate(acc, in + n*block_size + s*stripe_size, secret + 8*s);
+			}
+			scramble(acc, secret + secret_size - stripe_size);
+		}
+		const std::size_t num_stripes = ((len - 1) - block_size*num_blocks)/stripe_size;
+		for (std::size_t s=0; s<num_stripes; ++s) {
+			accumulate(acc, in + num_blocks*block_size + s*stripe_size, secret + 8*s);
+		}
+		accumulate(acc, in + len - stripe_size, secret + secret_size - stripe_size - 7);
+		uint64 result = len*prime64_1;
+		for (int i=0; i<4; ++i) {
+			result += mul128_fold64(acc[2*i] ^ read64(secret + 11 + 16*i),
+				acc[2*i+1] ^ read64(secret + 11 + 16*i + 8));
+		}
+		return avalanche(result);
+	}
+
+	struct crc32c_table {
+		std::uint32_t data[256];
+		crc32c_table() noexcept {
+			for (std::uint32_t i=0; i<256; ++i) {
+				std::uint32_t c = i;
+				for (int j=0; j<8; ++j) { c = (c >> 1) ^ (UINT32_C(0x82f63b78) & (0u - (c & 1))); }
+				this->data[i] = c;
+			}
+		}
+	};
+
+	/// Canonical bytes of SQL value that are hashed.
+	class value_bytes {
+
+	private:
+		unsigned char _buffer[8];
+		const void* _data = nullptr;
+		std::size_t _size = 0;
+
+	public:
+
+		explicit value_bytes(sqlite::types::value* v) noexcept {
+			switch (::sqlite3_value_type(v)) {
+				case SQLITE_INTEGER:
+					integer(::sqlite3_value_int64(v));
+					break;
+				case SQLITE_FLOAT: {
+					const double x = ::sqlite3_value_double(v);
+					if (x >= -9223372036854775808.0 && x < 9223372036854775808.0 &&
+						double(int64(x)) == x) {
+						integer(int64(x));
+					} else {
+						uint64 bits;
+						std::memcpy(&bits, &x, sizeof(bits));
+						integer(int64(bits));
+					}
+					break;
+				}
+				case SQLITE_TEXT:
+					this->_data = ::sqlite3_value_text(v);
+					this->_size = ::sqlite3_value_bytes(v);
+					break;
+				default:
+					this->_data = ::sqlite3_value_blob(v);
+					this->_size = ::sqlite3_value_bytes(v);
+					break;
+			}
+		}
+
+		inline const void* data() const noexcept { return this->_data; }
+		inline std::size_t size() const noexcept { return this->_size; }
+
+	private:
+
+		inline void
+		integer(int64 x) noexcept {
+			write64(this->_buffer, uint64(x));
+			this->_data = this->_buffer;
+			this->_size = sizeof(this->_buffer);
+		}
+
+	};
+
+	inline bool
+	is_null(sqlite::types::value* v) noexcept {
+		return ::sqlite3_value_type(v) == SQLITE_NULL;
+	}
+
+	inline uint64
+	value_hash(sqlite::types::value* v) noexcept {
+		value_bytes bytes(v);
+		return sqlite::xxh3_64(bytes.data(), bytes.size());
+	}
+
+	void
+	xxh3_function(sqlite::types::context* ctx, int nargs, sqlite::types::value** args) noexcept {
+		context c(ctx);
+		if (is_null(args[0]) || (nargs > 1 && is_null(args[1]))) { c.result(nullptr); return; }
+		const uint64 seed = nargs > 1 ? uint64(::sqlite3_value_int64(args[1])) : 0;
+		value_bytes bytes(args[0]);
+		c.result(int64(sqlite::xxh3_64(bytes.data(), bytes.size(), seed)));
+	}
+
+	void
+	crc32c_function(sqlite::types::context* ctx, int, sqlite::types::value** args) noexcept {
+		context c(ctx);
+		if (is_null(args[0])) { c.result(nullptr); return; }
+		value_bytes bytes(args[0]);
+		c.result(int64(sqlite::crc32c(bytes.data(), bytes.size())));
+	}
+
+	struct bloom_build: public sqlite::aggregate {
+		sqlite::bloom_filter filter;
+
+		inline void
+		step(context*, int, any_base* args) {
+			if (this->filter.empty()) {
+				this->filter = sqlite::bloom_filter(
+					uint64(::sqlite3_value_int64(args[1].get())),
+					::sqlite3_value_int(args[2].get()));
+			}
+			if (!is_null(args[0].get())) { this->filter.add(value_hash(args[0].get())); }
+		}
+
+		inline void
+		end(context* c) {
+			if (this->filter.empty()) { c->result(nullptr); return; }
+			const auto& data = this->filter.serialize();
+			::sqlite3_result_blob64(c->get(), data.data(), data.size(), SQLITE_TRANSIENT);
+		}
+	};
+
+	void
+	bloom_probe_function(sqlite::types::context* ctx, int, sqlite::types::value** args) noexcept {
+		using sqlite::bloom_filter;
+		context c(ctx);
+		try {
+			if (is_null(args[0]) || is_null(args[1])) { c.result(nullptr); return; }
+			const auto hash = value_hash(args[1]);
+			if (auto* filter = c.metadata<bloom_filter>(0)) {
+				c.result(int(filter->contains(hash)));
+				return;
+			}
+			const auto* data = ::sqlite3_value_blob(args[0]);
+			const std::size_t size = ::sqlite3_value_bytes(args[0]);
+			bloom_filter::validate(data, size);
+			c.result(int(bloom_filter::contains(data, hash)));
+			// auxiliary data is kept between rows only for constant arguments
+			if (::sqlite3_value_frombind(args[0])) {
+				std::unique_ptr<bloom_filter> filter(new bloom_filter);
+				filter->deserialize(data, size);
+				c.metadata(0, filter.release(), sqlite::bits::destroy<bloom_filter>);
+			}
+		} catch (...) {
+			sqlite::bits::result_error(c);
+		}
+	}
+
+}
+
+auto
+sqlite::xxh3_64(const void* data, std::size_t size, uint64 seed) noexcept -> uint64 {
+	auto* in = static_cast<const unsigned char*>(data);
+	if (size <= 16) { return hash_short(in, size, default_secret, seed); }
+	if (size <= 240) { return hash_medium(in, size, default_secret, seed); }
+	if (seed == 0) { return hash_long(in, size, default_secret); }
+	unsigned char secret[secret_size];
+	for (std::size_t i=0; i<secret_size; i += 16) {
+		write64(secret + i, read64(default_secret + i) + seed);
+		write64(secret + i + 8, read64(default_secret + i + 8) - seed);
+	}
+	return hash_long(in, size, secret);
+}
+
+std::uint32_t
+sqlite::crc32c(const void* data, std::size_t size, std::uint32_t crc) noexcept {
+	auto* in = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+	#if defined(__SSE4_2__)
+	uint64 c = crc;
+	for (; size >= 8; size -= 8, in += 8) { c = _mm_crc32_u64(c, read64(in)); }
+	crc = std::uint32_t(c);
+	for (; size != 0; --size, ++in) { crc = _mm_crc32_u8(crc, *in); }
+	#else
+	static const crc32c_table table;
+	for (; size != 0; --size, ++in) { crc = table.data[(crc ^ *in) & 0xff] ^ (crc >> 8); }
+	#endif
+	return ~crc;
+}
+
+sqlite::bloom_filter::bloom_filter(uint64 num_bits, int num_hashes) {
+	if (num_bits == 0 || num_bits > max_bits) {
+		throw std::invalid_argument("the number of bits is out of range");
+	}
+	if (num_hashes < 1 || num_hashes > max_hashes) {
+		throw std::invalid_argument("the number of hash functions is out of range");
+	}
+	num_bits = (num_bits + 7) & ~uint64(7);
+	this->_data.assign(header_size + num_bits/8, '\0');
+	auto* header = reinterpret_cast<unsigned char*>(&this->_data[0]);
+	header[0] = 'B';
+	header[1] = static_cast<unsigned char>(num_hashes);
+	write64(header + 8, num_bits);
+}
+
+void
+sqlite::bloom_filter::validate(const void* data, std::size_t size) {
+	auto* header = static_cast<const unsigned char*>(data);
+	if (size < header_size || header[0] != 'B' || header[1] < 1 || header[1] > max_hashes ||
+		read64(header + 8) != 8*(size - header_size)) {
+		throw std::invalid_argument("malformed bloom filter");
+	}
+}
+
+void
+sqlite::bloom_filter::deserialize(const void* data, std::size_t size) {
+	validate(data, size);
+	this->_data.assign(static_cast<const char*>(data), size);
+}
+
+void
+sqlite::bloom_filter::add(void* data, uint64 hash) noexcept {
+	auto* header = static_cast<unsigned char*>(data);
+	auto* bits = header + header_size;
+	const int num_hashes = header[1];
+	const uint64 num_bits = read64(header + 8);
+	const uint64 delta = rotl(hash, 32) | 1;
+	for (int i=0; i<num_hashes; ++i, hash += delta) {
+		const auto pos = uint64((static_cast<unsigned __int128>(hash)*num_bits) >> 64);
+		bits[pos >> 3] |= static_cast<unsigned char>(1u << (pos & 7));
+	}
+}
+
+bool
+sqlite::bloom_filter::contains(const void* data, uint64 hash) noexcept {
+	auto* header = static_cast<const unsigned char*>(data);
+	auto* bits = header + header_size;
+	const int num_hashes = header[1];
+	const uint64 num_bits = read64(header + 8);
+	const uint64 delta = rotl(hash, 32) | 1;
+	for (int i=0; i<num_hashes; ++i, hash += delta) {
+		const auto pos = uint64((static_cast<unsigned __int128>(hash)*num_bits) >> 64);
+		if ((bits[pos >> 3] & (1u << (pos & 7))) == 0) { return false; }
+	}
+	return true;
+}
+
+void
+sqlite::register_hash_functions(connection_base& db) {
+	db.scalar_function(xxh3_function, "xxh3_64", 1);
+	db.scalar_function(xxh3_function, "xxh3_64", 2);
+	db.scalar_function(crc32c_function, "crc32c", 1);
+	db.aggregate_function<bloom_build>("bloom_build", 3);
+	db.scalar_function(bloom_probe_function, "bloom_probe", 2);
+}
@@ -0,0 +1,95 @@
+#ifndef SQLITEX_HASH_HH
+#define SQLITEX_HASH_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/// 64-bit XXH3 hash, the same as \c XXH3_64bits_withSeed from xxHash.
+	uint64 xxh3_64(const void* data, std::size_t size, uint64 seed=0) noexcept;
+
+	/**
+	CRC-32C (Castagnoli) checksum. Uses SSE4.2 CRC instruction if the
+	library is compiled with SSE4.2 support. Pass the previous checksum as
+	\p crc to compute the checksum of the concatenated data.
+	*/
+	std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc=0) noexcept;
+
+	/**
+	\brief Bloom filter that uses double hashing of 64-bit hashes.
+	\details
+	The serialized filter is 16-byte header (\c 'B', the number of hash
+	functions, six zero bytes, the number of bits as 64-bit little-endian
+	integer) followed by the bits. The bits are addressed byte-wise, so that
+	the filter can be probed without copying.
+	*/
+	class bloom_filter {
+
+	public:
+		static constexpr const std::size_t header_size = 16;
+		static constexpr const int max_hashes = 32;
+		static constexpr const uint64 max_bits = uint64(1) << 33;
+
+	private:
+		/// The header followed by the bits.
+		std::string _data;
+
+	public:
+
+		bloom_filter() = default;
+
+		/// \throw std::invalid_argument if the parameters are out of range
+		bloom_filter(uint64 num_bits, int num_hashes);
+
+		inline void add(uint64 hash) noexcept { add(&this->_data[0], hash); }
+
+		inline bool
+		contains(uint64 hash) const noexcept {
+			return contains(this->_data.data(), hash);
+		}
+
+		inline const std::string& serialize() const noexcept { return this->_data; }
+
+		/// \throw std::invalid_argument if the filter is malformed
+		void deserialize(const void* data, std::size_t size);
+
+		inline bool empty() const noexcept { return this->_data.empty(); }
+
+		/// \throw std::invalid_argument if the filter is malformed
+		static void validate(const void* data, std::size_t size);
+
+		/// Probe the serialized filter that was validated.
+		static bool contains(const void* data, uint64 hash) noexcept;
+
+	private:
+		static void add(void* data, uint64 hash) noexcept;
+
+	};
+
+	/**
+	Register hash functions:
+	- \c xxh3_64(x[,seed]) returns XXH3 hash as 64-bit signed integer,
+	- \c crc32c(x) returns CRC-32C checksum,
+	- \c bloom_build(x,bits,k) aggregate returns the blob with Bloom filter
+	  of \p bits bits and \p k hash functions that contains all values,
+	- \c bloom_probe(filter,x) returns 1 if the value may be in the
+	  filter and 0 if it is definitely not there.
+
+	Text and blobs are hashed as is, integers (and reals with integer values)
+	as 64-bit little-endian integers, other reals as 64-bit little-endian
+	IEEE 754 numbers. All functions return NULL for NULL arguments.
+
+	The filter that is passed to \c bloom_probe as a bound parameter is
+	decoded once per statement, other filters are probed in place. Note
+	that SQLite copies the result of a scalar subquery for every row, so
+	large filters should be bound as parameters.
+	*/
+	void register_hash_functions(connection_base& db);
+
+}
+
+#endif // vim:filetype=cpp
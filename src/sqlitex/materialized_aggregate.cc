@@ -0,0 +1,449 @@
+#include <cctype>
+#include <iterator>
+#include <stdexcept>
+
+#include <sqlitex/materialized_aggregate.hh>
+#include <sqlitex/query_cache.hh>
+
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace {
+
+	using sqlite::int64;
+	using sqlite::uint64;
+	using sqlite::data_type;
+	using value_type = sqlite::types::value;
+
+	/// Reals with integer values are grouped with integers.
+	inline bool
+	integral(double x, int64& out) noexcept {
+		if (!(x >= -9223372036854775808.0 && x < 9223372036854775808.0)) { return false; }
+		out = int64(x);
+		return double(out) == x;
+	}
+
+	/**
+	REAL columns store reals with integer values as integers and convert
+	them back on read, the same rules as \c sqlite3AffinityType.
+	*/
+	bool
+	real_affinity(std::string type) {
+		for (auto& ch : type) { ch = char(std::toupper(static_cast<unsigned char>(ch))); }
+		auto contains = [&type] (const char* s) { return type.find(s) != std::string::npos; };
+		if (contains("INT") || contains("CHAR") || contains("CLOB") || contains("TEXT") ||
+			contains("BLOB")) {
+			return false;
+		}
+		return contains("REAL") || contains("FLOA") || contains("DOUB");
+	}
+
+	inline data_type
+	type_of(value_type* v, bool real) noexcept {
+		auto type = data_type(::sqlite3_value_type(v));
+		if (real && type == data_type::integer) { type = data_type::floating_point; }
+		return type;
+	}
+
+	void
+	append_value(std::string& key, value_type* v, bool real) {
+		using sqlite::bits::append_key;
+		switch (type_of(v, real)) {
+			case data_type::integer:
+				append_key(key, int64(::sqlite3_value_int64(v)));
+				break;
+			case data_type::floating_point: {
+				const double x = ::sqlite3_value_double(v);
+				int64 n = 0;
+				if (integral(x, n)) { append_key(key, n); }
+				else { append_key(key, x); }
+				break;
+			}
+			case data_type::text: {
+				auto* data = ::sqlite3_value_text(v);
+				append_key(key, 't', data, ::sqlite3_value_bytes(v));
+				break;
+			}
+			case data_type::blob: {
+				auto* data = ::sqlite3_value_blob(v);
+				append_key(key, 'b', data, ::sqlite3_value_bytes(v));
+				break;
+			}
+			default:
+				append_key(key, nullptr);
+				break;
+		}
+	}
+
+	sqlite::materialized_aggregate::value
+	make_value(value_type* v, bool real) {
+		sqlite::materialized_aggregate::value result;
+		result.type = type_of(v, real);
+		switch (result.type) {
+			case data_type::integer: result.integer = ::sqlite3_value_int64(v); break;
+			case data_type::floating_point: result.real = ::sqlite3_value_double(v); break;
+			case data_type::text:
+			case data_type::blob: {
+				const void* data = result.type == data_type::text
+					? static_cast<const void*>(::sqlite3_value_text(v))
+					: ::sqlite3_value_blob(v);
+				if (data) {
+					result.bytes.assign(static_cast<const char*>(data), ::sqlite3_value_bytes(v));
+				}
+				break;
+			}
+			default: break;
+		}
+		return result;
+	}
+
+	/// Addition modulo 2^64 that is reversed by subtraction.
+	inline int64 wrap_add(int64 a, int64 b) noexcept { return int64(uint64(a) + uint64(b)); }
+
+	void
+	add(sqlite::materialized_aggregate::sum& lhs,
+		const sqlite::materialized_aggregate::sum& rhs) noexcept {
+		lhs.integer = wrap_add(lhs.integer, rhs.integer);
+		lhs.real += rhs.real;
+		lhs.count += rhs.count;
+		lhs.reals += rhs.reals;
+	}
+
+	void
+	merge(sqlite::materialized_aggregate::sum& lhs,
+		  const sqlite::materialized_aggregate::sum& rhs) noexcept {
+		add(lhs, rhs);
+		// drop rounding errors of the values that were removed
+		if (lhs.reals == 0) { lhs.real = 0; }
+		if (lhs.count == 0) { lhs.integer = 0; }
+	}
+
+	/// Add the changes of the savepoint to the changes of the enclosing one.
+	void
+	merge_changes(sqlite::materialized_aggregate::group_map& lhs,
+				  sqlite::materialized_aggregate::group_map& rhs) {
+		for (auto& pair : rhs) {
+			auto result = lhs.find(pair.first);
+			if (result == lhs.end()) {
+				lhs.emplace(pair.first, std::move(pair.second));
+				continue;
+			}
+			auto& g = result->second;
+			const auto& delta = pair.second;
+			// groups with zero count may still have changed sums
+			g.count += delta.count;
+			for (std::size_t i=0; i<g.sums.size(); ++i) { add(g.sums[i], delta.sums[i]); }
+		}
+		rhs.clear();
+	}
+
+}
+
+sqlite::materialized_aggregate::materialized_aggregate(
+	connection& db,
+	const char* table,
+	std::vector<std::string> group_by,
+	std::vector<std::string> sums,
+	const char* schema
+):
+_db(db), _schema(schema), _table(table),
+_group_by(std::move(group_by)), _sums(std::move(sums)) {
+	struct table_column { std::string name; int position; bool hidden; bool real; };
+	std::vector<table_column> columns;
+	{
+		statement s(db.prepare(format("PRAGMA %Q.table_xinfo(%Q)", schema, table).get()));
+		while (s.step() == errc::row) {
+			table_column c;
+			s.column(1, c.name);
+			c.position = ::sqlite3_column_int(s.get(), 0);
+			c.hidden = ::sqlite3_column_int(s.get(), 6) != 0;
+			std::string type;
+			s.column(2, type);
+			c.real = real_affinity(std::move(type));
+			columns.emplace_back(std::move(c));
+		}
+	}
+	if (columns.empty()) {
+		throw std::invalid_argument(std::string("no such table: ") + table);
+	}
+	auto find = [&] (const std::string& name) {
+		for (const auto& c : columns) {
+			if (::sqlite3_stricmp(c.name.data(), name.data()) != 0) { continue; }
+			if (c.hidden) {
+				throw std::invalid_argument("generated or hidden column: " + name);
+			}
+			this->_columns.emplace_back(c.position);
+			this->_real.emplace_back(c.real);
+			return;
+		}
+		throw std::invalid_argument("no such column: " + name);
+	};
+	for (const auto& name : this->_group_by) { find(name); }
+	for (const auto& name : this->_sums) { find(name); }
+	this->_values.resize(this->_columns.size());
+	this->refresh();
+	db.add_preupdate_hook(this, [this] (preupdate_database& pdb, action a, const char* schema,
+										const char* table, int64, int64) {
+		this->on_change(pdb, a, schema, table);
+	});
+	db.add_savepoint_hook(this, [this] (savepoint_event event, int level) {
+		this->on_savepoint(event, level);
+	});
+	db.add_statement_hook(this, [this] (statement_event event, types::statement* s) {
+		this->on_statement(event, s);
+	});
+	// merge only when the commit can not fail or be turned into rollback any more
+	db.add_commit_listener(this, [this] () { this->commit(); });
+	db.add_rollback_hook(this, [this] () { this->rollback(); });
+}
+
+sqlite::materialized_aggregate::~materialized_aggregate() noexcept {
+	this->_db.remove_preupdate_hook(this);
+	this->_db.remove_savepoint_hook(this);
+	this->_db.remove_statement_hook(this);
+	this->_db.remove_commit_listener(this);
+	this->_db.remove_rollback_hook(this);
+}
+
+void
+sqlite::materialized_aggregate::refresh() {
+	std::string sql = "SELECT ";
+	for (std::size_t i=0; i<this->_columns.size(); ++i) {
+		if (i != 0) { sql += ','; }
+		const auto& name = i < this->_group_by.size() ? this->_group_by[i] :
+			this->_sums[i-this->_group_by.size()];
+		sql += format("\"%w\"", name.data()).get();
+	}
+	if (this->_columns.empty()) { sql += '1'; }
+	sql += format(" FROM \"%w\".\"%w\"", this->_schema.data(), this->_table.data()).get();
+	group_map groups;
+	statement s(this->_db.prepare(sql));
+	const int n = int(this->_columns.size());
+	while (s.step() == errc::row) {
+		for (int i=0; i<n; ++i) {
+			this->_values[i].clear(::sqlite3_column_value(s.get(), i));
+		}
+		this->add(groups, 1);
+	}
+	this->_groups.swap(groups);
+	this->_pending.clear();
+	this->_savepoints.clear();
+	this->_stale = false;
+}
+
+void
+sqlite::materialized_aggregate::on_change(
+	preupdate_database& pdb,
+	action a,
+	const char* schema,
+	const char* table
+) {
+	if (::sqlite3_stricmp(table, this->_table.data()) != 0 ||
+		::sqlite3_stricmp(schema, this->_schema.data()) != 0) {
+		return;
+	}
+	++this->_changes;
+	const auto n = this->_columns.size();
+	try {
+		if (a == action::delete_ || a == action::update) {
+			for (std::size_t i=0; i<n; ++i) {
+				this->_values[i] = pdb.old_value(this->_columns[i]);
+			}
+			this->add(this->changes(), -1);
+		}
+		if (a == action::insert || a == action::update) {
+			for (std::size_t i=0; i<n; ++i) {
+				this->_values[i] = pdb.new_value(this->_columns[i]);
+			}
+			this->add(this->changes(), 1);
+		}
+	} catch (...) {
+		// exceptions must not propagate through SQLite
+		this->_stale = true;
+	}
+}
+
+void
+sqlite::materialized_aggregate::add(group_map& groups, int64 sign) {
+	const auto ngroup = this->_group_by.size();
+	auto& key = this->_key;
+	key.clear();
+	for (std::size_t i=0; i<ngroup; ++i) {
+		append_value(key, this->_values[i].get(), this->_real[i]);
+	}
+	auto result = groups.emplace(key, group());
+	auto& g = result.first->second;
+	if (result.second) {
+		g.keys.reserve(ngroup);
+		for (std::size_t i=0; i<ngroup; ++i) {
+			g.keys.emplace_back(make_value(this->_values[i].get(), this->_real[i]));
+		}
+		g.sums.resize(this->_sums.size());
+	}
+	g.count += sign;
+	for (std::size_t i=0; i<g.sums.size(); ++i) {
+		auto* v = this->_values[ngroup+i].get();
+		// SUM uses the same conversion
+		auto type = data_type(::sqlite3_value_numeric_type(v));
+		if (type == data_type::null) { continue; }
+		if (type == data_type::integer && this->_real[ngroup+i]) {
+			type = data_type::floating_point;
+		}
+		auto& s = g.sums[i];
+		s.count += sign;
+		if (type == data_type::integer) {
+			s.integer = wrap_add(s.integer, int64(uint64(sign)*uint64(::sqlite3_value_int64(v))));
+		} else {
+			s.real += double(sign)*::sqlite3_value_double(v);
+			s.reals += sign;
+		}
+	}
+}
+
+void
+sqlite::materialized_aggregate::on_savepoint(savepoint_event event, int level) {
+	try {
+		auto& sp = this->_savepoints;
+		switch (event) {
+			case savepoint_event::begin:
+				sp.emplace_back(level, group_map());
+				break;
+			case savepoint_event::release:
+				while (!sp.empty() && sp.back().first >= level) {
+					group_map changes(std::move(sp.back().second));
+					sp.pop_back();
+					merge_changes(this->changes(), changes);
+				}
+				break;
+			case savepoint_event::rollback:
+				while (!sp.empty() && sp.back().first >= level) { sp.pop_back(); }
+				break;
+		}
+	} catch (...) {
+		// savepoint hooks must not throw
+		this->_stale = true;
+	}
+}
+
+void
+sqlite::materialized_aggregate::on_statement(statement_event event, types::statement* s) noexcept {
+	auto& marks = this->_statements;
+	auto* db = this->_db.get();
+	if (event == statement_event::begin) {
+		// in autocommit mode the rollback hook discards the changes
+		if (::sqlite3_get_autocommit(db) || ::sqlite3_stmt_readonly(s)) { return; }
+		try {
+			marks.emplace_back(s, this->_changes);
+		} catch (...) {
+			this->_stale = true;
+		}
+		return;
+	}
+	auto first = marks.rbegin();
+	while (first != marks.rend() && first->first != s) { ++first; }
+	if (first == marks.rend()) { return; }
+	const auto changes = first->second;
+	marks.erase(std::next(first).base());
+	// statement rollback resets the number of changes to zero
+	if (this->_changes != changes && !::sqlite3_get_autocommit(db) &&
+		::sqlite3_changes(db) == 0) {
+		this->_stale = true;
+	}
+}
+
+void
+sqlite::materialized_aggregate::commit() {
+	try {
+		while (!this->_savepoints.empty()) {
+			group_map changes(std::move(this->_savepoints.back().second));
+			this->_savepoints.pop_back();
+			merge_changes(this->changes(), changes);
+		}
+	} catch (...) {
+		this->_stale = true;
+	}
+	for (auto& pair : this->_pending) {
+		auto& delta = pair.second;
+		auto result = this->_groups.find(pair.first);
+		if (result == this->_groups.end()) {
+			if (delta.count == 0) { continue; }
+			group g;
+			g.keys = std::move(delta.keys);
+			g.sums.resize(delta.sums.size());
+			result = this->_groups.emplace(pair.first, std::move(g)).first;
+		}
+		auto& g = result->second;
+		g.count += delta.count;
+		if (g.count == 0) { this->_groups.erase(result); continue; }
+		for (std::size_t i=0; i<g.sums.size(); ++i) { merge(g.sums[i], delta.sums[i]); }
+	}
+	this->_pending.clear();
+}
+
+void
+sqlite::materialized_aggregate::rollback() noexcept {
+	this->_pending.clear();
+	this->_savepoints.clear();
+}
+
+sqlite::materialized_aggregate_table::materialized_aggregate_table(
+	connection_base db,
+	int,
+	const char* const*,
+	void* data
+): _aggregate(static_cast<const materialized_aggregate*>(data)) {
+	std::string sql = "CREATE TABLE x(";
+	for (const auto& name : this->_aggregate->group_by()) {
+		sql += format("\"%w\",", name.data()).get();
+	}
+	sql += "count INTEGER";
+	for (const auto& name : this->_aggregate->sums()) {
+		sql += format(",\"sum_%w\"", name.data()).get();
+	}
+	sql += ')';
+	db.declare_virtual_table(sql.data());
+}
+
+int
+sqlite::materialized_aggregate_table::best_index(virtual_table_index* info) {
+	const auto nrows = this->_aggregate->groups().size();
+	info->estimatedRows = int64(nrows);
+	info->estimatedCost = double(nrows);
+	return SQLITE_OK;
+}
+
+int
+sqlite::materialized_aggregate_cursor::filter(int, const char*, int, any_base*) {
+	this->_rows.clear();
+	for (const auto& pair : this->_aggregate->groups()) { this->_rows.emplace_back(pair.second); }
+	this->_position = 0;
+	return SQLITE_OK;
+}
+
+int
+sqlite::materialized_aggregate_cursor::column(virtual_table_context* c, int n) {
+	const auto& g = this->_rows[this->_position];
+	const int ngroup = int(g.keys.size());
+	if (n < ngroup) {
+		const auto& v = g.keys[n];
+		switch (v.type) {
+			case data_type::integer: c->result(v.integer); break;
+			case data_type::floating_point: c->result(v.real); break;
+			case data_type::text: c->result(v.bytes, pass_by_reference); break;
+			case data_type::blob:
+				::sqlite3_result_blob64(c->get(), v.bytes.data(), v.bytes.size(),
+					pass_by_reference);
+				break;
+			default: c->result(nullptr); break;
+		}
+	} else if (n == ngroup) {
+		c->result(g.count);
+	} else if (std::size_t(n-ngroup-1) < g.sums.size()) {
+		const auto& s = g.sums[n-ngroup-1];
+		if (s.null()) { c->result(nullptr); }
+		else if (s.integral()) { c->result(s.integer); }
+		else { c->result(s.to_double()); }
+	} else {
+		c->result(nullptr);
+	}
+	return SQLITE_OK;
+}
+#endif
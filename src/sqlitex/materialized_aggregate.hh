@@ -0,0 +1,217 @@
+#ifndef SQLITEX_MATERIALIZED_AGGREGATE_HH
+#define SQLITEX_MATERIALIZED_AGGREGATE_HH
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+#include <sqlitex/virtual_table.hh>
+
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace sqlite {
+
+	/**
+	\brief <tt>SELECT g..., COUNT(*), SUM(x)... FROM t GROUP BY g...</tt>
+	that is maintained incrementally.
+	\details
+	The groups are computed once by scanning the table, then the preupdate
+	hook subtracts old rows and adds new rows of each change. Changes are
+	accumulated separately for each savepoint of transaction_statements,
+	are discarded when the savepoint is rolled back, and are merged into
+	the groups after the commit completes (see
+	connection::add_commit_listener), so that the groups reflect committed
+	data only. Groups with zero rows are removed. Only changes made by the
+	connection passed to the constructor are seen.
+
+	Values are grouped like SQLite groups them with BINARY collation:
+	integers and reals with integer values are the same key. Integer sums
+	are computed modulo 2^64, so that the result is exact when the final sum
+	fits in 64-bit integer; real sums accumulate rounding errors.
+
+	A statement that fails inside an explicit transaction is rolled back
+	by SQLite without calling any hook. When a statement that changed the
+	table ends with zero \c sqlite3_changes, the aggregate is marked
+	stale and refresh() has to be called after the transaction ends. Raw
+	SQL <tt>ROLLBACK TO</tt> is not seen by the hooks, call refresh()
+	after it. The aggregate must be destroyed before the connection.
+	\code{.cpp}
+	materialized_aggregate totals(db, "orders", {"customer"}, {"amount"});
+	register_materialized_aggregate(db, "order_totals", totals);
+	statement s = db.prepare("SELECT customer, count, sum_amount FROM order_totals");
+	\endcode
+	*/
+	class materialized_aggregate {
+
+	public:
+		/// Group key.
+		struct value {
+			data_type type = data_type::null;
+			int64 integer = 0;
+			double real = 0;
+			/// Text or blob.
+			std::string bytes;
+		};
+
+		/// SUM of one column.
+		struct sum {
+			int64 integer = 0;
+			double real = 0;
+			/// The number of non-NULL values.
+			int64 count = 0;
+			/// The number of non-integer values.
+			int64 reals = 0;
+			/// SUM is NULL when there are no non-NULL values.
+			inline bool null() const noexcept { return this->count == 0; }
+			/// SUM is integer when all values are integers.
+			inline bool integral() const noexcept { return this->reals == 0; }
+			inline double to_double() const noexcept { return double(this->integer) + this->real; }
+		};
+
+		struct group {
+			std::vector<value> keys;
+			int64 count = 0;
+			std::vector<sum> sums;
+		};
+
+		using group_map = std::unordered_map<std::string,group>;
+
+	private:
+		connection& _db;
+		std::string _schema;
+		std::string _table;
+		std::vector<std::string> _group_by;
+		std::vector<std::string> _sums;
+		/// Positions of group-by columns followed by summed columns.
+		std::vector<int> _columns;
+		/// Whether the columns have REAL affinity.
+		std::vector<bool> _real;
+		group_map _groups;
+		/// Changes of the current transaction.
+		group_map _pending;
+		/// Changes made after each open savepoint and its level.
+		std::vector<std::pair<int,group_map>> _savepoints;
+		std::string _key;
+		std::vector<any_base> _values;
+		/// The number of changes of the table seen by the preupdate hook.
+		uint64 _changes = 0;
+		/// The number of changes when each running statement started.
+		std::vector<std::pair<types::statement*,uint64>> _statements;
+		bool _stale = false;
+
+	public:
+
+		/**
+		\throw std::invalid_argument if the table has no such columns or the
+		columns are generated
+		*/
+		materialized_aggregate(
+			connection& db,
+			const char* table,
+			std::vector<std::string> group_by,
+			std::vector<std::string> sums,
+			const char* schema="main"
+		);
+
+		~materialized_aggregate() noexcept;
+
+		materialized_aggregate(const materialized_aggregate&) = delete;
+		materialized_aggregate& operator=(const materialized_aggregate&) = delete;
+
+		/// Committed groups keyed by opaque encoding of the group keys.
+		inline const group_map& groups() const noexcept { return this->_groups; }
+
+		inline const std::vector<std::string>& group_by() const noexcept { return this->_group_by; }
+		inline const std::vector<std::string>& sums() const noexcept { return this->_sums; }
+		inline const std::string& table() const noexcept { return this->_table; }
+		inline const std::string& schema() const noexcept { return this->_schema; }
+
+		/// True if a change could not be applied and refresh() has to be called.
+		inline bool stale() const noexcept { return this->_stale; }
+
+		/// Recompute the groups from the table and discard pending changes.
+		void refresh();
+
+	private:
+		void on_change(preupdate_database& pdb, action a, const char* schema, const char* table);
+		void add(group_map& groups, int64 sign);
+		void on_savepoint(savepoint_event event, int level);
+		void on_statement(statement_event event, types::statement* s) noexcept;
+		void commit();
+		void rollback() noexcept;
+
+		inline group_map&
+		changes() noexcept {
+			return this->_savepoints.empty() ? this->_pending : this->_savepoints.back().second;
+		}
+
+	};
+
+	/**
+	\brief Eponymous read-only virtual table over materialized_aggregate.
+	\details
+	The columns are the group-by columns, \c count and \c sum_<column> for
+	each summed column. Each query reads a copy of the committed groups.
+	*/
+	class materialized_aggregate_table: public virtual_table {
+
+	public:
+		static constexpr const bool eponymous = true;
+
+	private:
+		const materialized_aggregate* _aggregate;
+
+	public:
+
+		materialized_aggregate_table(connection_base db, int argc, const char* const* argv,
+									 void* data);
+
+		int best_index(virtual_table_index* info);
+
+		inline const materialized_aggregate&
+		aggregate() const noexcept {
+			return *this->_aggregate;
+		}
+
+	};
+
+	class materialized_aggregate_cursor: public virtual_table_cursor {
+
+	private:
+		const materialized_aggregate* _aggregate;
+		std::vector<materialized_aggregate::group> _rows;
+		std::size_t _position = 0;
+
+	public:
+
+		inline explicit
+		materialized_aggregate_cursor(materialized_aggregate_table* table) noexcept:
+		_aggregate(&table->aggregate()) {}
+
+		int filter(int idxNum, const char* idxStr, int argc, any_base* argv);
+
+		inline int next() { ++this->_position; return SQLITE_OK; }
+		inline bool eof() const noexcept { return this->_position >= this->_rows.size(); }
+
+		int column(virtual_table_context* c, int n);
+
+		inline int
+		rowid(int64& out) {
+			out = this->_position;
+			return SQLITE_OK;
+		}
+
+	};
+
+	inline void
+	register_materialized_aggregate(connection_base& db, const char* name,
+									const materialized_aggregate& aggregate) {
+		db.virtual_table<materialized_aggregate_table,materialized_aggregate_cursor>(
+			name, const_cast<materialized_aggregate*>(&aggregate));
+	}
+
+}
+#endif
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,196 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <sqlitex/query_cache.hh>
+
+void
+sqlite::cached_result::read(statement& s) {
+	this->_cells.clear();
+	this->_data.clear();
+	this->_ncolumns = s.num_columns();
+	while (s.step() == errc::row) {
+		auto* ptr = s.get();
+		for (int i=0; i<this->_ncolumns; ++i) {
+			cell c{};
+			c.type = s.column_type(i);
+			switch (c.type) {
+				case data_type::integer:
+					c.integer = ::sqlite3_column_int64(ptr, i);
+					break;
+				case data_type::floating_point:
+					c.real = ::sqlite3_column_double(ptr, i);
+					break;
+				case data_type::text:
+				case data_type::blob: {
+					const void* data = c.type == data_type::text
+						? static_cast<const void*>(::sqlite3_column_text(ptr, i))
+						: ::sqlite3_column_blob(ptr, i);
+					c.offset = this->_data.size();
+					c.size = ::sqlite3_column_bytes(ptr, i);
+					this->_data.append(static_cast<const char*>(data), c.size);
+					break;
+				}
+				default:
+					break;
+			}
+			this->_cells.emplace_back(c);
+		}
+	}
+	s.reset();
+}
+
+sqlite::query_cache::query_cache(connection& db, std::size_t max_bytes):
+_db(db), _max_bytes(max_bytes) {
+	this->_version = db.prepare(
+		"SELECT data_version, schema_version "
+		"FROM pragma_data_version(), pragma_schema_version()"
+	);
+	db.add_update_hook(this, [this] (action, const char*, const char* table, int64) {
+		this->invalidate(table);
+	});
+	db.add_rollback_hook(this, [this] () { this->invalidate(); });
+	db.add_savepoint_hook(this, [this] (savepoint_event event, int) {
+		if (event == savepoint_event::rollback) { this->invalidate(); }
+	});
+}
+
+sqlite::query_cache::~query_cache() noexcept {
+	this->_db.remove_update_hook(this);
+	this->_db.remove_rollback_hook(this);
+	this->_db.remove_savepoint_hook(this);
+}
+
+void
+sqlite::query_cache::clear() noexcept {
+	this->_index.clear();
+	this->_lru.clear();
+	this->_bytes = 0;
+}
+
+void
+sqlite::query_cache::invalidate(const char* table) {
+	auto result = this->_tables.find(table);
+	if (result != this->_tables.end()) { ++result->second.generation; }
+}
+
+auto
+sqlite::query_cache::find(const std::string& key) -> const cached_result* {
+	this->check_version();
+	auto result = this->_index.find(key);
+	if (result == this->_index.end()) {
+		++this->_counters.misses;
+		return nullptr;
+	}
+	auto it = result->second;
+	if (!this->valid(*it)) {
+		this->erase(it);
+		++this->_counters.invalidations;
+		++this->_counters.misses;
+		return nullptr;
+	}
+	this->_lru.splice(this->_lru.begin(), this->_lru, it);
+	++this->_counters.hits;
+	return &it->result;
+}
+
+auto
+sqlite::query_cache::prepare(const u8string& sql) -> query_entry& {
+	auto result = this->_queries.find(sql);
+	if (result != this->_queries.end()) { return result->second; }
+	std::vector<std::string> tables;
+	auto saved = this->_db.authorizer();
+	this->_db.authorizer(
+		[&tables,&saved] (action a, const char* a1, const char* a2,
+						  const char* a3, const char* a4) {
+			if (a == action::read && a1) { tables.emplace_back(a1); }
+			return saved ? saved(a, a1, a2, a3, a4) : permission::allow;
+		}
+	);
+	statement s;
+	try {
+		#if defined(SQLITE_PREPARE_PERSISTENT)
+		s = this->_db.prepare(sql, prepare_f::persistent);
+		#else
+		s = this->_db.prepare(sql);
+		#endif
+	} catch (...) {
+		if (saved) { this->_db.authorizer(saved); } else { this->_db.authorizer(nullptr); }
+		throw;
+	}
+	if (saved) { this->_db.authorizer(saved); } else { this->_db.authorizer(nullptr); }
+	if (!s.read_only()) { throw std::invalid_argument("statement is not read-only"); }
+	query_entry q;
+	q.stmt = std::move(s);
+	for (const auto& name : tables) {
+		auto* t = &this->_tables[name];
+		bool found = false;
+		for (auto* existing : q.tables) {
+			if (existing == t) { found = true; break; }
+		}
+		if (!found) { q.tables.emplace_back(t); }
+	}
+	return this->_queries.emplace(sql, std::move(q)).first->second;
+}
+
+auto
+sqlite::query_cache::insert(query_entry& q) -> const cached_result& {
+	result_entry e;
+	e.result.read(q.stmt);
+	e.size = e.result.size_in_bytes() + 2*this->_key.size() + sizeof(result_entry)
+		+ q.tables.size()*sizeof(uint64);
+	if (e.size > this->_max_bytes) {
+		this->_uncached = std::move(e.result);
+		return this->_uncached;
+	}
+	this->shrink(e.size);
+	e.key = this->_key;
+	e.query = &q;
+	e.global_generation = this->_global_generation;
+	e.generations.reserve(q.tables.size());
+	for (auto* t : q.tables) { e.generations.emplace_back(t->generation); }
+	this->_lru.emplace_front(std::move(e));
+	auto it = this->_lru.begin();
+	this->_index[it->key] = it;
+	this->_bytes += it->size;
+	return it->result;
+}
+
+void
+sqlite::query_cache::check_version() {
+	auto& s = this->_version;
+	s.step();
+	int64 data_version = 0, schema_version = 0;
+	s.column(0, data_version);
+	s.column(1, schema_version);
+	s.reset();
+	if (data_version != this->_data_version || schema_version != this->_schema_version) {
+		this->_data_version = data_version;
+		this->_schema_version = schema_version;
+		++this->_global_generation;
+	}
+}
+
+bool
+sqlite::query_cache::valid(const result_entry& e) const noexcept {
+	if (e.global_generation != this->_global_generation) { return false; }
+	const auto n = e.generations.size();
+	for (std::size_t i=0; i<n; ++i) {
+		if (e.query->tables[i]->generation != e.generations[i]) { return false; }
+	}
+	return true;
+}
+
+void
+sqlite::query_cache::erase(lru_iterator it) noexcept {
+	this->_bytes -= it->size;
+	this->_index.erase(it->key);
+	this->_lru.erase(it);
+}
+
+void
+sqlite::query_cache::shrink(std::size_t nbytes) noexcept {
+	while (!this->_lru.empty() && this->_bytes + nbytes > this->_max_bytes) {
+		this->erase(std::prev(this->_lru.end()));
+		++this->_counters.evictions;
+	}
+}
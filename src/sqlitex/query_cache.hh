@@ -0,0 +1,320 @@
+#ifndef SQLITEX_QUERY_CACHE_HH
+#define SQLITEX_QUERY_CACHE_HH
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Rows of a query stored in a compact form.
+	\details
+	Integers and floats are stored inline, text and blobs are stored in a
+	single contiguous buffer.
+	*/
+	class cached_result {
+
+	private:
+		struct cell {
+			data_type type;
+			union { int64 integer; double real; };
+			std::size_t offset;
+			std::size_t size;
+		};
+
+	private:
+		std::vector<cell> _cells;
+		std::string _data;
+		int _ncolumns = 0;
+
+	public:
+
+		cached_result() = default;
+		cached_result(cached_result&&) = default;
+		cached_result& operator=(cached_result&&) = default;
+		cached_result(const cached_result&) = default;
+		cached_result& operator=(const cached_result&) = default;
+
+		/// Steps through all rows of the statement.
+		void read(statement& s);
+
+		inline int num_columns() const noexcept { return this->_ncolumns; }
+
+		inline std::size_t
+		num_rows() const noexcept {
+			return this->_ncolumns == 0 ? 0 : this->_cells.size()/this->_ncolumns;
+		}
+
+		inline bool empty() const noexcept { return this->_cells.empty(); }
+
+		inline std::size_t
+		size_in_bytes() const noexcept {
+			return sizeof(cached_result) + this->_cells.size()*sizeof(cell) + this->_data.size();
+		}
+
+		inline data_type
+		column_type(std::size_t row, int i) const noexcept {
+			return at(row, i).type;
+		}
+
+		template <class Float>
+		inline auto
+		column(std::size_t row, int i, Float& value) const noexcept ->
+		typename std::enable_if<std::is_floating_point<Float>::value>::type {
+			const auto& c = at(row, i);
+			value = static_cast<Float>(
+				c.type == data_type::integer ? double(c.integer) :
+				c.type == data_type::floating_point ? c.real : 0
+			);
+		}
+
+		template <class Integer>
+		inline auto
+		column(std::size_t row, int i, Integer& value) const noexcept ->
+		typename std::enable_if<std::is_integral<Integer>::value>::type {
+			const auto& c = at(row, i);
+			value = static_cast<Integer>(
+				c.type == data_type::integer ? c.integer :
+				c.type == data_type::floating_point ? int64(c.real) : 0
+			);
+		}
+
+		template <class Alloc>
+		inline void
+		column(std::size_t row, int i, basic_u8string<Alloc>& value) const {
+			const auto& c = at(row, i);
+			value.assign(this->_data.data() + c.offset, c.size);
+		}
+
+		inline void
+		column(std::size_t row, int i, blob& value) const {
+			const auto& c = at(row, i);
+			value.assign(this->_data.data() + c.offset, c.size);
+		}
+
+		/// Pointer to text or blob data that is valid while the result is cached.
+		inline const char*
+		data(std::size_t row, int i) const noexcept {
+			return this->_data.data() + at(row, i).offset;
+		}
+
+		inline std::size_t size(std::size_t row, int i) const noexcept { return at(row, i).size; }
+
+	private:
+
+		inline const cell&
+		at(std::size_t row, int i) const noexcept {
+			return this->_cells[row*this->_ncolumns + i];
+		}
+
+	};
+
+	namespace bits {
+
+		inline void
+		append_key(std::string& key, char tag, const void* data, std::size_t n) {
+			key += tag;
+			key.append(reinterpret_cast<const char*>(&n), sizeof(n));
+			key.append(static_cast<const char*>(data), n);
+		}
+
+		template <class Float>
+		inline auto
+		append_key(std::string& key, Float value) ->
+		typename std::enable_if<std::is_floating_point<Float>::value>::type {
+			double tmp = value;
+			append_key(key, 'f', &tmp, sizeof(tmp));
+		}
+
+		template <class Integer>
+		inline auto
+		append_key(std::string& key, Integer value) ->
+		typename std::enable_if<std::is_integral<Integer>::value>::type {
+			int64 tmp = value;
+			append_key(key, 'i', &tmp, sizeof(tmp));
+		}
+
+		inline void
+		append_key(std::string& key, const char* value) {
+			append_key(key, 't', value, std::char_traits<char>::length(value));
+		}
+
+		template <class Alloc>
+		inline void
+		append_key(std::string& key, const basic_u8string<Alloc>& value) {
+			append_key(key, 't', value.data(), value.size());
+		}
+
+		template <class Alloc>
+		inline void
+		append_key(std::string& key, const basic_u16string<Alloc>& value) {
+			append_key(key, 'u', value.data(), value.size()*sizeof(char16_t));
+		}
+
+		inline void
+		append_key(std::string& key, const blob& value) {
+			append_key(key, 'b', value.data(), value.size());
+		}
+
+		inline void
+		append_key(std::string& key, std::nullptr_t) {
+			append_key(key, 'n', nullptr, 0);
+		}
+
+		template <class Clock, class Duration>
+		inline void
+		append_key(std::string& key, const std::chrono::time_point<Clock,Duration>& value) {
+			append_key(key, int64(Clock::to_time_t(value)));
+		}
+
+		inline void append_keys(std::string&) {}
+
+		template <class Head, class ... Tail>
+		inline void
+		append_keys(std::string& key, const Head& head, const Tail& ... tail) {
+			append_key(key, head);
+			append_keys(key, tail...);
+		}
+
+	}
+
+	/**
+	\brief Opt-in cache of read-only query results.
+	\details
+	Results are keyed on SQL and bound parameters. Tables that a query reads
+	are recorded by the authorizer when the statement is prepared, and
+	results are invalidated when the update hook reports a change to any of
+	these tables. Changes made by other connections are detected by
+	\c PRAGMA \c data_version, schema changes by \c PRAGMA \c schema_version.
+	Rollback invalidates everything, so does rollback of savepoint or
+	nested transaction object (see transaction.hh). Raw SQL <tt>ROLLBACK
+	TO</tt> fires no hook, call invalidate() after it.
+
+	The cache adds update, rollback and savepoint hooks to the connection.
+	Changes that do not fire the update hook (WITHOUT ROWID tables, truncate
+	optimisation) are only detected through data version when made by other
+	connections. Queries with non-deterministic functions should not be
+	cached. The cache must be destroyed before the connection.
+	\code{.cpp}
+	query_cache cache(db, 64*1024*1024);
+	const cached_result& r = cache.query("SELECT name FROM t WHERE id=?", id);
+	std::string name;
+	if (r.num_rows() != 0) { r.column(0, 0, name); }
+	\endcode
+	*/
+	class query_cache {
+
+	public:
+		struct counters {
+			uint64 hits = 0;
+			uint64 misses = 0;
+			uint64 evictions = 0;
+			uint64 invalidations = 0;
+			inline double
+			hit_ratio() const noexcept {
+				auto total = this->hits + this->misses;
+				return total == 0 ? 0.0 : double(this->hits)/double(total);
+			}
+		};
+
+	private:
+		struct table_entry { uint64 generation = 0; };
+
+		struct query_entry {
+			statement stmt;
+			std::vector<table_entry*> tables;
+		};
+
+		struct result_entry {
+			std::string key;
+			query_entry* query;
+			std::vector<uint64> generations;
+			uint64 global_generation;
+			cached_result result;
+			std::size_t size;
+		};
+
+		using lru_list = std::list<result_entry>;
+		using lru_iterator = lru_list::iterator;
+
+	private:
+		connection& _db;
+		std::size_t _max_bytes;
+		std::size_t _bytes = 0;
+		std::unordered_map<std::string,query_entry> _queries;
+		std::unordered_map<std::string,table_entry> _tables;
+		std::unordered_map<std::string,lru_iterator> _index;
+		lru_list _lru;
+		statement _version;
+		int64 _data_version = -1;
+		int64 _schema_version = -1;
+		uint64 _global_generation = 0;
+		counters _counters;
+		cached_result _uncached;
+		std::string _key;
+
+	public:
+
+		query_cache(connection& db, std::size_t max_bytes);
+		~query_cache() noexcept;
+
+		query_cache(const query_cache&) = delete;
+		query_cache& operator=(const query_cache&) = delete;
+
+		/**
+		Returns cached result or executes the query and caches its result.
+		The reference is valid until the next call to any non-const method.
+		*/
+		template <class ... Args>
+		inline const cached_result&
+		query(const u8string& sql, const Args& ... args) {
+			this->_key.assign(sql);
+			this->_key += '\0';
+			bits::append_keys(this->_key, args...);
+			auto* r = this->find(this->_key);
+			if (r) { return *r; }
+			auto& q = this->prepare(sql);
+			q.stmt.reset();
+			bind(q.stmt, 1, args...);
+			return this->insert(q);
+		}
+
+		void clear() noexcept;
+
+		/// Invalidate cached results for the table.
+		void invalidate(const char* table);
+
+		/// Invalidate all cached results.
+		inline void invalidate() noexcept { ++this->_global_generation; }
+
+		inline const counters& get_counters() const noexcept { return this->_counters; }
+		inline void reset_counters() noexcept { this->_counters = counters(); }
+		inline std::size_t size_in_bytes() const noexcept { return this->_bytes; }
+		inline std::size_t max_size_in_bytes() const noexcept { return this->_max_bytes; }
+		inline std::size_t size() const noexcept { return this->_lru.size(); }
+
+		inline void
+		max_size_in_bytes(std::size_t rhs) {
+			this->_max_bytes = rhs;
+			this->shrink(0);
+		}
+
+	private:
+		const cached_result* find(const std::string& key);
+		query_entry& prepare(const u8string& sql);
+		const cached_result& insert(query_entry& q);
+		void check_version();
+		bool valid(const result_entry& e) const noexcept;
+		void erase(lru_iterator it) noexcept;
+		void shrink(std::size_t nbytes) noexcept;
+
+	};
+
+}
+
+#endif // vim:filetype=cpp
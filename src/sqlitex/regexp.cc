@@ -0,0 +1,1054 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sqlitex/function.hh>
+#include <sqlitex/regexp.hh>
+
+struct sqlite::regexp::program {
+
+	enum class opcode: unsigned char {
+		/// Consume the byte equal to \c value.
+		byte,
+		/// Consume the byte from the set \c x.
+		set,
+		/// Continue at \c x and \c y.
+		split,
+		/// Continue at \c x.
+		jump,
+		/// Continue at the next instruction if the assertion \c value holds.
+		assertion,
+		match
+	};
+
+	struct instruction {
+		opcode op;
+		unsigned char value;
+		std::uint32_t x;
+		std::uint32_t y;
+	};
+
+	/// Lazily built DFA state: NFA threads at some position of the text.
+	struct state {
+		/// Sorted consuming instructions and end-of-text assertions.
+		std::vector<std::uint32_t> threads;
+		/// One of the threads matches at the end of the text, negative if not computed yet.
+		int end_match = -1;
+	};
+
+	enum state_flags: unsigned char {
+		/// One of the threads reached the match instruction.
+		matched = 1,
+		/// There are no threads.
+		dead = 2
+	};
+
+	std::vector<instruction> instructions;
+	std::vector<std::bitset<256>> sets;
+	/// Word boundaries depend on the next byte, DFA is not used for them.
+	bool word_assertions = false;
+
+	/// DFA cache that is shared by searches.
+	mutable std::mutex mutex;
+	mutable std::vector<state> states;
+	/// States after each byte (256 per state), negative if not computed yet.
+	mutable std::vector<std::int32_t> transitions;
+	mutable std::vector<unsigned char> flags;
+	mutable std::map<std::vector<std::uint32_t>,std::int32_t> index;
+	/// The state with only the threads that start at the current position.
+	mutable std::int32_t idle = -1;
+	/// The first state of the search that starts at the beginning and in the middle of the text.
+	mutable std::int32_t initial[2] = {-1, -1};
+	/// Incremented when the cache is cleared.
+	mutable std::uint64_t generation = 0;
+
+};
+
+namespace {
+
+	using sqlite::u8string_view;
+	using program = sqlite::regexp::program;
+	using opcode = program::opcode;
+
+	enum assertion: unsigned char {
+		text_begin, text_end, word_boundary, not_word_boundary
+	};
+
+	constexpr const std::size_t max_instructions = 1u << 16;
+	constexpr const std::size_t max_states = 512;
+	constexpr const std::uint32_t match_key = UINT32_MAX;
+	constexpr const int max_depth = 256;
+
+	class syntax_error: public std::regex_error {
+
+	private:
+		const char* _message;
+
+	public:
+		inline
+		syntax_error(std::regex_constants::error_type code, const char* message):
+		std::regex_error(code), _message(message) {}
+
+		const char* what() const noexcept override { return this->_message; }
+
+	};
+
+	struct node {
+		enum type_type { empty, byte, set, assertion, concat, alternative, repeat };
+		type_type type = empty;
+		unsigned char value = 0;
+		std::uint32_t set_index = 0;
+		/// Repetition bounds, negative maximum means no limit.
+		int min = 0, max = 0;
+		std::vector<node> children;
+
+		node() = default;
+		inline explicit node(type_type t): type(t) {}
+	};
+
+	inline bool
+	is_word(unsigned char ch) noexcept {
+		return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') ||
+			(ch >= 'A' && ch <= 'Z') || ch == '_';
+	}
+
+	inline int
+	hex_digit(char ch) noexcept {
+		if (ch >= '0' && ch <= '9') { return ch - '0'; }
+		if (ch >= 'a' && ch <= 'f') { return ch - 'a' + 10; }
+		if (ch >= 'A' && ch <= 'F') { return ch - 'A' + 10; }
+		return -1;
+	}
+
+	/// Recursive descent parser of ECMAScript patterns.
+	class parser {
+
+	private:
+		u8string_view _pattern;
+		std::size_t _pos = 0;
+		std::vector<std::bitset<256>>& _sets;
+
+	public:
+
+		inline
+		parser(u8string_view pattern, std::vector<std::bitset<256>>& sets):
+		_pattern(pattern), _sets(sets) {}
+
+		node
+		parse() {
+			auto result = this->alternative(0);
+			if (!this->done()) { throw syntax_error(std::regex_constants::error_paren, "unmatched )"); }
+			return result;
+		}
+
+	private:
+
+		inline bool done() const noexcept { return this->_pos == this->_pattern.size(); }
+		inline char peek() const noexcept { return this->_pattern[this->_pos]; }
+
+		inline bool
+		next_is(char ch) const noexcept {
+			return !this->done() && this->peek() == ch;
+		}
+
+		node
+		alternative(int depth) {
+			if (depth > max_depth) {
+				throw syntax_error(std::regex_constants::error_complexity, "too many nested groups");
+			}
+			node result(node::alternative);
+			result.children.emplace_back(this->concatenation(depth));
+			while (this->next_is('|')) {
+				++this->_pos;
+				result.children.emplace_back(this->concatenation(depth));
+			}
+			if (result.children.size() == 1) { return std::move(result.children.front()); }
+			return result;
+		}
+
+		node
+		concatenation(int depth) {
+			node result(node::concat);
+			while (!this->done() && this->peek() != '|' && this->peek() != ')') {
+				result.children.emplace_back(this->repetition(depth));
+			}
+			return result;
+		}
+
+		node
+		repetition(int depth) {
+			auto atom = this->atom(depth);
+			int min = 0, max = 0;
+			if (!this->quantifier(min, max)) { return atom; }
+			if (atom.type == node::assertion) {
+				throw syntax_error(std::regex_constants::error_badrepeat, "repeated assertion");
+			}
+			// lazy quantifiers match the same texts
+			if (this->next_is('?')) { ++this->_pos; }
+			int dummy;
+			if (!this->done() && this->quantifier(dummy, dummy)) {
+				throw syntax_error(std::regex_constants::error_badrepeat, "nothing to repeat");
+			}
+			node result(node::repeat);
+			result.min = min;
+			result.max = max;
+			result.children.emplace_back(std::move(atom));
+			return result;
+		}
+
+		bool
+		quantifier(int& min, int& max) {
+			if (this->done()) { return false; }
+			switch (this->peek()) {
+				case '*': ++this->_pos; min = 0; max = -1; return true;
+				case '+': ++this->_pos; min = 1; max = -1; return true;
+				case '?': ++this->_pos; min = 0; max = 1; return true;
+				case '{': break;
+				default: return false;
+			}
+			++this->_pos;
+			min = this->number();
+			max = min;
+			if (this->next_is(',')) {
+				++this->_pos;
+				max = this->next_is('}') ? -1 : this->number();
+			}
+			if (!this->next_is('}') || (max >= 0 && max < min)) {
+				throw syntax_error(std::regex_constants::error_badbrace, "invalid repetition count");
+			}
+			++this->_pos;
+			return true;
+		}
+
+		int
+		number() {
+			int n = 0;
+			const auto first = this->_pos;
+			while (!this->done() && this->peek() >= '0' && this->peek() <= '9') {
+				n = n*10 + (this->peek() - '0');
+				if (n > int(max_instructions)) {
+					throw syntax_error(std::regex_constants::error_complexity, "repetition count is too large");
+				}
+				++this->_pos;
+			}
+			if (first == this->_pos) {
+				throw syntax_error(std::regex_constants::error_badbrace, "invalid repetition count");
+			}
+			return n;
+		}
+
+		node
+		atom(int depth) {
+			const char ch = this->peek();
+			++this->_pos;
+			switch (ch) {
+				case '(': {
+					if (this->next_is('?')) {
+						++this->_pos;
+						if (!this->next_is(':')) {
+							throw syntax_error(std::regex_constants::error_complexity,
+								"lookahead assertions are not supported");
+						}
+						++this->_pos;
+					}
+					auto result = this->alternative(depth+1);
+					if (!this->next_is(')')) {
+						throw syntax_error(std::regex_constants::error_paren, "unmatched (");
+					}
+					++this->_pos;
+					return result;
+				}
+				case '[': return this->bracket();
+				case '.': {
+					std::bitset<256> s;
+					s.set();
+					s.reset('\n');
+					s.reset('\r');
+					return this->make_set(s);
+				}
+				case '^': return make_assertion(text_begin);
+				case '$': return make_assertion(text_end);
+				case '*': case '+': case '?': case '{':
+					throw syntax_error(std::regex_constants::error_badrepeat, "nothing to repeat");
+				case '\\': return this->escape();
+				default: return make_byte(ch);
+			}
+		}
+
+		node
+		escape() {
+			if (this->done()) { throw syntax_error(std::regex_constants::error_escape, "trailing \\"); }
+			const char ch = this->peek();
+			std::bitset<256> s;
+			if (class_escape(ch, s)) {
+				++this->_pos;
+				return this->make_set(s);
+			}
+			switch (ch) {
+				case 'b': ++this->_pos; return make_assertion(word_boundary);
+				case 'B': ++this->_pos; return make_assertion(not_word_boundary);
+				case 'u': {
+					++this->_pos;
+					const auto code = this->hex(4);
+					// UTF-8 bytes of the code point
+					node result(node::concat);
+					if (code < 0x80) {
+						result.children.emplace_back(make_byte(char(code)));
+					} else if (code < 0x800) {
+						result.children.emplace_back(make_byte(char(0xc0 | (code >> 6))));
+						result.children.emplace_back(make_byte(char(0x80 | (code & 0x3f))));
+					} else {
+						result.children.emplace_back(make_byte(char(0xe0 | (code >> 12))));
+						result.children.emplace_back(make_byte(char(0x80 | ((code >> 6) & 0x3f))));
+						result.children.emplace_back(make_byte(char(0x80 | (code & 0x3f))));
+					}
+					return result;
+				}
+				default: return make_byte(char(this->character_escape()));
+			}
+		}
+
+		/// Escapes that are the same inside and outside of brackets.
+		unsigned char
+		character_escape() {
+			const char ch = this->peek();
+			++this->_pos;
+			switch (ch) {
+				case 'n': return '\n';
+				case 'r': return '\r';
+				case 't': return '\t';
+				case 'f': return '\f';
+				case 'v': return '\v';
+				case '0':
+					if (!this->done() && this->peek() >= '0' && this->peek() <= '9') { break; }
+					return 0;
+				case 'x': return static_cast<unsigned char>(this->hex(2));
+				case 'c':
+					if (!this->done() && std::isalpha(static_cast<unsigned char>(this->peek()))) {
+						return static_cast<unsigned char>(this->_pattern[this->_pos++] % 32);
+					}
+					break;
+				default:
+					if (ch >= '1' && ch <= '9') {
+						throw syntax_error(std::regex_constants::error_backref,
+							"back-references are not supported");
+					}
+					if (!std::isalnum(static_cast<unsigned char>(ch))) {
+						return static_cast<unsigned char>(ch);
+					}
+			}
+			throw syntax_error(std::regex_constants::error_escape, "invalid escape");
+		}
+
+		unsigned
+		hex(int n) {
+			unsigned code = 0;
+			for (int i=0; i<n; ++i) {
+				const int d = this->done() ? -1 : hex_digit(this->peek());
+				if (d < 0) { throw syntax_error(std::regex_constants::error_escape, "invalid escape"); }
+				code = code*16 + unsigned(d);
+				++this->_pos;
+			}
+			return code;
+		}
+
+		static bool
+		class_escape(char ch, std::bitset<256>& s) {
+			switch (ch) {
+				case 'd': case 'D':
+					for (int i='0'; i<='9'; ++i) { s.set(i); }
+					break;
+				case 'w': case 'W':
+					for (int i=0; i<256; ++i) { if (is_word(i)) { s.set(i); } }
+					break;
+				case 's': case 'S':
+					for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) { s.set(c); }
+					break;
+				default: return false;
+			}
+			if (std::isupper(static_cast<unsigned char>(ch))) { s.flip(); }
+			return true;
+		}
+
+		node
+		bracket() {
+			std::bitset<256> s;
+			bool negate = false;
+			if (this->next_is('^')) { negate = true; ++this->_pos; }
+			while (!this->next_is(']')) {
+				if (this->done()) { throw syntax_error(std::regex_constants::error_brack, "unmatched ["); }
+				int first = 0;
+				if (!this->bracket_atom(s, first)) { continue; }
+				if (this->next_is('-') && this->_pos+1 < this->_pattern.size() &&
+					this->_pattern[this->_pos+1] != ']') {
+					++this->_pos;
+					int last = 0;
+					if (!this->bracket_atom(s, last) || last < first) {
+						throw syntax_error(std::regex_constants::error_range, "invalid range");
+					}
+					for (int i=first; i<=last; ++i) { s.set(i); }
+				} else {
+					s.set(first);
+				}
+			}
+			++this->_pos;
+			if (negate) { s.flip(); }
+			return this->make_set(s);
+		}
+
+		/// Returns false if the atom is a class that was added to the set.
+		bool
+		bracket_atom(std::bitset<256>& s, int& ch) {
+			ch = static_cast<unsigned char>(this->peek());
+			++this->_pos;
+			if (ch == '[' && this->next_is(':')) { return this->named_class(s); }
+			if (ch != '\\') { return true; }
+			if (this->done()) { throw syntax_error(std::regex_constants::error_escape, "trailing \\"); }
+			std::bitset<256> t;
+			if (class_escape(this->peek(), t)) {
+				++this->_pos;
+				s |= t;
+				return false;
+			}
+			if (this->peek() == 'b') { ++this->_pos; ch = '\b'; return true; }
+			if (this->peek() == 'u') {
+				++this->_pos;
+				const auto code = this->hex(4);
+				if (code >= 0x80) {
+					throw syntax_error(std::regex_constants::error_range,
+						"non-ASCII characters are not supported in brackets");
+				}
+				ch = int(code);
+				return true;
+			}
+			ch = this->character_escape();
+			return true;
+		}
+
+		bool
+		named_class(std::bitset<256>& s) {
+			static const struct { const char* name; int (*test)(int); } classes[] = {
+				{"alnum", std::isalnum}, {"alpha", std::isalpha}, {"blank", std::isblank},
+				{"cntrl", std::iscntrl}, {"digit", std::isdigit}, {"graph", std::isgraph},
+				{"lower", std::islower}, {"print", std::isprint}, {"punct", std::ispunct},
+				{"space", std::isspace}, {"upper", std::isupper}, {"xdigit", std::isxdigit},
+			};
+			const auto first = this->_pos + 1;
+			auto last = first;
+			while (last+1 < this->_pattern.size() &&
+				!(this->_pattern[last] == ':' && this->_pattern[last+1] == ']')) {
+				++last;
+			}
+			if (last+1 >= this->_pattern.size()) {
+				throw syntax_error(std::regex_constants::error_brack, "unmatched [:");
+			}
+			const auto* name = this->_pattern.data() + first;
+			const auto n = last - first;
+			for (const auto& c : classes) {
+				if (std::strlen(c.name) == n && std::memcmp(name, c.name, n) == 0) {
+					for (int i=0; i<128; ++i) { if (c.test(i)) { s.set(i); } }
+					this->_pos = last + 2;
+					return false;
+				}
+			}
+			throw syntax_error(std::regex_constants::error_ctype, "unknown character class");
+		}
+
+		node
+		make_set(const std::bitset<256>& s) {
+			node result(node::set);
+			result.set_index = std::uint32_t(this->_sets.size());
+			this->_sets.emplace_back(s);
+			return result;
+		}
+
+		static node
+		make_byte(char ch) {
+			node result(node::byte);
+			result.value = static_cast<unsigned char>(ch);
+			return result;
+		}
+
+		static node
+		make_assertion(assertion a) {
+			node result(node::assertion);
+			result.value = a;
+			return result;
+		}
+
+	};
+
+	/// Emits Thompson NFA instructions for the syntax tree.
+	class compiler {
+
+	private:
+		std::vector<program::instruction>& _code;
+
+	public:
+		bool word_assertions = false;
+
+		inline explicit
+		compiler(std::vector<program::instruction>& code): _code(code) {}
+
+		void
+		emit(const node& n) {
+			switch (n.type) {
+				case node::empty: break;
+				case node::byte: this->push(opcode::byte, n.value); break;
+				case node::set: this->push(opcode::set, 0, n.set_index); break;
+				case node::assertion:
+					this->push(opcode::assertion, n.value);
+					if (n.value != text_begin && n.value != text_end) { this->word_assertions = true; }
+					break;
+				case node::concat:
+					for (const auto& child : n.children) { this->emit(child); }
+					break;
+				case node::alternative: {
+					std::vector<std::size_t> jumps;
+					for (std::size_t i=0; i+1<n.children.size(); ++i) {
+						const auto split = this->push(opcode::split);
+						this->_code[split].x = this->pc();
+						this->emit(n.children[i]);
+						jumps.emplace_back(this->push(opcode::jump));
+						this->_code[split].y = this->pc();
+					}
+					this->emit(n.children.back());
+					for (auto j : jumps) { this->_code[j].x = this->pc(); }
+					break;
+				}
+				case node::repeat: {
+					const auto& child = n.children.front();
+					for (int i=0; i<n.min; ++i) { this->emit(child); }
+					if (n.max < 0) {
+						const auto split = this->push(opcode::split);
+						this->_code[split].x = this->pc();
+						this->emit(child);
+						this->push(opcode::jump, 0, std::uint32_t(split));
+						this->_code[split].y = this->pc();
+					} else {
+						std::vector<std::size_t> splits;
+						for (int i=n.min; i<n.max; ++i) {
+							const auto split = this->push(opcode::split);
+							this->_code[split].x = this->pc();
+							splits.emplace_back(split);
+							this->emit(child);
+						}
+						for (auto s : splits) { this->_code[s].y = this->pc(); }
+					}
+					break;
+				}
+			}
+		}
+
+		inline std::uint32_t pc() const noexcept { return std::uint32_t(this->_code.size()); }
+
+		inline std::size_t
+		push(opcode op, unsigned char value=0, std::uint32_t x=0) {
+			if (this->_code.size() == max_instructions) {
+				throw syntax_error(std::regex_constants::error_complexity, "pattern is too large");
+			}
+			this->_code.push_back(program::instruction{op, value, x, 0});
+			return this->_code.size() - 1;
+		}
+
+	};
+
+	/// Set of instruction indices with constant time insertion and clearing.
+	class thread_list {
+
+	private:
+		std::vector<std::uint32_t> _dense;
+		std::vector<std::uint32_t> _sparse;
+		std::size_t _size = 0;
+
+	public:
+
+		inline void
+		reset(std::size_t n) {
+			if (this->_sparse.size() < n) {
+				this->_sparse.resize(n);
+				this->_dense.resize(n);
+			}
+			this->_size = 0;
+		}
+
+		inline bool
+		contains(std::uint32_t pc) const noexcept {
+			const auto i = this->_sparse[pc];
+			return i < this->_size && this->_dense[i] == pc;
+		}
+
+		inline void
+		insert(std::uint32_t pc) noexcept {
+			this->_sparse[pc] = std::uint32_t(this->_size);
+			this->_dense[this->_size++] = pc;
+		}
+
+		inline bool empty() const noexcept { return this->_size == 0; }
+
+		inline void
+		swap(thread_list& rhs) noexcept {
+			this->_dense.swap(rhs._dense);
+			this->_sparse.swap(rhs._sparse);
+			std::swap(this->_size, rhs._size);
+		}
+		inline const std::uint32_t* begin() const noexcept { return this->_dense.data(); }
+		inline const std::uint32_t* end() const noexcept { return this->_dense.data() + this->_size; }
+
+	};
+
+	inline bool
+	is_special(char ch) noexcept {
+		return std::strchr("\\^$.*+?()[]{}|", ch) != nullptr;
+	}
+
+	inline bool
+	is_escapable(char ch) noexcept {
+		return ch != 0 && std::strchr("\\^$.*+?()[]{}|/-", ch) != nullptr;
+	}
+
+	/// Returns true if the pattern has alternatives.
+	bool
+	has_alternatives(u8string_view pattern) noexcept {
+		for (std::size_t i=0; i<pattern.size(); ++i) {
+			if (pattern[i] == '\\') { ++i; continue; }
+			if (pattern[i] == '|') { return true; }
+		}
+		return false;
+	}
+
+	#if defined(__SSE2__)
+	inline __m128i
+	load16(const char* p) noexcept {
+		__m128i x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+	#endif
+
+	/// Position of the first occurrence of the \p needle, nullptr if not found.
+	const char*
+	find(const char* first, std::size_t n, const char* needle, std::size_t m) noexcept {
+		if (m == 0) { return first; }
+		if (m > n) { return nullptr; }
+		if (m == 1) { return static_cast<const char*>(std::memchr(first, needle[0], n)); }
+		std::size_t i = 0;
+		const std::size_t last = n - m;
+		#if defined(__SSE2__)
+		// compare the first and the last bytes of the needle at 16 positions at once
+		const auto head = _mm_set1_epi8(needle[0]);
+		const auto tail = _mm_set1_epi8(needle[m-1]);
+		for (; i+16 <= last+1; i += 16) {
+			auto mask = unsigned(_mm_movemask_epi8(_mm_and_si128(
+				_mm_cmpeq_epi8(load16(first+i), head),
+				_mm_cmpeq_epi8(load16(first+i+m-1), tail)
+			)));
+			while (mask != 0) {
+				const auto j = i + __builtin_ctz(mask);
+				if (std::memcmp(first+j+1, needle+1, m-2) == 0) { return first+j; }
+				mask &= mask-1;
+			}
+		}
+		#endif
+		while (i <= last) {
+			auto* p = static_cast<const char*>(std::memchr(first+i, needle[0], last+1-i));
+			if (!p) { return nullptr; }
+			if (std::memcmp(p+1, needle+1, m-1) == 0) { return p; }
+			i = (p - first) + 1;
+		}
+		return nullptr;
+	}
+
+	inline bool
+	starts_with(u8string_view text, const std::string& s) noexcept {
+		return text.size() >= s.size() && std::memcmp(text.data(), s.data(), s.size()) == 0;
+	}
+
+	inline bool
+	ends_with(u8string_view text, const std::string& s) noexcept {
+		return text.size() >= s.size() &&
+			std::memcmp(text.data() + text.size() - s.size(), s.data(), s.size()) == 0;
+	}
+
+	/// Memory that is reused by subsequent searches on the same thread.
+	struct workspace {
+		thread_list current;
+		thread_list next;
+		std::vector<std::uint32_t> stack;
+		std::vector<std::uint32_t> key;
+	};
+
+	/// What assertions see at some position of the text.
+	struct context {
+		bool begin;
+		bool end;
+		/// The byte before and after the position, negative if there is none.
+		int before;
+		int after;
+	};
+
+	/// Position that is not at the beginning or the end of the text.
+	constexpr const context middle{false, false, -1, -1};
+
+	/// Simulates NFA on the text, or runs DFA that is built from the NFA on demand.
+	class machine {
+
+	private:
+		const program& _program;
+		const char* _first;
+		const char* _last;
+		workspace& _workspace;
+
+	public:
+
+		inline
+		machine(const program& p, const char* first, const char* last, workspace& w):
+		_program(p), _first(first), _last(last), _workspace(w) {}
+
+		/// Returns true if there is a match that starts at \p start or later.
+		bool
+		search(const char* start, bool anchored, const std::string& literal) {
+			const auto& p = this->_program;
+			if (!p.word_assertions) {
+				// another thread uses the cache
+				std::unique_lock<std::mutex> lock(p.mutex, std::try_to_lock);
+				if (lock.owns_lock()) { return this->dfa_search(start, anchored, literal); }
+			}
+			return this->nfa_search(start, anchored, literal);
+		}
+
+	private:
+
+		bool
+		nfa_search(const char* start, bool anchored, const std::string& literal) {
+			const auto n = this->_program.instructions.size();
+			auto& current = this->_workspace.current;
+			auto& next = this->_workspace.next;
+			current.reset(n);
+			for (const char* p=start; ; ++p) {
+				if (!anchored || p == start) {
+					if (current.empty() && !anchored && !literal.empty() && p != start) {
+						// the next match can not start before the next occurrence of the literal
+						p = find(p, std::size_t(this->_last - p), literal.data(), literal.size());
+						if (!p) { return false; }
+					}
+					if (this->add(current, 0, this->at(p))) { return true; }
+				} else if (current.empty()) {
+					return false;
+				}
+				if (p == this->_last) { return false; }
+				const auto ch = static_cast<unsigned char>(*p);
+				const auto ctx = this->at(p+1);
+				next.reset(n);
+				for (auto pc : current) {
+					if (this->consumes(pc, ch) && this->add(next, pc+1, ctx)) { return true; }
+				}
+				current.swap(next);
+			}
+		}
+
+		bool
+		dfa_search(const char* start, bool anchored, const std::string& literal) {
+			const auto& prog = this->_program;
+			const bool skip = !anchored && !literal.empty();
+			if (skip && prog.idle < 0) {
+				auto& list = this->reset_list();
+				prog.idle = this->find_state(list, this->add(list, 0, middle));
+			}
+			auto s = this->initial_state(start);
+			auto idle = skip ? prog.idle : -1;
+			const auto generation = prog.generation;
+			const auto* transitions = prog.transitions.data();
+			const auto* flags = prog.flags.data();
+			const char* last = this->_last;
+			for (const char* p=start; ; ++p) {
+				if (flags[s] != 0) { return (flags[s] & program::matched) != 0; }
+				if (p == last) { return this->end_match(s); }
+				if (s == idle) {
+					// the next match can not start before the next occurrence of the literal
+					p = find(p, std::size_t(last - p), literal.data(), literal.size());
+					if (!p) { return false; }
+				}
+				const auto ch = static_cast<unsigned char>(*p);
+				const auto t = transitions[std::size_t(s)*256 + ch];
+				if (t >= 0) { s = t; continue; }
+				s = this->transition(s, ch, anchored);
+				transitions = prog.transitions.data();
+				flags = prog.flags.data();
+				if (generation != prog.generation) { idle = -1; }
+			}
+		}
+
+		std::int32_t
+		initial_state(const char* start) {
+			const auto& prog = this->_program;
+			auto& list = this->reset_list();
+			if (start == this->_last) { return this->find_state(list, this->add(list, 0, this->at(start))); }
+			const bool begin = start == this->_first;
+			auto& s = prog.initial[begin ? 0 : 1];
+			if (s < 0) {
+				const context ctx{begin, false, -1, -1};
+				const auto t = this->find_state(list, this->add(list, 0, ctx));
+				s = t;
+			}
+			return s;
+		}
+
+		std::int32_t
+		transition(std::int32_t s, unsigned char ch, bool anchored) {
+			const auto& prog = this->_program;
+			auto& list = this->reset_list();
+			bool matched = false;
+			for (auto pc : prog.states[s].threads) {
+				if (this->consumes(pc, ch) && this->add(list, pc+1, middle)) {
+					matched = true;
+					break;
+				}
+			}
+			if (!matched && !anchored) { matched = this->add(list, 0, middle); }
+			const auto generation = prog.generation;
+			const auto t = this->find_state(list, matched);
+			if (generation == prog.generation) { prog.transitions[std::size_t(s)*256 + ch] = t; }
+			return t;
+		}
+
+		/// Index of the state with the threads from the list. Clears the cache if it is full.
+		std::int32_t
+		find_state(const thread_list& list, bool matched) {
+			const auto& prog = this->_program;
+			auto& key = this->_workspace.key;
+			key.clear();
+			if (matched) {
+				key.emplace_back(match_key);
+			} else {
+				for (auto pc : list) {
+					const auto& in = prog.instructions[pc];
+					if (in.op == opcode::byte || in.op == opcode::set ||
+						(in.op == opcode::assertion && in.value == text_end)) {
+						key.emplace_back(pc);
+					}
+				}
+				std::sort(key.begin(), key.end());
+			}
+			auto result = prog.index.find(key);
+			if (result != prog.index.end()) { return result->second; }
+			if (prog.states.size() == max_states) {
+				prog.states.clear();
+				prog.transitions.clear();
+				prog.flags.clear();
+				prog.index.clear();
+				prog.idle = -1;
+				prog.initial[0] = -1;
+				prog.initial[1] = -1;
+				++prog.generation;
+			}
+			const auto s = std::int32_t(prog.states.size());
+			prog.states.emplace_back();
+			prog.transitions.resize(prog.transitions.size() + 256, -1);
+			prog.flags.emplace_back(
+				matched ? program::matched : (key.empty() ? program::dead : 0));
+			if (!matched) { prog.states.back().threads = key; }
+			prog.index.emplace(key, s);
+			return s;
+		}
+
+		bool
+		end_match(std::int32_t s) {
+			const auto& prog = this->_program;
+			auto& st = prog.states[s];
+			if (st.end_match < 0) {
+				auto& list = this->reset_list();
+				const context end{false, true, -1, -1};
+				st.end_match = 0;
+				for (auto pc : st.threads) {
+					const auto& in = prog.instructions[pc];
+					if (in.op == opcode::assertion && this->add(list, pc+1, end)) {
+						st.end_match = 1;
+						break;
+					}
+				}
+			}
+			return st.end_match == 1;
+		}
+
+		inline thread_list&
+		reset_list() {
+			auto& list = this->_workspace.current;
+			list.reset(this->_program.instructions.size());
+			return list;
+		}
+
+		inline context
+		at(const char* p) const noexcept {
+			return context{
+				p == this->_first,
+				p == this->_last,
+				p == this->_first ? -1 : static_cast<unsigned char>(p[-1]),
+				p == this->_last ? -1 : static_cast<unsigned char>(*p),
+			};
+		}
+
+		inline bool
+		consumes(std::uint32_t pc, unsigned char ch) const noexcept {
+			const auto& in = this->_program.instructions[pc];
+			return (in.op == opcode::byte && in.value == ch) ||
+				(in.op == opcode::set && this->_program.sets[in.x][ch]);
+		}
+
+		/// Adds the instruction and the instructions that are reachable without consuming a byte.
+		bool
+		add(thread_list& list, std::uint32_t pc, const context& ctx) {
+			auto& stack = this->_workspace.stack;
+			stack.clear();
+			stack.emplace_back(pc);
+			while (!stack.empty()) {
+				pc = stack.back();
+				stack.pop_back();
+				if (list.contains(pc)) { continue; }
+				list.insert(pc);
+				const auto& in = this->_program.instructions[pc];
+				switch (in.op) {
+					case opcode::match: return true;
+					case opcode::jump: stack.emplace_back(in.x); break;
+					case opcode::split:
+						stack.emplace_back(in.y);
+						stack.emplace_back(in.x);
+						break;
+					case opcode::assertion:
+						if (holds(in.value, ctx)) { stack.emplace_back(pc+1); }
+						break;
+					case opcode::byte:
+					case opcode::set:
+						break;
+				}
+			}
+			return false;
+		}
+
+		inline static bool
+		holds(unsigned char a, const context& ctx) noexcept {
+			switch (a) {
+				case text_begin: return ctx.begin;
+				case text_end: return ctx.end;
+				default: {
+					const bool before = ctx.before >= 0 && is_word(ctx.before);
+					const bool after = ctx.after >= 0 && is_word(ctx.after);
+					return (before != after) == (a == word_boundary);
+				}
+			}
+		}
+
+	};
+
+	inline u8string_view
+	text_value(sqlite::types::value* v) noexcept {
+		auto* data = reinterpret_cast<const char*>(::sqlite3_value_text(v));
+		return u8string_view(data, ::sqlite3_value_bytes(v));
+	}
+
+	void
+	regexp_function(sqlite::types::context* ctx, int, sqlite::types::value** args) noexcept {
+		using sqlite::regexp;
+		sqlite::context c(ctx);
+		try {
+			if (::sqlite3_value_type(args[0]) == SQLITE_NULL ||
+				::sqlite3_value_type(args[1]) == SQLITE_NULL) {
+				c.result(nullptr);
+				return;
+			}
+			auto* re = c.metadata<regexp>(0);
+			std::unique_ptr<regexp> compiled;
+			if (!re) {
+				compiled.reset(new regexp(text_value(args[0])));
+				re = compiled.get();
+			}
+			c.result(int(re->search(text_value(args[1]))));
+			// SQLite may destroy the object right away
+			if (compiled) { c.metadata(0, compiled.release(), sqlite::bits::destroy<regexp>); }
+		} catch (const std::regex_error& err) {
+			c.error(std::string("invalid regular expression: ") + err.what());
+		} catch (...) {
+			sqlite::bits::result_error(c);
+		}
+	}
+
+}
+
+sqlite::regexp::regexp(u8string_view pattern) {
+	std::size_t i = 0;
+	const auto n = pattern.size();
+	const bool alternatives = has_alternatives(pattern);
+	if (!alternatives && i < n && pattern[i] == '^') { this->_anchored = true; ++i; }
+	// the longest literal at the start of the pattern
+	while (i < n) {
+		const char ch = pattern[i];
+		if (ch == '\\' && i+1 < n && is_escapable(pattern[i+1])) {
+			this->_literal += pattern[i+1];
+			i += 2;
+			continue;
+		}
+		if (is_special(ch)) { break; }
+		this->_literal += ch;
+		++i;
+	}
+	const bool optional = i < n && (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '{');
+	if (optional && !this->_literal.empty()) {
+		// the last character may not be present in the match
+		this->_literal.pop_back();
+	}
+	if (alternatives) {
+		this->_literal.clear();
+	} else if (!optional && i == n) {
+		this->_kind = this->_anchored ? kind::prefix : kind::contains;
+		return;
+	} else if (!optional && i+1 == n && pattern[i] == '$') {
+		this->_kind = this->_anchored ? kind::equals : kind::suffix;
+		return;
+	}
+	std::shared_ptr<program> p(new program);
+	compiler c(p->instructions);
+	c.emit(parser(pattern, p->sets).parse());
+	c.push(program::opcode::match);
+	p->word_assertions = c.word_assertions;
+	this->_program = std::move(p);
+}
+
+bool
+sqlite::regexp::search(u8string_view text) const {
+	const auto& literal = this->_literal;
+	switch (this->_kind) {
+		case kind::contains:
+			return find(text.data(), text.size(), literal.data(), literal.size()) != nullptr;
+		case kind::prefix: return starts_with(text, literal);
+		case kind::suffix: return ends_with(text, literal);
+		case kind::equals: return text.size() == literal.size() && starts_with(text, literal);
+		case kind::expression: break;
+	}
+	const char* first = text.data();
+	const char* last = first + text.size();
+	const char* start = first;
+	if (this->_anchored) {
+		if (!starts_with(text, literal)) { return false; }
+	} else if (!literal.empty()) {
+		// the match can not start before the first occurrence of the literal
+		start = find(first, text.size(), literal.data(), literal.size());
+		if (!start) { return false; }
+	}
+	static thread_local workspace w;
+	return machine(*this->_program, first, last, w).search(start, this->_anchored, literal);
+}
+
+void
+sqlite::register_regexp(connection_base& db, const char* name) {
+	db.scalar_function(regexp_function, name, 2);
+}
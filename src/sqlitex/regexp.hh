@@ -0,0 +1,81 @@
+#ifndef SQLITEX_REGEXP_HH
+#define SQLITEX_REGEXP_HH
+
+#include <memory>
+#include <regex>
+#include <string>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Compiled regular expression with literal prefilter.
+	\details
+	The pattern uses ECMAScript syntax and matches the bytes of UTF-8
+	text. Back-references and lookahead assertions are not supported.
+	The pattern is compiled to a Thompson NFA that is simulated without
+	backtracking or recursion, so that the time is linear in the length
+	of the text and the stack usage does not depend on it. The states
+	of the equivalent DFA are built lazily during the search and cached
+	in the compiled pattern (up to 512 states); patterns with word
+	boundaries and searches that run concurrently with another search
+	of the same pattern use the NFA directly.
+
+	The literal that every match starts with is extracted from the
+	pattern and searched 16 bytes at a time before running the NFA.
+	Patterns that are plain literals (optionally anchored with \c ^ and
+	\c $) do not use the NFA at all.
+	*/
+	class regexp {
+
+	public:
+		enum class kind {
+			/// The literal is searched for, then the expression is matched.
+			expression,
+			/// The pattern is the literal itself.
+			contains,
+			/// The pattern is \c ^literal.
+			prefix,
+			/// The pattern is \c literal$.
+			suffix,
+			/// The pattern is \c ^literal$.
+			equals
+		};
+
+		/// Compiled NFA.
+		struct program;
+
+	private:
+		std::shared_ptr<const program> _program;
+		/// The literal that every match starts with.
+		std::string _literal;
+		kind _kind = kind::expression;
+		/// The match has to start at the beginning of the text.
+		bool _anchored = false;
+
+	public:
+
+		/// \throw std::regex_error if the pattern is malformed or not supported
+		explicit regexp(u8string_view pattern);
+
+		/// Returns true if the pattern matches any part of the \p text.
+		bool search(u8string_view text) const;
+
+		inline const std::string& literal() const noexcept { return this->_literal; }
+		inline kind type() const noexcept { return this->_kind; }
+
+	};
+
+	/**
+	Register \c regexp(pattern,text) function that implements
+	<code>text REGEXP pattern</code> operator. The compiled pattern is
+	cached for each statement with \c sqlite3_set_auxdata, so that the
+	pattern is compiled once per statement instead of once per row when it
+	is a constant or a bound parameter.
+	*/
+	void register_regexp(connection_base& db, const char* name="regexp");
+
+}
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,414 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <sqlitex/hash.hh>
+#include <sqlitex/replication_log.hh>
+#include <sqlitex/transaction.hh>
+
+#if defined(SQLITE_ENABLE_SESSION)
+namespace {
+
+	using sqlite::int64;
+	using sqlite::uint64;
+
+	constexpr const std::size_t header_size = 32;
+	constexpr const std::uint32_t magic = 0x53435153; // "SQCS"
+
+	struct header {
+		std::uint32_t magic;
+		std::uint32_t checksum;
+		uint64 sequence;
+		int64 timestamp;
+		uint64 size;
+	};
+
+	inline void
+	store(char* p, uint64 x, int n) noexcept {
+		for (int i=0; i<n; ++i) { p[i] = char(x >> (8*i)); }
+	}
+
+	inline uint64
+	load(const char* p, int n) noexcept {
+		uint64 x = 0;
+		for (int i=0; i<n; ++i) { x |= uint64(static_cast<unsigned char>(p[i])) << (8*i); }
+		return x;
+	}
+
+	inline void
+	encode(const header& h, char* p) noexcept {
+		store(p, h.magic, 4);
+		store(p+4, h.checksum, 4);
+		store(p+8, h.sequence, 8);
+		store(p+16, uint64(h.timestamp), 8);
+		store(p+24, h.size, 8);
+	}
+
+	inline header
+	decode(const char* p) noexcept {
+		header h;
+		h.magic = std::uint32_t(load(p, 4));
+		h.checksum = std::uint32_t(load(p+4, 4));
+		h.sequence = load(p+8, 8);
+		h.timestamp = int64(load(p+16, 8));
+		h.size = load(p+24, 8);
+		return h;
+	}
+
+	[[noreturn]] inline void
+	throw_errno() {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	[[noreturn]] inline void
+	throw_corrupt() {
+		throw std::system_error(SQLITE_CORRUPT, sqlite::sqlite_category);
+	}
+
+	/// Read exactly \p n bytes, fewer only at the end of file.
+	std::size_t
+	read_at(int fd, void* data, std::size_t n, int64 offset) {
+		std::size_t nread = 0;
+		while (nread != n) {
+			auto ret = ::pread(fd, static_cast<char*>(data)+nread, n-nread, offset+nread);
+			if (ret == -1) {
+				if (errno == EINTR) { continue; }
+				throw_errno();
+			}
+			if (ret == 0) { break; }
+			nread += ret;
+		}
+		return nread;
+	}
+
+	void
+	write_all(int fd, struct ::iovec* iov, int niov) {
+		while (niov != 0) {
+			auto ret = ::writev(fd, iov, niov);
+			if (ret == -1) {
+				if (errno == EINTR) { continue; }
+				throw_errno();
+			}
+			std::size_t nwritten = ret;
+			while (niov != 0 && nwritten >= iov->iov_len) {
+				nwritten -= iov->iov_len;
+				++iov, --niov;
+			}
+			if (niov != 0) {
+				iov->iov_base = static_cast<char*>(iov->iov_base) + nwritten;
+				iov->iov_len -= nwritten;
+			}
+		}
+	}
+
+	inline int64
+	file_size(int fd) {
+		struct ::stat st;
+		if (::fstat(fd, &st) == -1) { throw_errno(); }
+		return st.st_size;
+	}
+
+	std::string
+	segment_path(const std::string& directory, const std::string& name, uint64 first) {
+		return sqlite::format("%s/%s-%020llu.log", directory.data(), name.data(),
+			static_cast<unsigned long long>(first)).get();
+	}
+
+	/// The first sequence numbers of the segments in ascending order.
+	std::vector<uint64>
+	list_segments(const std::string& directory, const std::string& name) {
+		std::vector<uint64> result;
+		auto* dir = ::opendir(directory.data());
+		if (!dir) { throw_errno(); }
+		const auto prefix = name + '-';
+		while (auto* entry = ::readdir(dir)) {
+			const char* s = entry->d_name;
+			const auto n = std::strlen(s);
+			if (n != prefix.size() + 24 || std::strncmp(s, prefix.data(), prefix.size()) != 0 ||
+				std::strcmp(s + n - 4, ".log") != 0) {
+				continue;
+			}
+			uint64 first = 0;
+			bool digits = true;
+			for (const char* p=s+prefix.size(); p!=s+n-4; ++p) {
+				if (*p < '0' || *p > '9') { digits = false; break; }
+				first = first*10 + uint64(*p - '0');
+			}
+			if (digits) { result.emplace_back(first); }
+		}
+		::closedir(dir);
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	inline int64
+	nanoseconds(sqlite::replication_log::time_point t) noexcept {
+		using namespace std::chrono;
+		return duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	}
+
+	/// Streams the changeset of one batch and verifies its checksum.
+	struct batch_input {
+		int fd;
+		int64 offset;
+		uint64 remaining;
+		std::uint32_t expected;
+		std::uint32_t checksum;
+
+		std::size_t
+		operator()(void* data, std::size_t n) {
+			if (this->remaining == 0) { return 0; }
+			n = std::size_t(std::min<uint64>(n, this->remaining));
+			if (read_at(this->fd, data, n, this->offset) != n) { throw_corrupt(); }
+			this->offset += n;
+			this->remaining -= n;
+			this->checksum = sqlite::crc32c(data, n, this->checksum);
+			if (this->remaining == 0 && this->checksum != this->expected) { throw_corrupt(); }
+			return n;
+		}
+	};
+
+}
+
+sqlite::replication_log::replication_log(options opts):
+_options(std::move(opts)) {
+	auto segments = list_segments(this->_options.directory, this->_options.name);
+	if (segments.empty()) { this->open(); }
+	else { this->recover(segments.back()); }
+}
+
+sqlite::replication_log::~replication_log() noexcept {
+	try {
+		this->flush();
+	} catch (...) {
+	}
+	this->close();
+}
+
+void
+sqlite::replication_log::append(const void* data, std::size_t size) {
+	if (this->_batch_size == 0) { this->_batch_start = clock_type::now(); }
+	this->_group.add(data, size);
+	this->_batch_size += size;
+	++this->_counters.changesets;
+	this->_counters.input_bytes += size;
+	if (this->_batch_size >= this->_options.max_batch_size) { this->flush(); }
+	else { this->poll(); }
+}
+
+bool
+sqlite::replication_log::poll() {
+	if (this->_batch_size == 0) { return false; }
+	if (clock_type::now() - this->_batch_start < this->_options.max_batch_delay) { return false; }
+	this->flush();
+	return true;
+}
+
+void
+sqlite::replication_log::flush() {
+	if (this->_batch_size == 0) { return; }
+	blob data = this->_group.output();
+	// changes that cancel each other produce empty changeset
+	if (data.empty()) {
+		this->_group = changegroup();
+		this->_batch_size = 0;
+		return;
+	}
+	// the segment was closed by failed write or rotation
+	if (this->_fd == -1) { this->recover(this->_segment); }
+	if (this->_options.max_segment_size > 0 &&
+		this->_segment_size >= this->_options.max_segment_size) {
+		this->close();
+		this->open();
+	}
+	header h{magic, crc32c(data.data(), data.size()), this->_sequence,
+		nanoseconds(clock_type::now()), data.size()};
+	char buf[header_size];
+	encode(h, buf);
+	struct ::iovec iov[2];
+	iov[0].iov_base = buf;
+	iov[0].iov_len = header_size;
+	iov[1].iov_base = data.get();
+	iov[1].iov_len = data.size();
+	try {
+		write_all(this->_fd, iov, 2);
+	} catch (...) {
+		// remove incomplete batch, so that the next batch follows the last
+		// complete one; the batch is kept and is written again by the next flush
+		if (::ftruncate(this->_fd, this->_segment_size) == -1 ||
+			::lseek(this->_fd, this->_segment_size, SEEK_SET) == -1) {
+			this->close();
+		}
+		throw;
+	}
+	// the batch is complete and readers may have applied it already,
+	// so it is not written again even if it can not be synced
+	this->_group = changegroup();
+	this->_batch_size = 0;
+	this->_segment_size += header_size + data.size();
+	++this->_sequence;
+	++this->_counters.batches;
+	this->_counters.output_bytes += header_size + data.size();
+	if (this->_options.sync && ::fdatasync(this->_fd) == -1) {
+		const int err = errno;
+		// the next flush reopens the segment and continues after
+		// the last batch that can be read back
+		this->close();
+		throw std::system_error(err, std::system_category());
+	}
+}
+
+void
+sqlite::replication_log::recover(uint64 first) {
+	auto path = segment_path(this->_options.directory, this->_options.name, first);
+	this->_fd = ::open(path.data(), O_RDWR | O_CLOEXEC);
+	if (this->_fd == -1) { throw_errno(); }
+	const auto size = file_size(this->_fd);
+	int64 offset = 0;
+	uint64 sequence = first;
+	std::vector<char> data;
+	char buf[header_size];
+	while (read_at(this->_fd, buf, header_size, offset) == header_size) {
+		auto h = decode(buf);
+		if (h.magic != magic || h.sequence != sequence ||
+			h.size > uint64(size - offset - int64(header_size))) {
+			break;
+		}
+		data.resize(h.size);
+		if (read_at(this->_fd, data.data(), h.size, offset+header_size) != h.size ||
+			crc32c(data.data(), data.size()) != h.checksum) {
+			break;
+		}
+		offset += header_size + h.size;
+		++sequence;
+	}
+	if (offset != size && ::ftruncate(this->_fd, offset) == -1) { throw_errno(); }
+	if (::lseek(this->_fd, offset, SEEK_SET) == -1) { throw_errno(); }
+	this->_segment = first;
+	this->_segment_size = offset;
+	this->_sequence = sequence;
+}
+
+void
+sqlite::replication_log::open() {
+	auto path = segment_path(this->_options.directory, this->_options.name, this->_sequence);
+	this->_fd = ::open(path.data(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (this->_fd == -1) { throw_errno(); }
+	this->_segment = this->_sequence;
+	this->_segment_size = file_size(this->_fd);
+}
+
+void
+sqlite::replication_log::close() noexcept {
+	if (this->_fd != -1) {
+		::close(this->_fd);
+		this->_fd = -1;
+	}
+}
+
+sqlite::replication_log_reader::replication_log_reader(connection& db, options opts):
+_db(db), _options(std::move(opts)) {
+	const auto* table = this->_options.state_table.data();
+	const auto* name = this->_options.name.data();
+	db.execute(format("CREATE TABLE IF NOT EXISTS \"%w\" "
+		"(name TEXT PRIMARY KEY, sequence INTEGER NOT NULL, timestamp INTEGER NOT NULL)",
+		table).get());
+	{
+		statement s(db.prepare(format(
+			"SELECT sequence, timestamp FROM \"%w\" WHERE name=%Q", table, name).get()));
+		if (s.step() == errc::row) {
+			this->_sequence = uint64(::sqlite3_column_int64(s.get(), 0));
+			auto t = std::chrono::nanoseconds(::sqlite3_column_int64(s.get(), 1));
+			this->_timestamp = time_point(std::chrono::duration_cast<clock_type::duration>(t));
+		}
+	}
+	this->_update = db.prepare(format(
+		"INSERT OR REPLACE INTO \"%w\"(name,sequence,timestamp) VALUES (%Q,?,?)",
+		table, name).get());
+}
+
+sqlite::replication_log_reader::~replication_log_reader() noexcept {
+	this->close();
+}
+
+std::size_t
+sqlite::replication_log_reader::apply(conflict_handler conflict, std::size_t max_batches) {
+	std::size_t n = 0;
+	char buf[header_size];
+	while (n != max_batches) {
+		if (this->_fd == -1 && !this->open_segment()) { break; }
+		const auto size = file_size(this->_fd);
+		if (size - this->_offset < int64(header_size) ||
+			read_at(this->_fd, buf, header_size, this->_offset) != header_size) {
+			// the end of the segment, switch to the next one if it exists
+			auto segments = list_segments(this->_options.directory, this->_options.name);
+			if (!segments.empty() && segments.back() > this->_segment) {
+				auto first = std::upper_bound(segments.begin(), segments.end(), this->_segment);
+				if (*first <= this->_sequence) {
+					this->close();
+					continue;
+				}
+			}
+			break;
+		}
+		auto h = decode(buf);
+		if (h.magic != magic) { throw_corrupt(); }
+		// incomplete batch
+		if (h.size > uint64(size - this->_offset - int64(header_size))) { break; }
+		const int64 next = this->_offset + int64(header_size + h.size);
+		if (h.sequence < this->_sequence) { this->_offset = next; continue; }
+		if (h.sequence != this->_sequence) { throw_corrupt(); }
+		const auto timestamp = time_point(std::chrono::duration_cast<clock_type::duration>(
+			std::chrono::nanoseconds(h.timestamp)));
+		immediate_transaction t(this->_db);
+		try {
+			batch_input in{this->_fd, this->_offset + int64(header_size), h.size, h.checksum, 0};
+			::sqlite::apply(this->_db, in, conflict);
+			this->_update.bind(1, int64(h.sequence + 1));
+			this->_update.bind(2, h.timestamp);
+			this->_update.step();
+			this->_update.reset();
+		} catch (...) {
+			::sqlite3_reset(this->_update.get());
+			throw;
+		}
+		t.commit();
+		this->_offset = next;
+		this->_sequence = h.sequence + 1;
+		this->_timestamp = timestamp;
+		++n;
+	}
+	return n;
+}
+
+bool
+sqlite::replication_log_reader::open_segment() {
+	auto segments = list_segments(this->_options.directory, this->_options.name);
+	// the last segment that starts at or before the next sequence number
+	auto first = std::upper_bound(segments.begin(), segments.end(), this->_sequence);
+	if (first == segments.begin()) { return false; }
+	--first;
+	auto path = segment_path(this->_options.directory, this->_options.name, *first);
+	this->_fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+	if (this->_fd == -1) { throw_errno(); }
+	this->_segment = *first;
+	this->_offset = 0;
+	return true;
+}
+
+void
+sqlite::replication_log_reader::close() noexcept {
+	if (this->_fd != -1) {
+		::close(this->_fd);
+		this->_fd = -1;
+	}
+}
+#endif
@@ -0,0 +1,193 @@
+#ifndef SQLITEX_REPLICATION_LOG_HH
+#define SQLITEX_REPLICATION_LOG_HH
+
+#include <chrono>
+#include <limits>
+#include <string>
+
+#include <sqlitex/connection.hh>
+#include <sqlitex/session.hh>
+
+#if defined(SQLITE_ENABLE_SESSION)
+namespace sqlite {
+
+	/**
+	\brief Log of compacted changesets for replicas.
+	\details
+	Changesets of small transactions are merged with changegroup into a
+	batch, so that repeated changes of the same row become one change. The
+	batch is written when its input exceeds \c max_batch_size bytes or
+	when it becomes older than \c max_batch_delay (checked by append() and
+	poll()). Batches are numbered sequentially from one and are appended
+	to segment files <tt>directory/name-SEQUENCE.log</tt>, where \c
+	SEQUENCE is the number of the first batch in the file. A new segment
+	is started when the current one exceeds \c max_segment_size bytes.
+
+	Each batch is stored as 32-byte header (magic, CRC-32C of the
+	changeset, sequence number, time of the write in nanoseconds since the
+	epoch, changeset size; little-endian) followed by the changeset.
+	Incomplete batch at the end of the last segment is truncated when the
+	log is opened again.
+	\code{.cpp}
+	replication_log::options opts;
+	opts.directory = "/var/lib/app/replication";
+	replication_log log(opts);
+	session s(db);
+	s.attach_all();
+	// after each transaction
+	log.append(s.changeset());
+	s = session(db);
+	s.attach_all();
+	\endcode
+	*/
+	class replication_log {
+
+	public:
+		using clock_type = std::chrono::system_clock;
+		using time_point = clock_type::time_point;
+
+		struct options {
+			std::string directory = ".";
+			/// Prefix of segment file names.
+			std::string name = "changes";
+			std::size_t max_batch_size = std::size_t(1) << 20;
+			std::chrono::milliseconds max_batch_delay{100};
+			int64 max_segment_size = int64(64) << 20;
+			/// Call \c fdatasync after each batch.
+			bool sync = false;
+		};
+
+		struct counters {
+			uint64 changesets = 0;
+			uint64 batches = 0;
+			/// Size of the changesets before merging.
+			uint64 input_bytes = 0;
+			/// Size of the batches.
+			uint64 output_bytes = 0;
+		};
+
+	private:
+		options _options;
+		changegroup _group;
+		int _fd = -1;
+		/// The first sequence number of the open segment.
+		uint64 _segment = 1;
+		int64 _segment_size = 0;
+		/// The sequence number of the next batch.
+		uint64 _sequence = 1;
+		std::size_t _batch_size = 0;
+		time_point _batch_start;
+		counters _counters;
+
+	public:
+
+		explicit replication_log(options opts);
+
+		/// Flushes the current batch ignoring errors.
+		~replication_log() noexcept;
+
+		replication_log(const replication_log&) = delete;
+		replication_log& operator=(const replication_log&) = delete;
+
+		void append(const void* data, std::size_t size);
+		inline void append(const blob& changeset) { this->append(changeset.data(), changeset.size()); }
+
+		/// Write the current batch if it is too old. \return true if the batch was written
+		bool poll();
+
+		/**
+		Write the current batch.
+		\throw std::system_error if the batch can not be written or synced;
+		after incomplete write the batch is kept and the segment ends with
+		the last complete batch; if only \c fdatasync fails, the batch stays
+		in the segment and counts as written
+		*/
+		void flush();
+
+		/// The sequence number of the next batch.
+		inline uint64 sequence() const noexcept { return this->_sequence; }
+		inline const counters& statistics() const noexcept { return this->_counters; }
+		inline const options& get_options() const noexcept { return this->_options; }
+
+	private:
+		/// Start new segment.
+		void open();
+		/// Continue the segment and truncate incomplete batch.
+		void recover(uint64 first);
+		void close() noexcept;
+
+	};
+
+	/**
+	\brief Applies batches of replication_log to a replica.
+	\details
+	Each batch is streamed from the segment file to \c
+	sqlite3changeset_apply_v2_strm and is applied in a transaction
+	together with the update of the sequence number of the next batch in
+	\c state_table, so that every batch is applied exactly once and the
+	reader can be restarted. The checksum is verified while the batch is
+	streamed; mismatch rolls back the transaction. The reader follows the
+	log while it is written by another process.
+	\code{.cpp}
+	replication_log_reader reader(replica, opts);
+	reader.apply([] (conflict_type, changeset_iterator_base&) {
+		return conflict_action::replace;
+	});
+	\endcode
+	*/
+	class replication_log_reader {
+
+	public:
+		using clock_type = replication_log::clock_type;
+		using time_point = replication_log::time_point;
+
+		struct options {
+			std::string directory = ".";
+			std::string name = "changes";
+			std::string state_table = "sqlitex_replication";
+		};
+
+	private:
+		connection& _db;
+		options _options;
+		int _fd = -1;
+		/// The first sequence number of the open segment.
+		uint64 _segment = 0;
+		int64 _offset = 0;
+		uint64 _sequence = 1;
+		time_point _timestamp;
+		statement _update;
+
+	public:
+
+		replication_log_reader(connection& db, options opts);
+		~replication_log_reader() noexcept;
+
+		replication_log_reader(const replication_log_reader&) = delete;
+		replication_log_reader& operator=(const replication_log_reader&) = delete;
+
+		/**
+		Apply at most \p max_batches complete batches.
+		\return the number of applied batches
+		\throw std::system_error if the batch is corrupted, can not be read
+		or applied
+		*/
+		std::size_t apply(conflict_handler conflict,
+						  std::size_t max_batches=std::numeric_limits<std::size_t>::max());
+
+		/// The sequence number of the next batch.
+		inline uint64 sequence() const noexcept { return this->_sequence; }
+
+		/// The time when the last applied batch was written.
+		inline time_point timestamp() const noexcept { return this->_timestamp; }
+
+	private:
+		bool open_segment();
+		void close() noexcept;
+
+	};
+
+}
+#endif
+
+#endif // vim:filetype=cpp
@@ -0,0 +1,258 @@
+#ifndef SQLITEX_ROW_CACHE_HH
+#define SQLITEX_ROW_CACHE_HH
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Cache of decoded rows of a single table keyed by rowid.
+	\details
+	Rows are read with a prepared statement that takes rowid as the only
+	parameter (e.g. <tt>SELECT a, b FROM t WHERE rowid=?</tt>) and decoded
+	with <tt>operator>>(const statement&, T&)</tt>, the same operator that
+	row_iterator uses. Decoded values are stored in a hash map that is split
+	into shards with separate locks, so that concurrent lookups of different
+	rows do not contend. Each shard evicts least recently used rows when it
+	is full.
+
+	Rows are invalidated by the update hook of the connection passed to the
+	constructor and of every connection passed to watch(); changes made by
+	connections that are not watched are not seen. The update hook fires
+	before the change is committed, hence rows are not cached while any
+	watched connection has a write transaction (before SQLite 3.34 an
+	explicit transaction), otherwise the old row could be read and cached
+	after the invalidation. This also covers savepoint rollbacks. The cache
+	must be destroyed before the connections.
+	\code{.cpp}
+	row_cache<Publication> cache(db, "publications",
+		"SELECT author, title, year FROM publications WHERE rowid=?");
+	Publication pub;
+	if (cache.get(rowid, pub)) { ... }
+	\endcode
+	*/
+	template <class T>
+	class row_cache {
+
+	public:
+		using value_type = T;
+
+		struct counters {
+			uint64 hits = 0;
+			uint64 misses = 0;
+			uint64 evictions = 0;
+			uint64 invalidations = 0;
+			inline double
+			hit_ratio() const noexcept {
+				auto total = this->hits + this->misses;
+				return total == 0 ? 0.0 : double(this->hits)/double(total);
+			}
+		};
+
+	private:
+		using lru_list = std::list<std::pair<int64,value_type>>;
+		using lru_iterator = typename lru_list::iterator;
+
+		struct shard {
+			std::mutex mtx;
+			lru_list lru;
+			std::unordered_map<int64,lru_iterator> index;
+			uint64 version = 0;
+			std::atomic<uint64> hits{0};
+			std::atomic<uint64> misses{0};
+			std::atomic<uint64> evictions{0};
+			std::atomic<uint64> invalidations{0};
+		};
+
+	private:
+		std::string _table;
+		statement _select;
+		std::mutex _select_mutex;
+		std::unique_ptr<shard[]> _shards;
+		std::size_t _nshards;
+		std::size_t _shard_capacity;
+		std::vector<connection*> _watched;
+
+	public:
+
+		/**
+		\param[in] capacity maximum number of rows in the cache
+		\param[in] nshards number of independently locked parts of the cache
+		*/
+		inline
+		row_cache(
+			connection& db,
+			const char* table,
+			const u8string& select,
+			std::size_t capacity=4096,
+			std::size_t nshards=16
+		):
+		_table(table), _shards(new shard[nshards == 0 ? 1 : nshards]),
+		_nshards(nshards == 0 ? 1 : nshards),
+		_shard_capacity((capacity + _nshards - 1)/_nshards) {
+			#if defined(SQLITE_PREPARE_PERSISTENT)
+			this->_select = db.prepare(select, prepare_f::persistent);
+			#else
+			this->_select = db.prepare(select);
+			#endif
+			this->watch(db);
+		}
+
+		inline ~row_cache() noexcept {
+			for (auto* db : this->_watched) {
+				db->remove_update_hook(this);
+				db->remove_rollback_hook(this);
+			}
+		}
+
+		row_cache(const row_cache&) = delete;
+		row_cache& operator=(const row_cache&) = delete;
+
+		/// Invalidate rows on changes made by another connection to the same database.
+		inline void
+		watch(connection& db) {
+			db.add_update_hook(this, [this] (action, const char*, const char* table, int64 rowid) {
+				if (this->_table == table) { this->invalidate(rowid); }
+			});
+			db.add_rollback_hook(this, [this] () { this->clear(); });
+			this->_watched.emplace_back(&db);
+		}
+
+		/**
+		Copy cached row to \p value or read it from the database.
+		\return false if there is no row with such rowid
+		*/
+		inline bool
+		get(int64 rowid, value_type& value) {
+			auto& s = this->get_shard(rowid);
+			uint64 version = 0;
+			{
+				std::lock_guard<std::mutex> lock(s.mtx);
+				auto result = s.index.find(rowid);
+				if (result != s.index.end()) {
+					s.lru.splice(s.lru.begin(), s.lru, result->second);
+					value = result->second->second;
+					++s.hits;
+					return true;
+				}
+				version = s.version;
+			}
+			++s.misses;
+			const bool cacheable = !this->writing();
+			{
+				std::lock_guard<std::mutex> lock(this->_select_mutex);
+				auto& stmt = this->_select;
+				stmt.reset();
+				stmt.bind(1, rowid);
+				if (stmt.step() != errc::row) {
+					stmt.reset();
+					return false;
+				}
+				static_cast<const statement&>(stmt) >> value;
+				stmt.reset();
+			}
+			std::lock_guard<std::mutex> lock(s.mtx);
+			// the row may be uncommitted or was changed while we were reading it
+			if (!cacheable || version != s.version || s.index.count(rowid) != 0) {
+				return true;
+			}
+			if (s.lru.size() >= this->_shard_capacity) {
+				s.index.erase(s.lru.back().first);
+				s.lru.pop_back();
+				++s.evictions;
+			}
+			s.lru.emplace_front(rowid, value);
+			s.index.emplace(rowid, s.lru.begin());
+			return true;
+		}
+
+		inline void
+		invalidate(int64 rowid) {
+			auto& s = this->get_shard(rowid);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			++s.version;
+			auto result = s.index.find(rowid);
+			if (result != s.index.end()) {
+				s.lru.erase(result->second);
+				s.index.erase(result);
+				++s.invalidations;
+			}
+		}
+
+		inline void
+		clear() {
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				auto& s = this->_shards[i];
+				std::lock_guard<std::mutex> lock(s.mtx);
+				++s.version;
+				s.invalidations += s.lru.size();
+				s.index.clear();
+				s.lru.clear();
+			}
+		}
+
+		inline counters
+		get_counters() const noexcept {
+			counters result;
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				const auto& s = this->_shards[i];
+				result.hits += s.hits;
+				result.misses += s.misses;
+				result.evictions += s.evictions;
+				result.invalidations += s.invalidations;
+			}
+			return result;
+		}
+
+		inline std::size_t
+		size() {
+			std::size_t n = 0;
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				auto& s = this->_shards[i];
+				std::lock_guard<std::mutex> lock(s.mtx);
+				n += s.lru.size();
+			}
+			return n;
+		}
+
+		inline std::size_t num_shards() const noexcept { return this->_nshards; }
+		inline const std::string& table() const noexcept { return this->_table; }
+
+	private:
+
+		/// True if any watched connection may have uncommitted changes.
+		inline bool
+		writing() noexcept {
+			for (auto* db : this->_watched) {
+				#if defined(SQLITE_TXN_WRITE)
+				if (::sqlite3_txn_state(db->get(), nullptr) == SQLITE_TXN_WRITE) { return true; }
+				#else
+				if (!::sqlite3_get_autocommit(db->get())) { return true; }
+				#endif
+			}
+			return false;
+		}
+
+		inline shard&
+		get_shard(int64 rowid) noexcept {
+			uint64 x = static_cast<uint64>(rowid);
+			x ^= x >> 33;
+			x *= UINT64_C(0xff51afd7ed558ccd);
+			x ^= x >> 33;
+			return this->_shards[x % this->_nshards];
+		}
+
+	};
+
+}
+
+#endif // vim:filetype=cpp
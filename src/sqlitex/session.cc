@@ -0,0 +1,260 @@
+#include <sqlitex/session.hh>
+
+#if defined(SQLITE_ENABLE_SESSION)
+namespace {
+
+	using output_stream = sqlite::bits::changeset_stream<sqlite::changeset_output>;
+	using input_stream = sqlite::bits::changeset_stream<sqlite::changeset_input>;
+
+	int
+	write_stream(void* ptr, const void* data, int size) noexcept {
+		auto* s = static_cast<output_stream*>(ptr);
+		try {
+			s->func(data, std::size_t(size));
+		} catch (...) {
+			s->error = std::current_exception();
+			return SQLITE_IOERR;
+		}
+		return SQLITE_OK;
+	}
+
+	int
+	read_stream(void* ptr, void* data, int* size) noexcept {
+		auto* s = static_cast<input_stream*>(ptr);
+		try {
+			*size = int(s->func(data, std::size_t(*size)));
+		} catch (...) {
+			s->error = std::current_exception();
+			return SQLITE_IOERR;
+		}
+		return SQLITE_OK;
+	}
+
+	inline void
+	check(int ret, std::exception_ptr& error) {
+		if (error) { std::rethrow_exception(error); }
+		sqlite::call(ret);
+	}
+
+	/// Copy the changeset that SQLite allocated.
+	inline sqlite::blob
+	take(int ret, int size, void* data) {
+		sqlite::unique_ptr<void> ptr(data);
+		sqlite::call(ret);
+		return sqlite::blob(static_cast<const char*>(data), std::size_t(size));
+	}
+
+	struct apply_context {
+		sqlite::conflict_handler conflict;
+		sqlite::table_filter filter;
+		std::exception_ptr error;
+	};
+
+	int
+	apply_filter(void* ptr, const char* table) noexcept {
+		auto* ctx = static_cast<apply_context*>(ptr);
+		if (ctx->error) { return 0; }
+		try {
+			return ctx->filter(table) ? 1 : 0;
+		} catch (...) {
+			ctx->error = std::current_exception();
+			return 0;
+		}
+	}
+
+	int
+	apply_conflict(void* ptr, int type, sqlite::types::changeset_iterator* it) noexcept {
+		auto* ctx = static_cast<apply_context*>(ptr);
+		if (ctx->error || !ctx->conflict) { return SQLITE_CHANGESET_ABORT; }
+		try {
+			sqlite::changeset_iterator_base iterator(it);
+			return int(ctx->conflict(sqlite::conflict_type(type), iterator));
+		} catch (...) {
+			ctx->error = std::current_exception();
+			return SQLITE_CHANGESET_ABORT;
+		}
+	}
+
+}
+
+void
+sqlite::session::filter(table_filter rhs) {
+	if (!rhs) {
+		::sqlite3session_table_filter(get(), nullptr, nullptr);
+		this->_filter.reset();
+		return;
+	}
+	this->_filter.reset(new table_filter(std::move(rhs)));
+	::sqlite3session_table_filter(
+		get(),
+		[] (void* ptr, const char* table) noexcept {
+			try {
+				return (*static_cast<table_filter*>(ptr))(table) ? 1 : 0;
+			} catch (...) {
+				return 0;
+			}
+		},
+		this->_filter.get()
+	);
+}
+
+void
+sqlite::session::diff(const char* from, const char* table) {
+	char* message = nullptr;
+	int ret = ::sqlite3session_diff(get(), from, table, &message);
+	unique_ptr<char> ptr(message);
+	if (ret != SQLITE_OK) {
+		if (message) { throw std::system_error(ret, sqlite_category, message); }
+		throw std::system_error(ret, sqlite_category);
+	}
+}
+
+sqlite::blob
+sqlite::session::changeset() {
+	int size = 0;
+	void* data = nullptr;
+	int ret = ::sqlite3session_changeset(get(), &size, &data);
+	return take(ret, size, data);
+}
+
+sqlite::blob
+sqlite::session::patchset() {
+	int size = 0;
+	void* data = nullptr;
+	int ret = ::sqlite3session_patchset(get(), &size, &data);
+	return take(ret, size, data);
+}
+
+void
+sqlite::session::changeset(changeset_output out) {
+	output_stream s{std::move(out), nullptr};
+	int ret = ::sqlite3session_changeset_strm(get(), write_stream, &s);
+	check(ret, s.error);
+}
+
+void
+sqlite::session::patchset(changeset_output out) {
+	output_stream s{std::move(out), nullptr};
+	int ret = ::sqlite3session_patchset_strm(get(), write_stream, &s);
+	check(ret, s.error);
+}
+
+sqlite::changeset_iterator::changeset_iterator(changeset_input in, bool invert):
+_input(new input_stream{std::move(in), nullptr}) {
+	call(::sqlite3changeset_start_v2_strm(&this->_ptr, read_stream, this->_input.get(),
+		invert ? SQLITE_CHANGESETSTART_INVERT : 0));
+}
+
+bool
+sqlite::changeset_iterator::next() {
+	int ret = ::sqlite3changeset_next(get());
+	if (ret == SQLITE_ROW) { return true; }
+	if (this->_input && this->_input->error) {
+		auto error = this->_input->error;
+		this->_input->error = nullptr;
+		std::rethrow_exception(error);
+	}
+	if (ret == SQLITE_DONE) { return false; }
+	call(ret);
+	return false;
+}
+
+void
+sqlite::changegroup::add(changeset_input in) {
+	input_stream s{std::move(in), nullptr};
+	int ret = ::sqlite3changegroup_add_strm(get(), read_stream, &s);
+	check(ret, s.error);
+}
+
+sqlite::blob
+sqlite::changegroup::output() {
+	int size = 0;
+	void* data = nullptr;
+	int ret = ::sqlite3changegroup_output(get(), &size, &data);
+	return take(ret, size, data);
+}
+
+void
+sqlite::changegroup::output(changeset_output out) {
+	output_stream s{std::move(out), nullptr};
+	int ret = ::sqlite3changegroup_output_strm(get(), write_stream, &s);
+	check(ret, s.error);
+}
+
+sqlite::blob
+sqlite::invert(const void* data, std::size_t size) {
+	int n = 0;
+	void* result = nullptr;
+	int ret = ::sqlite3changeset_invert(int(size), data, &n, &result);
+	return take(ret, n, result);
+}
+
+void
+sqlite::invert(changeset_input in, changeset_output out) {
+	input_stream i{std::move(in), nullptr};
+	output_stream o{std::move(out), nullptr};
+	int ret = ::sqlite3changeset_invert_strm(read_stream, &i, write_stream, &o);
+	check(ret, i.error);
+	check(ret, o.error);
+}
+
+sqlite::blob
+sqlite::concat(const blob& a, const blob& b) {
+	int n = 0;
+	void* result = nullptr;
+	int ret = ::sqlite3changeset_concat(
+		int(a.size()), const_cast<char*>(a.data()),
+		int(b.size()), const_cast<char*>(b.data()),
+		&n, &result
+	);
+	return take(ret, n, result);
+}
+
+void
+sqlite::concat(changeset_input a, changeset_input b, changeset_output out) {
+	input_stream i{std::move(a), nullptr};
+	input_stream j{std::move(b), nullptr};
+	output_stream o{std::move(out), nullptr};
+	int ret = ::sqlite3changeset_concat_strm(read_stream, &i, read_stream, &j, write_stream, &o);
+	check(ret, i.error);
+	check(ret, j.error);
+	check(ret, o.error);
+}
+
+void
+sqlite::apply(
+	connection_base db,
+	const void* data,
+	std::size_t size,
+	conflict_handler conflict,
+	table_filter filter,
+	int flags
+) {
+	apply_context ctx{std::move(conflict), std::move(filter), nullptr};
+	int ret = ::sqlite3changeset_apply_v2(
+		db.get(), int(size), const_cast<void*>(data),
+		ctx.filter ? apply_filter : nullptr, apply_conflict, &ctx,
+		nullptr, nullptr, flags
+	);
+	check(ret, ctx.error);
+}
+
+void
+sqlite::apply(
+	connection_base db,
+	changeset_input in,
+	conflict_handler conflict,
+	table_filter filter,
+	int flags
+) {
+	input_stream s{std::move(in), nullptr};
+	apply_context ctx{std::move(conflict), std::move(filter), nullptr};
+	int ret = ::sqlite3changeset_apply_v2_strm(
+		db.get(), read_stream, &s,
+		ctx.filter ? apply_filter : nullptr, apply_conflict, &ctx,
+		nullptr, nullptr, flags
+	);
+	check(ret, s.error);
+	check(ret, ctx.error);
+}
+#endif
@@ -1,24 +1,71 @@
 #ifndef SQLITEX_SESSION_HH
 #define SQLITEX_SESSION_HH
 
+#include <exception>
+#include <functional>
+#include <memory>
+
+#include <sqlitex/any.hh>
+#include <sqlitex/blob.hh>
+#include <sqlitex/connection.hh>
 #include <sqlitex/forward.hh>
 
-namespace sqlitex {
+#if defined(SQLITE_ENABLE_SESSION)
+namespace sqlite {
+
+	/**
+	Streaming output: called with consecutive chunks of a changeset.
+	Exceptions are rethrown after SQLite stops.
+	*/
+	using changeset_output = std::function<void(const void* data, std::size_t size)>;
+
+	/// Streaming input: fill the buffer and return the number of bytes, zero at the end.
+	using changeset_input = std::function<std::size_t(void* data, std::size_t size)>;
+
+	/// Return false to skip the table.
+	using table_filter = std::function<bool(const char* table)>;
+
+	namespace bits {
+		/// The exception is rethrown after SQLite returns.
+		template <class Function>
+		struct changeset_stream {
+			Function func;
+			std::exception_ptr error;
+		};
+	}
 
-	#if defined(SQLITE_ENABLE_SESSION)
 	class session {
 
 	private:
 		types::session* _ptr = nullptr;
+		std::unique_ptr<table_filter> _filter;
 
 	public:
 
+		inline explicit
+		session(connection_base& db, const char* name="main") {
+			call(::sqlite3session_create(db.get(), name, &this->_ptr));
+		}
+
 		inline explicit
 		session(types::connection* db, const char* name="main") {
 			call(::sqlite3session_create(db, name, &this->_ptr));
 		}
 
 		inline ~session() noexcept { this->close(); }
+		session(const session&) = delete;
+		session& operator=(const session&) = delete;
+		inline session(session&& rhs) noexcept: _ptr(rhs._ptr), _filter(std::move(rhs._filter)) {
+			rhs._ptr = nullptr;
+		}
+		inline session& operator=(session&& rhs) noexcept { this->swap(rhs); return *this; }
+
+		inline void
+		swap(session& rhs) noexcept {
+			std::swap(this->_ptr, rhs._ptr);
+			std::swap(this->_filter, rhs._filter);
+		}
+
 		inline types::session* get() noexcept { return this->_ptr; }
 		inline const types::session* get() const noexcept { return this->_ptr; }
 
@@ -28,15 +75,244 @@ namespace sqlitex {
 			this->_ptr = nullptr;
 		}
 
-		inline void record(bool enable) { call(::sqlite3session_enable(get(), enable)); }
-		inline bool indirect() const noexcept { return ::sqlite3session_indirect(get(), -1); }
+		inline void record(bool enable) { ::sqlite3session_enable(get(), enable); }
+		inline bool recording() const noexcept { return ::sqlite3session_enable(this->_ptr, -1); }
+		inline bool indirect() const noexcept { return ::sqlite3session_indirect(this->_ptr, -1); }
 		inline bool indirect(bool rhs) noexcept { return ::sqlite3session_indirect(get(), rhs); }
-		inline bool empty() const noexcept { return ::sqlite3session_isempty(get()); }
+		inline bool empty() const noexcept { return ::sqlite3session_isempty(this->_ptr); }
+
+		/// Record changes of the table.
 		inline void attach(const char* table) { call(::sqlite3session_attach(get(), table)); }
 
+		/// Record changes of all tables, including the tables that are created later.
+		inline void attach_all() { call(::sqlite3session_attach(get(), nullptr)); }
+
+		/// Filter the tables when all tables are attached. The filter must not throw.
+		void filter(table_filter rhs);
+
+		/**
+		Record the changes that turn \p table in database \p from into the
+		table in the database of the session.
+		*/
+		void diff(const char* from, const char* table);
+
+		/// Changes of attached tables with old values of updated columns.
+		blob changeset();
+
+		/// Changes of attached tables without old values.
+		blob patchset();
+
+		void changeset(changeset_output out);
+		void patchset(changeset_output out);
+
 	};
-	#endif
+
+	enum class conflict_type: int {
+		data=SQLITE_CHANGESET_DATA,
+		not_found=SQLITE_CHANGESET_NOTFOUND,
+		conflict=SQLITE_CHANGESET_CONFLICT,
+		constraint=SQLITE_CHANGESET_CONSTRAINT,
+		foreign_key=SQLITE_CHANGESET_FOREIGN_KEY,
+	};
+
+	enum class conflict_action: int {
+		omit=SQLITE_CHANGESET_OMIT,
+		replace=SQLITE_CHANGESET_REPLACE,
+		abort=SQLITE_CHANGESET_ABORT,
+	};
+
+	/**
+	\brief Read-only view of the current change of a changeset.
+	\details
+	Values are valid until the iterator moves to the next change.
+	*/
+	class changeset_iterator_base {
+
+	public:
+		struct operation {
+			const char* table;
+			int num_columns;
+			action type;
+			bool indirect;
+		};
+
+	protected:
+		types::changeset_iterator* _ptr = nullptr;
+
+	public:
+
+		inline explicit changeset_iterator_base(types::changeset_iterator* ptr) noexcept:
+		_ptr(ptr) {}
+
+		changeset_iterator_base() = default;
+
+		inline types::changeset_iterator* get() noexcept { return this->_ptr; }
+		inline const types::changeset_iterator* get() const noexcept { return this->_ptr; }
+
+		inline operation
+		op() {
+			operation result{};
+			int type = 0, indirect = 0;
+			call(::sqlite3changeset_op(get(), &result.table, &result.num_columns,
+				&type, &indirect));
+			result.type = action(type);
+			result.indirect = indirect != 0;
+			return result;
+		}
+
+		/// Array of flags that are non-zero for primary key columns.
+		inline const unsigned char*
+		primary_key() {
+			unsigned char* pk = nullptr;
+			int n = 0;
+			call(::sqlite3changeset_pk(get(), &pk, &n));
+			return pk;
+		}
+
+		/**
+		Old value of updated and deleted rows. For updates the pointer is
+		null for the columns that did not change.
+		*/
+		inline any_base
+		old_value(int column) {
+			types::value* value = nullptr;
+			call(::sqlite3changeset_old(get(), column, &value));
+			return any_base(value);
+		}
+
+		/**
+		New value of updated and inserted rows. For updates the pointer is
+		null for the columns that did not change.
+		*/
+		inline any_base
+		new_value(int column) {
+			types::value* value = nullptr;
+			call(::sqlite3changeset_new(get(), column, &value));
+			return any_base(value);
+		}
+
+		/// Conflicting row of the database (conflict handler only).
+		inline any_base
+		conflict_value(int column) {
+			types::value* value = nullptr;
+			call(::sqlite3changeset_conflict(get(), column, &value));
+			return any_base(value);
+		}
+
+		/// The number of foreign key violations (conflict handler only).
+		inline int
+		foreign_key_conflicts() {
+			int n = 0;
+			call(::sqlite3changeset_fk_conflicts(get(), &n));
+			return n;
+		}
+
+	};
+
+	/// Iterator over the changes of a changeset or a patchset.
+	class changeset_iterator: public changeset_iterator_base {
+
+	private:
+		std::unique_ptr<bits::changeset_stream<changeset_input>> _input;
+
+	public:
+
+		/// The changeset must outlive the iterator.
+		inline
+		changeset_iterator(const void* data, std::size_t size, bool invert=false) {
+			call(::sqlite3changeset_start_v2(&this->_ptr, int(size), const_cast<void*>(data),
+				invert ? SQLITE_CHANGESETSTART_INVERT : 0));
+		}
+
+		inline explicit
+		changeset_iterator(const blob& data, bool invert=false):
+		changeset_iterator(data.data(), data.size(), invert) {}
+
+		explicit changeset_iterator(changeset_input in, bool invert=false);
+
+		inline ~changeset_iterator() noexcept { ::sqlite3changeset_finalize(this->_ptr); }
+		changeset_iterator(const changeset_iterator&) = delete;
+		changeset_iterator& operator=(const changeset_iterator&) = delete;
+
+		/// \return false when there are no more changes
+		bool next();
+
+	};
+
+	/**
+	\brief Merges changesets.
+	\details
+	Multiple changes of the same row are combined into one change: e.g.
+	insertion followed by updates becomes single insertion, insertion
+	followed by deletion disappears.
+	*/
+	class changegroup {
+
+	private:
+		types::changegroup* _ptr = nullptr;
+
+	public:
+
+		inline changegroup() { call(::sqlite3changegroup_new(&this->_ptr)); }
+		inline ~changegroup() noexcept { ::sqlite3changegroup_delete(this->_ptr); }
+		changegroup(const changegroup&) = delete;
+		changegroup& operator=(const changegroup&) = delete;
+		inline changegroup(changegroup&& rhs) noexcept: _ptr(rhs._ptr) { rhs._ptr = nullptr; }
+		inline changegroup& operator=(changegroup&& rhs) noexcept { this->swap(rhs); return *this; }
+		inline void swap(changegroup& rhs) noexcept { std::swap(this->_ptr, rhs._ptr); }
+
+		inline types::changegroup* get() noexcept { return this->_ptr; }
+		inline const types::changegroup* get() const noexcept { return this->_ptr; }
+
+		inline void
+		add(const void* data, std::size_t size) {
+			call(::sqlite3changegroup_add(get(), int(size), const_cast<void*>(data)));
+		}
+
+		inline void add(const blob& data) { this->add(data.data(), data.size()); }
+		void add(changeset_input in);
+
+		blob output();
+		void output(changeset_output out);
+
+	};
+
+	/// Changeset that reverts the changes.
+	blob invert(const void* data, std::size_t size);
+	void invert(changeset_input in, changeset_output out);
+
+	/// Changeset that is equivalent to applying \p a and then \p b.
+	blob concat(const blob& a, const blob& b);
+	void concat(changeset_input a, changeset_input b, changeset_output out);
+
+	/**
+	Decide what to do with the change that conflicts with the database.
+	\c replace is allowed for \c data and \c conflict types only.
+	*/
+	using conflict_handler =
+		std::function<conflict_action(conflict_type,changeset_iterator_base&)>;
+
+	/**
+	\brief Apply changes to the database in a single savepoint.
+	\details
+	Changes of the tables that are rejected by \p filter or do not exist
+	are skipped. The changes are rolled back if the conflict handler
+	returns \c abort or throws (the exception is rethrown).
+	\param flags \c SQLITE_CHANGESETAPPLY_* flags
+	*/
+	void apply(connection_base db, const void* data, std::size_t size,
+			   conflict_handler conflict, table_filter filter=nullptr, int flags=0);
+
+	inline void
+	apply(connection_base db, const blob& data, conflict_handler conflict,
+		  table_filter filter=nullptr, int flags=0) {
+		apply(db, data.data(), data.size(), std::move(conflict), std::move(filter), flags);
+	}
+
+	void apply(connection_base db, changeset_input in,
+			   conflict_handler conflict, table_filter filter=nullptr, int flags=0);
 
 }
+#endif
 
 #endif // vim:filetype=cpp
@@ -0,0 +1,127 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <sqlitex/sharded_database.hh>
+
+namespace {
+
+	using sqlite::aggregate_value;
+	using sqlite::data_type;
+
+	inline int
+	type_rank(data_type t) noexcept {
+		switch (t) {
+			case data_type::null: return 0;
+			case data_type::integer:
+			case data_type::floating_point: return 1;
+			case data_type::text: return 2;
+			case data_type::blob: return 3;
+		}
+		return 0;
+	}
+
+	/// Compare non-null values in the order of SQLite with binary collation.
+	int
+	compare_values(const aggregate_value& x, const aggregate_value& y) noexcept {
+		const int rx = type_rank(x.type), ry = type_rank(y.type);
+		if (rx != ry) { return rx < ry ? -1 : 1; }
+		if (rx == 1) {
+			if (x.type == data_type::integer && y.type == data_type::integer) {
+				return x.integer < y.integer ? -1 : (y.integer < x.integer ? 1 : 0);
+			}
+			const auto a = x.to_double(), b = y.to_double();
+			return a < b ? -1 : (b < a ? 1 : 0);
+		}
+		const auto n = std::min(x.bytes.size(), y.bytes.size());
+		if (int ret = std::memcmp(x.bytes.data(), y.bytes.data(), n)) { return ret; }
+		return x.bytes.size() < y.bytes.size() ? -1 : (y.bytes.size() < x.bytes.size() ? 1 : 0);
+	}
+
+}
+
+sqlite::sharded_database::sharded_database(
+	const std::vector<std::string>& paths,
+	file_flag flags
+) {
+	if (paths.empty()) { throw std::invalid_argument("no shards"); }
+	this->_nshards = paths.size();
+	this->_shards.reset(new shard[this->_nshards]);
+	for (std::size_t i=0; i<this->_nshards; ++i) {
+		auto& s = this->_shards[i];
+		s.writer.reset(new cached_connection(::sqlite::connection(paths[i].data(), flags)));
+		s.reader.reset(new cached_connection(::sqlite::connection(paths[i].data(), flags)));
+	}
+}
+
+auto
+sqlite::sharded_database::combine(
+	const std::vector<aggregate_type>& types,
+	const std::vector<std::vector<std::vector<aggregate_value>>>& parts
+) -> std::vector<aggregate_value> {
+	const auto ncolumns = types.size();
+	std::vector<aggregate_value> result(ncolumns);
+	for (const auto& rows : parts) {
+		for (const auto& row : rows) {
+			if (row.size() < ncolumns) { throw std::invalid_argument("too few columns"); }
+			for (std::size_t i=0; i<ncolumns; ++i) {
+				const auto& x = row[i];
+				auto& y = result[i];
+				if (x.null()) { continue; }
+				const bool sum = types[i] == aggregate_type::count ||
+					types[i] == aggregate_type::sum;
+				if (sum && type_rank(x.type) != 1) {
+					throw std::invalid_argument("non-numeric partial sum");
+				}
+				if (y.null()) { y = x; continue; }
+				switch (types[i]) {
+					case aggregate_type::count:
+					case aggregate_type::sum:
+						if (x.type == data_type::integer && y.type == data_type::integer) {
+							if (__builtin_add_overflow(y.integer, x.integer, &y.integer)) {
+								throw std::overflow_error("integer overflow");
+							}
+						} else {
+							y.real = y.to_double() + x.to_double();
+							y.type = data_type::floating_point;
+						}
+						break;
+					case aggregate_type::min:
+						if (compare_values(x, y) < 0) { y = x; }
+						break;
+					case aggregate_type::max:
+						if (compare_values(x, y) > 0) { y = x; }
+						break;
+				}
+			}
+		}
+	}
+	for (std::size_t i=0; i<ncolumns; ++i) {
+		if (types[i] == aggregate_type::count && result[i].null()) {
+			result[i].type = data_type::integer;
+		}
+	}
+	return result;
+}
+
+void
+sqlite::operator>>(const statement& s, std::vector<aggregate_value>& row) {
+	const int n = s.num_columns();
+	row.resize(n);
+	for (int i=0; i<n; ++i) {
+		auto& v = row[i];
+		v.type = s.column_type(i);
+		switch (v.type) {
+			case data_type::integer: s.column(i, v.integer); break;
+			case data_type::floating_point: s.column(i, v.real); break;
+			case data_type::null: break;
+			case data_type::text:
+			case data_type::blob: {
+				auto* ptr = static_cast<const char*>(::sqlite3_column_blob(
+					const_cast<types::statement*>(s.get()), i));
+				if (ptr) { v.bytes.assign(ptr, s.column_size(i)); }
+				else { v.bytes.clear(); }
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,325 @@
+#ifndef SQLITEX_SHARDED_DATABASE_HH
+#define SQLITEX_SHARDED_DATABASE_HH
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection_cache.hh>
+
+namespace sqlite {
+
+	enum class aggregate_type { count, sum, min, max };
+
+	/// Result of an aggregate function combined from all shards.
+	struct aggregate_value {
+		data_type type = data_type::null;
+		int64 integer = 0;
+		double real = 0;
+		/// Bytes of TEXT and BLOB values.
+		std::string bytes;
+
+		inline bool null() const noexcept { return this->type == data_type::null; }
+
+		inline double
+		to_double() const noexcept {
+			return this->type == data_type::integer ? double(this->integer) : this->real;
+		}
+
+		inline int64
+		to_integer() const noexcept {
+			return this->type == data_type::floating_point ? int64(this->real) : this->integer;
+		}
+	};
+
+	namespace bits {
+
+		/// Stable hash that does not depend on the standard library implementation.
+		inline uint64
+		shard_hash(const void* data, std::size_t n) noexcept {
+			auto* first = static_cast<const unsigned char*>(data);
+			uint64 h = UINT64_C(14695981039346656037);
+			for (std::size_t i=0; i<n; ++i) { h = (h ^ first[i]) * UINT64_C(1099511628211); }
+			return h;
+		}
+
+		inline uint64
+		shard_hash(int64 key) noexcept {
+			uint64 x = static_cast<uint64>(key) + UINT64_C(0x9e3779b97f4a7c15);
+			x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+			x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+			return x ^ (x >> 31);
+		}
+
+		template <class Integer>
+		inline auto
+		shard_hash_of(Integer key) noexcept ->
+		typename std::enable_if<std::is_integral<Integer>::value,uint64>::type {
+			return shard_hash(int64(key));
+		}
+
+		inline uint64
+		shard_hash_of(const char* key) noexcept {
+			return shard_hash(key, std::char_traits<char>::length(key));
+		}
+
+		template <class Alloc>
+		inline uint64
+		shard_hash_of(const basic_u8string<Alloc>& key) noexcept {
+			return shard_hash(key.data(), key.size());
+		}
+
+		inline uint64
+		shard_hash_of(const blob& key) noexcept {
+			return shard_hash(key.data(), key.size());
+		}
+
+	}
+
+	/**
+	\brief Key space that is hash-partitioned across several database files.
+	\details
+	Every shard has a writer and a reader connection, each protected by its
+	own mutex, so that reads do not wait for writes in WAL mode. Writes are
+	routed to the shard that owns the key. Queries are sent to all shards in
+	parallel and per-shard results are either concatenated, merged in the
+	order defined by the comparator (each shard must return rows in the same
+	order), or combined as partial aggregates.
+
+	Rows are decoded with <tt>operator>>(const statement&, T&)</tt> like in
+	row_iterator. For concatenated results and aggregates each shard's rows
+	are collected on a separate thread. Ordered queries run the first step
+	of every shard on a separate thread, then merge per-shard row iterators
+	on the calling thread and stop reading when the limit is reached.
+	\code{.cpp}
+	sharded_database db({"a.db", "b.db", "c.db"});
+	db.execute_all("CREATE TABLE IF NOT EXISTS kv(k INTEGER PRIMARY KEY, v)");
+	db.execute(key, "INSERT INTO kv VALUES (?,?)", key, value);
+	auto agg = db.aggregate(
+		{aggregate_type::count, aggregate_type::max},
+		"SELECT count(*), max(v) FROM kv");
+	\endcode
+	*/
+	class sharded_database {
+
+	private:
+		struct shard {
+			std::unique_ptr<cached_connection> writer;
+			std::unique_ptr<cached_connection> reader;
+			std::mutex writer_mutex;
+			std::mutex reader_mutex;
+		};
+
+	private:
+		std::unique_ptr<shard[]> _shards;
+		std::size_t _nshards = 0;
+
+	public:
+
+		explicit
+		sharded_database(
+			const std::vector<std::string>& paths,
+			file_flag flags=file_flag::read_write | file_flag::create
+		);
+
+		sharded_database(const sharded_database&) = delete;
+		sharded_database& operator=(const sharded_database&) = delete;
+
+		inline std::size_t num_shards() const noexcept { return this->_nshards; }
+
+		template <class Key>
+		inline std::size_t
+		shard_of(const Key& key) const noexcept {
+			return bits::shard_hash_of(key) % this->_nshards;
+		}
+
+		/// Execute statement on the shard that owns the key.
+		template <class Key, class ... Args>
+		inline void
+		execute(const Key& key, const u8string& sql, const Args& ... args) {
+			auto& s = this->_shards[this->shard_of(key)];
+			std::lock_guard<std::mutex> lock(s.writer_mutex);
+			run(s.writer->prepare(sql), args...);
+		}
+
+		/// Execute statement on every shard (e.g. schema changes).
+		template <class ... Args>
+		inline void
+		execute_all(const u8string& sql, const Args& ... args) {
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				auto& s = this->_shards[i];
+				std::lock_guard<std::mutex> lock(s.writer_mutex);
+				run(s.writer->prepare(sql), args...);
+			}
+		}
+
+		/**
+		Call \p func with exclusive access to writer connection of the shard
+		that owns the key (e.g. to execute several statements in a transaction).
+		*/
+		template <class Key, class Function>
+		inline void
+		with_writer(const Key& key, Function func) {
+			auto& s = this->_shards[this->shard_of(key)];
+			std::lock_guard<std::mutex> lock(s.writer_mutex);
+			func(*s.writer);
+		}
+
+		/// Query all shards and concatenate the results in shard order.
+		template <class T, class ... Args>
+		inline std::vector<T>
+		query(const u8string& sql, const Args& ... args) {
+			auto parts = this->scatter<T>(sql, args...);
+			std::vector<T> result;
+			std::size_t n = 0;
+			for (const auto& p : parts) { n += p.size(); }
+			result.reserve(n);
+			for (auto& p : parts) {
+				std::move(p.begin(), p.end(), std::back_inserter(result));
+			}
+			return result;
+		}
+
+		/**
+		Query all shards and merge the results. Each shard must return rows
+		sorted by \p less (i.e. the query should have matching ORDER BY).
+		Reader connections of all shards are locked until the merge is done.
+		\param[in] limit maximum number of rows or zero
+		*/
+		template <class T, class Compare, class ... Args>
+		inline std::vector<T>
+		query_ordered(Compare less, std::size_t limit, const u8string& sql, const Args& ... args) {
+			using iterator = row_iterator<T>;
+			std::vector<std::unique_lock<std::mutex>> locks;
+			locks.reserve(this->_nshards);
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				locks.emplace_back(this->_shards[i].reader_mutex);
+			}
+			std::vector<statement*> statements(this->_nshards);
+			statement_guard guard{statements};
+			// the first step (e.g. sorting) is run on every shard in parallel
+			std::vector<std::future<iterator>> futures;
+			futures.reserve(this->_nshards);
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				shard* s = &this->_shards[i];
+				statement** stmt = &statements[i];
+				futures.emplace_back(std::async(std::launch::async, [s,stmt,&sql,&args...] () {
+					*stmt = &s->reader->prepare(sql);
+					bind(**stmt, 1, args...);
+					return iterator(*stmt);
+				}));
+			}
+			std::vector<iterator> rows(this->_nshards);
+			std::exception_ptr error;
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				try { rows[i] = futures[i].get(); }
+				catch (...) { if (!error) { error = std::current_exception(); } }
+			}
+			if (error) { std::rethrow_exception(error); }
+			// the rest of the rows are read on demand
+			auto greater = [&rows,&less] (std::size_t a, std::size_t b) {
+				return less(*rows[b], *rows[a]);
+			};
+			std::priority_queue<std::size_t,std::vector<std::size_t>,decltype(greater)>
+				queue(greater);
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				if (rows[i] != iterator()) { queue.emplace(i); }
+			}
+			std::vector<T> result;
+			if (limit != 0) { result.reserve(limit); }
+			while (!queue.empty() && (limit == 0 || result.size() != limit)) {
+				auto i = queue.top();
+				queue.pop();
+				result.emplace_back(std::move(*rows[i]));
+				if (++rows[i] != iterator()) { queue.emplace(i); }
+			}
+			return result;
+		}
+
+		/**
+		Query all shards with a statement that returns a single row of
+		aggregates, and combine partial aggregates. Column \c i of the query
+		is combined according to <tt>types[i]</tt>: COUNT and SUM are
+		summed, MIN and MAX are compared in SQLite order (numbers before
+		TEXT before BLOB, TEXT and BLOB are compared with \c memcmp).
+		\throw std::overflow_error if integer sum overflows
+		\throw std::invalid_argument if partial COUNT or SUM is not a number
+		*/
+		template <class ... Args>
+		inline std::vector<aggregate_value>
+		aggregate(
+			const std::vector<aggregate_type>& types,
+			const u8string& sql,
+			const Args& ... args
+		) {
+			auto parts = this->scatter<std::vector<aggregate_value>>(sql, args...);
+			return combine(types, parts);
+		}
+
+		/// Reader connection of the shard. Not protected by a mutex.
+		inline cached_connection& reader(std::size_t i) noexcept { return *this->_shards[i].reader; }
+
+		/// Writer connection of the shard. Not protected by a mutex.
+		inline cached_connection& writer(std::size_t i) noexcept { return *this->_shards[i].writer; }
+
+	private:
+
+		/// Resets statements of the merged shards.
+		struct statement_guard {
+			std::vector<statement*>& statements;
+			inline ~statement_guard() noexcept {
+				for (auto* s : this->statements) {
+					if (s) { ::sqlite3_reset(s->get()); }
+				}
+			}
+		};
+
+		template <class ... Args>
+		inline static void
+		run(statement& s, const Args& ... args) {
+			bind(s, 1, args...);
+			while (s.step() != errc::done) {}
+			s.reset();
+		}
+
+		template <class T, class ... Args>
+		inline std::vector<std::vector<T>>
+		scatter(const u8string& sql, const Args& ... args) {
+			std::vector<std::future<std::vector<T>>> futures;
+			futures.reserve(this->_nshards);
+			for (std::size_t i=0; i<this->_nshards; ++i) {
+				shard* s = &this->_shards[i];
+				futures.emplace_back(std::async(std::launch::async, [s,&sql,&args...] () {
+					std::lock_guard<std::mutex> lock(s->reader_mutex);
+					auto& stmt = s->reader->prepare(sql);
+					bind(stmt, 1, args...);
+					std::vector<T> rows;
+					for (auto& row : stmt.rows<T>()) { rows.emplace_back(std::move(row)); }
+					stmt.reset();
+					return rows;
+				}));
+			}
+			std::vector<std::vector<T>> result;
+			result.reserve(this->_nshards);
+			for (auto& f : futures) { result.emplace_back(f.get()); }
+			return result;
+		}
+
+		static std::vector<aggregate_value>
+		combine(
+			const std::vector<aggregate_type>& types,
+			const std::vector<std::vector<std::vector<aggregate_value>>>& parts
+		);
+
+	};
+
+	void operator>>(const statement& s, std::vector<aggregate_value>& row);
+
+}
+
+#endif // vim:filetype=cpp
@@ -1,4 +1,13 @@
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <ostream>
+#include <system_error>
+#include <vector>
 
 #include <sqlitex/connection.hh>
 #include <sqlitex/statement.hh>
@@ -21,3 +30,289 @@ sqlite::statement::dump(std::ostream& out) {
 sqlite::connection_base sqlite::statement::connection() {
 	return connection_base(::sqlite3_db_handle(this->_ptr));
 }
+
+namespace {
+
+	/// Reusable buffers that are written with one writev call when all of them are full.
+	class vector_writer {
+
+	private:
+		int _fd;
+		sqlite::export_counters& _counters;
+		std::vector<std::string> _buffers;
+		std::size_t _current = 0;
+		std::size_t _buffer_size;
+
+	public:
+
+		inline
+		vector_writer(
+			int fd,
+			sqlite::export_counters& counters,
+			std::size_t nbuffers=16,
+			std::size_t buffer_size=std::size_t(1)<<16
+		):
+		_fd(fd), _counters(counters), _buffers(nbuffers), _buffer_size(buffer_size) {
+			for (auto& b : this->_buffers) { b.reserve(buffer_size + buffer_size/4); }
+		}
+
+		inline std::string& buffer() noexcept { return this->_buffers[this->_current]; }
+
+		/// Switch to the next buffer between rows, so that rows are never split.
+		inline void
+		end_row() {
+			if (this->buffer().size() < this->_buffer_size) { return; }
+			if (++this->_current == this->_buffers.size()) { this->flush(); }
+		}
+
+		void
+		flush() {
+			struct ::iovec iov[IOV_MAX < 64 ? IOV_MAX : 64];
+			const std::size_t max_iov = sizeof(iov)/sizeof(*iov);
+			std::size_t n = std::min(this->_current+1, this->_buffers.size());
+			for (std::size_t first=0; first<n; first+=max_iov) {
+				int niov = 0;
+				for (std::size_t i=first; i<n && i<first+max_iov; ++i) {
+					auto& b = this->_buffers[i];
+					if (b.empty()) { continue; }
+					iov[niov].iov_base = &b[0];
+					iov[niov].iov_len = b.size();
+					++niov;
+				}
+				this->write(iov, niov);
+			}
+			for (std::size_t i=0; i<n; ++i) { this->_buffers[i].clear(); }
+			this->_current = 0;
+		}
+
+	private:
+
+		void
+		write(struct ::iovec* iov, int niov) {
+			while (niov != 0) {
+				auto ret = ::writev(this->_fd, iov, niov);
+				if (ret == -1) {
+					if (errno == EINTR) { continue; }
+					throw std::system_error(errno, std::system_category());
+				}
+				++this->_counters.writes;
+				this->_counters.bytes += ret;
+				std::size_t nwritten = ret;
+				while (niov != 0 && nwritten >= iov->iov_len) {
+					nwritten -= iov->iov_len;
+					++iov, --niov;
+				}
+				if (niov != 0) {
+					iov->iov_base = static_cast<char*>(iov->iov_base) + nwritten;
+					iov->iov_len -= nwritten;
+				}
+			}
+		}
+
+	};
+
+	inline void
+	append_integer(std::string& out, sqlite::int64 value) {
+		char buf[24];
+		char* last = buf + sizeof(buf);
+		char* first = last;
+		auto x = value < 0 ? 0 - sqlite::uint64(value) : sqlite::uint64(value);
+		do { *--first = char('0' + x%10); x /= 10; } while (x != 0);
+		if (value < 0) { *--first = '-'; }
+		out.append(first, last);
+	}
+
+	inline void
+	append_real(std::string& out, double value) {
+		char buf[32];
+		::sqlite3_snprintf(sizeof(buf), buf, "%!.15g", value);
+		out.append(buf);
+	}
+
+	inline void
+	append_hex(std::string& out, const unsigned char* data, int n) {
+		const char* digits = "0123456789abcdef";
+		auto old_size = out.size();
+		out.resize(old_size + 2*n);
+		char* p = &out[old_size];
+		for (int i=0; i<n; ++i) {
+			*p++ = digits[data[i] >> 4];
+			*p++ = digits[data[i] & 15];
+		}
+	}
+
+	void
+	append_csv(std::string& out, const char* s, int n) {
+		bool quote = false;
+		for (int i=0; i<n; ++i) {
+			char ch = s[i];
+			if (ch == ',' || ch == '"' || ch == '\n' || ch == '\r') { quote = true; break; }
+		}
+		if (!quote) { out.append(s, n); return; }
+		out += '"';
+		for (int i=0; i<n; ++i) {
+			if (s[i] == '"') { out += '"'; }
+			out += s[i];
+		}
+		out += '"';
+	}
+
+	void
+	append_json(std::string& out, const char* s, int n) {
+		const char* digits = "0123456789abcdef";
+		out += '"';
+		int first = 0;
+		for (int i=0; i<n; ++i) {
+			const auto ch = static_cast<unsigned char>(s[i]);
+			if (ch >= 0x20 && ch != '"' && ch != '\\') { continue; }
+			out.append(s+first, i-first);
+			first = i+1;
+			switch (ch) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					out += "\\u00";
+					out += digits[ch >> 4];
+					out += digits[ch & 15];
+			}
+		}
+		out.append(s+first, n-first);
+		out += '"';
+	}
+
+	template <class T>
+	inline void
+	append_le(std::string& out, T value) {
+		for (std::size_t i=0; i<sizeof(T); ++i) { out += char((value >> (8*i)) & 0xff); }
+	}
+
+	inline void
+	set_le32(std::string& out, std::size_t offset, std::uint32_t value) {
+		for (int i=0; i<4; ++i) { out[offset+i] = char((value >> (8*i)) & 0xff); }
+	}
+
+}
+
+auto
+sqlite::statement::export_to(int fd, export_format format, bool header) -> export_counters {
+	using clock_type = std::chrono::steady_clock;
+	const auto t0 = clock_type::now();
+	export_counters result;
+	vector_writer out(fd, result);
+	auto* ptr = this->_ptr;
+	const int ncolumns = this->num_columns();
+	std::vector<std::string> keys;
+	if (format == export_format::ndjson) {
+		for (int i=0; i<ncolumns; ++i) {
+			std::string key(i == 0 ? "{" : ",");
+			const char* name = ::sqlite3_column_name(ptr, i);
+			append_json(key, name, std::char_traits<char>::length(name));
+			key += ':';
+			keys.emplace_back(std::move(key));
+		}
+	}
+	if (format == export_format::csv && header) {
+		auto& b = out.buffer();
+		for (int i=0; i<ncolumns; ++i) {
+			if (i != 0) { b += ','; }
+			const char* name = ::sqlite3_column_name(ptr, i);
+			append_csv(b, name, std::char_traits<char>::length(name));
+		}
+		b += '\n';
+		out.end_row();
+	}
+	while (this->step() == errc::row) {
+		auto& b = out.buffer();
+		switch (format) {
+			case export_format::csv:
+				for (int i=0; i<ncolumns; ++i) {
+					if (i != 0) { b += ','; }
+					switch (data_type(::sqlite3_column_type(ptr, i))) {
+						case data_type::integer: append_integer(b, ::sqlite3_column_int64(ptr, i)); break;
+						case data_type::floating_point: append_real(b, ::sqlite3_column_double(ptr, i)); break;
+						case data_type::text: {
+							auto s = reinterpret_cast<const char*>(::sqlite3_column_text(ptr, i));
+							append_csv(b, s, ::sqlite3_column_bytes(ptr, i));
+							break;
+						}
+						case data_type::blob: {
+							auto s = static_cast<const unsigned char*>(::sqlite3_column_blob(ptr, i));
+							append_hex(b, s, ::sqlite3_column_bytes(ptr, i));
+							break;
+						}
+						case data_type::null: break;
+					}
+				}
+				b += '\n';
+				break;
+			case export_format::ndjson:
+				for (int i=0; i<ncolumns; ++i) {
+					b += keys[i];
+					switch (data_type(::sqlite3_column_type(ptr, i))) {
+						case data_type::integer: append_integer(b, ::sqlite3_column_int64(ptr, i)); break;
+						case data_type::floating_point: {
+							double x = ::sqlite3_column_double(ptr, i);
+							if (std::isfinite(x)) { append_real(b, x); } else { b += "null"; }
+							break;
+						}
+						case data_type::text: {
+							auto s = reinterpret_cast<const char*>(::sqlite3_column_text(ptr, i));
+							append_json(b, s, ::sqlite3_column_bytes(ptr, i));
+							break;
+						}
+						case data_type::blob: {
+							auto s = static_cast<const unsigned char*>(::sqlite3_column_blob(ptr, i));
+							b += '"';
+							append_hex(b, s, ::sqlite3_column_bytes(ptr, i));
+							b += '"';
+							break;
+						}
+						case data_type::null: b += "null"; break;
+					}
+				}
+				b += ncolumns == 0 ? "{}\n" : "}\n";
+				break;
+			case export_format::binary: {
+				const auto offset = b.size();
+				b.append(4, '\0');
+				for (int i=0; i<ncolumns; ++i) {
+					const auto type = ::sqlite3_column_type(ptr, i);
+					b += char(type);
+					switch (data_type(type)) {
+						case data_type::integer:
+							append_le(b, uint64(::sqlite3_column_int64(ptr, i)));
+							break;
+						case data_type::floating_point: {
+							double x = ::sqlite3_column_double(ptr, i);
+							uint64 bits = 0;
+							std::memcpy(&bits, &x, sizeof(x));
+							append_le(b, bits);
+							break;
+						}
+						case data_type::text:
+						case data_type::blob: {
+							auto s = type == SQLITE_TEXT
+								? static_cast<const void*>(::sqlite3_column_text(ptr, i))
+								: ::sqlite3_column_blob(ptr, i);
+							const auto n = ::sqlite3_column_bytes(ptr, i);
+							append_le(b, std::uint32_t(n));
+							if (n != 0) { b.append(static_cast<const char*>(s), n); }
+							break;
+						}
+						case data_type::null: break;
+					}
+				}
+				set_le32(b, offset, std::uint32_t(b.size() - offset - 4));
+				break;
+			}
+		}
+		++result.rows;
+		out.end_row();
+	}
+	out.flush();
+	result.time = clock_type::now() - t0;
+	return result;
+}
@@ -1,11 +1,14 @@
 #ifndef SQLITEX_STATEMENT_HH
 #define SQLITEX_STATEMENT_HH
 
+#include <chrono>
 #include <cstdint>
 #include <iosfwd>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <sqlitex/allocator.hh>
 #include <sqlitex/any.hh>
@@ -14,6 +17,10 @@
 #include <sqlitex/forward.hh>
 #include <sqlitex/named_ptr.hh>
 
+struct ArrowArray;
+struct ArrowSchema;
+struct ArrowArrayStream;
+
 namespace sqlite {
 
 	template <class Iterator>
@@ -91,6 +98,36 @@ namespace sqlite {
 
 	};
 
+	namespace bits {
+		/// Column types and the current row of statement::to_arrow between batches.
+		struct arrow_cursor {
+			std::vector<arrow_type> types;
+			bool has_row = false;
+			bool done = false;
+		};
+	}
+
+	/// Statistics of statement::export_to.
+	struct export_counters {
+		using duration = std::chrono::steady_clock::duration;
+		uint64 rows = 0;
+		uint64 bytes = 0;
+		uint64 writes = 0;
+		duration time{};
+
+		inline double
+		rows_per_second() const noexcept {
+			auto t = std::chrono::duration<double>(this->time).count();
+			return t == 0 ? 0.0 : double(this->rows)/t;
+		}
+
+		inline double
+		mb_per_second() const noexcept {
+			auto t = std::chrono::duration<double>(this->time).count();
+			return t == 0 ? 0.0 : double(this->bytes)/t/double(1<<20);
+		}
+	};
+
 	/**
 	\brief SQL statement.
 	\date 2018-10-08
@@ -120,6 +157,7 @@ namespace sqlite {
 
 	private:
 		types::statement* _ptr = nullptr;
+		std::unique_ptr<bits::arrow_cursor> _arrow;
 
 	public:
 
@@ -132,7 +170,9 @@ namespace sqlite {
 		statement(const statement&) = delete;
 		statement& operator=(const statement&) = delete;
 
-		inline statement(statement&& rhs) noexcept: _ptr(rhs._ptr) { rhs._ptr = nullptr; }
+		inline statement(statement&& rhs) noexcept: _ptr(rhs._ptr), _arrow(std::move(rhs._arrow)) {
+			rhs._ptr = nullptr;
+		}
 
 		inline statement&
 		operator=(statement&& rhs) noexcept {
@@ -143,6 +183,7 @@ namespace sqlite {
 		inline void
 		swap(statement& rhs) noexcept {
 			std::swap(this->_ptr, rhs._ptr);
+			std::swap(this->_arrow, rhs._arrow);
 		}
 
 		inline
@@ -153,6 +194,7 @@ namespace sqlite {
 
 		inline void
 		close() {
+			this->_arrow.reset();
 			call(::sqlite3_finalize(this->_ptr));
 			this->_ptr = nullptr;
 		}
@@ -171,7 +213,11 @@ namespace sqlite {
 		}
 
 		inline int num_columns() const noexcept { return ::sqlite3_column_count(this->_ptr); }
-		inline void reset() { call(::sqlite3_reset(this->_ptr)); }
+		inline void
+		reset() {
+			this->_arrow.reset();
+			call(::sqlite3_reset(this->_ptr));
+		}
 
 		inline statement_counters counters() { return statement_counters(this->_ptr); }
 
@@ -435,6 +481,25 @@ namespace sqlite {
 		inline int
 		column_size(int i) const noexcept;
 
+		/**
+		Export at most \p batch_rows next rows as Arrow struct array (see arrow.hh).
+		Column types are deduced on the first call and are the same for all
+		batches until reset().
+		\return the number of exported rows, zero when all rows were exported
+		*/
+		int64 to_arrow(ArrowArray* array, ArrowSchema* schema, int64 batch_rows=65536);
+
+		/// Export remaining rows as Arrow stream. The statement must outlive the stream.
+		void to_arrow(ArrowArrayStream* stream, int64 batch_rows=65536);
+
+		/**
+		Write remaining rows to file descriptor. Values are formatted
+		directly from column pointers into reusable buffers that are written
+		with \c writev. CSV and NDJSON blobs are written as hexadecimal
+		strings, and CSV starts with the column names if \p header is true.
+		*/
+		export_counters export_to(int fd, export_format format, bool header=true);
+
 		template <class T> inline row_iterator<T> begin() { return row_iterator<T>(this); }
 		template <class T> inline row_iterator<T> end() noexcept { return row_iterator<T>(); }
 
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include <sqlitex/time_partitioned_store.hh>
+#include <sqlitex/transaction.hh>
+
+namespace {
+
+	inline sqlite::int64
+	to_seconds(sqlite::time_partitioned_store::time_point t) {
+		return sqlite::time_partitioned_store::clock_type::to_time_t(t);
+	}
+
+	inline sqlite::time_partitioned_store::time_point
+	from_seconds(sqlite::int64 t) {
+		return sqlite::time_partitioned_store::clock_type::from_time_t(std::time_t(t));
+	}
+
+	inline std::string
+	attached_name(sqlite::int64 id) {
+		return "p" + std::to_string(id);
+	}
+
+}
+
+sqlite::time_partitioned_store::time_partitioned_store(const options& opts):
+_options(opts) {
+	auto catalog = this->_options.directory + '/' + this->_options.name + ".catalog.db";
+	this->_catalog.open(catalog.data(), this->_options.flags);
+	this->_catalog.execute(
+		"CREATE TABLE IF NOT EXISTS partitions ("
+		"id INTEGER PRIMARY KEY, path TEXT NOT NULL, "
+		"start INTEGER NOT NULL, end INTEGER)"
+	);
+	this->load();
+	this->_reader.open(":memory:");
+	// empty tables in the main schema of the reader make views valid
+	// even when no partition is attached
+	if (!this->_options.schema.empty()) { this->_reader.execute(this->_options.schema); }
+	if (!this->_partitions.empty() && this->_partitions.back().current()) {
+		this->open_current();
+	}
+}
+
+auto
+sqlite::time_partitioned_store::writer(time_point now) -> connection& {
+	if (this->_partitions.empty() || !this->_partitions.back().current()) {
+		this->rollover(now);
+	} else {
+		const auto& p = this->_partitions.back();
+		if (now >= p.start + this->_options.partition_duration ||
+			(this->_options.max_partition_size > 0 &&
+			 this->current_size() >= this->_options.max_partition_size)) {
+			this->rollover(now);
+		}
+	}
+	return this->_writer;
+}
+
+void
+sqlite::time_partitioned_store::rollover(time_point now) {
+	partition p;
+	p.id = this->_partitions.empty() ? 1 : this->_partitions.back().id + 1;
+	p.start = now;
+	p.end = time_point::max();
+	p.path = this->make_path(now, p.id);
+	{
+		immediate_transaction tr(this->_catalog);
+		if (!this->_partitions.empty() && this->_partitions.back().current()) {
+			this->_catalog.execute(
+				"UPDATE partitions SET end=? WHERE id=?",
+				to_seconds(now), this->_partitions.back().id
+			);
+		}
+		this->_catalog.execute(
+			"INSERT INTO partitions (id, path, start) VALUES (?,?,?)",
+			p.id, p.path, to_seconds(now)
+		);
+		tr.commit();
+	}
+	if (!this->_partitions.empty() && this->_partitions.back().current()) {
+		this->_partitions.back().end = now;
+	}
+	this->_partitions.emplace_back(p);
+	this->open_current();
+	if (!this->_options.schema.empty()) { this->_writer.execute(this->_options.schema); }
+}
+
+auto
+sqlite::time_partitioned_store::partitions(time_point from, time_point to) const ->
+std::vector<partition> {
+	std::vector<partition> result;
+	for (const auto& p : this->_partitions) {
+		if (p.overlaps(from, to)) { result.emplace_back(p); }
+	}
+	return result;
+}
+
+void
+sqlite::time_partitioned_store::attach(
+	time_point from,
+	time_point to,
+	const std::vector<std::string>& tables
+) {
+	std::vector<int64> ids;
+	for (const auto& p : this->_partitions) {
+		if (p.overlaps(from, to)) { ids.emplace_back(p.id); }
+	}
+	if (ids == this->_attached && tables == this->_views) { return; }
+	if (ids.size() > std::size_t(this->_reader.limit(limit::attached))) {
+		throw std::length_error("too many partitions to attach");
+	}
+	for (const auto& view : this->_views) {
+		this->_reader.execute(format("DROP VIEW IF EXISTS temp.\"%w\"", view.data()).get());
+	}
+	this->_views.clear();
+	for (auto id : this->_attached) {
+		if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+			this->_reader.execute(format("DETACH DATABASE %Q", attached_name(id).data()).get());
+		}
+	}
+	for (auto id : ids) {
+		if (std::find(this->_attached.begin(), this->_attached.end(), id) ==
+			this->_attached.end()) {
+			auto result = std::find_if(
+				this->_partitions.begin(),
+				this->_partitions.end(),
+				[id] (const partition& p) { return p.id == id; }
+			);
+			this->_reader.attach(result->path.data(), attached_name(id).data());
+		}
+	}
+	this->_attached = ids;
+	for (const auto& table : tables) {
+		std::string sql = format("CREATE TEMP VIEW \"%w\" AS ", table.data()).get();
+		bool first = true;
+		if (!this->_options.schema.empty()) {
+			sql += format("SELECT * FROM main.\"%w\"", table.data()).get();
+			first = false;
+		}
+		for (auto id : ids) {
+			if (!first) { sql += " UNION ALL "; }
+			sql += format(
+				"SELECT * FROM \"%w\".\"%w\"",
+				attached_name(id).data(),
+				table.data()
+			).get();
+			first = false;
+		}
+		if (first) { throw std::invalid_argument("no partitions and no schema"); }
+		this->_reader.execute(sql);
+		this->_views.emplace_back(table);
+	}
+}
+
+std::size_t
+sqlite::time_partitioned_store::drop_expired(time_point now) {
+	if (this->_options.retention.count() == 0) { return 0; }
+	std::vector<partition> expired;
+	for (const auto& p : this->_partitions) {
+		if (!p.current() && p.end + this->_options.retention < now) {
+			expired.emplace_back(p);
+		}
+	}
+	if (expired.empty()) { return 0; }
+	this->detach_all();
+	{
+		immediate_transaction tr(this->_catalog);
+		for (const auto& p : expired) {
+			this->_catalog.execute("DELETE FROM partitions WHERE id=?", p.id);
+		}
+		tr.commit();
+	}
+	for (const auto& p : expired) {
+		for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+			std::remove((p.path + suffix).data());
+		}
+	}
+	this->_partitions.erase(
+		std::remove_if(
+			this->_partitions.begin(),
+			this->_partitions.end(),
+			[&now,this] (const partition& p) {
+				return !p.current() && p.end + this->_options.retention < now;
+			}
+		),
+		this->_partitions.end()
+	);
+	return expired.size();
+}
+
+void
+sqlite::time_partitioned_store::load() {
+	this->_partitions.clear();
+	statement s = this->_catalog.prepare(
+		"SELECT id, path, start, end FROM partitions ORDER BY start, id"
+	);
+	while (s.step() == errc::row) {
+		partition p;
+		int64 start = 0, end = 0;
+		s.column(0, p.id);
+		s.column(1, p.path);
+		s.column(2, start);
+		p.start = from_seconds(start);
+		if (s.column_type(3) == data_type::null) {
+			p.end = time_point::max();
+		} else {
+			s.column(3, end);
+			p.end = from_seconds(end);
+		}
+		this->_partitions.emplace_back(p);
+	}
+}
+
+void
+sqlite::time_partitioned_store::open_current() {
+	this->_page_count = statement();
+	this->_writer.open(this->_partitions.back().path.data(), this->_options.flags);
+	this->_page_size = this->_writer.page_size();
+	this->_page_count = this->_writer.prepare("PRAGMA page_count");
+}
+
+sqlite::int64
+sqlite::time_partitioned_store::current_size() {
+	int64 npages = 0;
+	this->_page_count.step();
+	this->_page_count.column(0, npages);
+	this->_page_count.reset();
+	return npages*this->_page_size;
+}
+
+void
+sqlite::time_partitioned_store::detach_all() {
+	for (const auto& view : this->_views) {
+		this->_reader.execute(format("DROP VIEW IF EXISTS temp.\"%w\"", view.data()).get());
+	}
+	this->_views.clear();
+	for (auto id : this->_attached) {
+		this->_reader.execute(format("DETACH DATABASE %Q", attached_name(id).data()).get());
+	}
+	this->_attached.clear();
+}
+
+std::string
+sqlite::time_partitioned_store::make_path(time_point start, int64 id) const {
+	return this->_options.directory + '/' + this->_options.name + '-' +
+		std::to_string(to_seconds(start)) + '-' + std::to_string(id) + ".db";
+}
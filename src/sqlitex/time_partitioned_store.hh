@@ -0,0 +1,144 @@
+#ifndef SQLITEX_TIME_PARTITIONED_STORE_HH
+#define SQLITEX_TIME_PARTITIONED_STORE_HH
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sqlitex/connection.hh>
+
+namespace sqlite {
+
+	/**
+	\brief Append-only store that is split into database files by time.
+	\details
+	Rows are written to the current partition file. A new partition is
+	started when the current one becomes older than \c partition_duration
+	or larger than \c max_partition_size bytes. The list of partitions is
+	kept in a separate catalog database.
+
+	Queries are run on a reader connection. Partitions that overlap the
+	requested time interval are attached to it (partitions outside of the
+	interval are detached), and a temporary view with the name of the table
+	is created as UNION ALL of the table in every attached partition. The
+	number of attached partitions is bounded by limit::attached.
+
+	Expired partitions are dropped by removing their files instead of
+	deleting rows.
+	\code{.cpp}
+	time_partitioned_store::options opts;
+	opts.directory = "/var/lib/app";
+	opts.name = "events";
+	opts.partition_duration = std::chrono::hours(1);
+	opts.retention = std::chrono::hours(24*7);
+	opts.schema = "CREATE TABLE IF NOT EXISTS events(t INTEGER, payload BLOB)";
+	time_partitioned_store store(opts);
+	store.writer().execute("INSERT INTO events VALUES (?,?)", t, payload);
+	statement s = store.select(t0, t1, "events",
+		"SELECT count(*) FROM events WHERE t BETWEEN ? AND ?");
+	store.drop_expired();
+	\endcode
+	*/
+	class time_partitioned_store {
+
+	public:
+		using clock_type = std::chrono::system_clock;
+		using time_point = clock_type::time_point;
+
+		struct options {
+			/// Directory where partition files are stored.
+			std::string directory = ".";
+			/// Prefix of partition file names.
+			std::string name = "partition";
+			std::chrono::seconds partition_duration{std::chrono::hours(24)};
+			/// Maximum partition size in bytes or zero.
+			int64 max_partition_size = 0;
+			/// Time after the end of partition when it is dropped, zero means never.
+			std::chrono::seconds retention{0};
+			/// SQL that is executed on every new partition.
+			std::string schema;
+			file_flag flags = file_flag::read_write | file_flag::create;
+		};
+
+		struct partition {
+			int64 id = 0;
+			std::string path;
+			time_point start;
+			/// End of the partition or time_point::max() for the current one.
+			time_point end;
+			inline bool current() const noexcept { return this->end == time_point::max(); }
+			inline bool
+			overlaps(time_point a, time_point b) const noexcept {
+				return this->start <= b && a < this->end;
+			}
+		};
+
+	private:
+		options _options;
+		connection _catalog;
+		connection _writer;
+		connection _reader;
+		statement _page_count;
+		int64 _page_size = 0;
+		std::vector<partition> _partitions;
+		std::vector<int64> _attached;
+		std::vector<std::string> _views;
+
+	public:
+
+		explicit time_partitioned_store(const options& opts);
+
+		time_partitioned_store(const time_partitioned_store&) = delete;
+		time_partitioned_store& operator=(const time_partitioned_store&) = delete;
+
+		/// Writer connection of the current partition after rollover check.
+		connection& writer(time_point now=clock_type::now());
+
+		/// Close current partition and start a new one.
+		void rollover(time_point now=clock_type::now());
+
+		/// Partitions that overlap interval <tt>[from,to]</tt>.
+		std::vector<partition> partitions(time_point from, time_point to) const;
+
+		inline const std::vector<partition>& partitions() const noexcept { return this->_partitions; }
+
+		/**
+		Attach partitions that overlap interval <tt>[from,to]</tt> to the
+		reader connection and create temporary views for the tables.
+		*/
+		void attach(time_point from, time_point to, const std::vector<std::string>& tables);
+
+		/// Attach partitions and prepare the statement on the reader connection.
+		template <class ... Args>
+		inline statement
+		select(
+			time_point from,
+			time_point to,
+			const std::string& table,
+			const u8string& sql,
+			const Args& ... args
+		) {
+			this->attach(from, to, {table});
+			return this->_reader.prepare(sql, args...);
+		}
+
+		inline connection& reader() noexcept { return this->_reader; }
+
+		/**
+		Remove files of partitions that ended more than \c retention ago.
+		\return the number of dropped partitions
+		*/
+		std::size_t drop_expired(time_point now=clock_type::now());
+
+	private:
+		void load();
+		void open_current();
+		int64 current_size();
+		void detach_all();
+		std::string make_path(time_point start, int64 id) const;
+
+	};
+
+}
+
+#endif // vim:filetype=cpp
@@ -1,34 +1,113 @@
 #ifndef SQLITEX_TRANSACTION_HH
 #define SQLITEX_TRANSACTION_HH
 
+#include <chrono>
+
 #include <sqlitex/connection.hh>
 
 namespace sqlite {
 
-	#define SQLITEX_TRANSACTION(NAME, type) \
-		class NAME { \
-		private: \
-			connection& _db; \
-			bool _success = false; \
-		public: \
-			inline explicit \
-			NAME(connection& db): _db(db) { \
-				this->_db.execute("BEGIN " type " TRANSACTION"); \
-			} \
-			inline ~NAME() { \
-				if (!this->_success) { \
-					this->_db.execute("ROLLBACK"); \
-				} \
-			} \
-			inline void commit() { \
-				this->_db.execute("COMMIT"); \
-				this->_success = true; \
-			} \
+	/**
+	\brief RAII transaction that uses cached control statements.
+	\details
+	The outermost object issues BEGIN/COMMIT/ROLLBACK, nested objects
+	issue SAVEPOINT/RELEASE/ROLLBACK TO. Transaction is rolled back in
+	destructor unless it was committed. Savepoints are reported to
+	connection::add_savepoint_hook.
+	\code{.cpp}
+	immediate_transaction outer(db);
+	{
+		immediate_transaction inner(db); // savepoint
+		inner.commit();                  // release
+	}
+	outer.commit();
+	std::cout << outer.commit_duration().count() << std::endl;
+	\endcode
+	*/
+	class transaction_base {
+
+	public:
+		using clock_type = std::chrono::steady_clock;
+		using duration = clock_type::duration;
+
+	private:
+		connection& _db;
+		int _level = 0;
+		bool _savepoint = false;
+		bool _finished = false;
+		duration _commit_duration{};
+
+	public:
+
+		inline ~transaction_base() noexcept {
+			if (!this->_finished) {
+				try { this->rollback(); } catch (...) {}
+			}
 		}
 
-	SQLITEX_TRANSACTION(deferred_transaction, "DEFERRED");
-	SQLITEX_TRANSACTION(immediate_transaction, "IMMEDIATE");
-	SQLITEX_TRANSACTION(exclusive_transaction, "EXCLUSIVE");
+		transaction_base(const transaction_base&) = delete;
+		transaction_base& operator=(const transaction_base&) = delete;
+
+		inline void
+		commit() {
+			auto& t = this->_db.transactions();
+			auto t0 = clock_type::now();
+			if (this->_savepoint) { t.release(this->_db, this->_level); }
+			else { t.commit(this->_db); }
+			this->_commit_duration = clock_type::now() - t0;
+			this->_finished = true;
+		}
+
+		inline void
+		rollback() {
+			auto& t = this->_db.transactions();
+			this->_finished = true;
+			if (this->_savepoint) { t.rollback(this->_db, this->_level); }
+			else { t.rollback(this->_db); }
+		}
+
+		/// Time spent in COMMIT/RELEASE statement.
+		inline duration commit_duration() const noexcept { return this->_commit_duration; }
+		inline bool nested() const noexcept { return this->_level > 1; }
+		inline int level() const noexcept { return this->_level; }
+		inline bool finished() const noexcept { return this->_finished; }
+
+	protected:
+
+		inline explicit
+		transaction_base(connection& db, transaction_type type, bool savepoint):
+		_db(db) {
+			auto& t = db.transactions();
+			if (savepoint || db.transaction_is_active()) {
+				this->_level = t.savepoint(db);
+				this->_savepoint = true;
+			} else {
+				t.begin(db, type);
+				this->_level = 1;
+			}
+		}
+
+	};
+
+	template <transaction_type type>
+	class basic_transaction: public transaction_base {
+	public:
+		inline explicit
+		basic_transaction(connection& db):
+		transaction_base(db, type, false) {}
+	};
+
+	/// Savepoint that starts a deferred transaction when none is active.
+	class savepoint: public transaction_base {
+	public:
+		inline explicit
+		savepoint(connection& db):
+		transaction_base(db, transaction_type::deferred, true) {}
+	};
+
+	using deferred_transaction = basic_transaction<transaction_type::deferred>;
+	using immediate_transaction = basic_transaction<transaction_type::immediate>;
+	using exclusive_transaction = basic_transaction<transaction_type::exclusive>;
 
 }
 
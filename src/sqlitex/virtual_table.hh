@@ -1,17 +1,182 @@
 #ifndef SQLITEX_VIRTUAL_TABLE_HH
 #define SQLITEX_VIRTUAL_TABLE_HH
 
+#include <iterator>
+
 #include <sqlitex/any.hh>
 #include <sqlitex/context.hh>
+#include <sqlitex/errc.hh>
 #include <sqlitex/forward.hh>
 
 namespace sqlite {
 
+	enum class constraint_op: unsigned char {
+		eq=SQLITE_INDEX_CONSTRAINT_EQ,
+		gt=SQLITE_INDEX_CONSTRAINT_GT,
+		le=SQLITE_INDEX_CONSTRAINT_LE,
+		lt=SQLITE_INDEX_CONSTRAINT_LT,
+		ge=SQLITE_INDEX_CONSTRAINT_GE,
+		match=SQLITE_INDEX_CONSTRAINT_MATCH,
+		like=SQLITE_INDEX_CONSTRAINT_LIKE,
+		glob=SQLITE_INDEX_CONSTRAINT_GLOB,
+		regexp=SQLITE_INDEX_CONSTRAINT_REGEXP,
+		ne=SQLITE_INDEX_CONSTRAINT_NE,
+		is_not=SQLITE_INDEX_CONSTRAINT_ISNOT,
+		is_not_null=SQLITE_INDEX_CONSTRAINT_ISNOTNULL,
+		is_null=SQLITE_INDEX_CONSTRAINT_ISNULL,
+		is=SQLITE_INDEX_CONSTRAINT_IS,
+		#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+		limit=SQLITE_INDEX_CONSTRAINT_LIMIT,
+		offset=SQLITE_INDEX_CONSTRAINT_OFFSET,
+		#endif
+		function=SQLITE_INDEX_CONSTRAINT_FUNCTION,
+	};
+
+	/// How the rows are used by DISTINCT, GROUP BY and ORDER BY (see virtual_table_index::distinct).
+	enum class distinct_mode {
+		/// Rows must be in ORDER BY order.
+		ordered=0,
+		/// Rows with equal ORDER BY columns must be adjacent.
+		grouped=1,
+		/// Like grouped, and duplicate rows may be omitted.
+		distinct=2,
+		/// Duplicate rows may be omitted, the order does not matter.
+		unordered=3,
+	};
+
 	class virtual_table_index: public types::index_info {
+
 	public:
 		inline const char* collation(int n) { return ::sqlite3_vtab_collation(this, n); }
+
+		inline int num_constraints() const noexcept { return this->nConstraint; }
+		inline int column(int i) const noexcept { return this->aConstraint[i].iColumn; }
+		inline bool usable(int i) const noexcept { return this->aConstraint[i].usable != 0; }
+
+		inline constraint_op
+		op(int i) const noexcept {
+			return constraint_op(this->aConstraint[i].op);
+		}
+
+		/**
+		Pass the right-hand side of the constraint to the filter as argument
+		number \p argv_index (one-based). Omitted constraints are not checked
+		by SQLite.
+		*/
+		inline void
+		use(int i, int argv_index, bool omit=true) noexcept {
+			this->aConstraintUsage[i].argvIndex = argv_index;
+			this->aConstraintUsage[i].omit = omit;
+		}
+
+		/// Index of the first usable constraint with this operator or -1.
+		inline int
+		find(constraint_op op) const noexcept {
+			for (int i=0; i<this->nConstraint; ++i) {
+				const auto& c = this->aConstraint[i];
+				if (c.usable && constraint_op(c.op) == op) { return i; }
+			}
+			return -1;
+		}
+
+		#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+		/// Is this equality constraint an IN operator that can be processed at once?
+		inline bool in(int i) noexcept { return ::sqlite3_vtab_in(this, i, -1) != 0; }
+
+		/**
+		Receive all values of the IN operator in one filter call (see
+		virtual_table_in_list). The constraint must be used and omitted.
+		*/
+		inline void in(int i, bool all) noexcept { ::sqlite3_vtab_in(this, i, all); }
+
+		/**
+		Right-hand side of the constraint if it is known at planning time
+		(usually a literal).
+		*/
+		inline bool
+		rhs_value(int i, any_base& out) noexcept {
+			types::value* v = nullptr;
+			if (::sqlite3_vtab_rhs_value(this, i, &v) != SQLITE_OK) { return false; }
+			out = any_base(v);
+			return true;
+		}
+
+		inline distinct_mode
+		distinct() noexcept {
+			return distinct_mode(::sqlite3_vtab_distinct(this));
+		}
+		#endif
+
 	};
 
+	#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+	/**
+	\brief Values of IN operator that were requested with virtual_table_index::in.
+	\code{.cpp}
+	for (any_base value : virtual_table_in_list(argv[0])) { ... }
+	\endcode
+	*/
+	class virtual_table_in_list {
+
+	public:
+		class iterator {
+
+		private:
+			types::value* _list = nullptr;
+			types::value* _value = nullptr;
+
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = any_base;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const any_base*;
+			using reference = any_base;
+
+			inline explicit
+			iterator(types::value* list): _list(list) {
+				this->check(::sqlite3_vtab_in_first(list, &this->_value));
+			}
+
+			iterator() = default;
+
+			inline any_base operator*() const noexcept { return any_base(this->_value); }
+
+			inline iterator&
+			operator++() {
+				this->check(::sqlite3_vtab_in_next(this->_list, &this->_value));
+				return *this;
+			}
+
+			inline bool
+			operator==(const iterator& rhs) const noexcept {
+				return this->_value == rhs._value;
+			}
+
+			inline bool
+			operator!=(const iterator& rhs) const noexcept {
+				return !this->operator==(rhs);
+			}
+
+		private:
+			inline void
+			check(int ret) {
+				if (ret == SQLITE_DONE) { this->_value = nullptr; }
+				else { call(ret); }
+			}
+
+		};
+
+	private:
+		any_base _list;
+
+	public:
+		inline explicit virtual_table_in_list(any_base list) noexcept: _list(list) {}
+		inline iterator begin() { return iterator(this->_list.get()); }
+		inline iterator end() noexcept { return iterator(); }
+
+	};
+	#endif
+
 	class virtual_table_context: public context {
 
 	public:
@@ -21,16 +186,18 @@ namespace sqlite {
 
 	};
 
-	class virtual_table_cursor {
+	class virtual_table_cursor: public types::virtual_table_cursor {
 
 	public:
 
+		inline virtual_table_cursor() noexcept: types::virtual_table_cursor{} {}
+
 		inline int close() { return 0; }
 		inline int filter(int idxNum, const char* idxStr, int argc, any_base* argv) { return 0; }
 		inline int next() { return 0; }
 		inline bool eof() { return false; }
 		inline int column(virtual_table_context* c, int n) { return 0; }
-		inline int rowid(int64& out);
+		inline int rowid(int64& out) { return SQLITE_ERROR; }
 
 	};
 
@@ -41,8 +208,13 @@ namespace sqlite {
 			constraint_support=SQLITE_VTAB_CONSTRAINT_SUPPORT,
 		};
 
+		/// Eponymous-only tables can not be created with CREATE VIRTUAL TABLE.
+		static constexpr const bool eponymous = false;
+
 	public:
 
+		inline virtual_table() noexcept: types::virtual_table{} {}
+
 		inline int best_index(virtual_table_index* ptr) { return 0; }
 		inline int disconnect() { return 0; }
 		inline int destroy() { return 0; }
@@ -54,7 +226,7 @@ namespace sqlite {
 		inline int savepoint(int n) { return 0; }
 		inline int release(int n) { return 0; }
 		inline int rollback(int n) { return 0; }
-		inline int update(int argc, any_base* argv, int64& rowid);
+		inline int update(int argc, any_base* argv, int64& rowid) { return SQLITE_READONLY; }
 		inline int find_function(
 			int nargs,
 			const char* name,
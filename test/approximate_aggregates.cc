@@ -0,0 +1,39 @@
+#include <sqlitex/approximate_aggregates.hh>
+
+#include "test.hh"
+
+using sqlite::test::fails;
+using sqlite::test::select;
+
+int main() {
+	sqlite::connection db(":memory:");
+	sqlite::register_approximate_aggregates(db);
+	db.execute("CREATE TABLE t(x)");
+	db.execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<10000) "
+		"INSERT INTO t SELECT i FROM n");
+
+	// the state round-trips through the blob
+	SQLITEX_CHECK(select<sqlite::int64>(db, "SELECT approx_count_distinct(x) FROM t") ==
+		select<sqlite::int64>(db,
+			"SELECT approx_count_distinct_merge(s) "
+			"FROM (SELECT approx_count_distinct_state(x) AS s FROM t)"));
+
+	// malformed states are rejected: sparse entry with register index out of range
+	// (merged into dense registers), zero rank, truncated entries, unknown header
+	SQLITEX_CHECK(fails(db,
+		"SELECT approx_count_distinct_merge(s) FROM ("
+		"SELECT approx_count_distinct_state(x) AS s FROM t "
+		"UNION ALL SELECT x'480e5301000000c1ffffff')"));
+	SQLITEX_CHECK(fails(db, "SELECT approx_count_distinct_merge(x'480e5301000000c1ffffff')"));
+	SQLITEX_CHECK(fails(db, "SELECT approx_count_distinct_merge(x'480e530100000040000000')"));
+	SQLITEX_CHECK(fails(db, "SELECT approx_count_distinct_merge(x'480e530200000041000000')"));
+	SQLITEX_CHECK(fails(db, "SELECT approx_count_distinct_merge(x'480f5300000000')"));
+	SQLITEX_CHECK(fails(db, "SELECT approx_count_distinct_merge(x'480e44')"));
+	SQLITEX_CHECK(!fails(db, "SELECT approx_count_distinct_merge(x'480e530100000041000000')"));
+
+	// infinite values are valid JSON
+	db.execute("INSERT INTO t VALUES (1e999), (-1e999)");
+	SQLITEX_CHECK(select<int>(db, "SELECT json_valid(approx_top_k(x,5)) FROM t") == 1);
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include <sqlitex/regexp.hh>
+
+#include "test.hh"
+
+using sqlite::test::fails;
+using sqlite::test::select;
+
+int main() {
+	sqlite::connection db(":memory:");
+	sqlite::register_regexp(db);
+
+	SQLITEX_CHECK(select<int>(db, "SELECT 'abc' REGEXP 'b'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'abc' REGEXP '^b'") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'abc' REGEXP 'c$'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'abc' REGEXP '^abc$'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'x1y22z' REGEXP '^(?:[a-z]\\d{1,2})+$'") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'x1y22z3' REGEXP '^(?:[a-z]\\d{1,2})+$'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'foo bar' REGEXP '\\bbar'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'foobar' REGEXP '\\bbar'") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'a' || char(10) || 'b' REGEXP 'a.b'") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT 'caf' || char(233) REGEXP 'caf\\u00e9$'") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT NULL REGEXP 'a' IS NULL") == 1);
+	SQLITEX_CHECK(fails(db, "SELECT 'a' REGEXP '(a'"));
+	SQLITEX_CHECK(fails(db, "SELECT 'aa' REGEXP '(a)\\1'"));
+
+	// the matcher does not recurse per byte of the text
+	db.execute("CREATE TABLE t(x)");
+	db.execute("INSERT INTO t VALUES (replace(hex(zeroblob(1048576)),'0','a') || 'xb')");
+	SQLITEX_CHECK(select<int>(db, "SELECT length(x) > 2000000 FROM t") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP 'x.*b' FROM t") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP 'a.*b' FROM t") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP '(a|b)*c' FROM t") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP '^(a|x)*b$' FROM t") == 1);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP '^a+$' FROM t") == 0);
+	SQLITEX_CHECK(select<int>(db, "SELECT x REGEXP '(?:a|aa)*c' FROM t") == 0);
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SQLITEX_TEST_TEST_HH
+#define SQLITEX_TEST_TEST_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <sqlitex/connection.hh>
+
+/// Print the failed expression and exit with non-zero status.
+#define SQLITEX_CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			std::exit(1); \
+		} \
+	} while (false)
+
+namespace sqlite {
+
+	namespace test {
+
+		/// The first column of the first row.
+		template <class T>
+		inline T
+		select(connection_base& db, const u8string& sql) {
+			auto s = db.prepare(sql);
+			T value{};
+			if (s.step() == errc::row) { s.column(0, value); }
+			return value;
+		}
+
+		/// Returns true if the statement fails.
+		inline bool
+		fails(connection_base& db, const u8string& sql) {
+			try {
+				auto s = db.prepare(sql);
+				while (s.step() != errc::done) {}
+			} catch (const std::exception&) {
+				return true;
+			}
+			return false;
+		}
+
+	}
+
+}
+
+#endif // vim:filetype=cpp